@@ -0,0 +1,1011 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <random>
+
+#define OCARN2_IMPLEMENTATION
+#include "ocarn2.h"
+#include "ocarn2_async.h"
+#include "ocarn2_atlas.h"
+#include "ocarn2_bvh.h"
+#include "ocarn2_flags.h"
+#include "ocarn2_image.h"
+#include "ocarn2_instances.h"
+#include "ocarn2_lighting.h"
+#include "ocarn2_mesh.h"
+#include "ocarn2_nav.h"
+#include "ocarn2_pack.h"
+#include "ocarn2_pvs.h"
+#include "ocarn2_raster.h"
+#include "ocarn2_shm.h"
+#include "ocarn2_terrain.h"
+#include "ocarn2_tiled_map.h"
+
+/**
+ * Benchmarks for the loaders and the apis built on top of them
+ *
+ * Everything runs against synthetic files generated into the temp directory, so no game data is needed.
+ * Pass a name (or part of one) to only run matching benchmarks, eg `bench map`
+ */
+
+
+// count every heap allocation, so each benchmark can report allocations per run
+
+static std::atomic<uint64_t> allocations {0};
+
+// the full set of replacements, so every new goes through the count and every delete matches its new. they
+// stay out of line, or gcc inlines malloc and free into the callers and takes them for a mismatched pair
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new(size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    // aligned_alloc wants the size a multiple of the alignment
+    size_t align = std::max((size_t) alignment, sizeof(void*));
+    if(void* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { try { return operator new(size); } catch(...) { return nullptr; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { try { return operator new(size); } catch(...) { return nullptr; } }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try { return operator new(size, alignment); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try { return operator new(size, alignment); } catch(...) { return nullptr; }
+}
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { operator delete(p, alignment); }
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept { operator delete(p, alignment); }
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept { operator delete(p, alignment); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { operator delete(p, alignment); }
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { operator delete(p, alignment); }
+
+
+const char* filter = nullptr;
+
+// benchmarks that only compute a value store it here, so the work behind it can't be optimized away
+static volatile double sink = 0;
+
+/**
+ * runs fn until at least half a second has passed (and at least 3 times), then prints
+ * time per run, throughput over `bytes` and allocations per run
+ *
+ * @param name
+ * @param bytes how many bytes one run processes, 0 to skip the throughput column
+ * @param fn
+ * @return seconds per run, 0 if the filter skipped it
+ */
+double run_bench(const std::string& name, uint64_t bytes, const std::function<void()>& fn) {
+    if(filter && name.find(filter) == std::string::npos) return 0;
+
+    fn(); // warm up the page cache and the allocator
+
+    using clock = std::chrono::steady_clock;
+
+    uint64_t runs = 0;
+    uint64_t allocationsBefore = allocations.load();
+    auto start = clock::now();
+    double elapsed = 0;
+
+    while(runs < 3 || elapsed < 0.5) {
+        fn();
+        runs++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    double perRun = elapsed / runs;
+    double allocationsPerRun = (double) (allocations.load() - allocationsBefore) / runs;
+
+    printf("%-32s %8llu runs %12.3f ms/run", name.c_str(), (unsigned long long) runs, perRun * 1000.0);
+
+    if(bytes) printf(" %10.1f MB/s", bytes / perRun / (1024.0 * 1024.0));
+    else printf(" %10s     ", "-");
+
+    printf(" %12.1f allocs/run\n", allocationsPerRun);
+
+    return perRun;
+}
+
+uint64_t file_size(const std::string& filename) {
+    return std::filesystem::file_size(filename);
+}
+
+
+// synthetic data
+
+/**
+ * rolling hills, a handful of textures, some water and scattered objects.
+ * not pretty, but it compresses and branches about like a real area does
+ */
+OCARN2::Map make_synthetic_map(uint32_t seed) {
+    OCARN2::Map map {};
+    std::mt19937 rng(seed);
+
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) {
+            uint32_t i = z * 1024 + x;
+
+            int height = 128 + (int) (60 * std::sin(x * 0.013) * std::cos(z * 0.017)) + (int) (rng() % 5);
+            map.heightMap[i] = (unsigned char) height;
+
+            map.textureMap[i] = (uint16_t) ((x / 16 + z / 16) % 24);
+            map.textureMapFar[i] = map.textureMap[i];
+            map.objectMap[i] = rng() % 40 == 0 ? (unsigned char) (rng() % 32) : 255;
+
+            uint16_t flags = (uint16_t) (rng() & (OCARN2::BF_TEXTURE_DIRECTION | OCARN2::BF_MODEL_DIRECTION | OCARN2::BF_REVERSE));
+            if(height < 100) flags |= OCARN2::BF_WATER;
+            if(height > 180) flags |= OCARN2::BF_IMPASSABLE;
+            map.bitflagMap[i] = flags;
+
+            map.lightingMap[0][i] = (unsigned char) (height / 2);
+            map.lightingMap[1][i] = (unsigned char) height;
+            map.lightingMap[2][i] = (unsigned char) (height / 4);
+            map.waterMap[i] = height < 100 ? 1 : 0;
+            map.objectHeightMap[i] = (unsigned char) height;
+        }
+    }
+
+    for(uint32_t i=0; i < 512 * 512; i++) {
+        map.fogMap[i] = (unsigned char) (i % 7 == 0);
+        map.ambientMap[i] = (unsigned char) ((i / 4096) % 4);
+    }
+
+    return map;
+}
+
+OCARN2::Mesh make_synthetic_mesh(std::mt19937& rng, uint32_t numVertices, uint32_t numFaces, uint32_t numNodes) {
+    OCARN2::Mesh mesh {};
+
+    for(uint32_t i=0; i < numVertices; i++) {
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        mesh.vertices.push_back({ position(rng), position(rng), position(rng), (int16_t) (i % 8), 0 });
+    }
+
+    for(uint32_t i=0; i < numFaces; i++) {
+        OCARN2::Face face {};
+        face.v1 = rng() % numVertices;
+        face.v2 = rng() % numVertices;
+        face.v3 = rng() % numVertices;
+        face.tax = rng() % 256; face.tbx = rng() % 256; face.tcx = rng() % 256;
+        face.tay = rng() % 256; face.tby = rng() % 256; face.tcy = rng() % 256;
+        face.flags = rng() % 4 == 0 ? (uint16_t) OCARN2::SF_DOUBLE_SIDE : (uint16_t) 0;
+        mesh.faces.push_back(face);
+    }
+
+    for(uint32_t i=0; i < numNodes; i++) {
+        OCARN2::Node node {};
+        snprintf(node.name, sizeof(node.name), "node%u", i);
+        mesh.nodes.push_back(node);
+    }
+
+    mesh.numVertices = numVertices;
+    mesh.numFaces = numFaces;
+    mesh.numNodes = numNodes;
+
+    mesh.textureSize = 256 * 256 * 2;
+    mesh.textureData = new uint16_t[mesh.textureSize / 2];
+    for(uint32_t i=0; i < mesh.textureSize / 2; i++) mesh.textureData[i] = (uint16_t) rng();
+
+    return mesh;
+}
+
+/**
+ * creature sized car file with a stack of animations and sounds
+ */
+OCARN2::Mesh make_synthetic_car(uint32_t seed) {
+    std::mt19937 rng(seed);
+    OCARN2::Mesh mesh = make_synthetic_mesh(rng, 2000, 3600, 0);
+
+    for(uint32_t a=0; a < 16; a++) {
+        OCARN2::Animation animation {};
+        snprintf(animation.name, sizeof(animation.name), "anim%u", a);
+        animation.kps = 24;
+        animation.numFrames = 40;
+        animation.data = new int16_t[mesh.vertices.size() * animation.numFrames * 3];
+
+        for(size_t i=0; i < mesh.vertices.size() * animation.numFrames * 3; i++) animation.data[i] = (int16_t) (rng() % 2000);
+
+        mesh.animations.push_back(animation);
+    }
+
+    for(uint32_t s=0; s < 8; s++) {
+        OCARN2::SoundEffect sound {};
+        snprintf(sound.name, sizeof(sound.name), "sound%u", s);
+        sound.length = 22050 * 2;
+        sound.data = new uint16_t[sound.length / 2];
+        for(uint32_t i=0; i < sound.length / 2; i++) sound.data[i] = (uint16_t) rng();
+
+        mesh.soundEffects.push_back(sound);
+    }
+
+    mesh.numAnimations = (uint32_t) mesh.animations.size();
+    mesh.numSoundEffects = (uint32_t) mesh.soundEffects.size();
+
+    return mesh;
+}
+
+/**
+ * area sized rsc. lots of textures and small models, and the sky
+ */
+OCARN2::Rsc* make_synthetic_rsc(uint32_t seed) {
+    std::mt19937 rng(seed);
+    auto* rsc = new OCARN2::Rsc {};
+
+    for(uint32_t t=0; t < 128; t++) {
+        OCARN2::Texture texture {};
+        texture.size = 128 * 128 * 2;
+        texture.data = new uint16_t[128 * 128];
+        for(uint32_t i=0; i < 128 * 128; i++) texture.data[i] = (uint16_t) ((i * (t + 1)) ^ (rng() & 7));
+
+        rsc->textures.push_back(texture);
+    }
+
+    for(uint32_t m=0; m < 48; m++) {
+        OCARN2::RscModel model {};
+        model.radius = 64;
+        model.mesh = make_synthetic_mesh(rng, 300, 500, 4);
+        model.textureData = new uint16_t[128 * 128]();
+
+        rsc->models.push_back(model);
+    }
+
+    for(auto& sky: rsc->sky) {
+        for(uint32_t i=0; i < 256 * 256; i++) sky[i] = (uint16_t) (i / 256 + (rng() & 3));
+    }
+
+    for(uint32_t s=0; s < 16; s++) {
+        OCARN2::SoundEffect sound {};
+        sound.length = 44100;
+        sound.data = new uint16_t[sound.length / 2];
+        for(uint32_t i=0; i < sound.length / 2; i++) sound.data[i] = (uint16_t) rng();
+
+        rsc->soundEffects.push_back(sound);
+    }
+
+    rsc->fogs.push_back({ 0x808080, {}, 400.0f, false, 0.5f, 2000.0f });
+    rsc->waters.push_back({ 0, 90, 0.5f, 0x204060, {} });
+
+    rsc->numTextures = (uint32_t) rsc->textures.size();
+    rsc->numModels = (uint32_t) rsc->models.size();
+
+    return rsc;
+}
+
+/**
+ * _RES.TXT with a full roster of weapons and characters
+ */
+std::string make_synthetic_res_txt() {
+    std::string text = "weapons {\n";
+    for(int i=0; i < 16; i++) {
+        text += " {\n  name = Weapon " + std::to_string(i) + "\n  file = WEAPON" + std::to_string(i) + ".CAR\n  pic = WEAPON.TGA\n";
+        text += "  power = 4\n  prec = 0.6\n  loud = 1.3\n  rate = 1.6\n  shots = 8\n }\n";
+    }
+
+    text += "}\n\ncharacters {\n";
+    for(int i=0; i < 32; i++) {
+        text += " {\n  name = Dino " + std::to_string(i) + "\n  file = DINO" + std::to_string(i) + ".CAR\n";
+        text += "  ai = 10\n  mass = 0.8\n  length = 5.2\n  radius = 300\n  health = 20\n  basescore = 10\n";
+        text += "  smell = 0.8\n  hear = 0.6\n  look = 0.4\n  shipdelta = 50\n  scale0 = 800\n  scaleA = 400\n  danger = TRUE\n }\n";
+    }
+
+    text += "}\n\nprices {\n start = 100\n";
+    for(int i=0; i < 16; i++) text += " area = 10\n dino = 20\n weapon = 30\n acces = 40\n";
+    text += "}\n";
+
+    return text;
+}
+
+
+int main(int argc, char* argv[]) {
+    if(argc > 1) filter = argv[1];
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "ocarn2-bench";
+    std::filesystem::create_directories(directory);
+
+    std::string mapFile = (directory / "SYNTH.MAP").string();
+    std::string rscFile = (directory / "SYNTH.RSC").string();
+    std::string carFile = (directory / "SYNTH.CAR").string();
+    std::string modelFile = (directory / "SYNTH.3DF").string();
+    std::string resTxtFile = (directory / "_RES.TXT").string();
+    std::string mapPackFile = (directory / "SYNTH.MAP.pack").string();
+    std::string rscPackFile = (directory / "SYNTH.RSC.pack").string();
+
+    printf("generating synthetic data in %s\n\n", directory.string().c_str());
+
+    OCARN2::Map map = make_synthetic_map(1);
+    save_map_file(map, mapFile);
+
+    OCARN2::Rsc* rsc = make_synthetic_rsc(2);
+    save_rsc_file(*rsc, rscFile);
+
+    OCARN2::Mesh car = make_synthetic_car(3);
+    save_car_file(car, carFile);
+    save_3df_file(rsc->models[0].mesh, modelFile);
+
+    std::string resTxt = make_synthetic_res_txt();
+    {
+        std::ofstream out(resTxtFile, std::ios::binary);
+        out << resTxt;
+    }
+
+    save_map_pack(map, mapPackFile);
+    bake_rsc_pack(rscFile, rscPackFile);
+
+    printf("%-32s %13s %15s %13s %23s\n", "benchmark", "runs", "time", "throughput", "allocations");
+
+
+    // loaders
+
+    run_bench("load_3df_file", file_size(modelFile), [&]() {
+        OCARN2::Mesh mesh = load_3df_file(modelFile);
+        free_mesh(mesh);
+    });
+
+    run_bench("load_car_file", file_size(carFile), [&]() {
+        OCARN2::Mesh mesh = load_car_file(carFile);
+        free_mesh(mesh);
+    });
+
+    run_bench("load_rsc_file", file_size(rscFile), [&]() {
+        auto* resources = new OCARN2::Rsc(load_rsc_file(rscFile));
+        free_rsc(*resources);
+        delete resources;
+    });
+
+    run_bench("load_map_file", file_size(mapFile), [&]() {
+        OCARN2::Map loaded = load_map_file(mapFile);
+    });
+
+    run_bench("load_res_txt_file", file_size(resTxtFile), [&]() {
+        OCARN2::ResTxt resources = load_res_txt_file(resTxtFile);
+    });
+
+    run_bench("parse_res_txt", resTxt.size(), [&]() {
+        OCARN2::ResTxt resources;
+        parse_res_txt(resTxt.data(), resTxt.size(), resources);
+    });
+
+
+    // writers
+
+    run_bench("save_car_file", file_size(carFile), [&]() {
+        save_car_file(car, carFile);
+    });
+
+    run_bench("save_rsc_file", file_size(rscFile), [&]() {
+        save_rsc_file(*rsc, rscFile);
+    });
+
+    run_bench("save_map_file", file_size(mapFile), [&]() {
+        save_map_file(map, mapFile);
+    });
+
+
+    // record conversion for records that aren't the file layout in memory, here fogs: runs of plain fields copied a
+    // block per record against a field at a time, with a memcpy of the same bytes as the floor
+
+    const size_t numRecords = 1 << 20;
+    std::vector<unsigned char> fogRecords(numRecords * ocarn2__records<OCARN2::Fog>::size);
+    for(size_t i=0; i < fogRecords.size(); i++) fogRecords[i] = (unsigned char) (i * 131);
+    std::vector<OCARN2::Fog> fogs(numRecords);
+
+    run_bench("decode_records (fogs, memcpy)", fogRecords.size(), [&]() {
+        memcpy(fogs.data(), fogRecords.data(), fogRecords.size());
+    });
+
+    run_bench("decode_records (fogs, per field)", fogRecords.size(), [&]() {
+        std::apply([&](const auto&... field) { (ocarn2__decode_field(field, fogRecords.data(), fogs.data(), numRecords), ...); },
+                   ocarn2__record<OCARN2::Fog>::fields);
+    });
+
+    run_bench("decode_records (fogs, runs)", fogRecords.size(), [&]() {
+        ocarn2__decode_records(fogRecords.data(), fogs.data(), numRecords);
+    });
+
+    run_bench("encode_records (fogs, runs)", fogRecords.size(), [&]() {
+        ocarn2__encode_records(fogs.data(), fogRecords.data(), numRecords);
+    });
+
+
+    // packs. throughput is over the uncompressed size
+
+    run_bench("save_map_pack", file_size(mapFile), [&]() {
+        save_map_pack(map, mapPackFile);
+    });
+
+    run_bench("load_map_pack", file_size(mapFile), [&]() {
+        OCARN2::Map loaded = load_map_pack(mapPackFile);
+    });
+
+    run_bench("load_rsc_pack", file_size(rscFile), [&]() {
+        auto* resources = new OCARN2::Rsc(load_rsc_pack(rscPackFile));
+        free_rsc(*resources);
+        delete resources;
+    });
+
+    OCARN2::PackFile pack = open_pack_file(mapPackFile);
+    std::vector<uint16_t> rows(1024 * 64);
+    run_bench("read_map_pack_rows (64 rows)", rows.size() * 2, [&]() {
+        read_map_pack_rows(pack, OCARN2::MAP_BITFLAG, 512, 64, rows.data());
+    });
+
+
+    // tiled map, from a cold cache each run
+
+    run_bench("get_map_tile (cold)", 64 * 64 * 13 + 32 * 32 * 2, [&]() {
+        OCARN2::TiledMap tiled = open_tiled_map(mapFile);
+        get_map_tile(tiled, 8, 8);
+    });
+
+    run_bench("prefetch_map_tiles (3x3)", (64 * 64 * 13 + 32 * 32 * 2) * 9, [&]() {
+        OCARN2::TiledMap tiled = open_tiled_map(mapFile);
+        prefetch_map_tiles(tiled, 512.0f, 512.0f);
+        wait_map_tiles(tiled);
+    });
+
+
+    // async loads, waiting on the future so it's comparable with the blocking loaders
+
+    for(int useIoUring=0; useIoUring < 2; useIoUring++) {
+        OCARN2::AsyncLoaderOptions options;
+        options.useIoUring = useIoUring;
+
+        OCARN2::AsyncLoader* loader = create_async_loader(options);
+        std::string suffix = loader->usingIoUring ? " (io_uring)" : " (pread)";
+
+        run_bench("load_map_file_future" + suffix, file_size(mapFile), [&]() {
+            OCARN2::Map loaded = load_map_file_future(loader, mapFile).get();
+        });
+
+        run_bench("load_rsc_file_future" + suffix, file_size(rscFile), [&]() {
+            std::unique_ptr<OCARN2::Rsc> resources = load_rsc_file_future(loader, rscFile).get();
+            free_rsc(*resources);
+        });
+
+        free_async_loader(loader);
+    }
+
+
+    // shared segments. what a second server on the host pays instead of loading the area itself
+
+    std::string segmentName = "/ocarn2-bench";
+    OCARN2::SharedAssets shared;
+    add_shared_map(shared, "area", map);
+    add_shared_rsc(shared, "area", *rsc);
+    add_shared_mesh(shared, "car", car);
+
+    remove_shared_segment(segmentName);
+    OCARN2::SharedSegment segment = create_shared_segment(segmentName, shared);
+
+    run_bench("open_shared_segment (3 assets)", segment.size, [&]() {
+        OCARN2::SharedSegment opened = open_shared_segment(segmentName);
+        OCARN2::SharedMap sharedMap = find_shared_map(opened, "area");
+        OCARN2::SharedRsc sharedRsc = find_shared_rsc(opened, "area");
+        OCARN2::SharedMesh sharedCar = find_shared_mesh(opened, "car");
+        sink = sharedMap.planes[OCARN2::MAP_HEIGHT][512 * 1024 + 512] + sharedRsc.models.size() + sharedCar.numFaces;
+        close_shared_segment(opened);
+    });
+
+    size_t segmentSize = segment.size;
+    close_shared_segment(segment);
+    remove_shared_segment(segmentName);
+
+
+    // terrain, from the height, texture and flag planes
+
+    run_bench("build_terrain_mesh", 1024 * 1024 * 7, [&]() {
+        OCARN2::TerrainMesh terrain = build_terrain_mesh(map);
+    });
+
+    OCARN2::TerrainMesh terrain = build_terrain_mesh(map);
+    std::vector<size_t> triangles(terrain.options.numLods);
+    for(auto& chunk: terrain.chunks) {
+        for(size_t l=0; l < chunk.lods.size(); l++) triangles[l] += chunk.lods[l].indices.size() / 3;
+    }
+
+    printf("\nterrain triangles per lod:");
+    for(size_t count: triangles) printf(" %zu", count);
+    printf("\n");
+
+    // flag counts, against going through bitflagMap a cell at a time
+
+    run_bench("count BF_REVERSE (per cell)", 1024 * 1024 * 2, [&]() {
+        uint32_t count = 0;
+        for(uint16_t flags: map.bitflagMap) {
+            if(flags & OCARN2::BF_REVERSE) count++;
+        }
+        sink = count;
+    });
+
+    run_bench("build_flag_planes", 1024 * 1024 * 2, [&]() {
+        OCARN2::FlagPlanes planes = build_flag_planes(map);
+    });
+
+    OCARN2::FlagPlanes planes = build_flag_planes(map);
+
+    run_bench("count_flags (popcount)", 1024 * 1024 * 2, [&]() {
+        sink = count_flags(planes, OCARN2::BF_TEXTURE_DIRECTION, OCARN2::BF_IMPASSABLE | OCARN2::BF_WATER);
+    });
+
+    run_bench("count_flags_rect (summed)", 0, [&]() {
+        sink = count_flags_rect(planes, { 100, 200, 300, 400 }, OCARN2::BF_WATER);
+    });
+
+    run_bench("count_flags_grid (16x16)", 0, [&]() {
+        std::vector<uint32_t> counts = count_flags_grid(planes, 64, 0, OCARN2::BF_IMPASSABLE | OCARN2::BF_WATER);
+    });
+
+    // triangle walks over a big mesh, summing areas like a collision or skinning pass would.
+    // faces use nearby vertices, as they do in real models
+
+    std::mt19937 meshRandom(4);
+    OCARN2::Mesh big = make_synthetic_mesh(meshRandom, 200000, 400000, 0);
+    for(uint32_t i=0; i < big.faces.size(); i++) {
+        big.faces[i].v1 = (int32_t) (i / 2);
+        big.faces[i].v2 = (int32_t) std::min(i / 2 + 1 + (uint32_t) (meshRandom() % 4), 199999u);
+        big.faces[i].v3 = (int32_t) std::min(i / 2 + 1 + (uint32_t) (meshRandom() % 16), 199999u);
+    }
+
+    OCARN2::CompactMesh compact = build_compact_mesh(big);
+
+    auto area = [](float ax, float ay, float az, float bx, float by, float bz, float cx, float cy, float cz) {
+        float ux = bx - ax, uy = by - ay, uz = bz - az;
+        float vx = cx - ax, vy = cy - ay, vz = cz - az;
+        float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        return std::sqrt(nx * nx + ny * ny + nz * nz);
+    };
+
+    run_bench("triangle walk (Mesh)", 0, [&]() {
+        float total = 0;
+        for(const OCARN2::Face& face: big.faces) {
+            const OCARN2::Vertex& a = big.vertices[face.v1];
+            const OCARN2::Vertex& b = big.vertices[face.v2];
+            const OCARN2::Vertex& c = big.vertices[face.v3];
+            total += area(a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z);
+        }
+        sink = total;
+    });
+
+    run_bench("triangle walk (CompactMesh)", 0, [&]() {
+        float total = 0;
+        const float* x = compact.x.data();
+        const float* y = compact.y.data();
+        const float* z = compact.z.data();
+
+        for(uint32_t i=0; i < compact.numFaces; i++) {
+            uint32_t a = compact.indices[i * 3], b = compact.indices[i * 3 + 1], c = compact.indices[i * 3 + 2];
+            total += area(x[a], y[a], z[a], x[b], y[b], z[b], x[c], y[c], z[c]);
+        }
+        sink = total;
+    });
+
+    run_bench("build_compact_mesh", big.faces.size() * sizeof(OCARN2::Face) + big.vertices.size() * sizeof(OCARN2::Vertex), [&]() {
+        OCARN2::CompactMesh built = build_compact_mesh(big);
+    });
+
+    free_mesh(big);
+
+    run_bench("build_mesh_batches (car)", 0, [&]() {
+        OCARN2::MeshBatches batches = build_mesh_batches(car);
+    });
+
+    // quantized creature. the real dimorphodon from testdata, when run from the repo or a build directory in it
+
+    OCARN2::Mesh dimorphodon {};
+    for(const char* path: { "testdata/DIMOR2.CAR", "../testdata/DIMOR2.CAR" }) {
+        if(std::filesystem::exists(path)) {
+            dimorphodon = load_car_file(path);
+            break;
+        }
+    }
+
+    OCARN2::QuantizedMesh quantized;
+    double rawPoseTime = 0, compressedPoseTime = 0;
+
+    if(!dimorphodon.animations.empty()) {
+        run_bench("build_quantized_mesh (DIMOR2)", 0, [&]() {
+            OCARN2::QuantizedMesh built = build_quantized_mesh(dimorphodon);
+        });
+
+        quantized = build_quantized_mesh(dimorphodon);
+
+        const OCARN2::Animation& animation = dimorphodon.animations[0];
+        uint32_t n = quantized.numVertices;
+        std::vector<float> pose(n * 3);
+        float poseFrame = 0;
+
+        rawPoseTime = run_bench("evaluate_pose (DIMOR2)", n * 12, [&]() {
+            evaluate_pose(animation, n, poseFrame, &pose[0], &pose[n], &pose[n * 2]);
+            poseFrame = std::fmod(poseFrame + 0.37f, (float) (animation.numFrames - 1));
+        });
+
+        compressedPoseTime = run_bench("evaluate_compressed_pose (DIMOR2)", n * 12, [&]() {
+            evaluate_compressed_pose(quantized.animations[0], poseFrame, &pose[0], &pose[n], &pose[n * 2]);
+            poseFrame = std::fmod(poseFrame + 0.37f, (float) (animation.numFrames - 1));
+        });
+    }
+
+    // texture atlases, the terrain textures the map uses with gutters, every model texture, and the terrain one
+    // coming back out of its cache file
+
+    run_bench("build_terrain_atlas", rsc->textures.size() * 128 * 128 * 2, [&]() {
+        OCARN2::TextureAtlas atlas = build_terrain_atlas(*rsc, &map);
+    });
+
+    run_bench("build_model_atlas", 0, [&]() {
+        OCARN2::TextureAtlas atlas = build_model_atlas(*rsc);
+    });
+
+    std::filesystem::path atlasFile = std::filesystem::temp_directory_path() / "ocarn2-bench" / "TERRAIN.ATLAS";
+    cached_terrain_atlas(*rsc, &map, atlasFile.string());
+    run_bench("cached_terrain_atlas (hit)", rsc->textures.size() * 128 * 128 * 2, [&]() {
+        OCARN2::TextureAtlas atlas = cached_terrain_atlas(*rsc, &map, atlasFile.string());
+    });
+
+    std::filesystem::path stampedAtlasFile = std::filesystem::temp_directory_path() / "ocarn2-bench" / "TERRAIN.STAMPED.ATLAS";
+    cached_terrain_atlas(*rsc, &map, stampedAtlasFile.string(), {}, { rscFile, mapFile });
+    run_bench("cached_terrain_atlas (file hit)", rsc->textures.size() * 128 * 128 * 2, [&]() {
+        OCARN2::TextureAtlas atlas = cached_terrain_atlas(*rsc, &map, stampedAtlasFile.string(), {}, { rscFile, mapFile });
+    });
+
+    // map planes to pictures, the way minimaps get made. first one cell at a time on one thread, like example_map used to
+
+    std::filesystem::path imageFile = std::filesystem::temp_directory_path() / "ocarn2-bench" / "PLANE.BMP";
+    run_bench("lighting plane bmp (serial)", 1024 * 1024, [&]() {
+        OCARN2::Image image = create_image(1024, 1024, 3);
+        for(uint32_t z=0; z < 1024; z++) {
+            for(uint32_t x=0; x < 1024; x++) {
+                unsigned char value = map.lightingMap[0][z * 1024 + x];
+                unsigned char* pixel = &image.pixels[((1023 - z) * 1024 + x) * 3];
+                pixel[0] = pixel[1] = pixel[2] = value;
+            }
+        }
+        save_bmp_file(image, imageFile.string());
+    });
+
+    run_bench("save_map_plane_image (lighting)", 1024 * 1024, [&]() {
+        save_map_plane_image(map, OCARN2::MAP_LIGHT_DAWN, imageFile.string());
+    });
+
+    run_bench("save_map_plane_image (texture)", 1024 * 1024 * 2, [&]() {
+        save_map_plane_image(map, OCARN2::MAP_TEXTURE, imageFile.string(), {}, rsc);
+    });
+
+    OCARN2::MapImageOptions minimap;
+    minimap.downsample = 4;
+    run_bench("map_plane_image (texture, 1/4)", 1024 * 1024 * 2, [&]() {
+        OCARN2::Image image = map_plane_image(map, OCARN2::MAP_TEXTURE, minimap, rsc);
+    });
+
+    // software rasterizer. the synthetic creature's faces join random vertices, so every one of them covers a good
+    // part of the 256x256 target and this is mostly fill rate. then a 256x256 cell block of terrain seen from
+    // above its corner, in colour and into a low res depth only target for occlusion queries
+
+    OCARN2::RasterTarget carTarget = create_raster_target(256, 256);
+    OCARN2::RasterCamera carCamera = frame_mesh_camera(car, 1.0f);
+    run_bench("draw_mesh (car, 256x256)", 0, [&]() {
+        clear_raster_target(carTarget);
+        draw_mesh(carTarget, car, carCamera);
+    });
+
+    OCARN2::RasterTarget terrainTarget = create_raster_target(512, 256);
+    OCARN2::RasterTarget occluders = create_raster_target(128, 64, true);
+    OCARN2::RasterCamera terrainCamera = look_at_camera(400 * 256, 200 * 64 + 9000, 400 * 256, 500 * 256, 100 * 64, 500 * 256,
+                                                        60.0f, 2.0f, 100.0f, 200000.0f);
+    run_bench("draw_terrain_region (512x256)", 0, [&]() {
+        clear_raster_target(terrainTarget);
+        draw_terrain_region(terrainTarget, map, rsc, 350, 350, 256, 256, terrainCamera);
+    });
+
+    run_bench("draw_terrain_region (depth)", 0, [&]() {
+        clear_raster_target(occluders);
+        draw_terrain_region(occluders, map, nullptr, 350, 350, 256, 256, terrainCamera);
+    });
+
+    float boxMin[3] = {500 * 256, 0, 500 * 256}, boxMax[3] = {500 * 256 + 100, 100, 500 * 256 + 100};
+    run_bench("raster_box_visible", 0, [&]() {
+        sink = raster_box_visible(occluders, terrainCamera, boxMin, boxMax);
+    });
+
+
+    // time of day lighting, jumping between hours so every block is blended, then a minute at a time
+
+    OCARN2::LightingBlender blender = create_lighting_blender(map, 8.0f);
+
+    float jumpHour = 8.0f;
+    run_bench("set_lighting_time (jump)", 1024 * 1024 * 4, [&]() {
+        jumpHour = jumpHour == 8.0f ? 14.0f : 8.0f;
+        set_lighting_time(blender, jumpHour);
+    });
+
+    float minuteHour = 8.0f;
+    run_bench("set_lighting_time (minute)", 0, [&]() {
+        minuteHour += 1.0f / 60.0f;
+        set_lighting_time(blender, minuteHour);
+    });
+
+    run_bench("sample_lighting", 0, [&]() {
+        sink = sample_lighting(blender, 123.25f, 456.75f);
+    });
+
+    run_bench("bake_lightmap", 1024 * 1024, [&]() {
+        std::vector<unsigned char> light = bake_lightmap(map, {}, rsc);
+    });
+
+    // raycasts against every placed object, like checking bullets. single shots in any direction from head
+    // height, and bursts of 8 from one spot inside a few degrees of each other
+
+    OCARN2::BvhWorld world;
+    run_bench("build_world_bvh", 0, [&]() {
+        world = build_world_bvh(map, *rsc);
+    });
+    if(world.nodes.empty()) world = build_world_bvh(map, *rsc);
+
+    const size_t numRays = 4096;
+    std::vector<OCARN2::BvhRay> shots(numRays), bursts(numRays);
+    std::vector<OCARN2::BvhHit> hits(numRays);
+    std::mt19937 rayRandom(44);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    for(size_t i=0; i < numRays; i++) {
+        for(std::vector<OCARN2::BvhRay>* rays: { &shots, &bursts }) {
+            bool burst = rays == &bursts;
+            if(burst && i % 8 != 0) {
+                // same spot as the first of the burst, a little spread
+                OCARN2::BvhRay ray = bursts[i - i % 8];
+                ray.direction[0] += (unit(rayRandom) - 0.5f) * 0.05f;
+                ray.direction[1] += (unit(rayRandom) - 0.5f) * 0.05f;
+                ray.direction[2] += (unit(rayRandom) - 0.5f) * 0.05f;
+                bursts[i] = ray;
+                continue;
+            }
+
+            uint32_t x = 100 + rayRandom() % 824, z = 100 + rayRandom() % 824;
+            float angle = unit(rayRandom) * 6.2831853f, pitch = (unit(rayRandom) - 0.5f) * 0.2f;
+
+            (*rays)[i] = {
+                { x * 256.0f + 128, map.heightMap[z * 1024 + x] * 64.0f + 150, z * 256.0f + 128 },
+                { std::cos(angle) * std::cos(pitch), std::sin(pitch), std::sin(angle) * std::cos(pitch) },
+                100 * 256.0f
+            };
+        }
+    }
+
+    double shotTime = run_bench("intersect_ray (4096 shots)", 0, [&]() {
+        for(size_t i=0; i < numRays; i++) hits[i] = intersect_ray(world, shots[i]);
+    });
+
+    double singleBurstTime = run_bench("intersect_ray (4096 in bursts)", 0, [&]() {
+        for(size_t i=0; i < numRays; i++) hits[i] = intersect_ray(world, bursts[i]);
+    });
+
+    double burstTime = run_bench("intersect_rays (4096 in bursts)", 0, [&]() {
+        intersect_rays(world, bursts.data(), numRays, hits.data());
+    });
+
+    // scenery. every placement's transform, walking objectMap cell by cell against going model by model through
+    // the instance arrays, and culling a quarter turn wide view across the middle of the map
+
+    OCARN2::InstanceSet scenery;
+    run_bench("build_instance_set", 0, [&]() {
+        scenery = build_instance_set(map, *rsc);
+    });
+    if(scenery.models.empty()) scenery = build_instance_set(map, *rsc);
+
+    std::vector<float> matrices(scenery.instances.size() * 12);
+
+    double walkTime = run_bench("objectMap walk (transforms)", matrices.size() * 4, [&]() {
+        size_t at = 0;
+        for(uint32_t cell=0; cell < 1024 * 1024; cell++) {
+            unsigned char model = map.objectMap[cell];
+            if(model == 255 || model >= rsc->models.size()) continue;
+
+            uint32_t rotation = (map.bitflagMap[cell] >> 2) & 3;
+            float c = rotation == 0 ? 1.0f : rotation == 2 ? -1.0f : 0.0f, s = rotation == 1 ? 1.0f : rotation == 3 ? -1.0f : 0.0f;
+            float* m = &matrices[at];
+            at += 12;
+            m[0] = c;  m[1] = 0; m[2] = s;  m[3] = (cell % 1024 + 0.5f) * 256.0f;
+            m[4] = 0;  m[5] = 1; m[6] = 0;  m[7] = map.objectHeightMap[cell] * 64.0f;
+            m[8] = -s; m[9] = 0; m[10] = c; m[11] = (cell / 1024 + 0.5f) * 256.0f;
+        }
+    });
+
+    double instanceTime = run_bench("instance_matrices (by model)", matrices.size() * 4, [&]() {
+        for(const OCARN2::InstanceModel& model: scenery.models) {
+            instance_matrices(scenery, model.firstInstance, model.numInstances, &matrices[(size_t) model.firstInstance * 12]);
+        }
+    });
+
+    const float eyeX = 512 * 256.0f, eyeZ = 512 * 256.0f, viewDistance = 128 * 256.0f;
+    const float frustum[6][4] = {
+        { 1, 0, 0, -eyeX }, { -1, 0, 0, eyeX + viewDistance },
+        { 1, 0, -1, eyeZ - eyeX }, { 1, 0, 1, -eyeX - eyeZ },
+        { 0, 1, 0, 1e9f }, { 0, -1, 0, 1e9f }
+    };
+    std::vector<uint32_t> visibleBatches;
+
+    run_bench("cull_instance_batches", 0, [&]() {
+        cull_instance_batches(scenery, frustum, visibleBatches);
+    });
+    cull_instance_batches(scenery, frustum, visibleBatches);
+
+    size_t visibleInstances = 0, visibleDraws = 0;
+    for(size_t i=0; i < visibleBatches.size(); i++) {
+        const OCARN2::InstanceBatch& batch = scenery.batches[visibleBatches[i]];
+        visibleInstances += batch.count;
+        if(i == 0 || scenery.batches[visibleBatches[i - 1]].model != batch.model) visibleDraws++;
+    }
+
+    // creature sight. random pairs of cells in view distance of each other, traced every time against looked up
+    // in the visibility set, which only traces the pairs whose regions it couldn't prove hidden or visible. the
+    // synthetic map's per cell noise is as tall as a creature's eyes, which no real area has, so sight runs over
+    // it smoothed the way map editors leave ground
+
+    OCARN2::Map sightMap = map;
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) {
+            uint32_t sum = 0, count = 0;
+            for(uint32_t nz=z ? z - 1 : 0; nz <= std::min(z + 1, 1023u); nz++) {
+                for(uint32_t nx=x ? x - 1 : 0; nx <= std::min(x + 1, 1023u); nx++, count++) sum += map.heightMap[nz * 1024 + nx];
+            }
+            sightMap.heightMap[z * 1024 + x] = (unsigned char) ((sum + count / 2) / count);
+        }
+    }
+
+    OCARN2::TerrainPvs pvs;
+    run_bench("build_terrain_pvs", 0, [&]() {
+        pvs = build_terrain_pvs(sightMap, rsc);
+    });
+    if(pvs.numRegions == 0) pvs = build_terrain_pvs(sightMap, rsc);
+
+    std::mt19937 sightRandom(16);
+    std::vector<uint32_t> sightQueries;
+    while(sightQueries.size() < 4096 * 4) {
+        uint32_t x0 = sightRandom() % 1024, z0 = sightRandom() % 1024;
+        int32_t x1 = (int32_t) x0 + (int32_t) (sightRandom() % 97) - 48, z1 = (int32_t) z0 + (int32_t) (sightRandom() % 97) - 48;
+        if(x1 < 0 || x1 > 1023 || z1 < 0 || z1 > 1023) continue;
+        sightQueries.insert(sightQueries.end(), { x0, z0, (uint32_t) x1, (uint32_t) z1 });
+    }
+
+    const size_t numSights = sightQueries.size() / 4;
+    std::vector<char> traced(numSights), looked(numSights);
+
+    // fog ranges worked out once, as the set has them, so both sides only pay for the checks
+    OCARN2::SightRanges sightRanges = terrain_sight_ranges(rsc, pvs.options);
+
+    double traceTime = run_bench("terrain_can_see (4096 pairs)", 0, [&]() {
+        for(size_t i=0; i < numSights; i++) {
+            const uint32_t* q = &sightQueries[i * 4];
+            traced[i] = terrain_can_see(sightMap, sightRanges, pvs.options, q[0], q[1], q[2], q[3]);
+        }
+    });
+
+    double pvsTime = run_bench("pvs_can_see (4096 pairs)", 0, [&]() {
+        for(size_t i=0; i < numSights; i++) {
+            const uint32_t* q = &sightQueries[i * 4];
+            looked[i] = pvs_can_see(pvs, sightMap, q[0], q[1], q[2], q[3]);
+        }
+    });
+
+    const double minSightBitTests = 0.5;
+    size_t sightPartial = 0, sightWrong = 0;
+    for(size_t i=0; i < numSights; i++) {
+        const uint32_t* q = &sightQueries[i * 4];
+        sightPartial += pvs_cell_visibility(pvs, q[0], q[1], q[2], q[3]) == OCARN2::PVS_PARTIAL;
+        sightWrong += traced[i] != looked[i];
+    }
+
+    // pathfinding. the synthetic map is mostly open, so queries go corner to corner across it
+
+    run_bench("build_nav_grid", 0, [&]() {
+        OCARN2::NavGrid grid = build_nav_grid(map);
+    });
+
+    OCARN2::NavGrid grid = build_nav_grid(map);
+
+    std::mt19937 navRandom(7);
+    std::vector<std::pair<OCARN2::NavPoint, OCARN2::NavPoint>> queries;
+    while(queries.size() < 64) {
+        OCARN2::NavPoint from = { (uint16_t) (navRandom() % 256), (uint16_t) (navRandom() % 256) };
+        OCARN2::NavPoint to = { (uint16_t) (768 + navRandom() % 256), (uint16_t) (768 + navRandom() % 256) };
+        if(nav_walkable(grid, from.x, from.z) && nav_walkable(grid, to.x, to.z)) queries.push_back({ from, to });
+    }
+
+    size_t navQuery = 0;
+    run_bench("find_nav_path", 0, [&]() {
+        auto& query = queries[navQuery++ % queries.size()];
+        std::vector<OCARN2::NavPoint> path = find_nav_path(grid, query.first, query.second);
+    });
+
+    printf("\nnav grid: %zu nodes, %zu edges, %.1f MB of steps\n",
+           grid.nodes.size(), grid.edges.size(), grid.steps.size() / 1048576.0);
+
+    if(shotTime && singleBurstTime && burstTime) {
+        printf("bvh: %zu instances, rays/sec %.2fM shots, %.2fM bursts one at a time, %.2fM bursts as packets\n",
+               world.instances.size(), numRays / shotTime / 1e6, numRays / singleBurstTime / 1e6, numRays / burstTime / 1e6);
+    }
+
+    if(walkTime && instanceTime) {
+        printf("instances: %zu in %zu batches over %zu models, %zu visible in %zu batches (%zu instanced draws), "
+               "transforms %.0fM/sec walking objectMap, %.0fM/sec by model\n",
+               scenery.instances.size(), scenery.batches.size(), scenery.models.size(), visibleInstances, visibleBatches.size(),
+               visibleDraws, scenery.instances.size() / walkTime / 1e6, scenery.instances.size() / instanceTime / 1e6);
+    }
+
+    if(traceTime && pvsTime) {
+        printf("pvs: %u regions, %.1f MB of bits, %.1f%% of sight checks a bit test, %.2f%% differ from tracing, "
+               "checks/sec %.2fM traced, %.2fM through the set\n",
+               pvs.numRegions, (pvs.seen.size() + pvs.clear.size()) * 8 / 1048576.0, 100.0 * (numSights - sightPartial) / numSights,
+               100.0 * sightWrong / numSights, numSights / traceTime / 1e6, numSights / pvsTime / 1e6);
+
+        // the set only classifies pairs it can prove, so this has to be zero, and the bench fails if it isn't.
+        // it also fails if too few checks are bit tests, since then the bits cost memory for nothing
+        if(sightWrong) printf("pvs: pvs_can_see and terrain_can_see disagree on %zu of %zu pairs\n", sightWrong, numSights);
+        if(numSights - sightPartial < numSights * minSightBitTests) {
+            printf("pvs: only %.1f%% of sight checks a bit test, want at least %.0f%%\n",
+                   100.0 * (numSights - sightPartial) / numSights, 100.0 * minSightBitTests);
+        }
+    }
+
+    printf("shared segment: %.1f MB per host, mapped rather than loaded by each server\n", segmentSize / 1048576.0);
+
+    if(rawPoseTime && compressedPoseTime) {
+        OCARN2::MemoryFootprint before = mesh_memory_footprint(dimorphodon), after = quantized_mesh_memory_footprint(quantized);
+
+        uint64_t geometry[2] = {}, animations[2] = {};
+        for(auto& section: before.sections) {
+            if(!strcmp(section.name, "faces") || !strcmp(section.name, "vertices")) geometry[0] += section.bytes;
+            if(!strcmp(section.name, "animations")) animations[0] += section.bytes;
+        }
+        for(auto& section: after.sections) {
+            if(!strcmp(section.name, "animations")) animations[1] += section.bytes;
+            else if(strcmp(section.name, "struct") != 0) geometry[1] += section.bytes;
+        }
+
+        float maxError = 0;
+        for(auto& a: quantized.animations) maxError = std::max(maxError, a.maxError);
+
+        printf("quantized DIMOR2.CAR: geometry %.1f KB -> %.1f KB, animations %.1f KB -> %.1f KB (%.2fx), max error %.3f, "
+               "poses %.0fM vertices/sec (%.0fM uncompressed)\n",
+               geometry[0] / 1024.0, geometry[1] / 1024.0, animations[0] / 1024.0, animations[1] / 1024.0,
+               (double) (geometry[0] + animations[0]) / (double) (geometry[1] + animations[1]), maxError,
+               quantized.numVertices / compressedPoseTime / 1e6, quantized.numVertices / rawPoseTime / 1e6);
+    }
+
+    printf("memory: map %.1f MB, rsc %.1f MB, car %.2f MB\n",
+           map_memory_footprint(map).bytes / 1048576.0, rsc_memory_footprint(*rsc).bytes / 1048576.0,
+           mesh_memory_footprint(car).bytes / 1048576.0);
+
+    printf("pack sizes: map %.1f MB -> %.1f MB, rsc %.1f MB -> %.1f MB\n",
+           file_size(mapFile) / 1048576.0, file_size(mapPackFile) / 1048576.0,
+           file_size(rscFile) / 1048576.0, file_size(rscPackFile) / 1048576.0);
+
+    free_mesh(car);
+    free_mesh(dimorphodon);
+    free_rsc(*rsc);
+    delete rsc;
+
+    bool sightFailed = sightWrong || numSights - sightPartial < numSights * minSightBitTests;
+    return traceTime && pvsTime && sightFailed ? 1 : 0;
+}
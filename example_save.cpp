@@ -0,0 +1,59 @@
+#include <fstream>
+#include <iterator>
+
+#define OCARN2_IMPLEMENTATION
+#include "ocarn2.h"
+
+/**
+ * reads a whole file into memory, for comparing the saved files with the originals
+ */
+std::vector<char> read_bytes(const std::string& filename) {
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+bool same_bytes(const std::string& original, const std::string& saved) {
+    std::vector<char> a = read_bytes(original);
+    std::vector<char> b = read_bytes(saved);
+
+    printf("%s: %zu bytes, saved copy %zu bytes, %s\n", original.c_str(), a.size(), b.size(), a == b ? "identical" : "DIFFERENT");
+
+    return !a.empty() && a == b;
+}
+
+/**
+ * Example to load files and save them back out. The saved copies should match the originals byte for byte
+ *
+ * @param argc
+ * @param argv
+ * @return
+ */
+int main(int argc, char* argv[]) {
+    bool ok = true;
+
+    OCARN2::Mesh compass = load_3df_file("testdata/COMPAS.3DF");
+    save_3df_file(compass, "COMPAS.saved.3DF");
+    ok &= same_bytes("testdata/COMPAS.3DF", "COMPAS.saved.3DF");
+    free_mesh(compass);
+
+    OCARN2::Mesh dimorphodon = load_car_file("testdata/DIMOR2.CAR");
+    save_car_file(dimorphodon, "DIMOR2.saved.CAR");
+    ok &= same_bytes("testdata/DIMOR2.CAR", "DIMOR2.saved.CAR");
+    free_mesh(dimorphodon);
+
+    // the area files aren't in testdata, but they'll be checked if you drop them in
+    if(std::ifstream("testdata/AREA1.RSC")) {
+        OCARN2::Rsc resources = load_rsc_file("testdata/AREA1.RSC");
+        save_rsc_file(resources, "AREA1.saved.RSC");
+        ok &= same_bytes("testdata/AREA1.RSC", "AREA1.saved.RSC");
+        free_rsc(resources);
+    }
+
+    if(std::ifstream("testdata/AREA1.MAP")) {
+        OCARN2::Map map = load_map_file("testdata/AREA1.MAP");
+        save_map_file(map, "AREA1.saved.MAP");
+        ok &= same_bytes("testdata/AREA1.MAP", "AREA1.saved.MAP");
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+
+#define OCARN2_IMPLEMENTATION
+#include "ocarn2.h"
+
+/**
+ * libFuzzer target for the .car loader. Every input has to either load or be turned down with an error,
+ * without reading out of bounds or allocating more than the input could back
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    OCARN2::Mesh result = load_car_memory(data, size);
+    free_mesh(result);
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+
+#define OCARN2_IMPLEMENTATION
+#include "ocarn2.h"
+
+/**
+ * libFuzzer target for the .map loader. Every input has to either load or be turned down with an error,
+ * without reading out of bounds or allocating more than the input could back
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    load_map_memory(data, size);
+
+    return 0;
+}
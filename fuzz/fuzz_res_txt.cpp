@@ -0,0 +1,13 @@
+
+#define OCARN2_IMPLEMENTATION
+#include "ocarn2.h"
+
+/**
+ * libFuzzer target for the _RES.TXT parser
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    OCARN2::ResTxt result;
+    parse_res_txt((const char*) data, size, result);
+
+    return 0;
+}
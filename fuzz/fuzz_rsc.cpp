@@ -0,0 +1,17 @@
+
+#define OCARN2_IMPLEMENTATION
+#include "ocarn2.h"
+
+#include <memory>
+
+/**
+ * libFuzzer target for the .rsc loader. Every input has to either load or be turned down with an error,
+ * without reading out of bounds or allocating more than the input could back
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // Rsc carries the sky textures inline, too big for the stack
+    std::unique_ptr<OCARN2::Rsc> result(new OCARN2::Rsc(load_rsc_memory(data, size)));
+    free_rsc(*result);
+
+    return 0;
+}
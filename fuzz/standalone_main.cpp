@@ -0,0 +1,28 @@
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+/**
+ * Runs a fuzz target over the files given on the command line, once each. Used in place of libFuzzer
+ * when the compiler doesn't have it, to replay a corpus or a crash under the sanitizers
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char* argv[]) {
+    for(int i=1; i < argc; i++) {
+        std::ifstream file(argv[i], std::ios::in | std::ios::binary);
+        if(!file.is_open()) {
+            fprintf(stderr, "Unable to open %s\n", argv[i]);
+            return 1;
+        }
+
+        std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(contents.data(), contents.size());
+    }
+
+    printf("ran %d inputs\n", argc - 1);
+    return 0;
+}
@@ -15,6 +15,26 @@
  * Mesh load_car_file(const std::string& filename);
  * Rsc load_rsc_file(const std::string& filename);
  * Map load_map_file(const std::string& filename);
+ * ResTxt load_res_txt_file(const std::string& filename);
+ *
+ * every count in the binary formats is checked against what's left of the file before anything is allocated for it, so
+ * truncated or corrupt files are turned down with an empty result. pass a LoadError* to find out why and where.
+ * load_3df_memory, load_car_memory, load_rsc_memory and load_map_memory do the same for files already in memory
+ *
+ * and each of the binary formats can be written back out with
+ *
+ * bool save_3df_file(const Mesh& mesh, const std::string& filename);
+ * bool save_car_file(const Mesh& mesh, const std::string& filename);
+ * bool save_rsc_file(const Rsc& resources, const std::string& filename);
+ * bool save_map_file(const Map& map, const std::string& filename);
+ *
+ * define OCARN2_STATS to have every load record its time, bytes read, syscalls and allocations, per load and per section.
+ * read them back with stats_counters(), stats_sections() or stats_chrome_trace(). Allocations are only counted if
+ * OCARN2_STATS_REPLACE_NEW is also defined, or your own operator new calls stats_record_allocation(). The newest
+ * OCARN2_STATS_MAX_EVENTS (65536 by default) are kept, and stats_dropped_events() counts the ones that weren't
+ *
+ * mesh_memory_footprint, rsc_memory_footprint and map_memory_footprint add up the bytes a loaded asset holds, section
+ * by section, and memory_register keeps a process wide list of them so memory_total() is measured rather than guessed
  */
 
 #pragma once
@@ -154,6 +174,10 @@ namespace OCARN2 {
 
         int32_t textureSize = 128 * 128 * 2;
         uint16_t* textureData;
+
+        // only there when flags has OF_ANIMATED set. the second header value is the vertex count the frames are sized by
+        int32_t animationHeader[2];
+        Animation animation;
     };
 
     /**
@@ -201,6 +225,33 @@ namespace OCARN2 {
         std::vector<unsigned char> ambientMap = std::vector<unsigned char>(512 * 512);
     };
 
+    /**
+     * the planes of a .map file, in the order they are stored on disk
+     */
+    enum MapPlane {
+        MAP_HEIGHT = 0,
+        MAP_TEXTURE,
+        MAP_TEXTURE_FAR,
+        MAP_OBJECT,
+        MAP_BITFLAG,
+        MAP_LIGHT_DAWN,
+        MAP_LIGHT_NOON,
+        MAP_LIGHT_NIGHT,
+        MAP_WATER,
+        MAP_OBJECT_HEIGHT,
+        MAP_FOG,
+        MAP_AMBIENT,
+
+        MAP_NUM_PLANES
+    };
+
+    struct MapPlaneInfo {
+        const char* name;
+        uint32_t width;      // plane is width * width cells
+        uint32_t cellSize;   // bytes per cell
+        uint64_t fileOffset; // where the plane starts in a .map file
+    };
+
 
     enum Bitflags {
         /**
@@ -304,6 +355,80 @@ namespace OCARN2 {
 
         Prices prices;
     };
+
+    /**
+     * load statistics, only recorded when OCARN2_STATS is defined
+     */
+    struct StatsCounters {
+        uint64_t count = 0;
+        uint64_t nanoseconds = 0;
+        uint64_t bytesRead = 0;
+        uint64_t syscalls = 0;
+        uint64_t allocations = 0;
+    };
+
+    // one load (depth 0) or one section of a load (depth 1)
+    struct StatsEvent {
+        const char* name;
+        std::string detail; // filename
+        uint32_t depth;
+        uint64_t threadId;
+        uint64_t startNanoseconds;
+
+        StatsCounters counters;
+    };
+
+    struct StatsSection {
+        std::string name;
+        uint32_t depth;
+
+        StatsCounters counters;
+    };
+
+    /**
+     * why a binary file was turned down, and how far into it
+     */
+    struct LoadError {
+        uint64_t offset = 0;
+        std::string message;
+    };
+
+    struct ResTxtError {
+        uint32_t line = 0; // 1 based line the error was found on
+        std::string message;
+    };
+
+    /**
+     * bytes held by one part of an asset. bytes is everything allocated for it, used is what its data needs,
+     * so the difference is vector capacity and buffer slack. allocator overhead isn't counted
+     */
+    struct MemorySection {
+        const char* name;
+        uint64_t bytes = 0;
+        uint64_t used = 0;
+    };
+
+    struct MemoryFootprint {
+        uint64_t bytes = 0;
+        uint64_t used = 0;
+
+        std::vector<MemorySection> sections;
+    };
+
+    enum MemoryAssetKind {
+        MEMORY_MESH = 0,
+        MEMORY_RSC,
+        MEMORY_MAP
+    };
+
+    // one asset in the process wide registry, as measured when it was last registered
+    struct MemoryAsset {
+        std::string name;
+        MemoryAssetKind kind;
+        const void* asset;
+
+        MemoryFootprint footprint;
+    };
 }
 
 
@@ -316,15 +441,50 @@ namespace OCARN2 {
 #endif
 
 
-OCARN2_DEF OCARN2::Mesh load_3df_file(const std::string& filename);
-OCARN2_DEF OCARN2::Mesh load_car_file(const std::string& filename);
-OCARN2_DEF OCARN2::Rsc load_rsc_file(const std::string& filename);
-OCARN2_DEF OCARN2::Map load_map_file(const std::string& filename);
-OCARN2_DEF OCARN2::ResTxt load_res_txt_file(const std::string& filename);
+OCARN2_DEF OCARN2::Mesh load_3df_file(const std::string& filename, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Mesh load_car_file(const std::string& filename, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Rsc load_rsc_file(const std::string& filename, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Map load_map_file(const std::string& filename, OCARN2::LoadError* error = nullptr);
+
+OCARN2_DEF OCARN2::Mesh load_3df_memory(const void* data, size_t size, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Mesh load_car_memory(const void* data, size_t size, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Rsc load_rsc_memory(const void* data, size_t size, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Map load_map_memory(const void* data, size_t size, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::ResTxt load_res_txt_file(const std::string& filename, OCARN2::ResTxtError* error = nullptr);
+
+OCARN2_DEF bool save_3df_file(const OCARN2::Mesh& mesh, const std::string& filename);
+OCARN2_DEF bool save_car_file(const OCARN2::Mesh& mesh, const std::string& filename);
+OCARN2_DEF bool save_rsc_file(const OCARN2::Rsc& resources, const std::string& filename);
+OCARN2_DEF bool save_map_file(const OCARN2::Map& map, const std::string& filename);
+OCARN2_DEF bool parse_res_txt(const char* data, size_t size, OCARN2::ResTxt& resources, OCARN2::ResTxtError* error = nullptr);
 
 OCARN2_DEF void free_mesh(OCARN2::Mesh& mesh);
 OCARN2_DEF void free_rsc(OCARN2::Rsc& resources);
 
+OCARN2_DEF void stats_reset();
+OCARN2_DEF void stats_record_allocation();
+OCARN2_DEF std::vector<OCARN2::StatsEvent> stats_events();
+OCARN2_DEF uint64_t stats_dropped_events();
+OCARN2_DEF OCARN2::StatsCounters stats_counters();
+OCARN2_DEF std::vector<OCARN2::StatsSection> stats_sections();
+OCARN2_DEF std::string stats_chrome_trace();
+OCARN2_DEF bool save_stats_chrome_trace(const std::string& filename);
+
+OCARN2_DEF OCARN2::MemoryFootprint mesh_memory_footprint(const OCARN2::Mesh& mesh);
+OCARN2_DEF OCARN2::MemoryFootprint rsc_memory_footprint(const OCARN2::Rsc& resources);
+OCARN2_DEF OCARN2::MemoryFootprint map_memory_footprint(const OCARN2::Map& map);
+
+OCARN2_DEF uint64_t memory_register(const std::string& name, const OCARN2::Mesh& mesh);
+OCARN2_DEF uint64_t memory_register(const std::string& name, const OCARN2::Rsc& resources);
+OCARN2_DEF uint64_t memory_register(const std::string& name, const OCARN2::Map& map);
+OCARN2_DEF bool memory_unregister(const void* asset);
+OCARN2_DEF std::vector<OCARN2::MemoryAsset> memory_assets();
+OCARN2_DEF uint64_t memory_total();
+
+OCARN2_DEF OCARN2::MapPlaneInfo map_plane_info(OCARN2::MapPlane plane);
+OCARN2_DEF unsigned char* map_plane_data(OCARN2::Map& map, OCARN2::MapPlane plane);
+OCARN2_DEF const unsigned char* map_plane_data(const OCARN2::Map& map, OCARN2::MapPlane plane);
+
 
 #ifdef OCARN2_IMPLEMENTATION
 
@@ -333,618 +493,2096 @@ OCARN2_DEF void free_rsc(OCARN2::Rsc& resources);
 #include <fstream>
 #include <functional>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
 #include <locale>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
 
-/**
- * Internal function to open given filename, run callback, then close file
- * If file cannot be opened, error is printed to err stream
- *
- * @param filename
- * @param callback
- */
-OCARN2_DEF void ocarn2__openFile(const std::string& filename, const std::function<void(std::fstream&)>& callback) {
-    std::fstream file(filename, std::ios::in | std::ios::binary);
-    if(file.is_open()) {
+// load statistics. compiled out unless OCARN2_STATS is defined
 
-        callback(file);
+#ifdef OCARN2_STATS
 
-        file.close();
-    }
-    else {
-        std::cerr << "Unable to open " << filename << std::endl;
-    }
+#include <chrono>
+#include <mutex>
+
+// counters for the loads running on this thread
+struct ocarn2__stats_thread {
+    uint64_t bytesRead = 0;
+    uint64_t syscalls = 0;
+    uint64_t allocations = 0;
+
+    struct ocarn2__stats_load* load = nullptr;
+};
+
+static thread_local ocarn2__stats_thread ocarn2__stats_local;
+
+#define OCARN2__STATS_LOAD(name, filename) ocarn2__stats_load ocarn2__stats_scope(name, filename)
+#define OCARN2__STATS_SECTION(name) ocarn2__stats_section(name)
+#define OCARN2__STATS_IO(calls, bytes) (ocarn2__stats_local.syscalls += (calls), ocarn2__stats_local.bytesRead += (bytes))
+// the log keeps the newest this many events, so a long running process doesn't grow it forever
+#ifndef OCARN2_STATS_MAX_EVENTS
+#define OCARN2_STATS_MAX_EVENTS 65536
+#endif
+
+static std::mutex ocarn2__stats_mutex;
+static std::vector<OCARN2::StatsEvent> ocarn2__stats_log; // a ring once it's full, oldest at ocarn2__stats_oldest
+static size_t ocarn2__stats_oldest = 0;
+static uint64_t ocarn2__stats_dropped = 0;
+
+static inline uint64_t ocarn2__stats_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+static inline uint64_t ocarn2__stats_thread_id() {
+    return (uint64_t) std::hash<std::thread::id>()(std::this_thread::get_id());
+}
 
 /**
- * Internal function to load vertex from 3df file pointer
- *
- * @param in
- * @return
+ * Internal marker for the start of a span. The span's counters are the difference between two of these
  */
-OCARN2_DEF OCARN2::Vertex ocarn2__load_3df_vertex(std::fstream& in) {
-    OCARN2::Vertex vertex {};
+struct ocarn2__stats_mark {
+    uint64_t time, bytesRead, syscalls, allocations;
 
-    in.read((char*) &vertex.x, 4);
-    in.read((char*) &vertex.y, 4);
-    in.read((char*) &vertex.z, 4);
+    static ocarn2__stats_mark now() {
+        return { ocarn2__stats_now(), ocarn2__stats_local.bytesRead, ocarn2__stats_local.syscalls, ocarn2__stats_local.allocations };
+    }
+};
+
+static inline void ocarn2__stats_record(const char* name, const std::string& detail, uint32_t depth, const ocarn2__stats_mark& start) {
+    ocarn2__stats_mark end = ocarn2__stats_mark::now();
+
+    OCARN2::StatsEvent event;
+    event.name = name;
+    event.depth = depth;
+    event.threadId = ocarn2__stats_thread_id();
+    event.startNanoseconds = start.time;
+    event.counters = { 1, end.time - start.time, end.bytesRead - start.bytesRead, end.syscalls - start.syscalls, end.allocations - start.allocations };
+
+    std::lock_guard<std::mutex> lock(ocarn2__stats_mutex);
+    if(ocarn2__stats_log.size() < OCARN2_STATS_MAX_EVENTS) {
+        ocarn2__stats_log.push_back(event);
+        ocarn2__stats_log.back().detail = detail;
+        return;
+    }
 
-    in.read((char*) &vertex.owner, 2);
-    in.read((char*) &vertex.hidden, 2);
+    // full, so the newest takes the oldest's place
+    OCARN2::StatsEvent& oldest = ocarn2__stats_log[ocarn2__stats_oldest];
+    oldest = event;
+    oldest.detail = detail;
 
-    return vertex;
+    ocarn2__stats_oldest = (ocarn2__stats_oldest + 1) % ocarn2__stats_log.size();
+    ocarn2__stats_dropped++;
 }
 
 /**
- * Internal function to load 3df node from file pointer
- *
- * @param in
- * @return
+ * Internal span covering one load_*_file call. Sections inside it run back to back, so starting a
+ * section ends the one before it
  */
-OCARN2_DEF OCARN2::Node ocarn2__load_3df_node(std::fstream& in) {
-    OCARN2::Node node {};
+struct ocarn2__stats_load {
+    const char* name;
+    const std::string& detail;
+    ocarn2__stats_mark start;
 
-    in.read(node.name, 32);
+    const char* section = nullptr;
+    ocarn2__stats_mark sectionStart {};
 
-    in.read((char*) &node.x, 4);
-    in.read((char*) &node.y, 4);
-    in.read((char*) &node.z, 4);
+    ocarn2__stats_load* outer;
 
-    in.read((char*) &node.owner, 2);
-    in.read((char*) &node.hidden, 2);
+    ocarn2__stats_load(const char* name, const std::string& detail) : name(name), detail(detail), start(ocarn2__stats_mark::now()) {
+        outer = ocarn2__stats_local.load;
+        ocarn2__stats_local.load = this;
+    }
+
+    ~ocarn2__stats_load() {
+        end_section();
+        ocarn2__stats_record(name, detail, 0, start);
+
+        ocarn2__stats_local.load = outer;
+    }
+
+    void end_section() {
+        if(section) ocarn2__stats_record(section, detail, 1, sectionStart);
+        section = nullptr;
+    }
+
+    void begin_section(const char* next) {
+        end_section();
+
+        section = next;
+        sectionStart = ocarn2__stats_mark::now();
+    }
+};
 
-    return node;
+static inline void ocarn2__stats_section(const char* name) {
+    if(ocarn2__stats_local.load) ocarn2__stats_local.load->begin_section(name);
 }
 
 /**
- * Internal function to load face from 3df file pointer
- *
- * @param in
- * @return
+ * Internal stream buffer used while stats are on. It buffers like std::filebuf does, over an unbuffered
+ * filebuf, so every time it goes to the file is exactly one read or seek syscall and can be counted
  */
-OCARN2_DEF OCARN2::Face ocarn2__load_3df_face(std::fstream& in) {
-    OCARN2::Face face {};
+struct ocarn2__stats_filebuf : std::streambuf {
+    std::streambuf* file;
+    char buffer[8192];
+
+    explicit ocarn2__stats_filebuf(std::streambuf* file) : file(file) {
+        setg(buffer, buffer, buffer);
+    }
+
+    std::streamsize fill(char* destination, std::streamsize size) {
+        std::streamsize got = file->sgetn(destination, size);
+        OCARN2__STATS_IO(1, got);
+
+        return got;
+    }
 
-    in.read((char*) &face, 64);
+    int_type underflow() override {
+        if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
 
-/*
-    in.read((char*) &face.v1, 4);
-    in.read((char*) &face.v2, 4);
-    in.read((char*) &face.v3, 4);
+        std::streamsize got = fill(buffer, sizeof(buffer));
+        setg(buffer, buffer, buffer + got);
 
-    in.read((char*) &face.tax, 4);
-    in.read((char*) &face.tbx, 4);
-    in.read((char*) &face.tcx, 4);
+        return got > 0 ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+    }
+
+    std::streamsize xsgetn(char* s, std::streamsize n) override {
+        std::streamsize done = 0;
+
+        while(done < n) {
+            std::streamsize buffered = egptr() - gptr();
+
+            if(buffered == 0) {
+                // big reads skip the buffer, same as filebuf
+                if(n - done >= (std::streamsize) sizeof(buffer)) return done + fill(s + done, n - done);
+                if(underflow() == traits_type::eof()) break;
+                continue;
+            }
+
+            std::streamsize take = std::min(buffered, n - done);
+            memcpy(s + done, gptr(), take);
+            gbump((int) take);
+            done += take;
+        }
+
+        return done;
+    }
+
+    pos_type seekoff(off_type offset, std::ios::seekdir direction, std::ios::openmode which) override {
+        if(direction == std::ios::cur) offset -= egptr() - gptr();
+        setg(buffer, buffer, buffer);
+
+        OCARN2__STATS_IO(1, 0);
+        return file->pubseekoff(offset, direction, which);
+    }
 
-    in.read((char*) &face.tay, 4);
-    in.read((char*) &face.tby, 4);
-    in.read((char*) &face.tcy, 4);
+    pos_type seekpos(pos_type position, std::ios::openmode which) override {
+        setg(buffer, buffer, buffer);
 
-    in.read((char*) &face.flags, 2);
-    in.read((char*) &face.DMask, 2);
+        OCARN2__STATS_IO(1, 0);
+        return file->pubseekpos(position, which);
+    }
+};
 
-    in.read((char*) &face.distant, 4);
-    in.read((char*) &face.next, 4);
-    in.read((char*) &face.group, 4);
+#ifdef OCARN2_STATS_REPLACE_NEW
+#include <cstdlib>
+#include <new>
 
-    char buffer[255];
-    in.read(buffer, 12);*/
+// opt in replacement of the global allocator, so heap allocations made during a load are counted
+void* operator new(size_t size) {
+    stats_record_allocation();
 
-    return face;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
 }
 
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+#endif
+
+#else
+
+#define OCARN2__STATS_LOAD(name, filename)
+#define OCARN2__STATS_SECTION(name)
+#define OCARN2__STATS_IO(calls, bytes)
+
+#endif
+
 /**
- * Loads data from the given .3DF file
- *
- * @param filename
- * @return
+ * Counts a heap allocation against whatever load is running on this thread. Call it from your own
+ * operator new, or define OCARN2_STATS_REPLACE_NEW to have one provided
  */
-OCARN2_DEF OCARN2::Mesh load_3df_file(const std::string& filename) {
-    OCARN2::Mesh mesh {};
-
-    /**
-     * helper function do logging if filename is bad, and provide automatic closing of file when finished
-     */
-    ocarn2__openFile(filename, [&](std::fstream& file) {
-        file.read( (char*) &mesh.numVertices, 4 );
-        file.read( (char*) &mesh.numFaces,  4 );
-        file.read( (char*) &mesh.numNodes, 4 );
-        file.read( (char*) &mesh.textureSize, 4 );
-
-        // load faces
-        for(auto i=0; i < mesh.numFaces; i++) {
-            mesh.faces.emplace_back(ocarn2__load_3df_face(file) );
-        }
+OCARN2_DEF void stats_record_allocation() {
+#ifdef OCARN2_STATS
+    ocarn2__stats_local.allocations++;
+#endif
+}
 
-        // load vertices
-        for(auto i=0; i < mesh.numVertices; i++) {
-            mesh.vertices.emplace_back(ocarn2__load_3df_vertex(file) );
-        }
+/**
+ * Throws away everything recorded so far
+ */
+OCARN2_DEF void stats_reset() {
+#ifdef OCARN2_STATS
+    std::lock_guard<std::mutex> lock(ocarn2__stats_mutex);
+    ocarn2__stats_log.clear();
+    ocarn2__stats_oldest = 0;
+    ocarn2__stats_dropped = 0;
+#endif
+}
 
-        // load nodes
-        for(auto i=0; i < mesh.numNodes; i++) {
-            mesh.nodes.emplace_back(ocarn2__load_3df_node(file) );
-        }
+/**
+ * Every load and section recorded since the last reset, in the order they finished. Only the newest
+ * OCARN2_STATS_MAX_EVENTS are kept, the ones before them are counted by stats_dropped_events()
+ *
+ * @return
+ */
+OCARN2_DEF std::vector<OCARN2::StatsEvent> stats_events() {
+#ifdef OCARN2_STATS
+    std::lock_guard<std::mutex> lock(ocarn2__stats_mutex);
 
-        // load texture
-        mesh.textureData = new uint16_t[mesh.textureSize];
-        file.read((char*) mesh.textureData, mesh.textureSize);
-    });
+    std::vector<OCARN2::StatsEvent> events(ocarn2__stats_log.begin() + ocarn2__stats_oldest, ocarn2__stats_log.end());
+    events.insert(events.end(), ocarn2__stats_log.begin(), ocarn2__stats_log.begin() + ocarn2__stats_oldest);
+    return events;
+#else
+    return {};
+#endif
+}
 
-    return mesh;
+/**
+ * How many events were dropped since the last reset to keep the log at OCARN2_STATS_MAX_EVENTS. The totals from
+ * stats_counters() and stats_sections() leave them out
+ *
+ * @return
+ */
+OCARN2_DEF uint64_t stats_dropped_events() {
+#ifdef OCARN2_STATS
+    std::lock_guard<std::mutex> lock(ocarn2__stats_mutex);
+    return ocarn2__stats_dropped;
+#else
+    return 0;
+#endif
 }
 
 /**
- * Internal function to load animation from car file
+ * Totals over every load recorded since the last reset
  *
- * @param file
- * @param numVertices Number of Vertices in the Mesh. maybe pass mesh instead?
  * @return
  */
-OCARN2_DEF OCARN2::Animation ocarn2__load_car_animation(std::fstream& file, uint32_t numVertices) {
-    OCARN2::Animation animation {};
+OCARN2_DEF OCARN2::StatsCounters stats_counters() {
+    OCARN2::StatsCounters totals;
 
-    file.read(animation.name, 32);
-    file.read((char*) &animation.kps, 4);
-    file.read((char*) &animation.numFrames, 4);
+    for(auto& e: stats_events()) {
+        if(e.depth != 0) continue;
 
-    uint32_t size = numVertices * animation.numFrames * 6;
-    animation.data = new int16_t[size]; // (uint16_t*) malloc(size);
-    file.read((char*) animation.data, size);
+        totals.count++;
+        totals.nanoseconds += e.counters.nanoseconds;
+        totals.bytesRead += e.counters.bytesRead;
+        totals.syscalls += e.counters.syscalls;
+        totals.allocations += e.counters.allocations;
+    }
 
-    return animation;
+    return totals;
 }
 
 /**
- * Internal function to load sound effect associated with car model
+ * Totals per load function and per section name, in the order they were first seen
  *
- * @param file
  * @return
  */
-OCARN2_DEF OCARN2::SoundEffect ocarn2__load_car_sfx(std::fstream& file) {
-    OCARN2::SoundEffect effect {};
+OCARN2_DEF std::vector<OCARN2::StatsSection> stats_sections() {
+    std::vector<OCARN2::StatsSection> sections;
 
-    file.read(effect.name, 32);
-    file.read((char*) &effect.length, 4);
+    for(auto& e: stats_events()) {
+        auto found = std::find_if(sections.begin(), sections.end(), [&](const OCARN2::StatsSection& s) {
+            return s.name == e.name && s.depth == e.depth;
+        });
 
-    effect.data = new uint16_t[effect.length]; // (uint16_t*) malloc(effect.length);
-    file.read((char*) effect.data, effect.length);
+        if(found == sections.end()) {
+            sections.push_back({ e.name, e.depth, {} });
+            found = sections.end() - 1;
+        }
 
-    return effect;
-}
+        found->counters.count++;
+        found->counters.nanoseconds += e.counters.nanoseconds;
+        found->counters.bytesRead += e.counters.bytesRead;
+        found->counters.syscalls += e.counters.syscalls;
+        found->counters.allocations += e.counters.allocations;
+    }
 
+    return sections;
+}
 
 /**
- * Loads the Mesh found in the car file
+ * Everything recorded since the last reset as Chrome trace event json. Open it in chrome://tracing or Perfetto
  *
- * @param filename
  * @return
  */
-OCARN2_DEF OCARN2::Mesh load_car_file(const std::string& filename) {
-    OCARN2::Mesh mesh;
+OCARN2_DEF std::string stats_chrome_trace() {
+    std::vector<OCARN2::StatsEvent> events = stats_events();
 
-    ocarn2__openFile(filename, [&](std::fstream& file) {
-        file.read(mesh.name, 24);
-        file.read(mesh.msc, 8);
-
-        file.read((char*) &mesh.numAnimations, 4);
-        file.read((char*) &mesh.numSoundEffects, 4);
-        file.read((char*) &mesh.numVertices, 4);
-        file.read((char*) &mesh.numFaces, 4);
-        file.read((char*) &mesh.textureSize, 4);
-
-        // load faces
-        for(auto i=0; i < mesh.numFaces; i++) {
-            mesh.faces.emplace_back(ocarn2__load_3df_face(file) );
-        }
+    uint64_t origin = UINT64_MAX;
+    for(auto& e: events) origin = std::min(origin, e.startNanoseconds);
 
-        // load vertices
-        for(auto i=0; i < mesh.numVertices; i++) {
-            mesh.vertices.emplace_back(ocarn2__load_3df_vertex(file) );
-        }
+    std::string json = "{\"traceEvents\":[";
+    char line[512];
 
-        // load texture
-        mesh.textureData = new uint16_t[mesh.textureSize]; // (uint16_t*) malloc(mesh.textureSize);
-        file.read((char*) mesh.textureData, mesh.textureSize);
+    for(size_t i=0; i < events.size(); i++) {
+        const OCARN2::StatsEvent& e = events[i];
 
-        // read animations
-        for(auto i=0; i < mesh.numAnimations; i++) {
-            mesh.animations.emplace_back(ocarn2__load_car_animation(file, mesh.numVertices) );
+        // filenames are the only thing that might need escaping
+        std::string detail;
+        for(char c: e.detail) {
+            if(c == '"' || c == '\\') detail += '\\';
+            if((unsigned char) c >= 0x20) detail += c;
         }
 
-        // read sounds
-        for(auto i=0; i < mesh.numSoundEffects; i++) {
-            mesh.soundEffects.emplace_back( ocarn2__load_car_sfx(file) );
-        }
+        snprintf(line, sizeof(line),
+                 "%s\n{\"name\":\"%s\",\"cat\":\"ocarn2\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"file\":\"%s\",\"bytesRead\":%llu,\"syscalls\":%llu,\"allocations\":%llu}}",
+                 i == 0 ? "" : ",", e.name, (unsigned long long) (e.threadId & 0xffffffff),
+                 (e.startNanoseconds - origin) / 1000.0, e.counters.nanoseconds / 1000.0, detail.substr(0, 256).c_str(),
+                 (unsigned long long) e.counters.bytesRead, (unsigned long long) e.counters.syscalls, (unsigned long long) e.counters.allocations);
 
-        // read sound map
-        file.read((char*) &mesh.soundMap[0], 64 * 4);
-    });
+        json += line;
+    }
 
-    return mesh;
+    json += "\n]}\n";
+    return json;
 }
 
-
-// map and rsc definitions
 /**
- * Internal function to load texture from rsc file's current position
+ * Writes stats_chrome_trace() to a file
  *
- * @param file
+ * @param filename
  * @return
  */
-OCARN2_DEF OCARN2::Texture ocarn2__load_rsc_texture(std::fstream& file) {
-    OCARN2::Texture texture {};
-
-    texture.size = 128 * 128 * 2;
-    texture.data = new uint16_t[texture.size]; // (uint16_t*) malloc(texture.size);
-    file.read((char*) texture.data, texture.size);
+OCARN2_DEF bool save_stats_chrome_trace(const std::string& filename) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
 
-    return texture;
+    file << stats_chrome_trace();
+    return file.good();
 }
 
+
 /**
+ * Internal function to open given filename, run callback, then close file
+ * If file cannot be opened, error is printed to err stream
  *
- * @param file
- * @return
+ * @param filename
+ * @param callback
  */
-OCARN2_DEF OCARN2::Mesh ocarn2__load_rsc_mesh(std::fstream& file) {
-    OCARN2::Mesh mesh {};
+OCARN2_DEF void ocarn2__openFile(const std::string& filename, const std::function<void(std::fstream&)>& callback) {
+#ifdef OCARN2_STATS
+    // swap in the counting buffer, on top of an unbuffered file
+    std::fstream file;
+    file.rdbuf()->pubsetbuf(nullptr, 0);
+    file.open(filename, std::ios::in | std::ios::binary);
+#else
+    std::fstream file(filename, std::ios::in | std::ios::binary);
+#endif
+    if(file.is_open()) {
+#ifdef OCARN2_STATS
+        OCARN2__STATS_IO(1, 0); // the open
 
-    file.read((char*) &mesh.numVertices, 4);
-    file.read((char*) &mesh.numFaces, 4);
-    file.read((char*) &mesh.numNodes, 4);
-    file.read((char*) &mesh.textureSize, 4);
+        ocarn2__stats_filebuf counting(file.rdbuf());
+        file.std::ios::rdbuf(&counting);
 
+        callback(file);
 
-    // load faces
-    for(auto i=0; i < mesh.numFaces; i++) {
-        mesh.faces.emplace_back(ocarn2__load_3df_face(file) );
+        file.std::ios::rdbuf(file.rdbuf());
+#else
+        callback(file);
+#endif
+
+        file.close();
+    }
+    else {
+        std::cerr << "Unable to open " << filename << std::endl;
     }
+}
 
-    // load vertices
-    for(auto i=0; i < mesh.numVertices; i++) {
-        mesh.vertices.emplace_back(ocarn2__load_3df_vertex(file) );
+
+/**
+ * Internal streambuf over a block of memory, so the stream based readers can parse data
+ * that has already been loaded or decompressed
+ */
+struct ocarn2__membuf : std::streambuf {
+    ocarn2__membuf(const void* data, size_t size) {
+        char* p = (char*) data;
+        setg(p, p, p + size);
     }
 
-    // load nodes
-    for(auto i=0; i < mesh.numNodes; i++) {
-        mesh.nodes.emplace_back(ocarn2__load_3df_node(file) );
+    // seeking lets the loaders find out how big the data is up front
+    pos_type seekoff(off_type offset, std::ios::seekdir direction, std::ios::openmode which) override {
+        off_type base = direction == std::ios::beg ? 0 : direction == std::ios::cur ? gptr() - eback() : egptr() - eback();
+        return seekpos(pos_type(base + offset), which);
     }
 
-    // load texture
-    mesh.textureData = new uint16_t[mesh.textureSize]; // (uint16_t*) malloc(mesh.textureSize);
-    file.read((char*) mesh.textureData, mesh.textureSize);
+    pos_type seekpos(pos_type position, std::ios::openmode which) override {
+        off_type at = position;
+        if(!(which & std::ios::in) || at < 0 || at > egptr() - eback()) return pos_type(off_type(-1));
 
-    return mesh;
-}
+        setg(eback(), eback() + at, egptr());
+        return position;
+    }
+};
+
+// cos and sin of each quarter turn, as map objects are rotated by bits 2-3 of the flag plane
+static const float ocarn2__quarter_cos[4] = { 1, 0, -1, 0 };
+static const float ocarn2__quarter_sin[4] = { 0, 1, 0, -1 };
 
 /**
- * Internal function to load an RSC formatted model from a filestream. Very similar to the 3df method
+ * Internal function to run callback(i) for every i in [0, count), spread over a number of threads.
+ * threads == 0 uses the hardware concurrency
  *
- * @param filename
- * @return
+ * @param count
+ * @param threads
+ * @param callback
  */
-OCARN2_DEF OCARN2::RscModel ocarn2__load_rsc_model(std::fstream &file) {
-    OCARN2::RscModel model {};
+OCARN2_DEF void ocarn2__parallel_for(size_t count, unsigned threads, const std::function<void(size_t)>& callback) {
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    if(threads > count) threads = (unsigned) count;
 
-    // read header
-    file.read((char*) &model.radius, 4);
-    file.read((char*) &model.yLo, 4);
-    file.read((char*) &model.yHi, 4);
-    file.read((char*) &model.lineLength, 4);
-    file.read((char*) &model.lightIntensity, 4);
-    file.read((char*) &model.circleRadius, 4);
-    file.read((char*) &model.circleIntensity, 4);
+    if(threads <= 1) {
+        for(size_t i=0; i < count; i++) callback(i);
+        return;
+    }
 
-    file.read((char*) &model.flags, 4);
+    std::atomic<size_t> next {0};
+    auto worker = [&]() {
+        for(size_t i = next++; i < count; i = next++) callback(i);
+    };
 
-    file.read((char*) &model.grRadius, 4);
-    file.read((char*) &model.defLight, 4);
-    file.read((char*) &model.lastAnimationTime, 4);
-    file.read((char*) &model.boundingRadius, 4);
+    std::vector<std::thread> pool;
+    for(unsigned t=1; t < threads; t++) pool.emplace_back(worker);
+    worker();
 
-    file.read(model.reserved, 16);
+    for(auto& t: pool) t.join();
+}
 
-    // done reading header
-    // read mesh
 
-    OCARN2::Mesh mesh {};
-    file.read( (char*) &mesh.numVertices, 4 );
-    file.read( (char*) &mesh.numFaces,  4 );
-    file.read( (char*) &mesh.numNodes, 4 );
-    file.read( (char*) &mesh.textureSize, 4 );
+// record descriptors. every fixed size record in the files lists its fields in file order, each with its offset
+// in the record and its type on disk. that's checked against the record size at compile time, and tells the
+// readers and writers whether an array of records can go straight to and from the file in one memcpy (the struct
+// already is the file layout, on a little endian host) or has to be converted a field at a time
 
-    // load faces
-    for(auto i=0; i < mesh.numFaces; i++) {
-        mesh.faces.emplace_back(ocarn2__load_3df_face(file) );
-    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define OCARN2__BIG_ENDIAN 1
+#else
+#define OCARN2__BIG_ENDIAN 0
+#endif
 
-    // load vertices
-    for(auto i=0; i < mesh.numVertices; i++) {
-        mesh.vertices.emplace_back(ocarn2__load_3df_vertex(file) );
+template<typename T, typename Member, typename Disk = Member>
+struct ocarn2__field {
+    using member_type = Member;
+    using disk_type = Disk;
+
+    Member T::* member;
+    size_t offset;                 // in the file record
+    size_t hostOffset = SIZE_MAX;  // in T, unknown if T isn't standard layout
+};
+
+// a field stored as it is in the struct, or converted from another type on disk
+#define OCARN2__FIELD(T, member, offset) ocarn2__field<T, decltype(T::member)> { &T::member, offset, offsetof(T, member) }
+#define OCARN2__FIELD_AS(T, member, Disk, offset) ocarn2__field<T, decltype(T::member), Disk> { &T::member, offset, offsetof(T, member) }
+
+template<typename T>
+struct ocarn2__record;
+
+template<>
+struct ocarn2__record<OCARN2::Face> {
+    static constexpr size_t size = 64;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__FIELD(OCARN2::Face, v1, 0), OCARN2__FIELD(OCARN2::Face, v2, 4), OCARN2__FIELD(OCARN2::Face, v3, 8),
+        OCARN2__FIELD(OCARN2::Face, tax, 12), OCARN2__FIELD(OCARN2::Face, tbx, 16), OCARN2__FIELD(OCARN2::Face, tcx, 20),
+        OCARN2__FIELD(OCARN2::Face, tay, 24), OCARN2__FIELD(OCARN2::Face, tby, 28), OCARN2__FIELD(OCARN2::Face, tcy, 32),
+        OCARN2__FIELD(OCARN2::Face, flags, 36), OCARN2__FIELD(OCARN2::Face, DMask, 38),
+        OCARN2__FIELD(OCARN2::Face, distant, 40), OCARN2__FIELD(OCARN2::Face, next, 44), OCARN2__FIELD(OCARN2::Face, group, 48),
+        OCARN2__FIELD(OCARN2::Face, reserved, 52));
+
+    static void finish(OCARN2::Face&) {}
+};
+
+template<>
+struct ocarn2__record<OCARN2::Vertex> {
+    static constexpr size_t size = 16;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__FIELD(OCARN2::Vertex, x, 0), OCARN2__FIELD(OCARN2::Vertex, y, 4), OCARN2__FIELD(OCARN2::Vertex, z, 8),
+        OCARN2__FIELD(OCARN2::Vertex, owner, 12), OCARN2__FIELD(OCARN2::Vertex, hidden, 14));
+
+    static void finish(OCARN2::Vertex&) {}
+};
+
+template<>
+struct ocarn2__record<OCARN2::Node> {
+    static constexpr size_t size = 48;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__FIELD(OCARN2::Node, name, 0),
+        OCARN2__FIELD(OCARN2::Node, x, 32), OCARN2__FIELD(OCARN2::Node, y, 36), OCARN2__FIELD(OCARN2::Node, z, 40),
+        OCARN2__FIELD(OCARN2::Node, owner, 44), OCARN2__FIELD(OCARN2::Node, hidden, 46));
+
+    static void finish(OCARN2::Node&) {}
+};
+
+template<>
+struct ocarn2__record<OCARN2::RandomSound> {
+    static constexpr size_t size = 16;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__FIELD(OCARN2::RandomSound, number, 0), OCARN2__FIELD(OCARN2::RandomSound, volume, 4),
+        OCARN2__FIELD(OCARN2::RandomSound, frequency, 8),
+        OCARN2__FIELD(OCARN2::RandomSound, environment, 12), OCARN2__FIELD(OCARN2::RandomSound, flags, 14));
+
+    static void finish(OCARN2::RandomSound&) {}
+};
+
+// isMortal is 4 bytes on disk, and the colour is worked out after
+template<>
+struct ocarn2__record<OCARN2::Fog> {
+    static constexpr size_t size = 20;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__FIELD(OCARN2::Fog, rgb, 0), OCARN2__FIELD(OCARN2::Fog, y, 4),
+        OCARN2__FIELD_AS(OCARN2::Fog, isMortal, int32_t, 8),
+        OCARN2__FIELD(OCARN2::Fog, transparent, 12), OCARN2__FIELD(OCARN2::Fog, fLimit, 16));
+
+    static void finish(OCARN2::Fog& fog) {
+        fog.color.a = 127; // fog will always be solid
+        fog.color.r = (fog.rgb >> 16) & 255;
+        fog.color.g = (fog.rgb >> 8) & 255;
+        fog.color.b = (fog.rgb) & 255;
     }
-
-    // load nodes
-    for(auto i=0; i < mesh.numNodes; i++) {
-        mesh.nodes.emplace_back(ocarn2__load_3df_node(file) );
+};
+
+template<>
+struct ocarn2__record<OCARN2::Water> {
+    static constexpr size_t size = 16;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__FIELD(OCARN2::Water, tIndex, 0), OCARN2__FIELD(OCARN2::Water, wLevel, 4),
+        OCARN2__FIELD(OCARN2::Water, transparency, 8), OCARN2__FIELD(OCARN2::Water, rgb, 12));
+
+    static void finish(OCARN2::Water& water) {
+        water.color.a = 0;
+        water.color.r = water.rgb >> 16;
+        water.color.g = water.rgb >> 8;
+        water.color.b = water.rgb >> 0;
     }
+};
 
-    // load texture
-    mesh.textureData = new uint16_t[mesh.textureSize];
-    file.read((char*) mesh.textureData, mesh.textureSize);
+// the 64 byte header in front of each rsc model. RscModel holds a Mesh, so it isn't standard layout and
+// offsetof can't be used on it, which also rules out copying the header straight in
+#define OCARN2__MODEL_FIELD(member, offset) ocarn2__field<OCARN2::RscModel, decltype(OCARN2::RscModel::member)> { &OCARN2::RscModel::member, offset }
 
-    model.mesh = mesh;
+template<>
+struct ocarn2__record<OCARN2::RscModel> {
+    static constexpr size_t size = 64;
+    static constexpr auto fields = std::make_tuple(
+        OCARN2__MODEL_FIELD(radius, 0), OCARN2__MODEL_FIELD(yLo, 4), OCARN2__MODEL_FIELD(yHi, 8),
+        OCARN2__MODEL_FIELD(lineLength, 12), OCARN2__MODEL_FIELD(lightIntensity, 16),
+        OCARN2__MODEL_FIELD(circleRadius, 20), OCARN2__MODEL_FIELD(circleIntensity, 24),
+        OCARN2__MODEL_FIELD(flags, 28), OCARN2__MODEL_FIELD(grRadius, 32), OCARN2__MODEL_FIELD(defLight, 36),
+        OCARN2__MODEL_FIELD(lastAnimationTime, 40), OCARN2__MODEL_FIELD(boundingRadius, 44),
+        OCARN2__MODEL_FIELD(reserved, 48));
 
-    // done reading mesh
-    // read texture?
+    static void finish(OCARN2::RscModel&) {}
+};
 
-    model.textureData = new uint16_t[model.textureSize];
-    file.read((char*) model.textureData, model.textureSize);
+#undef OCARN2__MODEL_FIELD
 
-    // end texture
-    // read animations, if any
-    if(model.flags & 0x80000000) {
-        OCARN2::Animation animation {};
-        int32_t vc;
+/**
+ * Internal check that a record's fields follow on from each other with no gaps, and fill it exactly
+ */
+template<typename T, size_t... I>
+static constexpr bool ocarn2__record_packed(std::index_sequence<I...>) {
+    constexpr auto& fields = ocarn2__record<T>::fields;
 
-        file.read((char*) &vc, 4);
-        file.read((char*) &vc, 4);
-        file.read((char*) &animation.kps, 4);
-        file.read((char*) &animation.numFrames, 4);
+    size_t ends[] = { (std::get<I>(fields).offset + sizeof(typename std::tuple_element<I, std::decay_t<decltype(fields)>>::type::disk_type))... };
+    size_t starts[] = { std::get<I>(fields).offset... };
 
-        int32_t size = vc * animation.numFrames * 6;
-        animation.data = new int16_t[size]; // (uint16_t*) malloc( size );
-        file.read((char*) animation.data, size);
-    }
-    return model;
+    if(starts[0] != 0 || ends[sizeof...(I) - 1] != ocarn2__record<T>::size) return false;
+    for(size_t i=1; i < sizeof...(I); i++) if(starts[i] != ends[i - 1]) return false;
+
+    return true;
 }
 
 /**
- * Loads all the data in an .rsc file into a self contained struct
- *
- * @param filename
- * @return
+ * Internal check that an array of T in memory is byte for byte the same as the records in the file
  */
-OCARN2_DEF OCARN2::Rsc load_rsc_file(const std::string& filename) {
-    OCARN2::Rsc rsc;
-
-    ocarn2__openFile(filename, [&](std::fstream& file) {
-        file.read((char*) &rsc.numTextures, 4);
-        file.read((char*) &rsc.numModels, 4);
-
-        file.read((char*) rsc.fadeRgb, 4 * 3 * 3);
-        file.read((char*) rsc.transRgb, 4 * 3 * 3);
+template<typename T, size_t... I>
+static constexpr bool ocarn2__record_direct(std::index_sequence<I...>) {
+    constexpr auto& fields = ocarn2__record<T>::fields;
+    using Fields = std::decay_t<decltype(fields)>;
 
-        // load textures
-        for(auto i=0; i < rsc.numTextures; i++) {
-            rsc.textures.emplace_back( ocarn2__load_rsc_texture(file) );
-        }
+    bool same[] = { (std::get<I>(fields).hostOffset == std::get<I>(fields).offset &&
+                     std::is_same<typename std::tuple_element<I, Fields>::type::member_type,
+                                  typename std::tuple_element<I, Fields>::type::disk_type>::value)... };
 
-        // load models
-        for(auto i=0; i < rsc.numModels; i++) {
-            rsc.models.emplace_back( ocarn2__load_rsc_model(file) );
-        }
+    for(bool s: same) if(!s) return false;
+    return !OCARN2__BIG_ENDIAN && sizeof(T) == ocarn2__record<T>::size && std::is_trivially_copyable<T>::value;
+}
 
-        // load sky textures
-        file.read((char*) rsc.sky[0], 256 * 256 * 2);
-        file.read((char*) rsc.sky[1], 256 * 256 * 2);
-        file.read((char*) rsc.sky[2], 256 * 256 * 2);
+/**
+ * Internal check that a field can be copied as bytes, and swapped if the host needs it: the same type in T as on
+ * disk, at a known offset in a T that can be copied a byte at a time
+ */
+template<typename T, size_t I>
+static constexpr bool ocarn2__field_plain() {
+    using Field = typename std::tuple_element<I, std::decay_t<decltype(ocarn2__record<T>::fields)>>::type;
 
-        // load cloudsMap
-        file.read((char*) rsc.skyMap, 128 * 128);
+    return std::is_trivially_copyable<T>::value && std::get<I>(ocarn2__record<T>::fields).hostOffset != SIZE_MAX &&
+           std::is_same<typename Field::member_type, typename Field::disk_type>::value;
+}
 
-        // load fogs map
-        file.read((char*) &rsc.numFogs, 4);
-        for(auto i=0; i < rsc.numFogs; i++) {
-            OCARN2::Fog fog {};
+// plain fields that follow on from each other both in the file and in T, copied as one block per record. on big
+// endian hosts a run only takes in fields of one width, so it can be swapped a value at a time
+struct ocarn2__run {
+    size_t offset = 0;     // in the file record
+    size_t hostOffset = 0; // in T
+    size_t bytes = 0;
+    size_t width = 0;      // of each value in it
+};
+
+template<typename T, size_t N>
+struct ocarn2__runs {
+    ocarn2__run runs[N] = {};
+    size_t count = 0;
+};
 
-            file.read((char*) &fog.rgb, 4);
+/**
+ * Internal function to group a record's plain fields into runs
+ */
+template<typename T, size_t... I>
+static constexpr ocarn2__runs<T, sizeof...(I)> ocarn2__record_runs(std::index_sequence<I...>) {
+    constexpr auto& fields = ocarn2__record<T>::fields;
+    using Fields = std::decay_t<decltype(fields)>;
+
+    bool plain[] = { ocarn2__field_plain<T, I>()... };
+    size_t offsets[] = { std::get<I>(fields).offset... };
+    size_t hostOffsets[] = { std::get<I>(fields).hostOffset... };
+    size_t bytes[] = { sizeof(typename std::tuple_element<I, Fields>::type::disk_type)... };
+    size_t widths[] = { sizeof(std::remove_all_extents_t<typename std::tuple_element<I, Fields>::type::member_type>)... };
+
+    ocarn2__runs<T, sizeof...(I)> runs;
+    for(size_t i=0; i < sizeof...(I); i++) {
+        if(!plain[i]) continue;
+
+        if(runs.count) {
+            ocarn2__run& last = runs.runs[runs.count - 1];
+            if(last.offset + last.bytes == offsets[i] && last.hostOffset + last.bytes == hostOffsets[i] &&
+               (!OCARN2__BIG_ENDIAN || last.width == widths[i])) {
+                last.bytes += bytes[i];
+                continue;
+            }
+        }
 
-            fog.color.a = 127; // fog will always be solid
-            fog.color.r = (fog.rgb >> 16) & 255;
-            fog.color.g = (fog.rgb >> 8) & 255;
-            fog.color.b = (fog.rgb) & 255;
+        runs.runs[runs.count++] = { offsets[i], hostOffsets[i], bytes[i], widths[i] };
+    }
 
+    return runs;
+}
 
-            file.read((char*) &fog.y, 4);
-            file.read((char*) &fog.isMortal, 4);
-            file.read((char*) &fog.transparent, 4);
-            file.read((char*) &fog.fLimit, 4);
+template<typename T>
+struct ocarn2__records {
+    static constexpr auto indices = std::make_index_sequence<std::tuple_size<std::decay_t<decltype(ocarn2__record<T>::fields)>>::value>();
+    static constexpr size_t size = ocarn2__record<T>::size;
+    static constexpr bool direct = ocarn2__record_direct<T>(indices);
+    static constexpr auto runs = ocarn2__record_runs<T>(indices);
 
-            rsc.fogs.emplace_back(fog);
-        }
+    static_assert(ocarn2__record_packed<T>(indices), "record fields have to fill the record with no gaps");
+};
 
-        // load random sounds
-        file.read((char*) &rsc.numSoundEffects, 4);
-        for(auto i=0; i < rsc.numSoundEffects; i++) {
-            OCARN2::SoundEffect sound {};
+static_assert(ocarn2__records<OCARN2::Face>::direct || OCARN2__BIG_ENDIAN, "Face must match the file layout");
+static_assert(ocarn2__records<OCARN2::Vertex>::direct || OCARN2__BIG_ENDIAN, "Vertex must match the file layout");
+static_assert(ocarn2__records<OCARN2::Node>::direct || OCARN2__BIG_ENDIAN, "Node must match the file layout");
 
-            file.read((char*) &sound.length, 4);
-            sound.data = new uint16_t[sound.length];
-            file.read((char*) sound.data, sound.length);
+/**
+ * Internal function to swap a little endian value to the host's order and back. Nothing on little endian hosts
+ */
+template<typename V>
+static inline V ocarn2__little_endian(V value) {
+#if OCARN2__BIG_ENDIAN
+    unsigned char bytes[sizeof(V)];
+    memcpy(bytes, &value, sizeof(V));
+    std::reverse(bytes, bytes + sizeof(V));
+    memcpy(&value, bytes, sizeof(V));
+#endif
+    return value;
+}
+
+/**
+ * Internal function to swap every value in a run of count records from little endian to the host's order and
+ * back. Nothing on little endian hosts, where the run was only a copy
+ */
+template<size_t Width>
+static void ocarn2__swap_run(unsigned char* data, size_t stride, size_t bytes, size_t count) {
+#if OCARN2__BIG_ENDIAN
+    for(size_t r=0; r < count; r++) {
+        for(size_t v=0; v < bytes; v += Width) std::reverse(data + r * stride + v, data + r * stride + v + Width);
+    }
+#else
+    (void) data; (void) stride; (void) bytes; (void) count;
+#endif
+}
+
+/**
+ * Internal function to copy one run of count records from the file's layout. The size is known at compile time,
+ * so each record's copy is a few moves rather than a memcpy call
+ */
+template<typename T, size_t R>
+static void ocarn2__decode_run(const unsigned char* source, T* records, size_t count) {
+    constexpr ocarn2__run run = ocarn2__records<T>::runs.runs[R];
+    unsigned char* out = (unsigned char*) records;
+
+    for(size_t r=0; r < count; r++) memcpy(out + r * sizeof(T) + run.hostOffset, source + r * ocarn2__records<T>::size + run.offset, run.bytes);
+    ocarn2__swap_run<run.width>(out + run.hostOffset, sizeof(T), run.bytes, count);
+}
+
+template<typename T, size_t R>
+static void ocarn2__encode_run(const T* records, unsigned char* destination, size_t count) {
+    constexpr ocarn2__run run = ocarn2__records<T>::runs.runs[R];
+    const unsigned char* in = (const unsigned char*) records;
+
+    for(size_t r=0; r < count; r++) memcpy(destination + r * ocarn2__records<T>::size + run.offset, in + r * sizeof(T) + run.hostOffset, run.bytes);
+    ocarn2__swap_run<run.width>(destination + run.offset, ocarn2__records<T>::size, run.bytes, count);
+}
+
+/**
+ * Internal function to convert one field of count records from the file's layout, for the fields that aren't in a
+ * run: converted from another type on disk, or in a T whose layout isn't known
+ */
+template<typename T, typename Field>
+static void ocarn2__decode_field(const Field& field, const unsigned char* source, T* records, size_t count) {
+    using Member = typename Field::member_type;
+    using Disk = typename Field::disk_type;
+    const size_t size = ocarn2__record<T>::size;
+
+    if constexpr(std::is_array<Member>::value) {
+        using Element = std::remove_extent_t<Member>;
+        for(size_t r=0; r < count; r++) {
+            Element* out = records[r].*field.member;
+            memcpy(out, source + r * size + field.offset, sizeof(Member));
+            for(size_t e=0; e < std::extent<Member>::value; e++) out[e] = ocarn2__little_endian(out[e]);
+        }
+    } else {
+        for(size_t r=0; r < count; r++) {
+            Disk value;
+            memcpy(&value, source + r * size + field.offset, sizeof(Disk));
+            records[r].*field.member = (Member) ocarn2__little_endian(value);
+        }
+    }
+}
+
+template<typename T, typename Field>
+static void ocarn2__encode_field(const Field& field, const T* records, unsigned char* destination, size_t count) {
+    using Member = typename Field::member_type;
+    using Disk = typename Field::disk_type;
+    const size_t size = ocarn2__record<T>::size;
+
+    if constexpr(std::is_array<Member>::value) {
+        using Element = std::remove_extent_t<Member>;
+        for(size_t r=0; r < count; r++) {
+            Element values[std::extent<Member>::value];
+            for(size_t e=0; e < std::extent<Member>::value; e++) values[e] = ocarn2__little_endian((records[r].*field.member)[e]);
+            memcpy(destination + r * size + field.offset, values, sizeof(Member));
+        }
+    } else {
+        for(size_t r=0; r < count; r++) {
+            Disk value = ocarn2__little_endian((Disk) (records[r].*field.member));
+            memcpy(destination + r * size + field.offset, &value, sizeof(Disk));
+        }
+    }
+}
+
+// records converted at a time, few enough that a block of them in both layouts stays in L1
+static const size_t ocarn2__record_block = 256;
+
+template<typename T, size_t... R, size_t... I>
+static void ocarn2__decode_parts(const unsigned char* source, T* records, size_t count, std::index_sequence<R...>, std::index_sequence<I...>) {
+    (ocarn2__decode_run<T, R>(source, records, count), ...);
+
+    constexpr auto& fields = ocarn2__record<T>::fields;
+    ([&]() { if constexpr(!ocarn2__field_plain<T, I>()) ocarn2__decode_field(std::get<I>(fields), source, records, count); }(), ...);
+}
+
+template<typename T, size_t... R, size_t... I>
+static void ocarn2__encode_parts(const T* records, unsigned char* destination, size_t count, std::index_sequence<R...>, std::index_sequence<I...>) {
+    (ocarn2__encode_run<T, R>(records, destination, count), ...);
+
+    constexpr auto& fields = ocarn2__record<T>::fields;
+    ([&]() { if constexpr(!ocarn2__field_plain<T, I>()) ocarn2__encode_field(std::get<I>(fields), records, destination, count); }(), ...);
+}
+
+/**
+ * Internal function to read count records laid out as in the file into records. Runs of plain fields go a block
+ * per record and only converted fields go one at a time. x86 hosts are little endian, so a run is a strided copy
+ * with nothing to shuffle, and it goes at memory speed without SSE or AVX2 (see "decode_records" in bench.cpp)
+ */
+template<typename T>
+static void ocarn2__decode_records(const unsigned char* source, T* records, size_t count) {
+    if constexpr(ocarn2__records<T>::direct) {
+        memcpy(records, source, count * sizeof(T));
+    } else {
+        // a block at a time, so every pass after the first over it is in cache
+        for(size_t begin=0; begin < count; begin += ocarn2__record_block) {
+            size_t n = std::min(count - begin, ocarn2__record_block);
+            ocarn2__decode_parts(source + begin * ocarn2__records<T>::size, records + begin, n,
+                                 std::make_index_sequence<ocarn2__records<T>::runs.count>(), ocarn2__records<T>::indices);
+            for(size_t r=begin; r < begin + n; r++) ocarn2__record<T>::finish(records[r]);
+        }
+    }
+}
+
+/**
+ * Internal function to lay count records out as they are in the file
+ */
+template<typename T>
+static void ocarn2__encode_records(const T* records, unsigned char* destination, size_t count) {
+    if constexpr(ocarn2__records<T>::direct) {
+        memcpy(destination, records, count * sizeof(T));
+    } else {
+        for(size_t begin=0; begin < count; begin += ocarn2__record_block) {
+            ocarn2__encode_parts(records + begin, destination + begin * ocarn2__records<T>::size, std::min(count - begin, ocarn2__record_block),
+                                 std::make_index_sequence<ocarn2__records<T>::runs.count>(), ocarn2__records<T>::indices);
+        }
+    }
+}
+
+
+/**
+ * Internal reader that knows how much of the stream is left, so counts read out of a header can be checked
+ * before anything gets allocated for them. Only the first problem is kept, every read after it fails
+ */
+struct ocarn2__bounded {
+    std::istream& in;
+    OCARN2::LoadError* error;
+
+    uint64_t offset = 0;
+    uint64_t size = UINT64_MAX; // stays unknown if the stream can't seek
+    bool ok = true;
+
+    ocarn2__bounded(std::istream& in, OCARN2::LoadError* error) : in(in), error(error) {
+        std::streampos start = in.tellg();
+        if(start == std::streampos(-1)) { in.clear(); return; }
+
+        in.seekg(0, std::ios::end);
+        std::streampos end = in.tellg();
+        if(end != std::streampos(-1) && end >= start) size = (uint64_t) (end - start);
+
+        in.clear();
+        in.seekg(start);
+    }
+
+    uint64_t remaining() const {
+        return size - offset;
+    }
+
+    bool fail(const std::string& message) {
+        if(ok && error) {
+            error->offset = offset;
+            error->message = message;
+        }
+
+        ok = false;
+        return false;
+    }
+
+    bool read(void* destination, uint64_t bytes, const char* what) {
+        if(!ok) return false;
+
+        if(bytes > remaining()) {
+            return fail(std::string(what) + " needs " + std::to_string(bytes) + " bytes, only " + std::to_string(remaining()) + " left");
+        }
+
+        in.read((char*) destination, (std::streamsize) bytes);
+        if((uint64_t) in.gcount() != bytes) {
+            offset += in.gcount();
+            return fail(std::string("file ended early reading ") + what);
+        }
+
+        offset += bytes;
+        return true;
+    }
+
+    template<typename T>
+    bool value(T& value, const char* what) {
+        return read(&value, sizeof(T), what);
+    }
+
+    // count items, each at least itemSize bytes, have to fit in what's left of the file
+    bool fits(uint64_t count, uint64_t itemSize, const char* what) {
+        if(!ok) return false;
+
+        if(itemSize && count > remaining() / itemSize) {
+            return fail(std::string(what) + " count " + std::to_string(count) + " runs past the end of the file");
+        }
+
+        return true;
+    }
+
+    // records that match the file layout are read straight in, anything else goes through a small buffer
+    template<typename T>
+    bool records(T* items, uint64_t count, const char* what) {
+        const uint64_t size = ocarn2__records<T>::size;
+        if(!fits(count, size, what)) return false;
+
+        if constexpr(ocarn2__records<T>::direct) {
+            return read(items, count * size, what);
+        } else {
+            unsigned char chunk[4096];
+            const uint64_t perChunk = sizeof(chunk) / size;
+
+            for(uint64_t done=0; done < count; done += perChunk) {
+                uint64_t n = std::min(perChunk, count - done);
+                if(!read(chunk, n * size, what)) return false;
+
+                ocarn2__decode_records(chunk, items + done, (size_t) n);
+            }
+
+            return true;
+        }
+    }
+
+    template<typename T>
+    bool records(std::vector<T>& items, uint64_t count, const char* what) {
+        if(!fits(count, ocarn2__records<T>::size, what)) return false;
+
+        items.resize(count);
+        return records(items.data(), count, what);
+    }
+
+    template<typename T>
+    bool record(T& item, const char* what) {
+        return records(&item, 1, what);
+    }
+
+    // the pointer is set before the read, so whatever owns it can free it on failure.
+    // sized in bytes, rounded up to whole T
+    template<typename T>
+    bool buffer(T*& data, uint64_t bytes, const char* what) {
+        if(!fits(bytes, 1, what)) return false;
+
+        data = new T[(bytes + sizeof(T) - 1) / sizeof(T)];
+        return read(data, bytes, what);
+    }
+};
+
+/**
+ * Internal function to read a .3df file's contents from a stream
+ *
+ * @param file
+ * @param mesh
+ * @param error
+ * @return false if the file is truncated or a count in it doesn't fit. the mesh is left empty
+ */
+OCARN2_DEF bool ocarn2__load_3df(std::istream& file, OCARN2::Mesh& mesh, OCARN2::LoadError* error = nullptr) {
+    ocarn2__bounded reader(file, error);
+
+    reader.value(mesh.numVertices, "vertex count");
+    reader.value(mesh.numFaces, "face count");
+    reader.value(mesh.numNodes, "node count");
+    reader.value(mesh.textureSize, "texture size");
+
+    // load faces
+    OCARN2__STATS_SECTION("faces");
+    reader.records(mesh.faces, mesh.numFaces, "faces");
+
+    // load vertices
+    OCARN2__STATS_SECTION("vertices");
+    reader.records(mesh.vertices, mesh.numVertices, "vertices");
+
+    // load nodes
+    OCARN2__STATS_SECTION("nodes");
+    reader.records(mesh.nodes, mesh.numNodes, "nodes");
+
+    // load texture
+    OCARN2__STATS_SECTION("texture");
+    reader.buffer(mesh.textureData, mesh.textureSize, "texture");
+
+    if(!reader.ok) {
+        free_mesh(mesh);
+        mesh = OCARN2::Mesh {};
+    }
+
+    return reader.ok;
+}
+
+/**
+ * Internal function for the public loaders to report a failed load
+ *
+ * @param filename
+ * @param failure
+ * @param error
+ */
+OCARN2_DEF void ocarn2__report_load_error(const std::string& filename, const OCARN2::LoadError& failure, OCARN2::LoadError* error) {
+    std::cerr << filename << ": " << failure.message << " at offset " << failure.offset << std::endl;
+
+    if(error) *error = failure;
+}
+
+/**
+ * Loads data from the given .3DF file
+ *
+ * @param filename
+ * @param error if given, filled in with the reason and file offset the load failed at
+ * @return an empty mesh if the file is missing or corrupt
+ */
+OCARN2_DEF OCARN2::Mesh load_3df_file(const std::string& filename, OCARN2::LoadError* error) {
+    OCARN2::Mesh mesh {};
+    OCARN2__STATS_LOAD("load_3df_file", filename);
+
+    /**
+     * helper function do logging if filename is bad, and provide automatic closing of file when finished
+     */
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        OCARN2::LoadError failure;
+        if(!ocarn2__load_3df(file, mesh, &failure)) ocarn2__report_load_error(filename, failure, error);
+    });
+
+    return mesh;
+}
+
+/**
+ * Same as load_3df_file, for a file that's already in memory. Nothing is logged, check error instead
+ *
+ * @param data
+ * @param size
+ * @param error
+ * @return
+ */
+OCARN2_DEF OCARN2::Mesh load_3df_memory(const void* data, size_t size, OCARN2::LoadError* error) {
+    OCARN2::Mesh mesh {};
+
+    ocarn2__membuf buffer(data, size);
+    std::istream in(&buffer);
+    ocarn2__load_3df(in, mesh, error);
+
+    return mesh;
+}
+
+
+/**
+ * Internal function to read a .car file's contents from a stream
+ *
+ * @param file
+ * @param mesh
+ * @param error
+ * @return false if the file is truncated or a count in it doesn't fit. the mesh is left empty
+ */
+OCARN2_DEF bool ocarn2__load_car(std::istream& file, OCARN2::Mesh& mesh, OCARN2::LoadError* error = nullptr) {
+    ocarn2__bounded reader(file, error);
+
+    reader.read(mesh.name, 24, "name");
+    reader.read(mesh.msc, 8, "msc");
+
+    reader.value(mesh.numAnimations, "animation count");
+    reader.value(mesh.numSoundEffects, "sound effect count");
+    reader.value(mesh.numVertices, "vertex count");
+    reader.value(mesh.numFaces, "face count");
+    reader.value(mesh.textureSize, "texture size");
+
+    // load faces
+    OCARN2__STATS_SECTION("faces");
+    reader.records(mesh.faces, mesh.numFaces, "faces");
+
+    // load vertices
+    OCARN2__STATS_SECTION("vertices");
+    reader.records(mesh.vertices, mesh.numVertices, "vertices");
+
+    // load texture
+    OCARN2__STATS_SECTION("texture");
+    reader.buffer(mesh.textureData, mesh.textureSize, "texture");
+
+    // read animations. each one is at least its 40 byte header
+    OCARN2__STATS_SECTION("animations");
+    if(reader.fits(mesh.numAnimations, 40, "animations")) {
+        for(uint32_t i=0; i < mesh.numAnimations && reader.ok; i++) {
+            mesh.animations.emplace_back();
+            OCARN2::Animation& animation = mesh.animations.back();
+
+            reader.read(animation.name, 32, "animation name");
+            reader.value(animation.kps, "animation kps");
+            reader.value(animation.numFrames, "animation frame count");
+
+            uint64_t size = (uint64_t) mesh.numVertices * animation.numFrames * 6;
+            reader.buffer(animation.data, size, "animation frames");
+        }
+    }
+
+    // read sounds
+    OCARN2__STATS_SECTION("sounds");
+    if(reader.fits(mesh.numSoundEffects, 36, "sound effects")) {
+        for(uint32_t i=0; i < mesh.numSoundEffects && reader.ok; i++) {
+            mesh.soundEffects.emplace_back();
+            OCARN2::SoundEffect& effect = mesh.soundEffects.back();
+
+            reader.read(effect.name, 32, "sound effect name");
+            reader.value(effect.length, "sound effect length");
+            reader.buffer(effect.data, effect.length, "sound effect");
+        }
+    }
+
+    // read sound map
+    reader.read(&mesh.soundMap[0], 64 * 4, "sound map");
+
+    if(!reader.ok) {
+        free_mesh(mesh);
+        mesh = OCARN2::Mesh {};
+    }
+
+    return reader.ok;
+}
+
+/**
+ * Loads the Mesh found in the car file
+ *
+ * @param filename
+ * @param error if given, filled in with the reason and file offset the load failed at
+ * @return an empty mesh if the file is missing or corrupt
+ */
+OCARN2_DEF OCARN2::Mesh load_car_file(const std::string& filename, OCARN2::LoadError* error) {
+    OCARN2::Mesh mesh {};
+    OCARN2__STATS_LOAD("load_car_file", filename);
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        OCARN2::LoadError failure;
+        if(!ocarn2__load_car(file, mesh, &failure)) ocarn2__report_load_error(filename, failure, error);
+    });
+
+    return mesh;
+}
+
+/**
+ * Same as load_car_file, for a file that's already in memory. Nothing is logged, check error instead
+ *
+ * @param data
+ * @param size
+ * @param error
+ * @return
+ */
+OCARN2_DEF OCARN2::Mesh load_car_memory(const void* data, size_t size, OCARN2::LoadError* error) {
+    OCARN2::Mesh mesh {};
+
+    ocarn2__membuf buffer(data, size);
+    std::istream in(&buffer);
+    ocarn2__load_car(in, mesh, error);
+
+    return mesh;
+}
+
+
+// map and rsc definitions
+/**
+ * Internal function to load an RSC formatted model from a filestream. Very similar to the 3df method
+ *
+ * @param reader
+ * @param model
+ */
+OCARN2_DEF void ocarn2__load_rsc_model(ocarn2__bounded& reader, OCARN2::RscModel& model) {
+    // read header
+    reader.record(model, "model header");
+
+    // done reading header
+    // read mesh
+
+    OCARN2::Mesh& mesh = model.mesh;
+    reader.value(mesh.numVertices, "model vertex count");
+    reader.value(mesh.numFaces, "model face count");
+    reader.value(mesh.numNodes, "model node count");
+    reader.value(mesh.textureSize, "model texture size");
+
+    reader.records(mesh.faces, mesh.numFaces, "model faces");
+    reader.records(mesh.vertices, mesh.numVertices, "model vertices");
+    reader.records(mesh.nodes, mesh.numNodes, "model nodes");
+    reader.buffer(mesh.textureData, mesh.textureSize, "model texture");
+
+    // done reading mesh
+    // read texture?
+
+    reader.buffer(model.textureData, (uint32_t) model.textureSize, "model texture");
+
+    // end texture
+    // read animations, if any
+    if(model.flags & 0x80000000) {
+        OCARN2::Animation& animation = model.animation;
+
+        reader.read(model.animationHeader, 8, "model animation header");
+        reader.value(animation.kps, "model animation kps");
+        reader.value(animation.numFrames, "model animation frame count");
+
+        if(model.animationHeader[1] < 0) {
+            reader.fail("negative model animation vertex count");
+            return;
+        }
+
+        uint64_t size = (uint64_t) model.animationHeader[1] * animation.numFrames * 6;
+        reader.buffer(animation.data, size, "model animation frames");
+    }
+}
+
+/**
+ * Internal function to read the contents of an .rsc file from the stream's current position.
+ * Split out of load_rsc_file so rsc data that is already in memory can be parsed too
+ *
+ * @param file
+ * @param rsc
+ * @param error
+ * @return false if the file is truncated or a count in it doesn't fit. everything loaded is freed
+ */
+OCARN2_DEF bool ocarn2__load_rsc(std::istream& file, OCARN2::Rsc& rsc, OCARN2::LoadError* error = nullptr) {
+    ocarn2__bounded reader(file, error);
+
+    reader.value(rsc.numTextures, "texture count");
+    reader.value(rsc.numModels, "model count");
+
+    reader.read(rsc.fadeRgb, 4 * 3 * 3, "fade colors");
+    reader.read(rsc.transRgb, 4 * 3 * 3, "transparent colors");
+
+    // load textures
+    OCARN2__STATS_SECTION("textures");
+    if(reader.fits(rsc.numTextures, 128 * 128 * 2, "textures")) {
+        for(uint32_t i=0; i < rsc.numTextures && reader.ok; i++) {
+            OCARN2::Texture texture {};
+            texture.size = 128 * 128 * 2;
+
+            reader.buffer(texture.data, texture.size, "texture");
+            rsc.textures.emplace_back(texture);
+        }
+    }
+
+    // load models. each one is at least its header and mesh counts
+    OCARN2__STATS_SECTION("models");
+    if(reader.fits(rsc.numModels, 64 + 16, "models")) {
+        for(uint32_t i=0; i < rsc.numModels && reader.ok; i++) {
+            rsc.models.emplace_back();
+            ocarn2__load_rsc_model(reader, rsc.models.back());
+        }
+    }
+
+    // load sky textures
+    OCARN2__STATS_SECTION("sky");
+    reader.read(rsc.sky[0], 256 * 256 * 2, "sky");
+    reader.read(rsc.sky[1], 256 * 256 * 2, "sky");
+    reader.read(rsc.sky[2], 256 * 256 * 2, "sky");
+
+    // load cloudsMap
+    reader.read(rsc.skyMap, 128 * 128, "sky map");
+
+    // load fogs map
+    OCARN2__STATS_SECTION("fogs");
+    reader.value(rsc.numFogs, "fog count");
+    reader.records(rsc.fogs, rsc.numFogs, "fogs");
+
+    // load random sounds
+    OCARN2__STATS_SECTION("sounds");
+    reader.value(rsc.numSoundEffects, "sound effect count");
+    if(reader.fits(rsc.numSoundEffects, 4, "sound effects")) {
+        for(uint32_t i=0; i < rsc.numSoundEffects && reader.ok; i++) {
+            OCARN2::SoundEffect sound {};
+
+            reader.value(sound.length, "sound effect length");
+            reader.buffer(sound.data, sound.length, "sound effect");
+
+            rsc.soundEffects.emplace_back(sound);
+        }
+    }
+
+    // load ambient sounds
+    OCARN2__STATS_SECTION("ambient");
+    reader.value(rsc.numAmbientSounds, "ambient sound count");
+    if(reader.fits(rsc.numAmbientSounds, 4 + sizeof(OCARN2::AmbientSound::randomSounds) + 8, "ambient sounds")) {
+        for(uint32_t i=0; i < rsc.numAmbientSounds && reader.ok; i++) {
+            OCARN2::AmbientSound ambient {};
+
+            reader.value(ambient.sound.length, "ambient sound length");
+            reader.buffer(ambient.sound.data, ambient.sound.length, "ambient sound");
+
+            reader.records(ambient.randomSounds, 16, "ambient sound");
+            reader.value(ambient.numSoundEffects, "ambient sound");
+            reader.value(ambient.volume, "ambient sound");
+
+            rsc.ambientSounds.emplace_back(ambient);
+        }
+    }
+
+    // load water table
+    OCARN2__STATS_SECTION("waters");
+    reader.value(rsc.numWaters, "water count");
+    reader.records(rsc.waters, rsc.numWaters, "waters");
+
+    if(!reader.ok) {
+        free_rsc(rsc);
+
+        rsc.textures.clear();
+        rsc.models.clear();
+        rsc.fogs.clear();
+        rsc.soundEffects.clear();
+        rsc.ambientSounds.clear();
+        rsc.waters.clear();
+
+        rsc.numTextures = rsc.numModels = rsc.numFogs = rsc.numSoundEffects = rsc.numAmbientSounds = rsc.numWaters = 0;
+    }
+
+    return reader.ok;
+}
+
+/**
+ * Loads all the data in an .rsc file into a self contained struct
+ *
+ * @param filename
+ * @param error if given, filled in with the reason and file offset the load failed at
+ * @return everything but the fixed size sky is empty if the file is missing or corrupt
+ */
+OCARN2_DEF OCARN2::Rsc load_rsc_file(const std::string& filename, OCARN2::LoadError* error) {
+    OCARN2::Rsc rsc {};
+    OCARN2__STATS_LOAD("load_rsc_file", filename);
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        OCARN2::LoadError failure;
+        if(!ocarn2__load_rsc(file, rsc, &failure)) ocarn2__report_load_error(filename, failure, error);
+    });
+
+    return rsc;
+}
+
+/**
+ * Same as load_rsc_file, for a file that's already in memory. Nothing is logged, check error instead
+ *
+ * @param data
+ * @param size
+ * @param error
+ * @return
+ */
+OCARN2_DEF OCARN2::Rsc load_rsc_memory(const void* data, size_t size, OCARN2::LoadError* error) {
+    OCARN2::Rsc rsc {};
+
+    ocarn2__membuf buffer(data, size);
+    std::istream in(&buffer);
+    ocarn2__load_rsc(in, rsc, error);
+
+    return rsc;
+}
+
+
+/**
+ * Internal function to read the twelve planes of a .map file from a stream
+ *
+ * @param file
+ * @param map
+ * @param error
+ * @return false if the file is too short
+ */
+OCARN2_DEF bool ocarn2__load_map(std::istream& file, OCARN2::Map& map, OCARN2::LoadError* error = nullptr) {
+    ocarn2__bounded reader(file, error);
+
+    // planes are stored back to back, in MapPlane order, so a short file can be turned down before reading any
+    OCARN2::MapPlaneInfo last = map_plane_info(OCARN2::MAP_AMBIENT);
+    reader.fits(last.fileOffset + last.width * last.width * last.cellSize, 1, "map");
+
+    for(int plane=0; plane < OCARN2::MAP_NUM_PLANES; plane++) {
+        OCARN2::MapPlaneInfo info = map_plane_info((OCARN2::MapPlane) plane);
+
+        OCARN2__STATS_SECTION(info.name);
+        reader.read(map_plane_data(map, (OCARN2::MapPlane) plane), (uint64_t) info.width * info.width * info.cellSize, info.name);
+    }
+
+    return reader.ok;
+}
+
+/**
+ * Reads a map file into a self contained struct
+ *
+ * All fields, except fog and ambient maps, are 1024 * 1024, single dimensional vectors
+ * fog and ambient maps are 512 * 512
+ *
+ * @param filename
+ * @param error if given, filled in with the reason the load failed
+ * @return
+ */
+OCARN2_DEF OCARN2::Map load_map_file(const std::string& filename, OCARN2::LoadError* error) {
+    OCARN2::Map map {};
+    OCARN2__STATS_LOAD("load_map_file", filename);
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        OCARN2::LoadError failure;
+        if(!ocarn2__load_map(file, map, &failure)) ocarn2__report_load_error(filename, failure, error);
+    });
+
+    return map;
+}
+
+/**
+ * Same as load_map_file, for a file that's already in memory. Nothing is logged, check error instead
+ *
+ * @param data
+ * @param size
+ * @param error
+ * @return
+ */
+OCARN2_DEF OCARN2::Map load_map_memory(const void* data, size_t size, OCARN2::LoadError* error) {
+    OCARN2::Map map {};
+
+    ocarn2__membuf buffer(data, size);
+    std::istream in(&buffer);
+    ocarn2__load_map(in, map, error);
+
+    return map;
+}
+
+
+/**
+ * Describes where a plane lives in a .map file and how big its cells are
+ *
+ * @param plane
+ * @return
+ */
+OCARN2_DEF OCARN2::MapPlaneInfo map_plane_info(OCARN2::MapPlane plane) {
+    static const OCARN2::MapPlaneInfo planes[OCARN2::MAP_NUM_PLANES] = {
+        { "height",       1024, 1, 0 },
+        { "texture",      1024, 2, 1024 * 1024 },
+        { "textureFar",   1024, 2, 1024 * 1024 * 3 },
+        { "object",       1024, 1, 1024 * 1024 * 5 },
+        { "bitflag",      1024, 2, 1024 * 1024 * 6 },
+        { "lightDawn",    1024, 1, 1024 * 1024 * 8 },
+        { "lightNoon",    1024, 1, 1024 * 1024 * 9 },
+        { "lightNight",   1024, 1, 1024 * 1024 * 10 },
+        { "water",        1024, 1, 1024 * 1024 * 11 },
+        { "objectHeight", 1024, 1, 1024 * 1024 * 12 },
+        { "fog",          512,  1, 1024 * 1024 * 13 },
+        { "ambient",      512,  1, 1024 * 1024 * 13 + 512 * 512 },
+    };
+
+    return planes[plane];
+}
+
+/**
+ * Returns a pointer to the raw bytes of the given plane
+ *
+ * @param map
+ * @param plane
+ * @return
+ */
+OCARN2_DEF unsigned char* map_plane_data(OCARN2::Map& map, OCARN2::MapPlane plane) {
+    switch(plane) {
+        case OCARN2::MAP_HEIGHT:        return map.heightMap.data();
+        case OCARN2::MAP_TEXTURE:       return (unsigned char*) map.textureMap.data();
+        case OCARN2::MAP_TEXTURE_FAR:   return (unsigned char*) map.textureMapFar.data();
+        case OCARN2::MAP_OBJECT:        return map.objectMap.data();
+        case OCARN2::MAP_BITFLAG:       return (unsigned char*) map.bitflagMap.data();
+        case OCARN2::MAP_LIGHT_DAWN:    return map.lightingMap[0].data();
+        case OCARN2::MAP_LIGHT_NOON:    return map.lightingMap[1].data();
+        case OCARN2::MAP_LIGHT_NIGHT:   return map.lightingMap[2].data();
+        case OCARN2::MAP_WATER:         return map.waterMap.data();
+        case OCARN2::MAP_OBJECT_HEIGHT: return map.objectHeightMap.data();
+        case OCARN2::MAP_FOG:           return map.fogMap.data();
+        case OCARN2::MAP_AMBIENT:       return map.ambientMap.data();
+        default:                        return nullptr;
+    }
+}
 
-            rsc.soundEffects.emplace_back(sound);
+OCARN2_DEF const unsigned char* map_plane_data(const OCARN2::Map& map, OCARN2::MapPlane plane) {
+    return map_plane_data(const_cast<OCARN2::Map&>(map), plane);
+}
+
+
+
+// saving
+
+/**
+ * Internal struct that gathers everything a file is made of, so it can go to disk in as few writes as possible.
+ * Big arrays are referenced where they are and never copied, small header values are copied into scratch.
+ * Anything referenced has to stay alive until ocarn2__write_file is done
+ */
+struct ocarn2__writer {
+    struct Segment {
+        const void* data; // nullptr means the bytes are in scratch, starting at offset
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<Segment> segments;
+    std::vector<char> scratch;
+
+    // reference size bytes at data. a missing buffer is written as zeros so the file layout still holds
+    void bytes(const void* data, size_t size) {
+        if(size == 0) return;
+
+        if(!data) {
+            copy(nullptr, size);
+            return;
         }
 
-        // load ambient sounds
-        file.read((char*) &rsc.numAmbientSounds, 4);
-        for(auto i=0; i < rsc.numAmbientSounds; i++) {
-            OCARN2::AmbientSound ambient {};
+        segments.push_back({ data, 0, size });
+    }
 
-            file.read((char*) &ambient.sound.length, 4);
+    void copy(const void* data, size_t size) {
+        size_t offset = scratch.size();
+        scratch.resize(offset + size);
 
-            ambient.sound.data = new uint16_t[ambient.sound.length];
-            file.read((char*) ambient.sound.data, ambient.sound.length);
+        if(data) memcpy(&scratch[offset], data, size);
 
-            file.read((char*) ambient.randomSounds, sizeof(ambient.randomSounds));
-            file.read((char*) &ambient.numSoundEffects, 4);
-            file.read((char*) &ambient.volume, 4);
+        // neighbouring scratch copies become a single write
+        if(!segments.empty() && !segments.back().data && segments.back().offset + segments.back().size == offset)
+            segments.back().size += size;
+        else
+            segments.push_back({ nullptr, offset, size });
+    }
 
-            rsc.ambientSounds.emplace_back(ambient);
+    template<typename T>
+    void value(const T& v) {
+        copy(&v, sizeof(T));
+    }
+
+    // records that already match the file layout are referenced, anything else is converted into scratch
+    template<typename T>
+    void records(const T* items, size_t count) {
+        const size_t size = ocarn2__records<T>::size;
+
+        if constexpr(ocarn2__records<T>::direct) {
+            bytes(items, count * size);
+        } else {
+            if(count == 0) return;
+
+            size_t offset = scratch.size();
+            copy(nullptr, count * size);
+            ocarn2__encode_records(items, (unsigned char*) &scratch[offset], count);
         }
+    }
+
+    template<typename T>
+    void record(const T& item) {
+        records(&item, 1);
+    }
+};
+
+/**
+ * Internal function to write everything gathered by the writer to filename. Uses writev where it's
+ * available so the whole file goes out in a handful of syscalls
+ *
+ * @param filename
+ * @param writer
+ * @return
+ */
+OCARN2_DEF bool ocarn2__write_file(const std::string& filename, const ocarn2__writer& writer) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
 
-        // load water table
-        file.read((char*) &rsc.numWaters, 4);
-        for(auto i=0; i < rsc.numWaters; i++) {
-            OCARN2::Water water {};
+    std::vector<iovec> iov;
+    for(auto& segment: writer.segments) {
+        const char* data = segment.data ? (const char*) segment.data : writer.scratch.data() + segment.offset;
+        iov.push_back({ (void*) data, segment.size });
+    }
 
-            file.read((char*) &water.tIndex, 4);
-            file.read((char*) &water.wLevel, 4);
-            file.read((char*) &water.transparency, 4);
-            file.read((char*) &water.rgb, 4);
+    size_t first = 0;
+    bool ok = true;
 
-            water.color.a = 0;
-            water.color.r = water.rgb >> 16;
-            water.color.g = water.rgb >> 8;
-            water.color.b = water.rgb >> 0;
+    while(first < iov.size()) {
+        int count = (int) std::min<size_t>(iov.size() - first, IOV_MAX);
+        ssize_t written = ::writev(fd, &iov[first], count);
 
-            rsc.waters.emplace_back(water);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            ok = false;
+            break;
         }
-    });
 
-    return rsc;
+        // skip past whatever made it out, a partial write leaves us part way into a segment
+        while(first < iov.size() && (size_t) written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+
+        if(first < iov.size()) {
+            iov[first].iov_base = (char*) iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+
+    if(::close(fd) != 0) ok = false;
+#else
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+
+    for(auto& segment: writer.segments) {
+        const char* data = segment.data ? (const char*) segment.data : writer.scratch.data() + segment.offset;
+        file.write(data, segment.size);
+    }
+
+    bool ok = file.good();
+#endif
+
+    if(!ok) std::cerr << "Unable to write " << filename << std::endl;
+
+    return ok;
 }
 
+/**
+ * Internal function to gather the faces, vertices and nodes of a mesh
+ *
+ * @param writer
+ * @param mesh
+ * @param nodes false for car files, which don't have any
+ */
+OCARN2_DEF void ocarn2__write_mesh_geometry(ocarn2__writer& writer, const OCARN2::Mesh& mesh, bool nodes) {
+    writer.records(mesh.faces.data(), mesh.faces.size());
+    writer.records(mesh.vertices.data(), mesh.vertices.size());
+    if(nodes) writer.records(mesh.nodes.data(), mesh.nodes.size());
+}
 
 /**
- * Reads a map file into a self contained struct
+ * Internal function to gather a 3df style mesh (header, geometry, texture), as used by .3df files and rsc models
  *
- * All fields, except fog and ambient maps, are 1024 * 1024, single dimensional vectors
- * fog and ambient maps are 512 * 512
+ * @param writer
+ * @param mesh
+ */
+OCARN2_DEF void ocarn2__write_3df_mesh(ocarn2__writer& writer, const OCARN2::Mesh& mesh) {
+    writer.value((uint32_t) mesh.vertices.size());
+    writer.value((uint32_t) mesh.faces.size());
+    writer.value((uint32_t) mesh.nodes.size());
+    writer.value(mesh.textureSize);
+
+    ocarn2__write_mesh_geometry(writer, mesh, true);
+
+    writer.bytes(mesh.textureData, mesh.textureSize);
+}
+
+/**
+ * Writes a mesh out as a .3DF file. Counts are taken from the vectors, not the num* fields
  *
+ * @param mesh
  * @param filename
  * @return
  */
-OCARN2_DEF OCARN2::Map load_map_file(const std::string& filename) {
-    OCARN2::Map map {};
+OCARN2_DEF bool save_3df_file(const OCARN2::Mesh& mesh, const std::string& filename) {
+    ocarn2__writer writer;
 
-    ocarn2__openFile(filename, [&](std::fstream& file) {
-        file.read((char*) &map.heightMap[0],       1024 * 1024);
-        file.read((char*) &map.textureMap[0],      1024 * 1024 * 2);
-        file.read((char*) &map.textureMapFar[0],   1024 * 1024 * 2);
-        file.read((char*) &map.objectMap[0],       1024 * 1024);
-        file.read((char*) &map.bitflagMap[0],      1024 * 1024 * 2);
-        file.read((char*) &map.lightingMap[0][0],  1024 * 1024); // dawn
-        file.read((char*) &map.lightingMap[1][0],  1024 * 1024); // noon
-        file.read((char*) &map.lightingMap[2][0],  1024 * 1024); // night
-        file.read((char*) &map.waterMap[0],        1024 * 1024);
-        file.read((char*) &map.objectHeightMap[0], 1024 * 1024);
-        file.read((char*) &map.fogMap[0],          512 * 512);
-        file.read((char*) &map.ambientMap[0],      512 * 512);
-    });
+    ocarn2__write_3df_mesh(writer, mesh);
 
-    return map;
+    return ocarn2__write_file(filename, writer);
 }
 
+/**
+ * Writes a mesh out as a .CAR file, with its animations and sounds. Counts are taken from the vectors
+ *
+ * @param mesh
+ * @param filename
+ * @return
+ */
+OCARN2_DEF bool save_car_file(const OCARN2::Mesh& mesh, const std::string& filename) {
+    ocarn2__writer writer;
+
+    writer.copy(mesh.name, 24);
+    writer.copy(mesh.msc, 8);
 
+    writer.value((uint32_t) mesh.animations.size());
+    writer.value((uint32_t) mesh.soundEffects.size());
+    writer.value((uint32_t) mesh.vertices.size());
+    writer.value((uint32_t) mesh.faces.size());
+    writer.value(mesh.textureSize);
 
-const char* ws = " \t\n\r\f\v";
+    ocarn2__write_mesh_geometry(writer, mesh, false);
+    writer.bytes(mesh.textureData, mesh.textureSize);
 
-// trim from end of string (right)
-static inline std::string& ocarn2__rtrim(std::string& s, const char* t = ws)
-{
-    s.erase(s.find_last_not_of(t) + 1);
-    return s;
-}
+    for(auto& a: mesh.animations) {
+        writer.copy(a.name, 32);
+        writer.value(a.kps);
+        writer.value(a.numFrames);
+        writer.bytes(a.data, (size_t) mesh.vertices.size() * a.numFrames * 6);
+    }
 
-// trim from beginning of string (left)
-static inline std::string& ocarn2__ltrim(std::string& s, const char* t = ws)
-{
-    s.erase(0, s.find_first_not_of(t));
-    return s;
-}
+    for(auto& s: mesh.soundEffects) {
+        writer.copy(s.name, 32);
+        writer.value(s.length);
+        writer.bytes(s.data, s.length);
+    }
+
+    // sound map is always 64 entries
+    int32_t soundMap[64] = {};
+    std::copy_n(mesh.soundMap.begin(), std::min<size_t>(64, mesh.soundMap.size()), soundMap);
+    writer.copy(soundMap, sizeof(soundMap));
 
-// trim from both ends of string (right then left)
-static inline std::string& ocarn2__trim(std::string& s, const char* t = ws)
-{
-    return ocarn2__ltrim(ocarn2__rtrim(s, t), t);
+    return ocarn2__write_file(filename, writer);
 }
 
+/**
+ * Writes resources out as an .RSC file. Counts are taken from the vectors
+ *
+ * @param resources
+ * @param filename
+ * @return
+ */
+OCARN2_DEF bool save_rsc_file(const OCARN2::Rsc& resources, const std::string& filename) {
+    ocarn2__writer writer;
+
+    writer.value((uint32_t) resources.textures.size());
+    writer.value((uint32_t) resources.models.size());
+    writer.copy(resources.fadeRgb, sizeof(resources.fadeRgb));
+    writer.copy(resources.transRgb, sizeof(resources.transRgb));
+
+    for(auto& t: resources.textures)
+        writer.bytes(t.data, 128 * 128 * 2);
+
+    for(auto& m: resources.models) {
+        writer.record(m);
+
+        ocarn2__write_3df_mesh(writer, m.mesh);
+        writer.bytes(m.textureData, m.textureSize);
+
+        if(m.flags & 0x80000000) {
+            writer.copy(m.animationHeader, 8);
+            writer.value(m.animation.kps);
+            writer.value(m.animation.numFrames);
+            writer.bytes(m.animation.data, (size_t) m.animationHeader[1] * m.animation.numFrames * 6);
+        }
+    }
+
+    writer.bytes(resources.sky, sizeof(resources.sky));
+    writer.bytes(resources.skyMap, sizeof(resources.skyMap));
 
-OCARN2_DEF OCARN2::Weapon ocarn2__load_weapon(std::fstream& file, std::string& line) {
-    OCARN2::Weapon weapon;
+    writer.value((uint32_t) resources.fogs.size());
+    writer.records(resources.fogs.data(), resources.fogs.size());
 
-    std::string key, value;
+    writer.value((uint32_t) resources.soundEffects.size());
+    for(auto& s: resources.soundEffects) {
+        writer.value(s.length);
+        writer.bytes(s.data, s.length);
+    }
+
+    writer.value((uint32_t) resources.ambientSounds.size());
+    for(auto& a: resources.ambientSounds) {
+        writer.value(a.sound.length);
+        writer.bytes(a.sound.data, a.sound.length);
+        writer.records(a.randomSounds, 16);
+        writer.value(a.numSoundEffects);
+        writer.value(a.volume);
+    }
+
+    writer.value((uint32_t) resources.waters.size());
+    writer.records(resources.waters.data(), resources.waters.size());
 
-    // load individual weapon block
-    while(std::getline(file, line) && !line.empty()) {
-        if( line.find('}') != std::string::npos ) { break; } // end subloop if we encounter a close brace
+    return ocarn2__write_file(filename, writer);
+}
 
-        key = line.substr(0, line.find('='));
-        value = line.substr( line.find('=') + 1 );
+/**
+ * Writes a map out as a .MAP file, every plane in one go
+ *
+ * @param map
+ * @param filename
+ * @return
+ */
+OCARN2_DEF bool save_map_file(const OCARN2::Map& map, const std::string& filename) {
+    ocarn2__writer writer;
 
-        ocarn2__trim(key);
-        ocarn2__trim(value);
+    for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+        OCARN2::MapPlane plane = (OCARN2::MapPlane) p;
+        OCARN2::MapPlaneInfo info = map_plane_info(plane);
 
-        // set properties
-        if(key == "name") weapon.name = value;
-        if(key == "file") weapon.file = value;
-        if(key == "pic") weapon.pic = value;
-        if(key == "power") weapon.power = std::stoi(value);
-        if(key == "prec") weapon.precision = std::stod(value);
-        if(key == "loud") weapon.loudness = std::stod(value);
-        if(key == "rate") weapon.rate = std::stod(value);
-        if(key == "shots") weapon.shots = std::stoi(value);
+        writer.bytes(map_plane_data(map, plane), (size_t) info.width * info.width * info.cellSize);
     }
 
-    return weapon;
+    return ocarn2__write_file(filename, writer);
 }
 
 
-OCARN2_DEF OCARN2::Dino ocarn2__load_character(std::fstream& file, std::string& line) {
-    OCARN2::Dino character;
+/**
+ * Internal function for hashing keys at compile time, so they can be switched on
+ *
+ * @param key
+ * @return
+ */
+static constexpr uint32_t ocarn2__hash(std::string_view key) {
+    uint32_t hash = 2166136261u;
+    for(char c: key) hash = (hash ^ (unsigned char) c) * 16777619u;
+    return hash;
+}
 
-    std::string key, value;
+enum ocarn2__res_key {
+    OCARN2__KEY_UNKNOWN,
+    OCARN2__KEY_NAME, OCARN2__KEY_FILE, OCARN2__KEY_PIC,
+    OCARN2__KEY_POWER, OCARN2__KEY_PREC, OCARN2__KEY_LOUD, OCARN2__KEY_RATE, OCARN2__KEY_SHOTS,
+    OCARN2__KEY_AI, OCARN2__KEY_MASS, OCARN2__KEY_LENGTH, OCARN2__KEY_RADIUS, OCARN2__KEY_HEALTH,
+    OCARN2__KEY_BASESCORE, OCARN2__KEY_SMELL, OCARN2__KEY_HEAR, OCARN2__KEY_LOOK, OCARN2__KEY_SHIPDELTA,
+    OCARN2__KEY_SCALE0, OCARN2__KEY_SCALEA, OCARN2__KEY_DANGER, OCARN2__KEY_HEARK, OCARN2__KEY_LOOKK,
+    OCARN2__KEY_START, OCARN2__KEY_AREA, OCARN2__KEY_DINO, OCARN2__KEY_WEAPON, OCARN2__KEY_ACCES
+};
 
-    // load individual character block
-    while(std::getline(file, line) && !line.empty()) {
-        if( line.find('}') != std::string::npos ) { break; } // end subloop if we encounter a close brace
+/**
+ * Internal function to map a key to its enum with a single switch. Two keys hashing the same
+ * would be a duplicate case, so collisions are caught by the compiler
+ *
+ * @param key
+ * @return
+ */
+static inline ocarn2__res_key ocarn2__lookup_res_key(std::string_view key) {
+#define OCARN2__KEY(text, value) case ocarn2__hash(text): return key == text ? value : OCARN2__KEY_UNKNOWN;
+    switch(ocarn2__hash(key)) {
+        OCARN2__KEY("name", OCARN2__KEY_NAME)
+        OCARN2__KEY("file", OCARN2__KEY_FILE)
+        OCARN2__KEY("pic", OCARN2__KEY_PIC)
+        OCARN2__KEY("power", OCARN2__KEY_POWER)
+        OCARN2__KEY("prec", OCARN2__KEY_PREC)
+        OCARN2__KEY("loud", OCARN2__KEY_LOUD)
+        OCARN2__KEY("rate", OCARN2__KEY_RATE)
+        OCARN2__KEY("shots", OCARN2__KEY_SHOTS)
+        OCARN2__KEY("ai", OCARN2__KEY_AI)
+        OCARN2__KEY("mass", OCARN2__KEY_MASS)
+        OCARN2__KEY("length", OCARN2__KEY_LENGTH)
+        OCARN2__KEY("radius", OCARN2__KEY_RADIUS)
+        OCARN2__KEY("health", OCARN2__KEY_HEALTH)
+        OCARN2__KEY("basescore", OCARN2__KEY_BASESCORE)
+        OCARN2__KEY("smell", OCARN2__KEY_SMELL)
+        OCARN2__KEY("hear", OCARN2__KEY_HEAR)
+        OCARN2__KEY("look", OCARN2__KEY_LOOK)
+        OCARN2__KEY("shipdelta", OCARN2__KEY_SHIPDELTA)
+        OCARN2__KEY("scale0", OCARN2__KEY_SCALE0)
+        OCARN2__KEY("scaleA", OCARN2__KEY_SCALEA)
+        OCARN2__KEY("danger", OCARN2__KEY_DANGER)
+        OCARN2__KEY("hearK", OCARN2__KEY_HEARK)
+        OCARN2__KEY("lookK", OCARN2__KEY_LOOKK)
+        OCARN2__KEY("start", OCARN2__KEY_START)
+        OCARN2__KEY("area", OCARN2__KEY_AREA)
+        OCARN2__KEY("dino", OCARN2__KEY_DINO)
+        OCARN2__KEY("weapon", OCARN2__KEY_WEAPON)
+        OCARN2__KEY("acces", OCARN2__KEY_ACCES)
+        default: return OCARN2__KEY_UNKNOWN;
+    }
+#undef OCARN2__KEY
+}
 
-        key = line.substr(0, line.find('='));
-        value = line.substr( line.find('=') + 1 );
+// trim whitespace from both ends
+static inline std::string_view ocarn2__trim(std::string_view s) {
+    const char* ws = " \t\n\r\f\v";
 
-        ocarn2__trim(key);
-        ocarn2__trim(value);
+    size_t first = s.find_first_not_of(ws);
+    if(first == std::string_view::npos) return {};
 
+    return s.substr(first, s.find_last_not_of(ws) - first + 1);
+}
 
-        // set properties
-        if(key == "name") character.name = value;
-        if(key == "file") character.file = value;
-        if(key == "ai") character.ai = std::stoi(value);
-        if(key == "mass") character.mass = std::stod(value);
-        if(key == "length") character.length = std::stod(value);
-        if(key == "radius") character.radius = std::stoi(value);
-        if(key == "health") character.health = std::stoi(value);
-        if(key == "basescore") character.baseScore = std::stoi(value);
-        if(key == "smell") character.smell = std::stod(value);
-        if(key == "hear") character.hearing = std::stod(value);
-        if(key == "look") character.sight = std::stod(value);
-        if(key == "shipdelta") character.shipDelta = std::stoi(value);
-        if(key == "scale0") character.scale0 = std::stoi(value);
-        if(key == "scaleA") character.scaleA = std::stoi(value);
+// parses the leading integer of value, ignoring anything after it like std::stoi does
+static inline bool ocarn2__parse_int(std::string_view value, int32_t& out) {
+    const char* begin = value.data();
+    const char* end = begin + value.size();
+    if(begin != end && *begin == '+') begin++;
 
+    return std::from_chars(begin, end, out).ec == std::errc();
+}
 
-        // convert TRUE -> true for comparison
-        if(key == "danger") {
-            std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) -> char {
-                return std::tolower(c);
-            });
+// parses the leading number of value, ignoring anything after it like std::stod does
+static inline bool ocarn2__parse_float(std::string_view value, float& out) {
+    const char* begin = value.data();
+    const char* end = begin + value.size();
+    if(begin != end && *begin == '+') begin++;
 
-            character.dangerous = (value == "true");
-        };
+    double d;
+    if(std::from_chars(begin, end, d).ec != std::errc()) return false;
 
+    out = (float) d;
+    return true;
+}
+
+static inline bool ocarn2__equals_ignore_case(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) return false;
+
+    for(size_t i=0; i < a.size(); i++) {
+        if(std::tolower((unsigned char) a[i]) != std::tolower((unsigned char) b[i])) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Internal function to apply one key = value line of a weapon block
+ *
+ * @return false if the value should have been a number and wasn't
+ */
+static inline bool ocarn2__set_weapon_value(OCARN2::Weapon& weapon, ocarn2__res_key key, std::string_view value) {
+    switch(key) {
+        case OCARN2__KEY_NAME:  weapon.name.assign(value); return true;
+        case OCARN2__KEY_FILE:  weapon.file.assign(value); return true;
+        case OCARN2__KEY_PIC:   weapon.pic.assign(value); return true;
+        case OCARN2__KEY_POWER: return ocarn2__parse_int(value, weapon.power);
+        case OCARN2__KEY_PREC:  return ocarn2__parse_float(value, weapon.precision);
+        case OCARN2__KEY_LOUD:  return ocarn2__parse_float(value, weapon.loudness);
+        case OCARN2__KEY_RATE:  return ocarn2__parse_float(value, weapon.rate);
+        case OCARN2__KEY_SHOTS: return ocarn2__parse_int(value, weapon.shots);
+        default: return true;
+    }
+}
+
+/**
+ * Internal function to apply one key = value line of a character block
+ *
+ * @return false if the value should have been a number and wasn't
+ */
+static inline bool ocarn2__set_character_value(OCARN2::Dino& character, ocarn2__res_key key, std::string_view value) {
+    switch(key) {
+        case OCARN2__KEY_NAME:      character.name.assign(value); return true;
+        case OCARN2__KEY_FILE:      character.file.assign(value); return true;
+        case OCARN2__KEY_AI:        return ocarn2__parse_int(value, character.ai);
+        case OCARN2__KEY_MASS:      return ocarn2__parse_float(value, character.mass);
+        case OCARN2__KEY_LENGTH:    return ocarn2__parse_float(value, character.length);
+        case OCARN2__KEY_RADIUS:    return ocarn2__parse_int(value, character.radius);
+        case OCARN2__KEY_HEALTH:    return ocarn2__parse_int(value, character.health);
+        case OCARN2__KEY_BASESCORE: return ocarn2__parse_int(value, character.baseScore);
+        case OCARN2__KEY_SMELL:     return ocarn2__parse_float(value, character.smell);
+        case OCARN2__KEY_HEAR:      return ocarn2__parse_float(value, character.hearing);
+        case OCARN2__KEY_LOOK:      return ocarn2__parse_float(value, character.sight);
+        case OCARN2__KEY_SHIPDELTA: return ocarn2__parse_int(value, character.shipDelta);
+        case OCARN2__KEY_SCALE0:    return ocarn2__parse_int(value, character.scale0);
+        case OCARN2__KEY_SCALEA:    return ocarn2__parse_int(value, character.scaleA);
+
+        case OCARN2__KEY_DANGER:
+            character.dangerous = ocarn2__equals_ignore_case(value, "true");
+            return true;
 
         // these are typos left over in the resources
         // should be "hear" and "look", so if the default value is still set, allow the typo to set the value
-        if(key == "hearK" && character.hearing == -1.0f)
-            character.hearing = std::stod(value);
+        case OCARN2__KEY_HEARK: return character.hearing != -1.0f || ocarn2__parse_float(value, character.hearing);
+        case OCARN2__KEY_LOOKK: return character.sight != -1.0f || ocarn2__parse_float(value, character.sight);
+
+        default: return true;
+    }
+}
+
+/**
+ * Internal function to apply one key = value line of the prices block
+ *
+ * @return false if the value should have been a number and wasn't
+ */
+static inline bool ocarn2__set_price_value(OCARN2::Prices& prices, ocarn2__res_key key, std::string_view value) {
+    std::vector<int>* list = nullptr;
+
+    switch(key) {
+        case OCARN2__KEY_START:  return ocarn2__parse_int(value, prices.baseCost);
+        case OCARN2__KEY_AREA:   list = &prices.areas; break;
+        case OCARN2__KEY_DINO:   list = &prices.dinos; break;
+        case OCARN2__KEY_WEAPON: list = &prices.weapons; break;
+        case OCARN2__KEY_ACCES:  list = &prices.accessories; break;
+        default: return true;
+    }
+
+    int32_t price;
+    if(!ocarn2__parse_int(value, price)) return false;
+
+    list->push_back(price);
+    return true;
+}
+
+/**
+ * Parses the contents of a _RES.TXT file that is already in memory. Works line by line over the buffer,
+ * so nothing is copied except the values that end up in the structs
+ *
+ * @param data
+ * @param size
+ * @param resources parsed weapons, characters and prices are added to this
+ * @param error if given, filled in with the line and reason the parse failed
+ * @return false if a value couldn't be parsed
+ */
+OCARN2_DEF bool parse_res_txt(const char* data, size_t size, OCARN2::ResTxt& resources, OCARN2::ResTxtError* error) {
+    enum { TOP, WEAPONS, WEAPON, CHARACTERS, CHARACTER, PRICES } state = TOP;
+
+    std::string_view text(data, size);
+    uint32_t lineNumber = 0;
+
+    while(!text.empty()) {
+        size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+        lineNumber++;
+
+        // an empty line ends the block it's in, the way the game reads the file: a weapon or character goes back
+        // to its list, and a list or the prices back to the top. only a truly empty line, "\r" or spaces don't
+        if(line.empty()) {
+            if(state == WEAPON) state = WEAPONS;
+            else if(state == CHARACTER) state = CHARACTERS;
+            else state = TOP;
+            continue;
+        }
 
-        if(key == "lookK" && character.sight == -1.0f)
-            character.sight = std::stod(value);
+        line = ocarn2__trim(line);
+        if(line.empty()) continue;
+
+        bool opens = line.find('{') != std::string_view::npos;
+        bool closes = line.find('}') != std::string_view::npos;
+
+        switch(state) {
+            case TOP:
+                if(line.find("weapons") != std::string_view::npos) state = WEAPONS;
+                else if(line.find("characters") != std::string_view::npos) state = CHARACTERS;
+                else if(line.find("prices") != std::string_view::npos) state = PRICES;
+                continue;
+
+            // lists of {} blocks, one per weapon or character
+            case WEAPONS:
+            case CHARACTERS:
+                if(closes) { state = TOP; continue; }
+                if(!opens) continue;
+
+                if(state == WEAPONS) { resources.weapons.emplace_back(); state = WEAPON; }
+                else { resources.characters.emplace_back(); state = CHARACTER; }
+                continue;
+
+            case WEAPON:
+            case CHARACTER:
+            case PRICES:
+                if(closes) { state = state == WEAPON ? WEAPONS : state == CHARACTER ? CHARACTERS : TOP; continue; }
+                break;
+        }
+
+        size_t equals = line.find('=');
+        if(equals == std::string_view::npos) continue;
+
+        std::string_view keyText = ocarn2__trim(line.substr(0, equals));
+        std::string_view value = ocarn2__trim(line.substr(equals + 1));
+        ocarn2__res_key key = ocarn2__lookup_res_key(keyText);
+
+        bool ok = true;
+        if(state == WEAPON) ok = ocarn2__set_weapon_value(resources.weapons.back(), key, value);
+        if(state == CHARACTER) ok = ocarn2__set_character_value(resources.characters.back(), key, value);
+        if(state == PRICES) ok = ocarn2__set_price_value(resources.prices, key, value);
+
+        if(!ok) {
+            if(error) {
+                error->line = lineNumber;
+                error->message = "expected a number for '" + std::string(keyText) + "', got '" + std::string(value) + "'";
+            }
+
+            return false;
+        }
     }
 
-    return character;
+    return true;
 }
 
 
@@ -952,80 +2590,259 @@ OCARN2_DEF OCARN2::Dino ocarn2__load_character(std::fstream& file, std::string&
  * Loads the _RES.TXT file in HUNTDAT for custom configuration
  *
  * @param filename
- * @return
+ * @param error if given, filled in with the line and reason the parse failed
+ * @return everything parsed up to the first error
  */
-OCARN2_DEF OCARN2::ResTxt load_res_txt_file(const std::string& filename) {
+OCARN2_DEF OCARN2::ResTxt load_res_txt_file(const std::string& filename, OCARN2::ResTxtError* error) {
     OCARN2::ResTxt resources;
+    OCARN2__STATS_LOAD("load_res_txt_file", filename);
 
     ocarn2__openFile(filename, [&](std::fstream& file) {
+        file.seekg(0, std::ios::end);
+        std::streampos size = file.tellg();
+        if(size == std::streampos(-1)) {
+            std::cerr << "Unable to tell the size of " << filename << std::endl;
+            return;
+        }
 
-        while(!file.eof()) {
-            std::string line;
+        std::string contents((size_t) size, '\0');
+        file.seekg(0, std::ios::beg);
+        if(!file.read(&contents[0], contents.size())) {
+            std::cerr << "Unable to read " << filename << std::endl;
+            return;
+        }
 
-            std::getline(file, line, '\n');
-            // process lines
+        OCARN2::ResTxtError failure;
+        if(!parse_res_txt(contents.data(), contents.size(), resources, &failure)) {
+            std::cerr << filename << ":" << failure.line << ": " << failure.message << std::endl;
 
+            if(error) *error = failure;
+        }
+    });
 
-            if( line.find("weapons") != std::string::npos ) {
+    return resources;
+}
 
-                // loop through weapons {}
-                while( std::getline(file, line) && !line.empty() ) {
-                    if( line.find('}') != std::string::npos ) break; // end subloop if we encounter a close brace
 
-                    // if we find an opening brace,
-                    if(line.find('{') != std::string::npos) {
+// memory accounting
 
-                        // load weapon into struct
-                        resources.weapons.emplace_back( ocarn2__load_weapon(file, line) );
-                    }
-                }
-            }
+/**
+ * Internal function to add bytes to a section, making it if this is the first of them
+ */
+static void ocarn2__memory_add(OCARN2::MemoryFootprint& footprint, const char* name, uint64_t bytes, uint64_t used) {
+    footprint.bytes += bytes;
+    footprint.used += used;
+
+    for(auto& section: footprint.sections) {
+        if(strcmp(section.name, name) == 0) {
+            section.bytes += bytes;
+            section.used += used;
+            return;
+        }
+    }
+
+    footprint.sections.push_back({ name, bytes, used });
+}
+
+template<typename T>
+static void ocarn2__memory_add(OCARN2::MemoryFootprint& footprint, const char* name, const std::vector<T>& vector) {
+    ocarn2__memory_add(footprint, name, vector.capacity() * sizeof(T), vector.size() * sizeof(T));
+}
 
-            // loop through dinos
-            if(line.find("characters") != std::string::npos ) {
+/**
+ * Internal function for a buffer the loaders made, bytes long rounded up to whole T. nothing if it's not there
+ */
+template<typename T>
+static void ocarn2__memory_add(OCARN2::MemoryFootprint& footprint, const char* name, const T* data, uint64_t bytes) {
+    if(data) ocarn2__memory_add(footprint, name, (bytes + sizeof(T) - 1) / sizeof(T) * sizeof(T), bytes);
+}
+
+/**
+ * Internal function for a mesh's heap, everything but the Mesh struct itself
+ */
+static void ocarn2__memory_mesh(OCARN2::MemoryFootprint& footprint, const OCARN2::Mesh& mesh, const char* faces, const char* vertices,
+                                const char* nodes, const char* animations, const char* sounds, const char* texture) {
+    ocarn2__memory_add(footprint, faces, mesh.faces);
+    ocarn2__memory_add(footprint, vertices, mesh.vertices);
+    ocarn2__memory_add(footprint, nodes, mesh.nodes);
 
-                // loop through characters {}
-                while( std::getline(file, line) && !line.empty() ) {
-                    if( line.find('}') != std::string::npos ) break; // end subloop if we encounter a close brace
+    ocarn2__memory_add(footprint, animations, mesh.animations);
+    for(auto& a: mesh.animations) ocarn2__memory_add(footprint, animations, a.data, (uint64_t) mesh.vertices.size() * a.numFrames * 6);
 
-                    // if we find an opening brace,
-                    if(line.find('{') != std::string::npos) {
+    ocarn2__memory_add(footprint, sounds, mesh.soundEffects);
+    ocarn2__memory_add(footprint, sounds, mesh.soundMap);
+    for(auto& e: mesh.soundEffects) ocarn2__memory_add(footprint, sounds, e.data, e.length);
 
-                        // load character into struct
-                        resources.characters.emplace_back( ocarn2__load_character(file, line) );
-                    }
-                }
-            }
+    ocarn2__memory_add(footprint, texture, mesh.textureData, mesh.textureSize);
+}
 
+/**
+ * Bytes held by a mesh, in sections struct, faces, vertices, nodes, animations, sounds and texture
+ *
+ * @param mesh
+ * @return
+ */
+OCARN2_DEF OCARN2::MemoryFootprint mesh_memory_footprint(const OCARN2::Mesh& mesh) {
+    OCARN2::MemoryFootprint footprint;
+
+    ocarn2__memory_add(footprint, "struct", sizeof(OCARN2::Mesh), sizeof(OCARN2::Mesh));
+    ocarn2__memory_mesh(footprint, mesh, "faces", "vertices", "nodes", "animations", "sounds", "texture");
 
-            // loop through prices
-            if( line.find("prices") != std::string::npos ) {
+    return footprint;
+}
 
-                while( std::getline(file, line) && !line.empty() ) {
-                    if( line.find('}') != std::string::npos ) break;
+/**
+ * Bytes held by an rsc, in sections struct, sky (held inline in the Rsc), textures, models, model textures,
+ * model animations, fogs, sounds, ambient and waters
+ *
+ * @param resources
+ * @return
+ */
+OCARN2_DEF OCARN2::MemoryFootprint rsc_memory_footprint(const OCARN2::Rsc& resources) {
+    OCARN2::MemoryFootprint footprint;
 
-                    std::string key, value;
+    uint64_t sky = sizeof(resources.sky) + sizeof(resources.skyMap);
+    ocarn2__memory_add(footprint, "struct", sizeof(OCARN2::Rsc) - sky, sizeof(OCARN2::Rsc) - sky);
+    ocarn2__memory_add(footprint, "sky", sky, sky);
 
-                    key = line.substr(0, line.find('='));
-                    value = line.substr( line.find('=') + 1 );
+    ocarn2__memory_add(footprint, "textures", resources.textures);
+    for(auto& t: resources.textures) ocarn2__memory_add(footprint, "textures", t.data, t.size);
 
-                    ocarn2__trim(key);
-                    ocarn2__trim(value);
+    // the RscModel structs, meshes included, are in the models vector
+    ocarn2__memory_add(footprint, "models", resources.models);
+    for(auto& m: resources.models) {
+        ocarn2__memory_mesh(footprint, m.mesh, "models", "models", "models", "model animations", "models", "model textures");
+        ocarn2__memory_add(footprint, "model textures", m.textureData, (uint64_t) std::max(m.textureSize, 0));
 
-                    if(key == "start") resources.prices.baseCost = std::stoi(value);
+        if(m.flags & OCARN2::OF_ANIMATED) {
+            uint64_t frames = (uint64_t) std::max(m.animationHeader[1], 0) * m.animation.numFrames * 6;
+            ocarn2__memory_add(footprint, "model animations", m.animation.data, frames);
+        }
+    }
 
-                    if(key == "area") resources.prices.areas.push_back( std::stoi(value) );
-                    if(key == "dino") resources.prices.dinos.push_back( std::stoi(value) );
-                    if(key == "weapon") resources.prices.weapons.push_back( std::stoi(value) );
-                    if(key == "acces") resources.prices.accessories.push_back( std::stoi(value) );
-                }
+    ocarn2__memory_add(footprint, "fogs", resources.fogs);
 
-            }
+    ocarn2__memory_add(footprint, "sounds", resources.soundEffects);
+    for(auto& e: resources.soundEffects) ocarn2__memory_add(footprint, "sounds", e.data, e.length);
+
+    ocarn2__memory_add(footprint, "ambient", resources.ambientSounds);
+    for(auto& a: resources.ambientSounds) ocarn2__memory_add(footprint, "ambient", a.sound.data, a.sound.length);
+
+    ocarn2__memory_add(footprint, "waters", resources.waters);
+
+    return footprint;
+}
+
+/**
+ * Bytes held by a map, a section per plane named as in map_plane_info, and struct
+ *
+ * @param map
+ * @return
+ */
+OCARN2_DEF OCARN2::MemoryFootprint map_memory_footprint(const OCARN2::Map& map) {
+    OCARN2::MemoryFootprint footprint;
+
+    ocarn2__memory_add(footprint, "struct", sizeof(OCARN2::Map), sizeof(OCARN2::Map));
+    ocarn2__memory_add(footprint, "struct", map.lightingMap);
+
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_HEIGHT).name, map.heightMap);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_TEXTURE).name, map.textureMap);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_TEXTURE_FAR).name, map.textureMapFar);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_OBJECT).name, map.objectMap);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_BITFLAG).name, map.bitflagMap);
+    for(size_t i=0; i < map.lightingMap.size() && i < 3; i++)
+        ocarn2__memory_add(footprint, map_plane_info((OCARN2::MapPlane) (OCARN2::MAP_LIGHT_DAWN + i)).name, map.lightingMap[i]);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_WATER).name, map.waterMap);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_OBJECT_HEIGHT).name, map.objectHeightMap);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_FOG).name, map.fogMap);
+    ocarn2__memory_add(footprint, map_plane_info(OCARN2::MAP_AMBIENT).name, map.ambientMap);
+
+    return footprint;
+}
+
+static std::mutex ocarn2__memory_mutex;
+static std::vector<OCARN2::MemoryAsset> ocarn2__memory_registry;
+
+/**
+ * Internal function to add an asset to the registry, or measure it again if it's already there
+ */
+static uint64_t ocarn2__memory_register(const std::string& name, OCARN2::MemoryAssetKind kind, const void* asset, OCARN2::MemoryFootprint footprint) {
+    uint64_t bytes = footprint.bytes;
+    std::lock_guard<std::mutex> lock(ocarn2__memory_mutex);
+
+    for(auto& entry: ocarn2__memory_registry) {
+        if(entry.asset == asset) {
+            entry.name = name;
+            entry.kind = kind;
+            entry.footprint = std::move(footprint);
+            return bytes;
         }
+    }
 
-    });
+    ocarn2__memory_registry.push_back({ name, kind, asset, std::move(footprint) });
+    return bytes;
+}
 
-    return resources;
+/**
+ * Measures a mesh and adds it to the registry of live assets. Registering it again measures it again.
+ * Unregister it before it's freed
+ *
+ * @param name
+ * @param mesh
+ * @return the bytes it holds
+ */
+OCARN2_DEF uint64_t memory_register(const std::string& name, const OCARN2::Mesh& mesh) {
+    return ocarn2__memory_register(name, OCARN2::MEMORY_MESH, &mesh, mesh_memory_footprint(mesh));
+}
+
+OCARN2_DEF uint64_t memory_register(const std::string& name, const OCARN2::Rsc& resources) {
+    return ocarn2__memory_register(name, OCARN2::MEMORY_RSC, &resources, rsc_memory_footprint(resources));
+}
+
+OCARN2_DEF uint64_t memory_register(const std::string& name, const OCARN2::Map& map) {
+    return ocarn2__memory_register(name, OCARN2::MEMORY_MAP, &map, map_memory_footprint(map));
+}
+
+/**
+ * Takes an asset out of the registry
+ *
+ * @param asset the Mesh, Rsc or Map that was registered
+ * @return false if it wasn't registered
+ */
+OCARN2_DEF bool memory_unregister(const void* asset) {
+    std::lock_guard<std::mutex> lock(ocarn2__memory_mutex);
+
+    for(size_t i=0; i < ocarn2__memory_registry.size(); i++) {
+        if(ocarn2__memory_registry[i].asset == asset) {
+            ocarn2__memory_registry.erase(ocarn2__memory_registry.begin() + i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Every registered asset, in the order they were registered
+ *
+ * @return
+ */
+OCARN2_DEF std::vector<OCARN2::MemoryAsset> memory_assets() {
+    std::lock_guard<std::mutex> lock(ocarn2__memory_mutex);
+    return ocarn2__memory_registry;
+}
+
+/**
+ * Bytes held by every registered asset together
+ *
+ * @return
+ */
+OCARN2_DEF uint64_t memory_total() {
+    std::lock_guard<std::mutex> lock(ocarn2__memory_mutex);
+
+    uint64_t total = 0;
+    for(auto& entry: ocarn2__memory_registry) total += entry.footprint.bytes;
+    return total;
 }
 
 
@@ -1037,14 +2854,14 @@ OCARN2_DEF OCARN2::ResTxt load_res_txt_file(const std::string& filename) {
  * @param mesh
  */
 OCARN2_DEF void free_mesh(OCARN2::Mesh& mesh) {
-    delete mesh.textureData;
+    delete[] mesh.textureData;
 
     for(auto& a: mesh.animations) {
-        delete a.data;
+        delete[] a.data;
     }
 
     for(auto& s: mesh.soundEffects) {
-        delete s.data;
+        delete[] s.data;
     }
 }
 
@@ -1056,16 +2873,17 @@ OCARN2_DEF void free_mesh(OCARN2::Mesh& mesh) {
 OCARN2_DEF void free_rsc(OCARN2::Rsc& resources) {
 
     for(auto& s: resources.soundEffects)
-        delete s.data;
+        delete[] s.data;
 
     for(auto& t: resources.textures)
-        delete t.data;
+        delete[] t.data;
 
     for(auto& a: resources.ambientSounds)
-        delete a.sound.data;
+        delete[] a.sound.data;
 
     for(auto& m: resources.models) {
-        delete m.textureData;
+        delete[] m.textureData;
+        delete[] m.animation.data;
 
         free_mesh(m.mesh);
     }
@@ -0,0 +1,724 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for loading files in the background, so a game loop doesn't stall on disk.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * An AsyncLoader owns a few worker threads. Each load is turned into a batch of reads that are submitted
+ * together: the twelve planes of a .map file go straight into the Map's vectors, and the other formats are
+ * read in large blocks and parsed from memory. On Linux the batch goes through io_uring (one ring per worker),
+ * anywhere else, or if the kernel refuses io_uring or doesn't support IORING_OP_READ (probed when the ring is
+ * set up, and checked again on every completion), the reads are done with pread. A load that throws is reported
+ * as a failed load.
+ *
+ * Callbacks run on whichever thread calls poll_async_loader, so they can touch game state without locking.
+ * Set callbackOnWorker to have them run on the worker as soon as the load finishes instead, or use the
+ * *_future variants.
+ *
+ * main methods are
+ *
+ * AsyncLoader* create_async_loader(const AsyncLoaderOptions& options);
+ * void load_map_file_async(AsyncLoader* loader, const std::string& filename, callback);
+ * std::future<Map> load_map_file_future(AsyncLoader* loader, const std::string& filename);
+ * size_t poll_async_loader(AsyncLoader* loader);
+ * void free_async_loader(AsyncLoader* loader);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace OCARN2 {
+
+    struct AsyncLoaderOptions {
+        // worker threads doing the reads and parsing
+        unsigned threads = 2;
+
+        // linux only. falls back to pread if the kernel doesn't allow it
+        bool useIoUring = true;
+
+        // reads in flight per worker
+        uint32_t queueDepth = 32;
+
+        // block size for formats that are read whole and then parsed
+        uint32_t readSize = 1024 * 1024;
+
+        // run callbacks on the worker thread instead of in poll_async_loader
+        bool callbackOnWorker = false;
+    };
+
+    struct AsyncLoader {
+        AsyncLoaderOptions options;
+
+        std::vector<std::thread> workers;
+        bool usingIoUring = false;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::function<void()>> jobs;
+        bool stopping = false;
+
+        std::mutex completedMutex;
+        std::deque<std::function<void()>> completed;
+
+        // loads whose callback hasn't run yet
+        std::atomic<size_t> pending {0};
+    };
+
+    template<typename T>
+    using AsyncCallback = std::function<void(T& result, bool ok)>;
+}
+
+
+OCARN2_DEF OCARN2::AsyncLoader* create_async_loader(const OCARN2::AsyncLoaderOptions& options = {});
+OCARN2_DEF void free_async_loader(OCARN2::AsyncLoader* loader);
+
+OCARN2_DEF void load_3df_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Mesh> callback);
+OCARN2_DEF void load_car_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Mesh> callback);
+OCARN2_DEF void load_rsc_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Rsc> callback);
+OCARN2_DEF void load_map_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Map> callback);
+
+OCARN2_DEF std::future<OCARN2::Mesh> load_3df_file_future(OCARN2::AsyncLoader* loader, const std::string& filename);
+OCARN2_DEF std::future<OCARN2::Mesh> load_car_file_future(OCARN2::AsyncLoader* loader, const std::string& filename);
+OCARN2_DEF std::future<std::unique_ptr<OCARN2::Rsc>> load_rsc_file_future(OCARN2::AsyncLoader* loader, const std::string& filename);
+OCARN2_DEF std::future<OCARN2::Map> load_map_file_future(OCARN2::AsyncLoader* loader, const std::string& filename);
+
+OCARN2_DEF size_t poll_async_loader(OCARN2::AsyncLoader* loader);
+OCARN2_DEF size_t async_loads_pending(OCARN2::AsyncLoader* loader);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <filesystem>
+#include <stdexcept>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define OCARN2__IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+/**
+ * Internal description of one read in a batch
+ */
+struct ocarn2__read {
+    uint64_t offset;
+    uint32_t size;
+    unsigned char* destination;
+};
+
+
+#ifdef OCARN2__IO_URING
+
+/**
+ * Internal io_uring, set up with the raw syscalls so there's no liburing dependency
+ */
+struct ocarn2__uring {
+    int fd = -1;
+
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead; unsigned* sqTail; unsigned* sqMask; unsigned* sqArray; unsigned sqEntries;
+    unsigned* cqHead; unsigned* cqTail; unsigned* cqMask; io_uring_cqe* cqes;
+};
+
+OCARN2_DEF void ocarn2__uring_free(ocarn2__uring& ring) {
+    if(ring.sqes) munmap(ring.sqes, ring.sqesSize);
+    if(ring.cqRing && ring.cqRing != ring.sqRing) munmap(ring.cqRing, ring.cqRingSize);
+    if(ring.sqRing) munmap(ring.sqRing, ring.sqRingSize);
+    if(ring.fd >= 0) close(ring.fd);
+
+    ring = ocarn2__uring {};
+}
+
+/**
+ * Internal function to create a ring
+ *
+ * @param ring
+ * @param entries
+ * @return false if io_uring isn't available, eg an old kernel or blocked by seccomp
+ */
+OCARN2_DEF bool ocarn2__uring_init(ocarn2__uring& ring, unsigned entries) {
+    io_uring_params params {};
+
+    ring.fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(ring.fd < 0) return false;
+
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) ring.sqRingSize = ring.cqRingSize = std::max(ring.sqRingSize, ring.cqRingSize);
+
+    ring.sqRing = mmap(nullptr, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if(ring.sqRing == MAP_FAILED) { ring.sqRing = nullptr; ocarn2__uring_free(ring); return false; }
+
+    if(single) ring.cqRing = ring.sqRing;
+    else {
+        ring.cqRing = mmap(nullptr, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if(ring.cqRing == MAP_FAILED) { ring.cqRing = nullptr; ocarn2__uring_free(ring); return false; }
+    }
+
+    ring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ring.sqes = (io_uring_sqe*) mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if(ring.sqes == MAP_FAILED) { ring.sqes = nullptr; ocarn2__uring_free(ring); return false; }
+
+    char* sq = (char*) ring.sqRing;
+    ring.sqHead = (unsigned*) (sq + params.sq_off.head);
+    ring.sqTail = (unsigned*) (sq + params.sq_off.tail);
+    ring.sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring.sqArray = (unsigned*) (sq + params.sq_off.array);
+    ring.sqEntries = params.sq_entries;
+
+    char* cq = (char*) ring.cqRing;
+    ring.cqHead = (unsigned*) (cq + params.cq_off.head);
+    ring.cqTail = (unsigned*) (cq + params.cq_off.tail);
+    ring.cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring.cqes = (io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    // kernels before 5.6 set up a ring but turn down IORING_OP_READ, and can't be probed either
+    std::vector<unsigned char> probeBytes(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = (io_uring_probe*) probeBytes.data();
+
+    if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+       probe->last_op < IORING_OP_READ || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+        ocarn2__uring_free(ring);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Internal function to reap whatever completions are waiting
+ *
+ * @param unsupported set if the kernel turned a read down with -EINVAL
+ * @return false if any of them failed
+ */
+OCARN2_DEF bool ocarn2__uring_reap(ocarn2__uring& ring, std::vector<ocarn2__read>& reads, std::deque<size_t>& waiting, size_t& inFlight, bool& unsupported) {
+    unsigned head = *ring.cqHead;
+    bool ok = true;
+
+    while(head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+        io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+        ocarn2__read& read = reads[cqe->user_data];
+
+        OCARN2__STATS_IO(0, cqe->res > 0 ? cqe->res : 0);
+
+        if(cqe->res == -EINVAL) unsupported = true;
+
+        if(cqe->res <= 0) ok = false;
+        else if((uint32_t) cqe->res < read.size) {
+            // short read, queue up the rest of it
+            read.offset += cqe->res;
+            read.destination += cqe->res;
+            read.size -= cqe->res;
+            waiting.push_back(cqe->user_data);
+        }
+
+        head++;
+        inFlight--;
+    }
+
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+    return ok;
+}
+
+/**
+ * Internal function to push a whole batch of reads through the ring, keeping the submission queue full.
+ * Never returns with a read still in flight, even on failure, since the caller frees the destinations
+ *
+ * @param ring
+ * @param fd
+ * @param reads modified as reads complete
+ * @param unsupported set if the kernel doesn't do IORING_OP_READ after all, the batch should go through pread
+ * @return false if any read failed or hit the end of the file
+ */
+OCARN2_DEF bool ocarn2__uring_read_batch(ocarn2__uring& ring, int fd, std::vector<ocarn2__read>& reads, bool& unsupported) {
+    std::deque<size_t> waiting;
+    for(size_t i=0; i < reads.size(); i++) waiting.push_back(i);
+
+    size_t inFlight = 0;
+    bool ok = true;
+    unsupported = false;
+
+    while((ok && !waiting.empty()) || inFlight > 0) {
+        unsigned tail = *ring.sqTail;
+        unsigned head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+        unsigned queued = 0;
+
+        // once something fails, stop submitting and just wait out what's in flight
+        while(ok && !waiting.empty() && tail - head < ring.sqEntries) {
+            ocarn2__read& read = reads[waiting.front()];
+
+            unsigned index = tail & *ring.sqMask;
+            io_uring_sqe* sqe = &ring.sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t) (uintptr_t) read.destination;
+            sqe->len = read.size;
+            sqe->off = read.offset;
+            sqe->user_data = waiting.front();
+
+            ring.sqArray[index] = index;
+            waiting.pop_front();
+
+            tail++;
+            queued++;
+        }
+
+        __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+        inFlight += queued;
+
+        // anything a failed or interrupted enter didn't take is still queued, so it goes in again with the new ones
+        unsigned unsubmitted = tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+
+        int entered = (int) syscall(__NR_io_uring_enter, ring.fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        OCARN2__STATS_IO(1, 0);
+
+        if(entered < 0) {
+            int code = errno;
+
+            if(code == EAGAIN || code == EBUSY) {
+                // out of resources or the completion queue is full, reaping below makes room
+                std::this_thread::yield();
+            } else if(code != EINTR) {
+                // take back what the kernel never consumed, so it can't be submitted once the destinations are
+                // freed. what it did take has to be waited out before returning
+                unsigned left = tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+                __atomic_store_n(ring.sqTail, tail - left, __ATOMIC_RELEASE);
+                inFlight -= left;
+                ok = false;
+
+                if(inFlight > 0) std::this_thread::yield();
+            }
+        }
+
+        if(!ocarn2__uring_reap(ring, reads, waiting, inFlight, unsupported)) ok = false;
+    }
+
+    return ok;
+}
+
+// each worker thread gets its own ring, since a ring isn't safe to share
+static thread_local ocarn2__uring* ocarn2__worker_ring = nullptr;
+
+#endif
+
+
+/**
+ * Internal function to run a batch of reads against a file, through io_uring if this worker has a ring
+ *
+ * @param filename
+ * @param reads
+ * @return
+ */
+OCARN2_DEF bool ocarn2__read_batch(const std::string& filename, std::vector<ocarn2__read>& reads) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    OCARN2__STATS_IO(1, 0);
+    if(fd < 0) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+
+#ifdef OCARN2__IO_URING
+    if(ocarn2__worker_ring) {
+        bool unsupported = false;
+        ok = ocarn2__uring_read_batch(*ocarn2__worker_ring, fd, reads, unsupported);
+
+        if(!unsupported) {
+            close(fd);
+            return ok;
+        }
+
+        // the kernel turned the reads down. stop using the ring on this worker and redo the batch with pread,
+        // reads that finished already are read again, short ones carry on from where they got to
+        ocarn2__uring_free(*ocarn2__worker_ring);
+        ocarn2__worker_ring = nullptr;
+        ok = true;
+    }
+#endif
+
+    for(auto& read: reads) {
+        uint64_t done = 0;
+
+        while(ok && done < read.size) {
+            ssize_t got = ::pread(fd, read.destination + done, read.size - done, (off_t) (read.offset + done));
+            OCARN2__STATS_IO(1, got > 0 ? got : 0);
+            if(got < 0 && errno == EINTR) continue;
+            if(got <= 0) ok = false;
+            else done += got;
+        }
+    }
+
+    close(fd);
+    return ok;
+#else
+    bool ok = false;
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        for(auto& read: reads) {
+            file.seekg((std::streamoff) read.offset, std::ios::beg);
+            file.read((char*) read.destination, read.size);
+        }
+
+        ok = (bool) file;
+    });
+
+    return ok;
+#endif
+}
+
+/**
+ * Internal function to read a whole file in readSize blocks, all submitted as one batch
+ *
+ * @param loader
+ * @param filename
+ * @param contents
+ * @return
+ */
+OCARN2_DEF bool ocarn2__read_whole_file(OCARN2::AsyncLoader* loader, const std::string& filename, std::vector<unsigned char>& contents) {
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(filename, error);
+    if(error) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+
+    contents.resize(size);
+
+    uint32_t block = std::max<uint32_t>(4096, loader->options.readSize);
+    std::vector<ocarn2__read> reads;
+
+    for(uint64_t offset=0; offset < size; offset += block)
+        reads.push_back({ offset, (uint32_t) std::min<uint64_t>(block, size - offset), contents.data() + offset });
+
+    return ocarn2__read_batch(filename, reads);
+}
+
+/**
+ * Internal function to queue a load on the workers. load runs on a worker, callback runs on the worker
+ * too if onWorker is set, otherwise in poll_async_loader
+ */
+template<typename T>
+void ocarn2__async_submit(OCARN2::AsyncLoader* loader, std::function<bool(T&)> load, OCARN2::AsyncCallback<T> callback, bool onWorker) {
+    loader->pending++;
+
+    auto job = [loader, load, callback, onWorker]() {
+        auto result = std::make_shared<T>();
+        bool ok = false;
+
+        // a throwing load (eg out of memory) is a failed load, not the end of the worker
+        try {
+            ok = load(*result);
+        } catch(const std::exception& e) {
+            std::cerr << "Async load failed: " << e.what() << std::endl;
+        } catch(...) {
+            std::cerr << "Async load failed with an unknown exception" << std::endl;
+        }
+
+        if(onWorker) {
+            try {
+                if(callback) callback(*result, ok);
+            } catch(const std::exception& e) {
+                std::cerr << "Async load callback threw: " << e.what() << std::endl;
+            } catch(...) {
+                std::cerr << "Async load callback threw an unknown exception" << std::endl;
+            }
+
+            loader->pending--;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(loader->completedMutex);
+        loader->completed.emplace_back([result, ok, callback]() {
+            if(callback) callback(*result, ok);
+        });
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->jobs.emplace_back(job);
+    }
+
+    loader->wake.notify_one();
+}
+
+/**
+ * Internal function to wrap a load in a future. The promise is settled on the worker, so futures
+ * don't need poll_async_loader to be called
+ */
+template<typename T, typename R>
+std::future<R> ocarn2__async_future(OCARN2::AsyncLoader* loader, const std::string& filename, std::function<bool(T&)> load, std::function<R(T&)> take) {
+    auto promise = std::make_shared<std::promise<R>>();
+    std::future<R> future = promise->get_future();
+
+    ocarn2__async_submit<T>(loader, load, [promise, take, filename](T& result, bool ok) {
+        if(!ok) {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error("Unable to load " + filename)));
+            return;
+        }
+
+        promise->set_value(take(result));
+    }, true);
+
+    return future;
+}
+
+
+// the loads themselves, run on a worker
+
+OCARN2_DEF std::function<bool(OCARN2::Mesh&)> ocarn2__async_3df_job(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return [loader, filename](OCARN2::Mesh& mesh) {
+        OCARN2__STATS_LOAD("load_3df_file_async", filename);
+        OCARN2__STATS_SECTION("read");
+
+        std::vector<unsigned char> contents;
+        if(!ocarn2__read_whole_file(loader, filename, contents)) return false;
+
+        ocarn2__membuf buffer(contents.data(), contents.size());
+        std::istream in(&buffer);
+        return ocarn2__load_3df(in, mesh);
+    };
+}
+
+OCARN2_DEF std::function<bool(OCARN2::Mesh&)> ocarn2__async_car_job(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return [loader, filename](OCARN2::Mesh& mesh) {
+        OCARN2__STATS_LOAD("load_car_file_async", filename);
+        OCARN2__STATS_SECTION("read");
+
+        std::vector<unsigned char> contents;
+        if(!ocarn2__read_whole_file(loader, filename, contents)) return false;
+
+        ocarn2__membuf buffer(contents.data(), contents.size());
+        std::istream in(&buffer);
+        return ocarn2__load_car(in, mesh);
+    };
+}
+
+OCARN2_DEF std::function<bool(OCARN2::Rsc&)> ocarn2__async_rsc_job(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return [loader, filename](OCARN2::Rsc& rsc) {
+        OCARN2__STATS_LOAD("load_rsc_file_async", filename);
+        OCARN2__STATS_SECTION("read");
+
+        std::vector<unsigned char> contents;
+        if(!ocarn2__read_whole_file(loader, filename, contents)) return false;
+
+        ocarn2__membuf buffer(contents.data(), contents.size());
+        std::istream in(&buffer);
+        return ocarn2__load_rsc(in, rsc);
+    };
+}
+
+// the twelve planes are read straight into the map in a single batch, no parsing needed
+OCARN2_DEF std::function<bool(OCARN2::Map&)> ocarn2__async_map_job(const std::string& filename) {
+    return [filename](OCARN2::Map& map) {
+        OCARN2__STATS_LOAD("load_map_file_async", filename);
+        OCARN2__STATS_SECTION("read");
+
+        std::vector<ocarn2__read> reads;
+
+        for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+            OCARN2::MapPlane plane = (OCARN2::MapPlane) p;
+            OCARN2::MapPlaneInfo info = map_plane_info(plane);
+
+            reads.push_back({ info.fileOffset, info.width * info.width * info.cellSize, map_plane_data(map, plane) });
+        }
+
+        return ocarn2__read_batch(filename, reads);
+    };
+}
+
+
+/**
+ * Starts the worker threads. Free it with free_async_loader
+ *
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::AsyncLoader* create_async_loader(const OCARN2::AsyncLoaderOptions& options) {
+    auto* loader = new OCARN2::AsyncLoader();
+    loader->options = options;
+
+    unsigned threads = std::max(1u, options.threads);
+
+    std::mutex startMutex;
+    std::condition_variable startedWake;
+    unsigned started = 0, ringsReady = 0;
+
+    for(unsigned t=0; t < threads; t++) {
+        loader->workers.emplace_back([loader, &startMutex, &startedWake, &started, &ringsReady]() {
+            bool hasRing = false;
+
+#ifdef OCARN2__IO_URING
+            ocarn2__uring ring;
+            if(loader->options.useIoUring && ocarn2__uring_init(ring, std::max(1u, loader->options.queueDepth))) {
+                ocarn2__worker_ring = &ring;
+                hasRing = true;
+            }
+#endif
+
+            // notified under the lock, so create_async_loader can't return and take the condition variable
+            // with it before the notify is done
+            {
+                std::lock_guard<std::mutex> lock(startMutex);
+                started++;
+                if(hasRing) ringsReady++;
+                startedWake.notify_one();
+            }
+
+            while(true) {
+                std::function<void()> job;
+
+                {
+                    std::unique_lock<std::mutex> lock(loader->mutex);
+                    loader->wake.wait(lock, [loader]() { return loader->stopping || !loader->jobs.empty(); });
+
+                    if(loader->jobs.empty()) break;
+
+                    job = std::move(loader->jobs.front());
+                    loader->jobs.pop_front();
+                }
+
+                job();
+            }
+
+#ifdef OCARN2__IO_URING
+            ocarn2__worker_ring = nullptr;
+            ocarn2__uring_free(ring);
+#endif
+        });
+    }
+
+    // wait for the workers to set up their rings, so usingIoUring is right from the start
+    {
+        std::unique_lock<std::mutex> lock(startMutex);
+        startedWake.wait(lock, [&]() { return started == threads; });
+        loader->usingIoUring = ringsReady == threads;
+    }
+
+    return loader;
+}
+
+/**
+ * Finishes every queued load, runs any callbacks that haven't been polled yet, then stops the workers
+ *
+ * @param loader
+ */
+OCARN2_DEF void free_async_loader(OCARN2::AsyncLoader* loader) {
+    if(!loader) return;
+
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->stopping = true;
+    }
+
+    loader->wake.notify_all();
+    for(auto& w: loader->workers) w.join();
+
+    poll_async_loader(loader);
+
+    delete loader;
+}
+
+/**
+ * Runs the callbacks of every load that has finished since the last poll, on the calling thread
+ *
+ * @param loader
+ * @return number of callbacks run
+ */
+OCARN2_DEF size_t poll_async_loader(OCARN2::AsyncLoader* loader) {
+    std::deque<std::function<void()>> ready;
+
+    {
+        std::lock_guard<std::mutex> lock(loader->completedMutex);
+        ready.swap(loader->completed);
+    }
+
+    for(auto& callback: ready) {
+        callback();
+        loader->pending--;
+    }
+
+    return ready.size();
+}
+
+/**
+ * Number of loads that are queued, in progress, or waiting for their callback to be polled
+ *
+ * @param loader
+ * @return
+ */
+OCARN2_DEF size_t async_loads_pending(OCARN2::AsyncLoader* loader) {
+    return loader->pending;
+}
+
+
+/**
+ * Queues a .3df load. callback gets the mesh, and whether every read succeeded
+ */
+OCARN2_DEF void load_3df_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Mesh> callback) {
+    ocarn2__async_submit<OCARN2::Mesh>(loader, ocarn2__async_3df_job(loader, filename), callback, loader->options.callbackOnWorker);
+}
+
+OCARN2_DEF void load_car_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Mesh> callback) {
+    ocarn2__async_submit<OCARN2::Mesh>(loader, ocarn2__async_car_job(loader, filename), callback, loader->options.callbackOnWorker);
+}
+
+OCARN2_DEF void load_rsc_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Rsc> callback) {
+    ocarn2__async_submit<OCARN2::Rsc>(loader, ocarn2__async_rsc_job(loader, filename), callback, loader->options.callbackOnWorker);
+}
+
+OCARN2_DEF void load_map_file_async(OCARN2::AsyncLoader* loader, const std::string& filename, OCARN2::AsyncCallback<OCARN2::Map> callback) {
+    ocarn2__async_submit<OCARN2::Map>(loader, ocarn2__async_map_job(filename), callback, loader->options.callbackOnWorker);
+}
+
+
+/**
+ * Same as the *_async functions, but the result comes back through a future. A failed load
+ * throws from future.get()
+ */
+OCARN2_DEF std::future<OCARN2::Mesh> load_3df_file_future(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return ocarn2__async_future<OCARN2::Mesh, OCARN2::Mesh>(loader, filename, ocarn2__async_3df_job(loader, filename), [](OCARN2::Mesh& m) { return std::move(m); });
+}
+
+OCARN2_DEF std::future<OCARN2::Mesh> load_car_file_future(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return ocarn2__async_future<OCARN2::Mesh, OCARN2::Mesh>(loader, filename, ocarn2__async_car_job(loader, filename), [](OCARN2::Mesh& m) { return std::move(m); });
+}
+
+// Rsc is too big to hand around by value, so it comes back on the heap
+OCARN2_DEF std::future<std::unique_ptr<OCARN2::Rsc>> load_rsc_file_future(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return ocarn2__async_future<OCARN2::Rsc, std::unique_ptr<OCARN2::Rsc>>(loader, filename, ocarn2__async_rsc_job(loader, filename), [](OCARN2::Rsc& r) {
+        return std::unique_ptr<OCARN2::Rsc>(new OCARN2::Rsc(std::move(r)));
+    });
+}
+
+OCARN2_DEF std::future<OCARN2::Map> load_map_file_future(OCARN2::AsyncLoader* loader, const std::string& filename) {
+    return ocarn2__async_future<OCARN2::Map, OCARN2::Map>(loader, filename, ocarn2__async_map_job(filename), [](OCARN2::Map& m) { return std::move(m); });
+}
+
+#endif
@@ -0,0 +1,660 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for packing an area's textures into one texture, so they can be uploaded and bound once.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * Terrain textures (Rsc::textures) and model textures (each RscModel's mesh) go into separate atlases. Textures
+ * are packed into rows on pages, and pages are stacked as layers, so a 2D atlas is one big page and an array
+ * texture is a page per texture (eg pageWidth = pageHeight = 128 with no gutter for terrain). Identical
+ * textures are only stored once, and with a Map only the terrain textures it uses are stored.
+ *
+ * Every texture gets a gutter of texels around it, wrapped around from the other side for terrain (tiles repeat)
+ * and the edge texels stretched out for models. Places and sizes are kept to multiples of the gutter, so a gutter
+ * of 2^n keeps the first n mip levels from bleeding into the neighbours.
+ *
+ * remap_map_textures points textureMap and textureMapFar at atlas rects, and remap_model_uvs moves model face
+ * texture coordinates into the atlas (the page to sample is the model's rect's layer). Both only go one way,
+ * remap a copy if the originals are needed again. Atlases can be saved and loaded, and the cached_* functions
+ * only build one when the textures or options have changed since the file was written. Given the files the
+ * textures came from, the cached_* functions go by their sizes and modification times, so a cache hit doesn't
+ * touch the textures or the map at all. Otherwise every texture is hashed.
+ *
+ * main methods are
+ *
+ * TextureAtlas build_terrain_atlas(const Rsc& rsc, const Map* map, const AtlasOptions& options);
+ * TextureAtlas build_model_atlas(const Rsc& rsc, const AtlasOptions& options);
+ * void remap_map_textures(Map& map, const TextureAtlas& atlas);
+ * bool remap_model_uvs(Rsc& rsc, const TextureAtlas& atlas);
+ * TextureAtlas cached_terrain_atlas(const Rsc& rsc, const Map* map, const std::string& filename, const AtlasOptions& options,
+ *                                   const std::vector<std::string>& sourceFiles);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct AtlasOptions {
+        // size of each page (layer). textures are placed on the first page with room
+        uint32_t pageWidth = 2048, pageHeight = 2048;
+
+        // texels around each texture. a power of two keeps that many doublings of mip levels clean
+        uint32_t gutter = 4;
+
+        // a single page is cut down to the smallest power of two height that holds everything
+        bool trimHeight = true;
+
+        // store identical textures once
+        bool deduplicate = true;
+
+        // threads used to hash and copy textures. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    // where a texture landed, not counting its gutter
+    struct AtlasRect {
+        uint32_t x, y, layer;
+        uint32_t width, height;
+    };
+
+    struct TextureAtlas {
+        uint32_t width = 0, height = 0, layers = 0;
+        uint32_t gutter = 0;
+
+        // 16 bit texels like the textures they came from, width * height per layer
+        std::vector<uint16_t> texels;
+
+        std::vector<AtlasRect> rects;
+
+        // source texture (or model) number to its rect, or ATLAS_NONE if it wasn't stored
+        std::vector<uint16_t> remap;
+
+        // hash of the textures (or the sizes and times of the files they came from) and options the atlas was built from
+        uint64_t sourceHash = 0;
+    };
+
+    static const uint16_t ATLAS_NONE = 0xffff;
+}
+
+
+OCARN2_DEF OCARN2::TextureAtlas build_terrain_atlas(const OCARN2::Rsc& rsc, const OCARN2::Map* map = nullptr, const OCARN2::AtlasOptions& options = {});
+OCARN2_DEF OCARN2::TextureAtlas build_model_atlas(const OCARN2::Rsc& rsc, const OCARN2::AtlasOptions& options = {});
+OCARN2_DEF void remap_map_textures(OCARN2::Map& map, const OCARN2::TextureAtlas& atlas);
+OCARN2_DEF bool remap_model_uvs(OCARN2::Rsc& rsc, const OCARN2::TextureAtlas& atlas);
+
+OCARN2_DEF bool save_texture_atlas(const OCARN2::TextureAtlas& atlas, const std::string& filename);
+OCARN2_DEF OCARN2::TextureAtlas load_texture_atlas(const std::string& filename);
+OCARN2_DEF OCARN2::TextureAtlas cached_terrain_atlas(const OCARN2::Rsc& rsc, const OCARN2::Map* map, const std::string& filename,
+                                                     const OCARN2::AtlasOptions& options = {}, const std::vector<std::string>& sourceFiles = {});
+OCARN2_DEF OCARN2::TextureAtlas cached_model_atlas(const OCARN2::Rsc& rsc, const std::string& filename, const OCARN2::AtlasOptions& options = {},
+                                                   const std::vector<std::string>& sourceFiles = {});
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <filesystem>
+
+static const char ocarn2__atlas_magic[4] = { 'O', 'C', 'A', 'T' };
+static const uint32_t ocarn2__atlas_version = 1;
+
+/**
+ * Internal description of one texture going into an atlas
+ */
+struct ocarn2__atlas_source {
+    const uint16_t* texels; // nullptr if there's nothing to store
+    uint32_t width, height;
+    uint64_t hash;
+};
+
+/**
+ * Internal function to hash some bytes, carrying on from hash. FNV-1a, but 8 bytes at a time with a shift
+ * to mix the high bits back down, since textures add up to megabytes. Big inputs go through four lanes that
+ * don't wait on each other, then the lanes are folded in
+ *
+ * @param hash
+ * @param data
+ * @param size in bytes
+ * @return
+ */
+static uint64_t ocarn2__atlas_hash(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*) data;
+
+    size_t i = 0;
+    if(size >= 32) {
+        uint64_t lanes[4] = { hash, hash ^ 0x9e3779b97f4a7c15ull, hash ^ 0xc2b2ae3d27d4eb4full, hash ^ 0x165667b19e3779f9ull };
+
+        for(; i + 32 <= size; i += 32) {
+            for(int l=0; l < 4; l++) {
+                uint64_t word;
+                memcpy(&word, bytes + i + l * 8, 8);
+                lanes[l] = (lanes[l] ^ word) * 1099511628211ull;
+                lanes[l] ^= lanes[l] >> 32;
+            }
+        }
+
+        for(uint64_t lane: lanes) {
+            hash = (hash ^ lane) * 1099511628211ull;
+            hash ^= hash >> 32;
+        }
+    }
+
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+    for(; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+/**
+ * Internal function to hash every source on its own, then all of them together with the options, for the cache
+ *
+ * @param sources
+ * @param options
+ * @param wrap
+ * @return
+ */
+static uint64_t ocarn2__atlas_hash_sources(std::vector<ocarn2__atlas_source>& sources, const OCARN2::AtlasOptions& options, bool wrap) {
+    ocarn2__parallel_for(sources.size(), options.threads, [&](size_t i) {
+        ocarn2__atlas_source& source = sources[i];
+        uint32_t size[2] = { source.width, source.height };
+
+        source.hash = ocarn2__atlas_hash(14695981039346656037ull, size, sizeof(size));
+        if(source.texels) source.hash = ocarn2__atlas_hash(source.hash, source.texels, (size_t) source.width * source.height * 2);
+    });
+
+    uint32_t settings[6] = { options.pageWidth, options.pageHeight, options.gutter, options.trimHeight, options.deduplicate, wrap };
+    uint64_t hash = ocarn2__atlas_hash(14695981039346656037ull, settings, sizeof(settings));
+
+    // which textures are left out changes the atlas too
+    for(const ocarn2__atlas_source& source: sources) {
+        uint64_t parts[2] = { source.hash, source.texels != nullptr };
+        hash = ocarn2__atlas_hash(hash, parts, sizeof(parts));
+    }
+
+    return hash;
+}
+
+/**
+ * Internal function to pack sources into an atlas. Sources without texels aren't stored. Everything is rounded
+ * up to a multiple of the gutter, and rows of textures are filled tallest first
+ *
+ * @param sources
+ * @param options
+ * @param wrap true to fill gutters from the opposite edge, false to repeat the edge texels
+ * @param hash
+ * @return empty atlas if a texture doesn't fit on a page
+ */
+static OCARN2::TextureAtlas ocarn2__build_atlas(const std::vector<ocarn2__atlas_source>& sources, const OCARN2::AtlasOptions& options,
+                                                bool wrap, uint64_t hash) {
+    OCARN2::TextureAtlas atlas;
+    atlas.gutter = options.gutter;
+    atlas.sourceHash = hash;
+    atlas.remap.assign(sources.size(), OCARN2::ATLAS_NONE);
+
+    uint32_t gutter = options.gutter;
+    uint32_t align = std::max(1u, gutter);
+    auto round_up = [align](uint32_t value) { return (value + align - 1) / align * align; };
+
+    // one rect per different texture
+    std::vector<uint32_t> unique;
+    for(uint32_t i=0; i < sources.size(); i++) {
+        const ocarn2__atlas_source& source = sources[i];
+        if(!source.texels || source.width == 0 || source.height == 0) continue;
+
+        if(options.deduplicate) {
+            for(uint32_t u: unique) {
+                const ocarn2__atlas_source& other = sources[u];
+                if(other.hash == source.hash && other.width == source.width && other.height == source.height &&
+                   memcmp(other.texels, source.texels, (size_t) source.width * source.height * 2) == 0) {
+                    atlas.remap[i] = atlas.remap[u];
+                    break;
+                }
+            }
+            if(atlas.remap[i] != OCARN2::ATLAS_NONE) continue;
+        }
+
+        if(unique.size() >= OCARN2::ATLAS_NONE) {
+            std::cerr << "Too many textures for an atlas" << std::endl;
+            return {};
+        }
+
+        atlas.remap[i] = (uint16_t) unique.size();
+        unique.push_back(i);
+    }
+
+    // tallest first, so rows waste as little as possible
+    std::vector<uint32_t> order(unique.size());
+    for(uint32_t i=0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return sources[unique[a]].height > sources[unique[b]].height;
+    });
+
+    atlas.rects.resize(unique.size());
+    uint32_t x = 0, y = 0, rowHeight = 0, layer = 0, usedHeight = 0;
+
+    for(uint32_t r: order) {
+        const ocarn2__atlas_source& source = sources[unique[r]];
+        uint32_t cellWidth = round_up(source.width + gutter * 2);
+        uint32_t cellHeight = round_up(source.height + gutter * 2);
+
+        if(cellWidth > options.pageWidth || cellHeight > options.pageHeight) {
+            std::cerr << "A " << source.width << "x" << source.height << " texture doesn't fit on a "
+                      << options.pageWidth << "x" << options.pageHeight << " atlas page" << std::endl;
+            return {};
+        }
+
+        if(x + cellWidth > options.pageWidth) {
+            x = 0;
+            y += rowHeight;
+            rowHeight = 0;
+        }
+        if(y + cellHeight > options.pageHeight) {
+            x = y = 0;
+            layer++;
+        }
+
+        atlas.rects[r] = { x + gutter, y + gutter, layer, source.width, source.height };
+        x += cellWidth;
+        rowHeight = std::max(rowHeight, cellHeight);
+        usedHeight = std::max(usedHeight, y + cellHeight);
+    }
+
+    atlas.width = options.pageWidth;
+    atlas.height = options.pageHeight;
+    atlas.layers = unique.empty() ? 0 : layer + 1;
+
+    if(options.trimHeight && atlas.layers == 1) {
+        uint32_t height = 1;
+        while(height < usedHeight) height *= 2;
+        atlas.height = std::min(height, options.pageHeight);
+    }
+
+    // copy each texture and its gutter in
+    atlas.texels.assign((size_t) atlas.width * atlas.height * atlas.layers, 0);
+
+    ocarn2__parallel_for(unique.size(), options.threads, [&](size_t r) {
+        const ocarn2__atlas_source& source = sources[unique[r]];
+        const OCARN2::AtlasRect& rect = atlas.rects[r];
+        int32_t w = (int32_t) source.width, h = (int32_t) source.height, g = (int32_t) gutter;
+
+        uint16_t* page = &atlas.texels[(size_t) rect.layer * atlas.width * atlas.height];
+
+        for(int32_t ty = -g; ty < h + g; ty++) {
+            int32_t sy = wrap ? ((ty % h) + h) % h : std::min(std::max(ty, 0), h - 1);
+            const uint16_t* row = source.texels + (size_t) sy * w;
+            uint16_t* out = page + (size_t) (rect.y + ty) * atlas.width + rect.x;
+
+            for(int32_t tx = -g; tx < 0; tx++) out[tx] = row[wrap ? ((tx % w) + w) % w : 0];
+            memcpy(out, row, (size_t) w * 2);
+            for(int32_t tx = w; tx < w + g; tx++) out[tx] = row[wrap ? tx % w : w - 1];
+        }
+    });
+
+    return atlas;
+}
+
+/**
+ * Internal function to list the terrain textures that go into an atlas. With a map, unused ones are left out
+ *
+ * @param rsc
+ * @param map
+ * @return
+ */
+static std::vector<ocarn2__atlas_source> ocarn2__terrain_atlas_sources(const OCARN2::Rsc& rsc, const OCARN2::Map* map) {
+    std::vector<ocarn2__atlas_source> sources(rsc.textures.size());
+
+    std::vector<unsigned char> used(rsc.textures.size(), map ? 0 : 1);
+    if(map) {
+        for(const std::vector<uint16_t>* plane: { &map->textureMap, &map->textureMapFar }) {
+            for(uint16_t texture: *plane) {
+                if(texture < used.size()) used[texture] = 1;
+            }
+        }
+    }
+
+    for(size_t i=0; i < rsc.textures.size(); i++) {
+        const OCARN2::Texture& texture = rsc.textures[i];
+
+        // terrain textures are 128 wide
+        uint32_t height = texture.size / 2 / 128;
+        sources[i] = { used[i] && height ? texture.data : nullptr, 128, height, 0 };
+    }
+
+    return sources;
+}
+
+/**
+ * Internal function to list the model textures that go into an atlas
+ *
+ * @param rsc
+ * @return
+ */
+static std::vector<ocarn2__atlas_source> ocarn2__model_atlas_sources(const OCARN2::Rsc& rsc) {
+    std::vector<ocarn2__atlas_source> sources(rsc.models.size());
+
+    for(size_t i=0; i < rsc.models.size(); i++) {
+        const OCARN2::Mesh& mesh = rsc.models[i].mesh;
+
+        // model textures are 256 wide
+        uint32_t height = mesh.textureSize / 2 / 256;
+        sources[i] = { height ? mesh.textureData : nullptr, 256, height, 0 };
+    }
+
+    return sources;
+}
+
+/**
+ * Packs the terrain textures of an rsc into an atlas. With a map, only the textures it uses are packed
+ *
+ * @param rsc
+ * @param map optional
+ * @param options
+ * @return empty atlas if a texture doesn't fit on a page
+ */
+OCARN2_DEF OCARN2::TextureAtlas build_terrain_atlas(const OCARN2::Rsc& rsc, const OCARN2::Map* map, const OCARN2::AtlasOptions& options) {
+    std::vector<ocarn2__atlas_source> sources = ocarn2__terrain_atlas_sources(rsc, map);
+    uint64_t hash = ocarn2__atlas_hash_sources(sources, options, true);
+
+    return ocarn2__build_atlas(sources, options, true, hash);
+}
+
+/**
+ * Packs the textures of every model in an rsc into an atlas
+ *
+ * @param rsc
+ * @param options
+ * @return empty atlas if a texture doesn't fit on a page
+ */
+OCARN2_DEF OCARN2::TextureAtlas build_model_atlas(const OCARN2::Rsc& rsc, const OCARN2::AtlasOptions& options) {
+    std::vector<ocarn2__atlas_source> sources = ocarn2__model_atlas_sources(rsc);
+    uint64_t hash = ocarn2__atlas_hash_sources(sources, options, false);
+
+    return ocarn2__build_atlas(sources, options, false, hash);
+}
+
+/**
+ * Points every cell of textureMap and textureMapFar at its texture's rect in a terrain atlas. Textures that
+ * aren't in the atlas become ATLAS_NONE
+ *
+ * @param map
+ * @param atlas
+ */
+OCARN2_DEF void remap_map_textures(OCARN2::Map& map, const OCARN2::TextureAtlas& atlas) {
+    for(std::vector<uint16_t>* plane: { &map.textureMap, &map.textureMapFar }) {
+        for(uint16_t& texture: *plane) {
+            texture = texture < atlas.remap.size() ? atlas.remap[texture] : OCARN2::ATLAS_NONE;
+        }
+    }
+}
+
+/**
+ * Moves the texture coordinates of every model's faces to where its texture is in a model atlas. The layer to
+ * sample is atlas.rects[atlas.remap[model]].layer
+ *
+ * @param rsc
+ * @param atlas built from this rsc with build_model_atlas
+ * @return false if the atlas wasn't built from this rsc's models
+ */
+OCARN2_DEF bool remap_model_uvs(OCARN2::Rsc& rsc, const OCARN2::TextureAtlas& atlas) {
+    if(atlas.remap.size() != rsc.models.size()) {
+        std::cerr << "Atlas has " << atlas.remap.size() << " textures, the rsc has " << rsc.models.size() << " models" << std::endl;
+        return false;
+    }
+
+    for(size_t m=0; m < rsc.models.size(); m++) {
+        if(atlas.remap[m] == OCARN2::ATLAS_NONE) continue;
+
+        const OCARN2::AtlasRect& rect = atlas.rects[atlas.remap[m]];
+        for(OCARN2::Face& face: rsc.models[m].mesh.faces) {
+            face.tax += (int32_t) rect.x; face.tbx += (int32_t) rect.x; face.tcx += (int32_t) rect.x;
+            face.tay += (int32_t) rect.y; face.tby += (int32_t) rect.y; face.tcy += (int32_t) rect.y;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes an atlas to a file
+ *
+ * @param atlas
+ * @param filename
+ * @return
+ */
+OCARN2_DEF bool save_texture_atlas(const OCARN2::TextureAtlas& atlas, const std::string& filename) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+
+    uint32_t header[6] = { ocarn2__atlas_version, atlas.width, atlas.height, atlas.layers, atlas.gutter, (uint32_t) atlas.rects.size() };
+    uint32_t numRemap = (uint32_t) atlas.remap.size();
+
+    file.write(ocarn2__atlas_magic, 4);
+    file.write((char*) header, sizeof(header));
+    file.write((char*) &atlas.sourceHash, 8);
+    file.write((char*) &numRemap, 4);
+    file.write((char*) atlas.rects.data(), atlas.rects.size() * sizeof(OCARN2::AtlasRect));
+    file.write((char*) atlas.remap.data(), atlas.remap.size() * 2);
+    file.write((char*) atlas.texels.data(), atlas.texels.size() * 2);
+
+    return file.good();
+}
+
+/**
+ * Internal function to read the fixed part of an atlas file, up to where the rects start
+ *
+ * @return false if it isn't an atlas file
+ */
+static bool ocarn2__atlas_read_header(std::istream& file, uint32_t (&header)[6], uint64_t& hash, uint32_t& numRemap) {
+    char magic[4];
+
+    file.read(magic, 4);
+    file.read((char*) header, sizeof(header));
+    file.read((char*) &hash, 8);
+    file.read((char*) &numRemap, 4);
+
+    return file && memcmp(magic, ocarn2__atlas_magic, 4) == 0 && header[0] == ocarn2__atlas_version;
+}
+
+/**
+ * Reads an atlas written by save_texture_atlas. On failure the returned atlas is empty, and why is logged
+ *
+ * @param filename
+ * @return
+ */
+OCARN2_DEF OCARN2::TextureAtlas load_texture_atlas(const std::string& filename) {
+    OCARN2::TextureAtlas atlas;
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        uint32_t header[6] = {};
+        uint64_t hash = 0;
+        uint32_t numRemap = 0;
+
+        if(!ocarn2__atlas_read_header(file, header, hash, numRemap)) {
+            std::cerr << filename << " is not an atlas file" << std::endl;
+            return;
+        }
+
+        // check the sizes add up to the file before allocating anything
+        uint64_t start = (uint64_t) file.tellg();
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = (uint64_t) file.tellg();
+        file.seekg((std::streamoff) start, std::ios::beg);
+
+        uint64_t numTexels = (uint64_t) header[1] * header[2] * header[3];
+        uint64_t needed = (uint64_t) header[5] * sizeof(OCARN2::AtlasRect) + (uint64_t) numRemap * 2 + numTexels * 2;
+        if(needed != fileSize - start) {
+            std::cerr << filename << " should have " << needed << " bytes after its header but has " << fileSize - start << std::endl;
+            return;
+        }
+
+        OCARN2::TextureAtlas loaded;
+        loaded.width = header[1];
+        loaded.height = header[2];
+        loaded.layers = header[3];
+        loaded.gutter = header[4];
+        loaded.sourceHash = hash;
+        loaded.rects.resize(header[5]);
+        loaded.remap.resize(numRemap);
+        loaded.texels.resize(numTexels);
+
+        file.read((char*) loaded.rects.data(), loaded.rects.size() * sizeof(OCARN2::AtlasRect));
+        file.read((char*) loaded.remap.data(), loaded.remap.size() * 2);
+        file.read((char*) loaded.texels.data(), loaded.texels.size() * 2);
+        if(!file) {
+            std::cerr << "Unable to read " << filename << std::endl;
+            return;
+        }
+
+        for(size_t i=0; i < loaded.remap.size(); i++) {
+            uint16_t r = loaded.remap[i];
+            if(r != OCARN2::ATLAS_NONE && r >= loaded.rects.size()) {
+                std::cerr << filename << " maps texture " << i << " to rect " << r << " of " << loaded.rects.size() << std::endl;
+                return;
+            }
+        }
+        for(size_t i=0; i < loaded.rects.size(); i++) {
+            const OCARN2::AtlasRect& rect = loaded.rects[i];
+            if(rect.layer >= loaded.layers || (uint64_t) rect.x + rect.width > loaded.width || (uint64_t) rect.y + rect.height > loaded.height) {
+                std::cerr << filename << " has rect " << i << " outside its " << loaded.width << "x" << loaded.height << "x"
+                          << loaded.layers << " pages" << std::endl;
+                return;
+            }
+        }
+
+        atlas = std::move(loaded);
+    });
+
+    return atlas;
+}
+
+/**
+ * Internal function to hash the sizes and modification times of the files an atlas's textures came from,
+ * with the options, instead of the textures themselves
+ *
+ * @param sourceFiles
+ * @param options
+ * @param wrap
+ * @param hash
+ * @return false if there are no files or one of them can't be looked at, so the textures have to be hashed
+ */
+static bool ocarn2__atlas_hash_files(const std::vector<std::string>& sourceFiles, const OCARN2::AtlasOptions& options, bool wrap, uint64_t& hash) {
+    if(sourceFiles.empty()) return false;
+
+    // a different start to ocarn2__atlas_hash_sources, so the two kinds of key never match each other
+    uint32_t settings[7] = { options.pageWidth, options.pageHeight, options.gutter, options.trimHeight, options.deduplicate, wrap, 0x46494c45 };
+    hash = ocarn2__atlas_hash(14695981039346656037ull, settings, sizeof(settings));
+
+    for(const std::string& file: sourceFiles) {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(file, error);
+        if(error) return false;
+
+        int64_t time = (int64_t) std::filesystem::last_write_time(file, error).time_since_epoch().count();
+        if(error) return false;
+
+        uint64_t parts[2] = { size, (uint64_t) time };
+        hash = ocarn2__atlas_hash(hash, file.data(), file.size());
+        hash = ocarn2__atlas_hash(hash, parts, sizeof(parts));
+    }
+
+    return true;
+}
+
+/**
+ * Internal function to load an atlas from its cache file if it was built from the same sources, or build it and
+ * write the cache file if not. Only the header is read until the key is known to match
+ *
+ * @param list the sources, only called when they're needed
+ * @param count number of sources, what the cached remap has to hold
+ * @param options
+ * @param wrap
+ * @param filename
+ * @param sourceFiles if not empty, the cache is keyed on these files rather than on the textures
+ * @return
+ */
+static OCARN2::TextureAtlas ocarn2__cached_atlas(const std::function<std::vector<ocarn2__atlas_source>()>& list, size_t count,
+                                                 const OCARN2::AtlasOptions& options, bool wrap, const std::string& filename,
+                                                 const std::vector<std::string>& sourceFiles) {
+    std::vector<ocarn2__atlas_source> sources;
+    uint64_t hash = 0;
+
+    bool stamped = ocarn2__atlas_hash_files(sourceFiles, options, wrap, hash);
+    if(!stamped) {
+        sources = list();
+        hash = ocarn2__atlas_hash_sources(sources, options, wrap);
+    }
+
+    bool matches = false;
+    {
+        std::ifstream file(filename, std::ios::binary);
+        uint32_t header[6] = {};
+        uint64_t cachedHash = 0;
+        uint32_t numRemap = 0;
+
+        matches = file.is_open() && ocarn2__atlas_read_header(file, header, cachedHash, numRemap) && cachedHash == hash && numRemap == count;
+    }
+
+    if(matches) {
+        OCARN2::TextureAtlas cached = load_texture_atlas(filename);
+        if(cached.sourceHash == hash && cached.remap.size() == count) return cached;
+    }
+
+    // building needs every texture's own hash to find duplicates, even when the key came from the files
+    if(stamped) {
+        sources = list();
+        ocarn2__atlas_hash_sources(sources, options, wrap);
+    }
+
+    OCARN2::TextureAtlas atlas = ocarn2__build_atlas(sources, options, wrap, hash);
+    if(!atlas.remap.empty()) save_texture_atlas(atlas, filename);
+
+    return atlas;
+}
+
+/**
+ * Same as build_terrain_atlas, but loads the atlas from filename if it was built from the same textures with
+ * the same options, and writes it there if not
+ *
+ * @param rsc
+ * @param map optional
+ * @param filename
+ * @param options
+ * @param sourceFiles optional, the .rsc (and .map) the textures came from. when given, a cache hit only looks at
+ *                    their sizes and modification times instead of hashing the textures and scanning the map
+ * @return
+ */
+OCARN2_DEF OCARN2::TextureAtlas cached_terrain_atlas(const OCARN2::Rsc& rsc, const OCARN2::Map* map, const std::string& filename,
+                                                     const OCARN2::AtlasOptions& options, const std::vector<std::string>& sourceFiles) {
+    return ocarn2__cached_atlas([&]() { return ocarn2__terrain_atlas_sources(rsc, map); }, rsc.textures.size(),
+                                options, true, filename, sourceFiles);
+}
+
+/**
+ * Same as build_model_atlas, but loads the atlas from filename if it was built from the same textures with
+ * the same options, and writes it there if not
+ *
+ * @param rsc
+ * @param filename
+ * @param options
+ * @param sourceFiles optional, the .rsc the textures came from. when given, a cache hit only looks at its size
+ *                    and modification time instead of hashing the textures
+ * @return
+ */
+OCARN2_DEF OCARN2::TextureAtlas cached_model_atlas(const OCARN2::Rsc& rsc, const std::string& filename, const OCARN2::AtlasOptions& options,
+                                                   const std::vector<std::string>& sourceFiles) {
+    return ocarn2__cached_atlas([&]() { return ocarn2__model_atlas_sources(rsc); }, rsc.models.size(),
+                                options, false, filename, sourceFiles);
+}
+
+#endif
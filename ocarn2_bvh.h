@@ -0,0 +1,811 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for exact raycasts against every object placed on a map, eg for checking bullet hits.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * It's a two level bounding volume hierarchy. Each RscModel's mesh gets its own tree of triangles, in model
+ * space, and the world gets a tree of instances, one for every cell of objectMap with a model in it. Both are
+ * built with binned SAH (surface area heuristic) splits. An instance sits in the middle of its cell at
+ * objectHeightMap * heightScale, turned a quarter turn at a time by BF_MODEL_DIRECTION and the bit above it,
+ * the same way the terrain turns textures. Terrain isn't in the tree.
+ *
+ * Rays are tested against both sides of every triangle. intersect_rays takes rays 8 at a time down the trees
+ * together with AVX2 when the cpu has it and the 8 start close together and head the same way (bursts, spread
+ * from one gun). Anything else goes one ray at a time, and either way the hits are the same as intersect_ray's.
+ *
+ * main methods are
+ *
+ * BvhWorld build_world_bvh(const Map& map, const Rsc& rsc, const BvhOptions& options);
+ * BvhHit intersect_ray(const BvhWorld& world, const BvhRay& ray);
+ * void intersect_rays(const BvhWorld& world, const BvhRay* rays, size_t count, BvhHit* hits, unsigned threads);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct BvhOptions {
+        // world units per cell, and per step of objectHeightMap, same as the terrain mesh
+        float cellSize = 256.0f;
+        float heightScale = 64.0f;
+
+        // most triangles (or instances) in a leaf
+        uint32_t leafSize = 4;
+
+        // buckets each axis is split into when looking for the cheapest split
+        uint32_t bins = 16;
+
+        // threads used to build the model trees. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    // 32 bytes. a leaf has count > 0 items starting at first, otherwise the children are first and first + 1
+    struct BvhNode {
+        float min[3];
+        uint32_t first;
+        float max[3];
+        uint32_t count;
+    };
+
+    // a corner and the two edges from it, ready for the ray test
+    struct BvhTriangle {
+        float v0[3], e1[3], e2[3];
+        uint32_t face;
+    };
+
+    struct BvhMesh {
+        std::vector<BvhNode> nodes;
+        std::vector<BvhTriangle> triangles;
+    };
+
+    struct BvhInstance {
+        float position[3];
+        uint32_t model;
+        uint16_t cellX, cellZ;
+
+        // quarter turns about y
+        uint32_t rotation;
+    };
+
+    struct BvhWorld {
+        BvhOptions options;
+
+        // one per RscModel
+        std::vector<BvhMesh> meshes;
+
+        // in tree order
+        std::vector<BvhInstance> instances;
+        std::vector<BvhNode> nodes;
+    };
+
+    // direction doesn't need to be normalized, hits are at origin + direction * t for t up to maxT
+    struct BvhRay {
+        float origin[3];
+        float direction[3];
+        float maxT;
+    };
+
+    static const uint32_t BVH_MISS = 0xffffffff;
+
+    struct BvhHit {
+        float t;
+        uint32_t instance; // BVH_MISS if nothing was hit
+        uint32_t face;     // in the model's mesh
+        float u, v;        // barycentric, along the face's v1 -> v2 and v1 -> v3 edges
+    };
+}
+
+
+OCARN2_DEF OCARN2::BvhMesh build_mesh_bvh(const OCARN2::Mesh& mesh, const OCARN2::BvhOptions& options = {});
+OCARN2_DEF OCARN2::BvhWorld build_world_bvh(const OCARN2::Map& map, const OCARN2::Rsc& rsc, const OCARN2::BvhOptions& options = {});
+OCARN2_DEF OCARN2::BvhHit intersect_ray(const OCARN2::BvhWorld& world, const OCARN2::BvhRay& ray);
+OCARN2_DEF void intersect_rays(const OCARN2::BvhWorld& world, const OCARN2::BvhRay* rays, size_t count, OCARN2::BvhHit* hits, unsigned threads = 1);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cfloat>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCARN2__BVH_AVX2
+#include <immintrin.h>
+#endif
+
+// trees are cut off at this depth so traversal stacks can be fixed size
+static const uint32_t ocarn2__bvh_max_depth = 48;
+
+/**
+ * Internal function to build a tree over boxes, 6 floats each (min xyz, max xyz). order comes back as the box
+ * each leaf slot refers to
+ *
+ * @param boxes
+ * @param order
+ * @param leafSize
+ * @param numBins
+ * @return nodes, the root first
+ */
+static std::vector<OCARN2::BvhNode> ocarn2__bvh_build(const std::vector<float>& boxes, std::vector<uint32_t>& order, uint32_t leafSize, uint32_t numBins) {
+    uint32_t count = (uint32_t) (boxes.size() / 6);
+    leafSize = std::max(1u, leafSize);
+    numBins = std::min(std::max(2u, numBins), 64u);
+
+    order.resize(count);
+    for(uint32_t i=0; i < count; i++) order[i] = i;
+
+    std::vector<float> centers(count * 3);
+    for(uint32_t i=0; i < count; i++) {
+        for(int a=0; a < 3; a++) centers[i * 3 + a] = (boxes[i * 6 + a] + boxes[i * 6 + 3 + a]) * 0.5f;
+    }
+
+    struct Bounds {
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        void grow(const float* box) {
+            for(int a=0; a < 3; a++) {
+                min[a] = std::min(min[a], box[a]);
+                max[a] = std::max(max[a], box[3 + a]);
+            }
+        }
+        void grow(const Bounds& b) {
+            for(int a=0; a < 3; a++) {
+                min[a] = std::min(min[a], b.min[a]);
+                max[a] = std::max(max[a], b.max[a]);
+            }
+        }
+        float area() const {
+            if(min[0] > max[0]) return 0;
+            float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    struct Job { uint32_t node, first, count, depth; };
+
+    std::vector<OCARN2::BvhNode> nodes(1);
+    std::vector<Job> jobs = { { 0, 0, count, 0 } };
+
+    while(!jobs.empty()) {
+        Job job = jobs.back();
+        jobs.pop_back();
+
+        Bounds bounds, centerBounds;
+        for(uint32_t i = job.first; i < job.first + job.count; i++) {
+            bounds.grow(&boxes[order[i] * 6]);
+
+            const float* c = &centers[order[i] * 3];
+            float point[6] = { c[0], c[1], c[2], c[0], c[1], c[2] };
+            centerBounds.grow(point);
+        }
+
+        OCARN2::BvhNode& node = nodes[job.node];
+        for(int a=0; a < 3; a++) {
+            node.min[a] = job.count ? bounds.min[a] : 0;
+            node.max[a] = job.count ? bounds.max[a] : 0;
+        }
+        node.first = job.first;
+        node.count = job.count;
+
+        if(job.count <= leafSize || job.depth >= ocarn2__bvh_max_depth) continue;
+
+        // cheapest split over every axis, at bucket boundaries
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        uint32_t bestSplit = 0;
+
+        for(int a=0; a < 3; a++) {
+            float extent = centerBounds.max[a] - centerBounds.min[a];
+            if(extent <= 0) continue;
+
+            Bounds bins[64];
+            uint32_t binCounts[64] = {};
+            float scale = numBins / extent;
+
+            for(uint32_t i = job.first; i < job.first + job.count; i++) {
+                uint32_t b = std::min(numBins - 1, (uint32_t) ((centers[order[i] * 3 + a] - centerBounds.min[a]) * scale));
+                bins[b].grow(&boxes[order[i] * 6]);
+                binCounts[b]++;
+            }
+
+            // areas to the right of each boundary, then sweep from the left
+            float rightArea[64];
+            uint32_t rightCount[64];
+            Bounds right;
+            uint32_t rightTotal = 0;
+            for(uint32_t b = numBins - 1; b > 0; b--) {
+                right.grow(bins[b]);
+                rightTotal += binCounts[b];
+                rightArea[b] = right.area();
+                rightCount[b] = rightTotal;
+            }
+
+            Bounds left;
+            uint32_t leftTotal = 0;
+            for(uint32_t b=1; b < numBins; b++) {
+                left.grow(bins[b - 1]);
+                leftTotal += binCounts[b - 1];
+                if(leftTotal == 0 || rightCount[b] == 0) continue;
+
+                float cost = left.area() * leftTotal + rightArea[b] * rightCount[b];
+                if(cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if(bestAxis < 0) {
+            // everything is in the same place. split down the middle so leaves stay small
+            middle = job.first + job.count / 2;
+        }
+        else {
+            // a leaf is cheaper when testing everything costs less than the split
+            if(bestCost >= bounds.area() * job.count) {
+                if(job.count <= leafSize * 4) continue;
+            }
+
+            float scale = numBins / (centerBounds.max[bestAxis] - centerBounds.min[bestAxis]);
+            float low = centerBounds.min[bestAxis];
+            uint32_t* split = std::partition(&order[job.first], &order[job.first] + job.count, [&](uint32_t i) {
+                return std::min(numBins - 1, (uint32_t) ((centers[i * 3 + bestAxis] - low) * scale)) < bestSplit;
+            });
+            middle = (uint32_t) (split - order.data());
+        }
+
+        uint32_t children = (uint32_t) nodes.size();
+        nodes[job.node].first = children;
+        nodes[job.node].count = 0;
+        nodes.resize(nodes.size() + 2);
+
+        jobs.push_back({ children, job.first, middle - job.first, job.depth + 1 });
+        jobs.push_back({ children + 1, middle, job.first + job.count - middle, job.depth + 1 });
+    }
+
+    return nodes;
+}
+
+/**
+ * Internal reciprocal of a direction, with zeros swapped for something tiny so slab tests never make NaNs
+ */
+static inline float ocarn2__bvh_inverse(float d) {
+    return 1.0f / (std::fabs(d) < 1e-30f ? std::copysign(1e-30f, d) : d);
+}
+
+/**
+ * Internal slab test of a ray against a node's box
+ *
+ * @return where the ray enters the box, or FLT_MAX if it misses or only gets there after maxT
+ */
+static inline float ocarn2__bvh_slab(const OCARN2::BvhNode& node, const float* o, const float* inv, float maxT) {
+    float tmin = 0, tmax = maxT;
+    for(int a=0; a < 3; a++) {
+        float t0 = (node.min[a] - o[a]) * inv[a];
+        float t1 = (node.max[a] - o[a]) * inv[a];
+        tmin = std::max(tmin, std::min(t0, t1));
+        tmax = std::min(tmax, std::max(t0, t1));
+    }
+    return tmin <= tmax ? tmin : FLT_MAX;
+}
+
+/**
+ * Internal test of one ray against one triangle, both sides
+ *
+ * @return true and fills in t, u and v when it's hit closer than maxT
+ */
+static inline bool ocarn2__bvh_triangle(const OCARN2::BvhTriangle& tri, const float* o, const float* d, float maxT, float& t, float& u, float& v) {
+    float p[3] = { d[1] * tri.e2[2] - d[2] * tri.e2[1], d[2] * tri.e2[0] - d[0] * tri.e2[2], d[0] * tri.e2[1] - d[1] * tri.e2[0] };
+    float det = tri.e1[0] * p[0] + tri.e1[1] * p[1] + tri.e1[2] * p[2];
+    if(std::fabs(det) < 1e-12f) return false;
+
+    float invDet = 1.0f / det;
+    float s[3] = { o[0] - tri.v0[0], o[1] - tri.v0[1], o[2] - tri.v0[2] };
+    u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+    if(u < 0 || u > 1) return false;
+
+    float q[3] = { s[1] * tri.e1[2] - s[2] * tri.e1[1], s[2] * tri.e1[0] - s[0] * tri.e1[2], s[0] * tri.e1[1] - s[1] * tri.e1[0] };
+    v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+    if(v < 0 || u + v > 1) return false;
+
+    t = (tri.e2[0] * q[0] + tri.e2[1] * q[1] + tri.e2[2] * q[2]) * invDet;
+    return t >= 0 && t < maxT;
+}
+
+/**
+ * Internal function to pick which child to visit first, the one on the side the ray comes from along the
+ * axis the children are furthest apart on
+ *
+ * @return true if the second child is nearer
+ */
+static inline bool ocarn2__bvh_second_first(const OCARN2::BvhNode& a, const OCARN2::BvhNode& b, const float* d) {
+    int axis = 0;
+    float best = -1;
+    for(int i=0; i < 3; i++) {
+        float gap = std::fabs((b.min[i] + b.max[i]) - (a.min[i] + a.max[i]));
+        if(gap > best) { best = gap; axis = i; }
+    }
+    return ((b.min[axis] + b.max[axis]) - (a.min[axis] + a.max[axis])) * d[axis] < 0;
+}
+
+/**
+ * Internal function to trace a ray, already in model space, through a model's tree
+ *
+ * @param mesh
+ * @param o
+ * @param d
+ * @param hit closest hit so far, updated with anything closer
+ * @param instance
+ */
+static void ocarn2__bvh_trace_mesh(const OCARN2::BvhMesh& mesh, const float* o, const float* d, OCARN2::BvhHit& hit, uint32_t instance) {
+    if(mesh.nodes.empty()) return;
+
+    float inv[3] = { ocarn2__bvh_inverse(d[0]), ocarn2__bvh_inverse(d[1]), ocarn2__bvh_inverse(d[2]) };
+
+    uint32_t stack[ocarn2__bvh_max_depth * 2 + 2];
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while(top) {
+        const OCARN2::BvhNode& node = mesh.nodes[stack[--top]];
+        if(ocarn2__bvh_slab(node, o, inv, hit.t) == FLT_MAX) continue;
+
+        if(node.count) {
+            for(uint32_t i = node.first; i < node.first + node.count; i++) {
+                float t, u, v;
+                if(ocarn2__bvh_triangle(mesh.triangles[i], o, d, hit.t, t, u, v)) {
+                    hit = { t, instance, mesh.triangles[i].face, u, v };
+                }
+            }
+            continue;
+        }
+
+        // the nearer child goes on top
+        bool swap = ocarn2__bvh_second_first(mesh.nodes[node.first], mesh.nodes[node.first + 1], d);
+        stack[top++] = node.first + (swap ? 0 : 1);
+        stack[top++] = node.first + (swap ? 1 : 0);
+    }
+}
+
+/**
+ * Builds the triangle tree for one mesh, in model space
+ *
+ * @param mesh
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::BvhMesh build_mesh_bvh(const OCARN2::Mesh& mesh, const OCARN2::BvhOptions& options) {
+    OCARN2::BvhMesh bvh;
+
+    // faces pointing at vertices that aren't there are left out
+    std::vector<uint32_t> faces;
+    for(uint32_t f=0; f < mesh.faces.size(); f++) {
+        const OCARN2::Face& face = mesh.faces[f];
+        if((uint32_t) face.v1 < mesh.vertices.size() && (uint32_t) face.v2 < mesh.vertices.size() && (uint32_t) face.v3 < mesh.vertices.size())
+            faces.push_back(f);
+    }
+    if(faces.empty()) return bvh;
+
+    std::vector<float> boxes(faces.size() * 6);
+    for(size_t i=0; i < faces.size(); i++) {
+        const OCARN2::Face& face = mesh.faces[faces[i]];
+        const OCARN2::Vertex* corners[3] = { &mesh.vertices[face.v1], &mesh.vertices[face.v2], &mesh.vertices[face.v3] };
+
+        float* box = &boxes[i * 6];
+        box[0] = box[1] = box[2] = FLT_MAX;
+        box[3] = box[4] = box[5] = -FLT_MAX;
+        for(const OCARN2::Vertex* c: corners) {
+            float p[3] = { c->x, c->y, c->z };
+            for(int a=0; a < 3; a++) {
+                box[a] = std::min(box[a], p[a]);
+                box[3 + a] = std::max(box[3 + a], p[a]);
+            }
+        }
+    }
+
+    std::vector<uint32_t> order;
+    bvh.nodes = ocarn2__bvh_build(boxes, order, options.leafSize, options.bins);
+
+    bvh.triangles.resize(faces.size());
+    for(size_t i=0; i < faces.size(); i++) {
+        const OCARN2::Face& face = mesh.faces[faces[order[i]]];
+        const OCARN2::Vertex& a = mesh.vertices[face.v1];
+        const OCARN2::Vertex& b = mesh.vertices[face.v2];
+        const OCARN2::Vertex& c = mesh.vertices[face.v3];
+
+        bvh.triangles[i] = {
+            { a.x, a.y, a.z },
+            { b.x - a.x, b.y - a.y, b.z - a.z },
+            { c.x - a.x, c.y - a.y, c.z - a.z },
+            faces[order[i]]
+        };
+    }
+
+    return bvh;
+}
+
+/**
+ * Builds a tree for every model in the rsc, and one over every object placed on the map
+ *
+ * @param map
+ * @param rsc
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::BvhWorld build_world_bvh(const OCARN2::Map& map, const OCARN2::Rsc& rsc, const OCARN2::BvhOptions& options) {
+    OCARN2::BvhWorld world;
+    world.options = options;
+
+    world.meshes.resize(rsc.models.size());
+    ocarn2__parallel_for(rsc.models.size(), options.threads, [&](size_t m) {
+        world.meshes[m] = build_mesh_bvh(rsc.models[m].mesh, options);
+    });
+
+    std::vector<OCARN2::BvhInstance> placed;
+    std::vector<float> boxes;
+
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) {
+            uint32_t cell = z * 1024 + x;
+            unsigned char model = map.objectMap[cell];
+            if(model == 255 || model >= world.meshes.size() || world.meshes[model].nodes.empty()) continue;
+
+            OCARN2::BvhInstance instance;
+            instance.position[0] = (x + 0.5f) * options.cellSize;
+            instance.position[1] = map.objectHeightMap[cell] * options.heightScale;
+            instance.position[2] = (z + 0.5f) * options.cellSize;
+            instance.model = model;
+            instance.cellX = (uint16_t) x;
+            instance.cellZ = (uint16_t) z;
+            instance.rotation = (map.bitflagMap[cell] >> 2) & 3;
+            placed.push_back(instance);
+
+            // the model's box turned, which stays a box for quarter turns
+            const OCARN2::BvhNode& root = world.meshes[model].nodes[0];
+            float c = ocarn2__quarter_cos[instance.rotation], s = ocarn2__quarter_sin[instance.rotation];
+            float x0 = c * root.min[0] + s * root.min[2], x1 = c * root.max[0] + s * root.max[2];
+            float z0 = -s * root.min[0] + c * root.min[2], z1 = -s * root.max[0] + c * root.max[2];
+
+            boxes.insert(boxes.end(), {
+                instance.position[0] + std::min(x0, x1), instance.position[1] + root.min[1], instance.position[2] + std::min(z0, z1),
+                instance.position[0] + std::max(x0, x1), instance.position[1] + root.max[1], instance.position[2] + std::max(z0, z1)
+            });
+        }
+    }
+
+    if(placed.empty()) return world;
+
+    std::vector<uint32_t> order;
+    world.nodes = ocarn2__bvh_build(boxes, order, options.leafSize, options.bins);
+
+    world.instances.resize(placed.size());
+    for(size_t i=0; i < placed.size(); i++) world.instances[i] = placed[order[i]];
+
+    return world;
+}
+
+/**
+ * Finds the closest object a ray hits
+ *
+ * @param world
+ * @param ray
+ * @return instance is BVH_MISS if nothing is hit
+ */
+OCARN2_DEF OCARN2::BvhHit intersect_ray(const OCARN2::BvhWorld& world, const OCARN2::BvhRay& ray) {
+    OCARN2::BvhHit hit = { ray.maxT, OCARN2::BVH_MISS, 0, 0, 0 };
+    if(world.nodes.empty()) return hit;
+
+    const float* o = ray.origin;
+    const float* d = ray.direction;
+    float inv[3] = { ocarn2__bvh_inverse(d[0]), ocarn2__bvh_inverse(d[1]), ocarn2__bvh_inverse(d[2]) };
+
+    uint32_t stack[ocarn2__bvh_max_depth * 2 + 2];
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while(top) {
+        const OCARN2::BvhNode& node = world.nodes[stack[--top]];
+        if(ocarn2__bvh_slab(node, o, inv, hit.t) == FLT_MAX) continue;
+
+        if(node.count) {
+            for(uint32_t i = node.first; i < node.first + node.count; i++) {
+                const OCARN2::BvhInstance& instance = world.instances[i];
+                float c = ocarn2__quarter_cos[instance.rotation], s = ocarn2__quarter_sin[instance.rotation];
+
+                // into model space, turning back the other way
+                float wx = o[0] - instance.position[0], wz = o[2] - instance.position[2];
+                float lo[3] = { c * wx - s * wz, o[1] - instance.position[1], s * wx + c * wz };
+                float ld[3] = { c * d[0] - s * d[2], d[1], s * d[0] + c * d[2] };
+
+                ocarn2__bvh_trace_mesh(world.meshes[instance.model], lo, ld, hit, i);
+            }
+            continue;
+        }
+
+        bool swap = ocarn2__bvh_second_first(world.nodes[node.first], world.nodes[node.first + 1], d);
+        stack[top++] = node.first + (swap ? 0 : 1);
+        stack[top++] = node.first + (swap ? 1 : 0);
+    }
+
+    return hit;
+}
+
+#ifdef OCARN2__BVH_AVX2
+
+/**
+ * Internal state of 8 rays going down the trees together. Lanes that aren't in use have t -1, so they miss everything
+ */
+struct ocarn2__bvh_packet {
+    alignas(32) float o[3][8];
+    alignas(32) float d[3][8];
+    alignas(32) float t[8];
+    alignas(32) float u[8];
+    alignas(32) float v[8];
+    alignas(32) uint32_t instance[8];
+    alignas(32) uint32_t face[8];
+};
+
+/**
+ * Internal slab test of 8 rays against a node's box
+ *
+ * @return lanes that hit it before their t
+ */
+__attribute__((target("avx2"))) static inline __m256 ocarn2__bvh_slab_avx2(const OCARN2::BvhNode& node, const __m256* o, const __m256* inv, __m256 t) {
+    __m256 tmin = _mm256_setzero_ps(), tmax = t;
+    for(int a=0; a < 3; a++) {
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min[a]), o[a]), inv[a]);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max[a]), o[a]), inv[a]);
+        tmin = _mm256_max_ps(tmin, _mm256_min_ps(t0, t1));
+        tmax = _mm256_min_ps(tmax, _mm256_max_ps(t0, t1));
+    }
+    return _mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ);
+}
+
+__attribute__((target("avx2"))) static inline __m256 ocarn2__bvh_cross_dot_avx2(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz,
+                                                                              __m256 cx, __m256 cy, __m256 cz) {
+    // (a x b) . c
+    __m256 x = _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by));
+    __m256 y = _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz));
+    __m256 z = _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, cx), _mm256_mul_ps(y, cy)), _mm256_mul_ps(z, cz));
+}
+
+/**
+ * Internal function to trace 8 rays, already in model space, through a model's tree. Same sums as the single
+ * ray version, so they find the same hits
+ */
+__attribute__((target("avx2"))) static void ocarn2__bvh_trace_mesh_avx2(const OCARN2::BvhMesh& mesh, const __m256* o, const __m256* d,
+                                                                        ocarn2__bvh_packet& packet, uint32_t instance) {
+    if(mesh.nodes.empty()) return;
+
+    __m256 inv[3];
+    for(int a=0; a < 3; a++) {
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, d[a]);
+        for(int l=0; l < 8; l++) lanes[l] = ocarn2__bvh_inverse(lanes[l]);
+        inv[a] = _mm256_load_ps(lanes);
+    }
+
+    __m256 t = _mm256_load_ps(packet.t), u = _mm256_load_ps(packet.u), v = _mm256_load_ps(packet.v);
+    __m256i face = _mm256_load_si256((const __m256i*) packet.face);
+    __m256i hitInstance = _mm256_load_si256((const __m256i*) packet.instance);
+
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 signBit = _mm256_set1_ps(-0.0f), epsilon = _mm256_set1_ps(1e-12f);
+    const __m256i instanceLanes = _mm256_set1_epi32((int) instance);
+
+    // lane 0's direction picks the child order. rays in a packet mostly go the same way
+    alignas(32) float firstDirection[3][8];
+    for(int a=0; a < 3; a++) _mm256_store_ps(firstDirection[a], d[a]);
+    float order[3] = { firstDirection[0][0], firstDirection[1][0], firstDirection[2][0] };
+
+    uint32_t stack[ocarn2__bvh_max_depth * 2 + 2];
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while(top) {
+        const OCARN2::BvhNode& node = mesh.nodes[stack[--top]];
+        if(_mm256_movemask_ps(ocarn2__bvh_slab_avx2(node, o, inv, t)) == 0) continue;
+
+        if(node.count) {
+            for(uint32_t i = node.first; i < node.first + node.count; i++) {
+                const OCARN2::BvhTriangle& tri = mesh.triangles[i];
+                __m256 e1x = _mm256_set1_ps(tri.e1[0]), e1y = _mm256_set1_ps(tri.e1[1]), e1z = _mm256_set1_ps(tri.e1[2]);
+                __m256 e2x = _mm256_set1_ps(tri.e2[0]), e2y = _mm256_set1_ps(tri.e2[1]), e2z = _mm256_set1_ps(tri.e2[2]);
+
+                // p = d x e2, det = e1 . p
+                __m256 px = _mm256_sub_ps(_mm256_mul_ps(d[1], e2z), _mm256_mul_ps(d[2], e2y));
+                __m256 py = _mm256_sub_ps(_mm256_mul_ps(d[2], e2x), _mm256_mul_ps(d[0], e2z));
+                __m256 pz = _mm256_sub_ps(_mm256_mul_ps(d[0], e2y), _mm256_mul_ps(d[1], e2x));
+                __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+                __m256 valid = _mm256_cmp_ps(_mm256_andnot_ps(signBit, det), epsilon, _CMP_GE_OQ);
+                if(_mm256_movemask_ps(valid) == 0) continue;
+
+                __m256 invDet = _mm256_div_ps(one, det);
+                __m256 sx = _mm256_sub_ps(o[0], _mm256_set1_ps(tri.v0[0]));
+                __m256 sy = _mm256_sub_ps(o[1], _mm256_set1_ps(tri.v0[1]));
+                __m256 sz = _mm256_sub_ps(o[2], _mm256_set1_ps(tri.v0[2]));
+
+                __m256 hu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+                // q = s x e1
+                __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+                __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+                __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+                __m256 hv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], qx), _mm256_mul_ps(d[1], qy)), _mm256_mul_ps(d[2], qz)), invDet);
+                __m256 ht = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+                valid = _mm256_and_ps(valid, _mm256_cmp_ps(hu, zero, _CMP_GE_OQ));
+                valid = _mm256_and_ps(valid, _mm256_cmp_ps(hu, one, _CMP_LE_OQ));
+                valid = _mm256_and_ps(valid, _mm256_cmp_ps(hv, zero, _CMP_GE_OQ));
+                valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(hu, hv), one, _CMP_LE_OQ));
+                valid = _mm256_and_ps(valid, _mm256_cmp_ps(ht, zero, _CMP_GE_OQ));
+                valid = _mm256_and_ps(valid, _mm256_cmp_ps(ht, t, _CMP_LT_OQ));
+                if(_mm256_movemask_ps(valid) == 0) continue;
+
+                t = _mm256_blendv_ps(t, ht, valid);
+                u = _mm256_blendv_ps(u, hu, valid);
+                v = _mm256_blendv_ps(v, hv, valid);
+                face = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(face), _mm256_castsi256_ps(_mm256_set1_epi32((int) tri.face)), valid));
+                hitInstance = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hitInstance), _mm256_castsi256_ps(instanceLanes), valid));
+            }
+            continue;
+        }
+
+        bool swap = ocarn2__bvh_second_first(mesh.nodes[node.first], mesh.nodes[node.first + 1], order);
+        stack[top++] = node.first + (swap ? 0 : 1);
+        stack[top++] = node.first + (swap ? 1 : 0);
+    }
+
+    _mm256_store_ps(packet.t, t);
+    _mm256_store_ps(packet.u, u);
+    _mm256_store_ps(packet.v, v);
+    _mm256_store_si256((__m256i*) packet.face, face);
+    _mm256_store_si256((__m256i*) packet.instance, hitInstance);
+}
+
+/**
+ * Internal function to trace 8 rays through the world's tree
+ */
+__attribute__((target("avx2"))) static void ocarn2__bvh_trace_packet_avx2(const OCARN2::BvhWorld& world, ocarn2__bvh_packet& packet) {
+    __m256 o[3], d[3], inv[3];
+    for(int a=0; a < 3; a++) {
+        o[a] = _mm256_load_ps(packet.o[a]);
+        d[a] = _mm256_load_ps(packet.d[a]);
+
+        alignas(32) float lanes[8];
+        for(int l=0; l < 8; l++) lanes[l] = ocarn2__bvh_inverse(packet.d[a][l]);
+        inv[a] = _mm256_load_ps(lanes);
+    }
+
+    float order[3] = { packet.d[0][0], packet.d[1][0], packet.d[2][0] };
+
+    uint32_t stack[ocarn2__bvh_max_depth * 2 + 2];
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while(top) {
+        const OCARN2::BvhNode& node = world.nodes[stack[--top]];
+        if(_mm256_movemask_ps(ocarn2__bvh_slab_avx2(node, o, inv, _mm256_load_ps(packet.t))) == 0) continue;
+
+        if(node.count) {
+            for(uint32_t i = node.first; i < node.first + node.count; i++) {
+                const OCARN2::BvhInstance& instance = world.instances[i];
+                __m256 c = _mm256_set1_ps(ocarn2__quarter_cos[instance.rotation]), s = _mm256_set1_ps(ocarn2__quarter_sin[instance.rotation]);
+
+                __m256 wx = _mm256_sub_ps(o[0], _mm256_set1_ps(instance.position[0]));
+                __m256 wz = _mm256_sub_ps(o[2], _mm256_set1_ps(instance.position[2]));
+                __m256 lo[3] = {
+                    _mm256_sub_ps(_mm256_mul_ps(c, wx), _mm256_mul_ps(s, wz)),
+                    _mm256_sub_ps(o[1], _mm256_set1_ps(instance.position[1])),
+                    _mm256_add_ps(_mm256_mul_ps(s, wx), _mm256_mul_ps(c, wz))
+                };
+                __m256 ld[3] = {
+                    _mm256_sub_ps(_mm256_mul_ps(c, d[0]), _mm256_mul_ps(s, d[2])),
+                    d[1],
+                    _mm256_add_ps(_mm256_mul_ps(s, d[0]), _mm256_mul_ps(c, d[2]))
+                };
+
+                ocarn2__bvh_trace_mesh_avx2(world.meshes[instance.model], lo, ld, packet, i);
+            }
+            continue;
+        }
+
+        bool swap = ocarn2__bvh_second_first(world.nodes[node.first], world.nodes[node.first + 1], order);
+        stack[top++] = node.first + (swap ? 0 : 1);
+        stack[top++] = node.first + (swap ? 1 : 0);
+    }
+}
+
+/**
+ * Internal check that rays start close together and head the same way, which is when tracing them as a packet
+ * is quicker than one at a time
+ *
+ * @param rays
+ * @param count up to 8
+ * @param cellSize
+ * @return
+ */
+static bool ocarn2__bvh_coherent(const OCARN2::BvhRay* rays, size_t count, float cellSize) {
+    const OCARN2::BvhRay& first = rays[0];
+    float length = std::sqrt(first.direction[0] * first.direction[0] + first.direction[1] * first.direction[1] + first.direction[2] * first.direction[2]);
+
+    for(size_t i=1; i < count; i++) {
+        const OCARN2::BvhRay& ray = rays[i];
+        float gap = 0, dot = 0, squared = 0;
+        for(int a=0; a < 3; a++) {
+            gap = std::max(gap, std::fabs(ray.origin[a] - first.origin[a]));
+            dot += ray.direction[a] * first.direction[a];
+            squared += ray.direction[a] * ray.direction[a];
+        }
+
+        // within a couple of cells and about 25 degrees
+        if(gap > cellSize * 2 || dot < 0.9f * length * std::sqrt(squared)) return false;
+    }
+    return true;
+}
+
+#endif
+
+/**
+ * Finds the closest object each of a batch of rays hits. Rays go 8 at a time with AVX2 when the cpu has it and
+ * the 8 start near each other and go the same way, so keep rays like that next to each other in the batch
+ *
+ * @param world
+ * @param rays
+ * @param count
+ * @param hits count hits, instance is BVH_MISS for rays that don't hit anything
+ * @param threads 0 = hardware concurrency
+ */
+OCARN2_DEF void intersect_rays(const OCARN2::BvhWorld& world, const OCARN2::BvhRay* rays, size_t count, OCARN2::BvhHit* hits, unsigned threads) {
+    size_t numPackets = (count + 7) / 8;
+
+#ifdef OCARN2__BVH_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if(avx2 && !world.nodes.empty()) {
+        ocarn2__parallel_for(numPackets, threads, [&](size_t p) {
+            ocarn2__bvh_packet packet;
+            size_t first = p * 8;
+            size_t lanes = std::min<size_t>(8, count - first);
+
+            if(!ocarn2__bvh_coherent(rays + first, lanes, world.options.cellSize)) {
+                for(size_t l=0; l < lanes; l++) hits[first + l] = intersect_ray(world, rays[first + l]);
+                return;
+            }
+
+            for(size_t l=0; l < 8; l++) {
+                // spare lanes copy the first ray with nowhere to go
+                const OCARN2::BvhRay& ray = rays[first + (l < lanes ? l : 0)];
+                for(int a=0; a < 3; a++) {
+                    packet.o[a][l] = ray.origin[a];
+                    packet.d[a][l] = ray.direction[a];
+                }
+                packet.t[l] = l < lanes ? ray.maxT : -1.0f;
+                packet.u[l] = packet.v[l] = 0;
+                packet.instance[l] = OCARN2::BVH_MISS;
+                packet.face[l] = 0;
+            }
+
+            ocarn2__bvh_trace_packet_avx2(world, packet);
+
+            for(size_t l=0; l < lanes; l++) {
+                hits[first + l] = { packet.t[l], packet.instance[l], packet.face[l], packet.u[l], packet.v[l] };
+            }
+        });
+        return;
+    }
+#endif
+
+    ocarn2__parallel_for(numPackets, threads, [&](size_t p) {
+        for(size_t i = p * 8; i < std::min(count, p * 8 + 8); i++) hits[i] = intersect_ray(world, rays[i]);
+    });
+}
+
+#endif
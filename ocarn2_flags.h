@@ -0,0 +1,384 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for counting flags in a Map's bitflagMap without going through it cell by cell.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * build_flag_planes splits bitflagMap into one bitset per flag, 64 cells to a word, so counting is a popcount
+ * over 16K words per plane instead of a branch per cell. Flags that get asked about a lot (BF_REVERSE,
+ * BF_IMPASSABLE and BF_WATER by default) also get a summed-area table, which makes counting one of them
+ * inside any rectangle four lookups.
+ *
+ * Queries take a set of flags that must all be on and a set that must all be off, so "walkable land" is
+ * count_flags(planes, 0, BF_IMPASSABLE | BF_WATER). On x86 with GCC or clang the splitting and counting use
+ * AVX2 when the CPU has it, picked at runtime, and plain 64 bit popcounts otherwise.
+ *
+ * main methods are
+ *
+ * FlagPlanes build_flag_planes(const Map& map, const FlagPlaneOptions& options);
+ * uint32_t count_flags(const FlagPlanes& planes, uint16_t set, uint16_t clear);
+ * uint32_t count_flags_rect(const FlagPlanes& planes, const FlagRect& rect, uint16_t set, uint16_t clear);
+ * FlagHistogram flag_histogram(const FlagPlanes& planes, const FlagRect& rect);
+ * std::vector<uint32_t> count_flags_grid(const FlagPlanes& planes, uint32_t regionSize, uint16_t set, uint16_t clear);
+ */
+
+#pragma once
+
+#include <array>
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct FlagPlaneOptions {
+        // flags that get a summed-area table, 4MB each
+        uint16_t summedFlags = BF_REVERSE | BF_IMPASSABLE | BF_WATER;
+
+        // threads used to build the planes and tables. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    // cells x to x + width - 1 and z to z + height - 1
+    struct FlagRect {
+        uint32_t x = 0, z = 0;
+        uint32_t width = 1024, height = 1024;
+    };
+
+    // cells with each bit of bitflagMap on, by bit number
+    typedef std::array<uint32_t, 16> FlagHistogram;
+
+    struct FlagPlanes {
+        FlagPlaneOptions options;
+
+        // by bit number. cell (x, z) is bit x % 64 of word z * 16 + x / 64
+        std::array<std::vector<uint64_t>, 16> bits;
+
+        // by bit number, empty unless the flag is in summedFlags. 1025 x 1025, entry (x, z) counts the cells above and left of it
+        std::array<std::vector<uint32_t>, 16> summed;
+    };
+}
+
+
+OCARN2_DEF OCARN2::FlagPlanes build_flag_planes(const OCARN2::Map& map, const OCARN2::FlagPlaneOptions& options = {});
+OCARN2_DEF uint32_t count_flags(const OCARN2::FlagPlanes& planes, uint16_t set, uint16_t clear = 0);
+OCARN2_DEF uint32_t count_flags_rect(const OCARN2::FlagPlanes& planes, const OCARN2::FlagRect& rect, uint16_t set, uint16_t clear = 0);
+OCARN2_DEF OCARN2::FlagHistogram flag_histogram(const OCARN2::FlagPlanes& planes, const OCARN2::FlagRect& rect = {});
+OCARN2_DEF std::vector<uint32_t> count_flags_grid(const OCARN2::FlagPlanes& planes, uint32_t regionSize, uint16_t set, uint16_t clear = 0);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCARN2__FLAGS_AVX2
+#include <immintrin.h>
+#endif
+
+static inline uint32_t ocarn2__popcount(uint64_t word) {
+#if defined(__GNUC__)
+    return (uint32_t) __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (uint32_t) ((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/**
+ * Internal list of the planes a query reads. With nothing in set every cell starts on, and with nothing in
+ * either it's just counting cells
+ */
+struct ocarn2__flag_query {
+    const uint64_t* set[16];
+    const uint64_t* clear[16];
+    uint32_t numSet = 0, numClear = 0;
+
+    ocarn2__flag_query(const OCARN2::FlagPlanes& planes, uint16_t setFlags, uint16_t clearFlags) {
+        for(uint32_t b=0; b < 16; b++) {
+            if(setFlags & (1u << b)) set[numSet++] = planes.bits[b].data();
+            if(clearFlags & (1u << b)) clear[numClear++] = planes.bits[b].data();
+        }
+    }
+
+    uint64_t word(size_t i) const {
+        uint64_t on = ~0ull;
+        for(uint32_t p=0; p < numSet; p++) on &= set[p][i];
+        for(uint32_t p=0; p < numClear; p++) on &= ~clear[p][i];
+        return on;
+    }
+};
+
+static uint32_t ocarn2__count_words_scalar(const ocarn2__flag_query& query, size_t begin, size_t end) {
+    uint32_t count = 0;
+    for(size_t i = begin; i < end; i++) count += ocarn2__popcount(query.word(i));
+    return count;
+}
+
+static void ocarn2__split_flags_scalar(const uint16_t* flags, uint64_t* const* bits, size_t begin, size_t end) {
+    for(size_t w = begin; w < end; w++) {
+        uint64_t words[16] = {};
+
+        for(uint32_t i=0; i < 64; i++) {
+            uint16_t cell = flags[w * 64 + i];
+            for(uint32_t b=0; b < 16; b++) words[b] |= (uint64_t) ((cell >> b) & 1) << i;
+        }
+
+        for(uint32_t b=0; b < 16; b++) bits[b][w] = words[b];
+    }
+}
+
+#ifdef OCARN2__FLAGS_AVX2
+
+/**
+ * Internal popcount of 4 words at once, by looking up each nibble and summing the bytes with sad
+ */
+__attribute__((target("avx2"))) static inline __m256i ocarn2__popcount_avx2(__m256i words) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(words, nibble));
+    __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(words, 4), nibble));
+
+    return _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2,popcnt"))) static uint32_t ocarn2__count_words_avx2(const ocarn2__flag_query& query, size_t begin, size_t end) {
+    __m256i sums = _mm256_setzero_si256();
+    size_t i = begin;
+
+    for(; i + 4 <= end; i += 4) {
+        __m256i on = _mm256_set1_epi64x(-1);
+        for(uint32_t p=0; p < query.numSet; p++) {
+            on = _mm256_and_si256(on, _mm256_loadu_si256((const __m256i*) (query.set[p] + i)));
+        }
+        for(uint32_t p=0; p < query.numClear; p++) {
+            on = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*) (query.clear[p] + i)), on);
+        }
+
+        sums = _mm256_add_epi64(sums, ocarn2__popcount_avx2(on));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, sums);
+
+    uint32_t count = (uint32_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    for(; i < end; i++) count += (uint32_t) __builtin_popcountll(query.word(i));
+
+    return count;
+}
+
+/**
+ * Internal split of 64 cells at a time. The low and high bytes of 32 cells are packed into one register each,
+ * then every bit is shifted up to the top of its byte and pulled out with movemask
+ */
+__attribute__((target("avx2"))) static void ocarn2__split_flags_avx2(const uint16_t* flags, uint64_t* const* bits, size_t begin, size_t end) {
+    const __m256i lowByte = _mm256_set1_epi16(0x00ff);
+
+    for(size_t w = begin; w < end; w++) {
+        uint64_t words[16] = {};
+
+        for(uint32_t half=0; half < 2; half++) {
+            const uint16_t* cells = flags + w * 64 + half * 32;
+            __m256i a = _mm256_loadu_si256((const __m256i*) cells);
+            __m256i b = _mm256_loadu_si256((const __m256i*) (cells + 16));
+
+            // packus works within 128 bit lanes, the permute puts the cells back in order
+            __m256i low = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a, lowByte), _mm256_and_si256(b, lowByte)), 0xd8);
+            __m256i high = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xd8);
+
+            for(uint32_t bit=0; bit < 8; bit++) {
+                __m128i shift = _mm_cvtsi32_si128(7 - bit);
+                words[bit] |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_sll_epi16(low, shift)) << (half * 32);
+                words[bit + 8] |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_sll_epi16(high, shift)) << (half * 32);
+            }
+        }
+
+        for(uint32_t b=0; b < 16; b++) bits[b][w] = words[b];
+    }
+}
+
+static bool ocarn2__has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    return supported;
+}
+
+#endif
+
+/**
+ * Internal count of the cells matching a query in words begin to end
+ */
+static uint32_t ocarn2__count_words(const ocarn2__flag_query& query, size_t begin, size_t end) {
+#ifdef OCARN2__FLAGS_AVX2
+    if(ocarn2__has_avx2()) return ocarn2__count_words_avx2(query, begin, end);
+#endif
+    return ocarn2__count_words_scalar(query, begin, end);
+}
+
+/**
+ * Splits bitflagMap into a bitset per flag, and builds summed-area tables for options.summedFlags
+ *
+ * @param map
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::FlagPlanes build_flag_planes(const OCARN2::Map& map, const OCARN2::FlagPlaneOptions& options) {
+    OCARN2::FlagPlanes planes;
+    planes.options = options;
+
+    uint64_t* bits[16];
+    for(uint32_t b=0; b < 16; b++) {
+        planes.bits[b].resize(1024 * 16);
+        bits[b] = planes.bits[b].data();
+    }
+
+    // bands of 64 rows
+    ocarn2__parallel_for(16, options.threads, [&](size_t band) {
+        size_t begin = band * 64 * 16, end = begin + 64 * 16;
+
+#ifdef OCARN2__FLAGS_AVX2
+        if(ocarn2__has_avx2()) {
+            ocarn2__split_flags_avx2(map.bitflagMap.data(), bits, begin, end);
+            return;
+        }
+#endif
+        ocarn2__split_flags_scalar(map.bitflagMap.data(), bits, begin, end);
+    });
+
+    std::vector<uint32_t> summed;
+    for(uint32_t b=0; b < 16; b++) {
+        if(options.summedFlags & (1u << b)) summed.push_back(b);
+    }
+
+    ocarn2__parallel_for(summed.size(), options.threads, [&](size_t i) {
+        const uint64_t* plane = bits[summed[i]];
+        std::vector<uint32_t>& table = planes.summed[summed[i]];
+        table.assign(1025 * 1025, 0);
+
+        for(uint32_t z=0; z < 1024; z++) {
+            const uint32_t* above = &table[z * 1025];
+            uint32_t* row = &table[(z + 1) * 1025];
+            uint32_t run = 0;
+
+            for(uint32_t x=0; x < 1024; x++) {
+                run += (uint32_t) (plane[z * 16 + x / 64] >> (x % 64)) & 1;
+                row[x + 1] = above[x + 1] + run;
+            }
+        }
+    });
+
+    return planes;
+}
+
+/**
+ * Counts the cells on the whole map that have every flag in set on, and every flag in clear off
+ *
+ * @param planes
+ * @param set
+ * @param clear
+ * @return
+ */
+OCARN2_DEF uint32_t count_flags(const OCARN2::FlagPlanes& planes, uint16_t set, uint16_t clear) {
+    return count_flags_rect(planes, {}, set, clear);
+}
+
+/**
+ * Counts the cells in a rectangle that have every flag in set on, and every flag in clear off. Asking about one
+ * flag with a summed-area table is constant time, anything else is a popcount over the words the rectangle covers
+ *
+ * @param planes
+ * @param rect clipped to the map
+ * @param set
+ * @param clear
+ * @return
+ */
+OCARN2_DEF uint32_t count_flags_rect(const OCARN2::FlagPlanes& planes, const OCARN2::FlagRect& rect, uint16_t set, uint16_t clear) {
+    uint32_t x0 = std::min(rect.x, 1024u), z0 = std::min(rect.z, 1024u);
+    uint32_t x1 = x0 + std::min(rect.width, 1024 - x0), z1 = z0 + std::min(rect.height, 1024 - z0);
+    if(x0 == x1 || z0 == z1) return 0;
+
+    // one flag with a table
+    if(clear == 0 && set != 0 && (set & (set - 1)) == 0) {
+        uint32_t b = 0;
+        while(!(set & (1u << b))) b++;
+
+        const std::vector<uint32_t>& table = planes.summed[b];
+        if(!table.empty()) {
+            return table[z1 * 1025 + x1] - table[z0 * 1025 + x1] - table[z1 * 1025 + x0] + table[z0 * 1025 + x0];
+        }
+    }
+
+    ocarn2__flag_query query(planes, set, clear);
+
+    // whole rows run together
+    if(x0 == 0 && x1 == 1024) return ocarn2__count_words(query, z0 * 16, z1 * 16);
+
+    uint32_t firstWord = x0 / 64, lastWord = (x1 - 1) / 64;
+    uint64_t firstMask = ~0ull << (x0 % 64);
+    uint64_t lastMask = ~0ull >> (63 - (x1 - 1) % 64);
+    if(firstWord == lastWord) firstMask &= lastMask;
+
+    uint32_t count = 0;
+    for(uint32_t z = z0; z < z1; z++) {
+        size_t row = z * 16;
+        count += ocarn2__popcount(query.word(row + firstWord) & firstMask);
+
+        if(lastWord > firstWord) {
+            count += ocarn2__count_words(query, row + firstWord + 1, row + lastWord);
+            count += ocarn2__popcount(query.word(row + lastWord) & lastMask);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Counts the cells in a rectangle that have each flag on
+ *
+ * @param planes
+ * @param rect clipped to the map
+ * @return
+ */
+OCARN2_DEF OCARN2::FlagHistogram flag_histogram(const OCARN2::FlagPlanes& planes, const OCARN2::FlagRect& rect) {
+    OCARN2::FlagHistogram histogram;
+
+    for(uint32_t b=0; b < 16; b++) histogram[b] = count_flags_rect(planes, rect, (uint16_t) (1u << b));
+
+    return histogram;
+}
+
+/**
+ * Cuts the map into square regions and counts the matching cells in each, for coverage maps
+ *
+ * @param planes
+ * @param regionSize cells per side of a region. must divide 1024
+ * @param set
+ * @param clear
+ * @return a count per region, row by row, or empty if regionSize doesn't divide the map
+ */
+OCARN2_DEF std::vector<uint32_t> count_flags_grid(const OCARN2::FlagPlanes& planes, uint32_t regionSize, uint16_t set, uint16_t clear) {
+    if(regionSize < 1 || regionSize > 1024 || 1024 % regionSize != 0) {
+        std::cerr << "Region size " << regionSize << " doesn't divide the map evenly" << std::endl;
+        return {};
+    }
+
+    uint32_t regions = 1024 / regionSize;
+    std::vector<uint32_t> counts(regions * regions);
+
+    for(uint32_t z=0; z < regions; z++) {
+        for(uint32_t x=0; x < regions; x++) {
+            OCARN2::FlagRect rect;
+            rect.x = x * regionSize;
+            rect.z = z * regionSize;
+            rect.width = rect.height = regionSize;
+
+            counts[z * regions + x] = count_flags_rect(planes, rect, set, clear);
+        }
+    }
+
+    return counts;
+}
+
+#endif
@@ -0,0 +1,467 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for getting pixels out of the library, as .bmp files.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * An Image is rows of 8 bit pixels from the top down, with 1 (grey), 3 (rgb) or 4 (rgba) channels. Grey and
+ * rgb are written as 24 bit .bmp files, rgba as 32 bit ones. Textures in the game files are 16 bit, 5 bits for
+ * each of red, green and blue, and texel_to_rgb turns one into 8 bit channels.
+ *
+ * Any plane of a Map can be turned into a picture, eg for minimaps. Byte planes (heights, lighting, water, ...)
+ * come out grey, bitflagMap shows impassable cells red, reversed cells green and water blue, and textureMap and
+ * textureMapFar show each cell as the average colour of its texture in the Rsc. Pictures can be shrunk by a
+ * whole factor, averaging each block of cells, and z runs up the picture like the game's map screen.
+ * save_map_plane_image never holds the whole picture, it converts a band of rows at a time on every thread and
+ * writes it out before starting the next, as a top down .bmp or as raw pixels with no header.
+ *
+ * main methods are
+ *
+ * bool save_bmp_file(const Image& image, const std::string& filename);
+ * void texel_to_rgb(uint16_t texel, unsigned char* rgb);
+ * Image map_plane_image(const Map& map, MapPlane plane, const MapImageOptions& options, const Rsc* rsc);
+ * bool save_map_plane_image(const Map& map, MapPlane plane, const std::string& filename, const MapImageOptions& options, const Rsc* rsc);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct Image {
+        uint32_t width = 0, height = 0;
+        uint32_t channels = 4;
+
+        // width * height * channels, top row first
+        std::vector<unsigned char> pixels;
+    };
+
+    enum ImageFormat {
+        IMAGE_BMP = 0,
+
+        // width * height * channels bytes, top row first, rgb order, no header
+        IMAGE_RAW
+    };
+
+    struct MapImageOptions {
+        // cells per pixel along each side, averaged. must divide the plane's width
+        uint32_t downsample = 1;
+
+        // what save_map_plane_image writes
+        ImageFormat format = IMAGE_BMP;
+
+        // rows converted per thread before a band is written out
+        uint32_t bandRows = 16;
+
+        // threads used to convert rows. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+}
+
+
+OCARN2_DEF OCARN2::Image create_image(uint32_t width, uint32_t height, uint32_t channels = 4);
+OCARN2_DEF bool save_bmp_file(const OCARN2::Image& image, const std::string& filename);
+OCARN2_DEF void texel_to_rgb(uint16_t texel, unsigned char* rgb);
+OCARN2_DEF std::vector<unsigned char> average_texture_colors(const OCARN2::Rsc& rsc, unsigned threads = 0);
+OCARN2_DEF OCARN2::Image map_plane_image(const OCARN2::Map& map, OCARN2::MapPlane plane, const OCARN2::MapImageOptions& options = {},
+                                         const OCARN2::Rsc* rsc = nullptr);
+OCARN2_DEF bool save_map_plane_image(const OCARN2::Map& map, OCARN2::MapPlane plane, const std::string& filename,
+                                     const OCARN2::MapImageOptions& options = {}, const OCARN2::Rsc* rsc = nullptr);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Internal function to fill in the 54 byte header of an uncompressed .bmp. A negative height means the rows
+ * are stored top down, which lets them be written as they're made
+ *
+ * @param header
+ * @param width
+ * @param height
+ * @param bitsPerPixel 24 or 32
+ */
+static void ocarn2__bmp_header(unsigned char* header, uint32_t width, int32_t height, uint32_t bitsPerPixel) {
+    uint32_t rowSize = (width * bitsPerPixel / 8 + 3) & ~3u;
+    uint32_t fileSize = 54 + rowSize * (uint32_t) std::abs(height);
+
+    auto put = [&](uint32_t at, uint32_t value, uint32_t bytes) {
+        for(uint32_t i=0; i < bytes; i++) header[at + i] = (unsigned char) (value >> (i * 8));
+    };
+
+    memset(header, 0, 54);
+    header[0] = 'B';
+    header[1] = 'M';
+    put(2, fileSize, 4);
+    put(10, 54, 4);
+
+    put(14, 40, 4);
+    put(18, width, 4);
+    put(22, (uint32_t) height, 4);
+    put(26, 1, 2);
+    put(28, bitsPerPixel, 2);
+}
+
+/**
+ * Internal function to turn a row of an image into .bmp order, blue first, padded out to 4 bytes
+ *
+ * @param pixels
+ * @param width
+ * @param channels
+ * @param out rowSize bytes
+ */
+static void ocarn2__bmp_row(const unsigned char* pixels, uint32_t width, uint32_t channels, unsigned char* out) {
+    for(uint32_t x=0; x < width; x++) {
+        const unsigned char* p = pixels + x * channels;
+
+        if(channels == 1) {
+            out[0] = out[1] = out[2] = p[0];
+            out += 3;
+        }
+        else {
+            out[0] = p[2];
+            out[1] = p[1];
+            out[2] = p[0];
+            if(channels == 4) out[3] = p[3];
+            out += channels;
+        }
+    }
+
+    // padding
+    size_t written = width * (channels == 4 ? 4 : 3);
+    for(size_t i = written; i % 4 != 0; i++) *out++ = 0;
+}
+
+/**
+ * Makes a blank image
+ *
+ * @param width
+ * @param height
+ * @param channels 1, 3 or 4
+ * @return
+ */
+OCARN2_DEF OCARN2::Image create_image(uint32_t width, uint32_t height, uint32_t channels) {
+    OCARN2::Image image;
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.pixels.resize((size_t) width * height * channels);
+
+    return image;
+}
+
+/**
+ * Writes an image as an uncompressed .bmp. Grey and rgb images become 24 bit, rgba 32 bit
+ *
+ * @param image
+ * @param filename
+ * @return false if the image has an odd number of channels or the file can't be written
+ */
+OCARN2_DEF bool save_bmp_file(const OCARN2::Image& image, const std::string& filename) {
+    if(image.channels != 1 && image.channels != 3 && image.channels != 4) {
+        std::cerr << "Can't write an image with " << image.channels << " channels as a bmp" << std::endl;
+        return false;
+    }
+    if(image.pixels.size() < (size_t) image.width * image.height * image.channels) {
+        std::cerr << "Image is smaller than its width and height" << std::endl;
+        return false;
+    }
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    if(!f) {
+        std::cerr << "Failed to open " << filename << std::endl;
+        return false;
+    }
+
+    uint32_t bitsPerPixel = image.channels == 4 ? 32 : 24;
+    unsigned char header[54];
+    ocarn2__bmp_header(header, image.width, (int32_t) image.height, bitsPerPixel);
+    fwrite(header, 1, 54, f);
+
+    // bottom row first
+    std::vector<unsigned char> row((image.width * bitsPerPixel / 8 + 3) & ~3u);
+    for(uint32_t y=0; y < image.height; y++) {
+        const unsigned char* pixels = &image.pixels[(size_t) (image.height - 1 - y) * image.width * image.channels];
+        ocarn2__bmp_row(pixels, image.width, image.channels, row.data());
+        fwrite(row.data(), 1, row.size(), f);
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+
+    if(!ok) std::cerr << "Failed to write " << filename << std::endl;
+    return ok;
+}
+
+/**
+ * Turns a 16 bit game texel (5 bits each of red, green and blue) into 8 bit red, green and blue
+ *
+ * @param texel
+ * @param rgb 3 bytes
+ */
+OCARN2_DEF void texel_to_rgb(uint16_t texel, unsigned char* rgb) {
+    rgb[0] = (unsigned char) (((texel >> 10) & 31) * 255 / 31);
+    rgb[1] = (unsigned char) (((texel >> 5) & 31) * 255 / 31);
+    rgb[2] = (unsigned char) ((texel & 31) * 255 / 31);
+}
+
+/**
+ * The average colour of every texture in an Rsc, 3 bytes (rgb) per texture
+ *
+ * @param rsc
+ * @param threads 0 = hardware concurrency
+ * @return
+ */
+OCARN2_DEF std::vector<unsigned char> average_texture_colors(const OCARN2::Rsc& rsc, unsigned threads) {
+    std::vector<unsigned char> colors(rsc.textures.size() * 3, 0);
+
+    ocarn2__parallel_for(rsc.textures.size(), threads, [&](size_t t) {
+        const OCARN2::Texture& texture = rsc.textures[t];
+        uint32_t count = texture.data ? texture.size / 2 : 0;
+        if(count == 0) return;
+
+        uint64_t sum[3] = {0, 0, 0};
+        for(uint32_t i=0; i < count; i++) {
+            uint16_t texel = texture.data[i];
+            sum[0] += (texel >> 10) & 31;
+            sum[1] += (texel >> 5) & 31;
+            sum[2] += texel & 31;
+        }
+
+        for(int c=0; c < 3; c++) colors[t * 3 + c] = (unsigned char) (sum[c] * 255 / (31 * (uint64_t) count));
+    });
+
+    return colors;
+}
+
+/**
+ * Internal state for turning a map plane into rows of pixels
+ */
+struct ocarn2__map_image {
+    OCARN2::MapPlane plane;
+    const unsigned char* bytes; // byte planes
+    const uint16_t* words;      // textureMap, textureMapFar and bitflagMap
+    bool textures;
+    std::vector<unsigned char> textureColors; // empty without an rsc, textures are then grey by number
+
+    uint32_t planeWidth;
+    uint32_t downsample;
+    uint32_t width;   // of the picture
+    uint32_t channels;
+};
+
+/**
+ * Internal function to set up a conversion, and check the options make sense for the plane
+ *
+ * @param image
+ * @param map
+ * @param plane
+ * @param options
+ * @param rsc
+ * @return false if the plane or downsampling is bad
+ */
+static bool ocarn2__map_image_begin(ocarn2__map_image& image, const OCARN2::Map& map, OCARN2::MapPlane plane,
+                                    const OCARN2::MapImageOptions& options, const OCARN2::Rsc* rsc) {
+    if(plane < 0 || plane >= OCARN2::MAP_NUM_PLANES) {
+        std::cerr << "Unknown map plane " << (int) plane << std::endl;
+        return false;
+    }
+
+    OCARN2::MapPlaneInfo info = map_plane_info(plane);
+    if(options.downsample == 0 || info.width % options.downsample != 0) {
+        std::cerr << "Downsampling by " << options.downsample << " doesn't divide the " << info.name << " plane" << std::endl;
+        return false;
+    }
+
+    image.plane = plane;
+    image.bytes = map_plane_data(map, plane);
+    image.words = (const uint16_t*) image.bytes;
+    image.planeWidth = info.width;
+    image.downsample = options.downsample;
+    image.width = info.width / options.downsample;
+
+    image.textures = plane == OCARN2::MAP_TEXTURE || plane == OCARN2::MAP_TEXTURE_FAR;
+    image.channels = plane == OCARN2::MAP_BITFLAG || (image.textures && rsc) ? 3 : 1;
+
+    if(image.textures && rsc) image.textureColors = average_texture_colors(*rsc, options.threads);
+
+    return true;
+}
+
+/**
+ * Internal function to convert one row of the picture with cell(index, sum) adding a cell's channels to sum.
+ * Split out per kind of plane so the choice isn't made for every cell
+ *
+ * @param image
+ * @param y row of the picture
+ * @param out width * Channels bytes
+ * @param cell
+ */
+template<uint32_t Channels, typename Cell>
+static void ocarn2__map_image_rows(const ocarn2__map_image& image, uint32_t y, unsigned char* out, Cell cell) {
+    uint32_t factor = image.downsample;
+    uint32_t firstZ = (image.width - 1 - y) * factor;
+
+    if(factor == 1) {
+        size_t first = (size_t) firstZ * image.planeWidth;
+
+        for(uint32_t x=0; x < image.width; x++) {
+            uint32_t sum[Channels] = {};
+            cell(first + x, sum);
+            for(uint32_t c=0; c < Channels; c++) *out++ = (unsigned char) sum[c];
+        }
+        return;
+    }
+
+    uint32_t cells = factor * factor;
+    for(uint32_t x=0; x < image.width; x++) {
+        uint32_t sum[Channels] = {};
+
+        for(uint32_t dz=0; dz < factor; dz++) {
+            size_t first = (size_t) (firstZ + dz) * image.planeWidth + (size_t) x * factor;
+            for(uint32_t dx=0; dx < factor; dx++) cell(first + dx, sum);
+        }
+
+        for(uint32_t c=0; c < Channels; c++) *out++ = (unsigned char) ((sum[c] + cells / 2) / cells);
+    }
+}
+
+/**
+ * Internal function to convert one row of the picture, the top row being the far end of the map's z axis
+ *
+ * @param image
+ * @param y row of the picture
+ * @param out width * channels bytes
+ */
+static void ocarn2__map_image_row(const ocarn2__map_image& image, uint32_t y, unsigned char* out) {
+    const unsigned char* bytes = image.bytes;
+    const uint16_t* words = image.words;
+
+    if(image.plane == OCARN2::MAP_BITFLAG) {
+        ocarn2__map_image_rows<3>(image, y, out, [words](size_t i, uint32_t* sum) {
+            uint16_t flags = words[i];
+            if(flags & OCARN2::BF_IMPASSABLE) sum[0] += 255;
+            if(flags & OCARN2::BF_REVERSE) sum[1] += 255;
+            if(flags & OCARN2::BF_WATER) sum[2] += 255;
+        });
+    }
+    else if(image.textures && image.channels == 3) {
+        // missing textures are black
+        const unsigned char* colors = image.textureColors.data();
+        size_t numTextures = image.textureColors.size() / 3;
+
+        ocarn2__map_image_rows<3>(image, y, out, [words, colors, numTextures](size_t i, uint32_t* sum) {
+            size_t texture = words[i];
+            if(texture < numTextures) {
+                sum[0] += colors[texture * 3];
+                sum[1] += colors[texture * 3 + 1];
+                sum[2] += colors[texture * 3 + 2];
+            }
+        });
+    }
+    else if(image.textures) {
+        ocarn2__map_image_rows<1>(image, y, out, [words](size_t i, uint32_t* sum) { sum[0] += words[i] & 0xff; });
+    }
+    else if(image.downsample == 1) {
+        memcpy(out, bytes + (size_t) (image.width - 1 - y) * image.planeWidth, image.width);
+    }
+    else {
+        ocarn2__map_image_rows<1>(image, y, out, [bytes](size_t i, uint32_t* sum) { sum[0] += bytes[i]; });
+    }
+}
+
+/**
+ * Turns a plane of a map into a picture. See the top of this file for what each plane looks like
+ *
+ * @param map
+ * @param plane
+ * @param options
+ * @param rsc for the average colour of each texture, when the plane is textureMap or textureMapFar
+ * @return grey or rgb image, empty if the options don't fit the plane
+ */
+OCARN2_DEF OCARN2::Image map_plane_image(const OCARN2::Map& map, OCARN2::MapPlane plane, const OCARN2::MapImageOptions& options,
+                                         const OCARN2::Rsc* rsc) {
+    ocarn2__map_image source;
+    if(!ocarn2__map_image_begin(source, map, plane, options, rsc)) return {};
+
+    OCARN2::Image image = create_image(source.width, source.width, source.channels);
+    size_t stride = (size_t) source.width * source.channels;
+
+    ocarn2__parallel_for(source.width, options.threads, [&](size_t y) {
+        ocarn2__map_image_row(source, (uint32_t) y, &image.pixels[y * stride]);
+    });
+
+    return image;
+}
+
+/**
+ * Writes a plane of a map straight to a file, as a .bmp or raw pixels. Rows are converted a band at a time over
+ * all the threads and each band is written before the next, so the whole picture is never held at once
+ *
+ * @param map
+ * @param plane
+ * @param filename
+ * @param options
+ * @param rsc for the average colour of each texture, when the plane is textureMap or textureMapFar
+ * @return false if the options don't fit the plane or the file can't be written
+ */
+OCARN2_DEF bool save_map_plane_image(const OCARN2::Map& map, OCARN2::MapPlane plane, const std::string& filename,
+                                     const OCARN2::MapImageOptions& options, const OCARN2::Rsc* rsc) {
+    ocarn2__map_image source;
+    if(!ocarn2__map_image_begin(source, map, plane, options, rsc)) return false;
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    if(!f) {
+        std::cerr << "Failed to open " << filename << std::endl;
+        return false;
+    }
+
+    bool bmp = options.format == OCARN2::IMAGE_BMP;
+    uint32_t width = source.width, height = source.width;
+    size_t stride = (size_t) width * source.channels;
+    size_t rowSize = bmp ? (width * 3 + 3) & ~3u : stride;
+
+    if(bmp) {
+        // top down, so rows go out in the order they're made
+        unsigned char header[54];
+        ocarn2__bmp_header(header, width, -(int32_t) height, 24);
+        fwrite(header, 1, 54, f);
+    }
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    uint32_t band = std::max(1u, options.bandRows) * threads;
+    std::vector<unsigned char> rows(rowSize * band);
+    std::vector<unsigned char> pixels(bmp ? stride * band : 0);
+
+    for(uint32_t first=0; first < height; first += band) {
+        uint32_t count = std::min(band, height - first);
+
+        ocarn2__parallel_for(count, threads, [&](size_t i) {
+            unsigned char* out = &rows[i * rowSize];
+
+            if(bmp) {
+                ocarn2__map_image_row(source, first + (uint32_t) i, &pixels[i * stride]);
+                ocarn2__bmp_row(&pixels[i * stride], width, source.channels, out);
+            }
+            else {
+                ocarn2__map_image_row(source, first + (uint32_t) i, out);
+            }
+        });
+
+        fwrite(rows.data(), 1, rowSize * count, f);
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+
+    if(!ok) std::cerr << "Failed to write " << filename << std::endl;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,335 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h that gathers every object placed on a Map into instance arrays, one per model.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * Each cell of objectMap with a model in it becomes an Instance, in the middle of its cell at objectHeightMap *
+ * heightScale, turned a quarter turn at a time by BF_MODEL_DIRECTION and the bit above it (the same placement as
+ * ocarn2_bvh.h), carrying the cell's dawn, noon and night light from lightingMap. Instances are sorted by model,
+ * then by chunk (64x64 cells by default, like the terrain), so all of a model's instances are one contiguous run
+ * and every chunk's share of that run is a batch with its own world space box.
+ *
+ * cull_instance_batches tests chunks against a frustum, then the batches in the chunks that pass, and hands
+ * back the visible batches still in model order, so consecutive batches of one model can be drawn as one
+ * instanced draw. instance_matrices writes 3x4 transforms for a run of instances, ready for an instance buffer.
+ * The light bytes mix with lighting_weights from ocarn2_lighting.h the same way the terrain's planes do.
+ *
+ * main methods are
+ *
+ * InstanceSet build_instance_set(const Map& map, const Rsc& rsc, const InstanceOptions& options);
+ * void cull_instance_batches(const InstanceSet& set, const float planes[6][4], std::vector<uint32_t>& visible);
+ * void instance_matrices(const InstanceSet& set, uint32_t first, uint32_t count, float* matrices);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct InstanceOptions {
+        // cells per side of a chunk. must divide 1024
+        uint32_t chunkSize = 64;
+
+        // world units per cell, and per step of objectHeightMap, same as the terrain mesh
+        float cellSize = 256.0f;
+        float heightScale = 64.0f;
+    };
+
+    // 28 bytes
+    struct Instance {
+        float position[3];
+
+        // of the turn about y. model x goes to cos * x + sin * z, model z to cos * z - sin * x
+        float cos, sin;
+
+        uint16_t cellX, cellZ;
+
+        // dawn, noon, night, from the map's lightingMap planes
+        unsigned char light[3];
+
+        // quarter turns about y
+        unsigned char rotation;
+    };
+
+    // a model's instances inside one chunk
+    struct InstanceBatch {
+        uint32_t model;
+        uint32_t chunk;
+        uint32_t first, count;
+
+        // world space, the model's box turned and moved to every instance
+        float min[3], max[3];
+    };
+
+    struct InstanceModel {
+        uint32_t firstInstance, numInstances;
+        uint32_t firstBatch, numBatches;
+
+        // model space bounds of the mesh
+        float min[3], max[3];
+    };
+
+    struct InstanceChunk {
+        uint32_t chunkX, chunkZ;
+        uint32_t numInstances;
+
+        // world space, over every batch in the chunk. empty chunks have min > max
+        float min[3], max[3];
+    };
+
+    struct InstanceSet {
+        InstanceOptions options;
+
+        uint32_t chunksPerSide = 0;
+        std::vector<InstanceChunk> chunks; // chunkZ * chunksPerSide + chunkX
+
+        // one per RscModel
+        std::vector<InstanceModel> models;
+
+        // by model, then chunk
+        std::vector<InstanceBatch> batches;
+        std::vector<Instance> instances;
+    };
+}
+
+
+OCARN2_DEF OCARN2::InstanceSet build_instance_set(const OCARN2::Map& map, const OCARN2::Rsc& rsc, const OCARN2::InstanceOptions& options = {});
+OCARN2_DEF void cull_instance_batches(const OCARN2::InstanceSet& set, const float planes[6][4], std::vector<uint32_t>& visible);
+OCARN2_DEF void instance_matrices(const OCARN2::InstanceSet& set, uint32_t first, uint32_t count, float* matrices);
+OCARN2_DEF OCARN2::MemoryFootprint instance_set_memory_footprint(const OCARN2::InstanceSet& set);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cfloat>
+
+/**
+ * Internal function to grow a box to take in another
+ *
+ * @param min
+ * @param max
+ * @param otherMin
+ * @param otherMax
+ */
+static void ocarn2__instance_grow(float* min, float* max, const float* otherMin, const float* otherMax) {
+    for(int a=0; a < 3; a++) {
+        min[a] = std::min(min[a], otherMin[a]);
+        max[a] = std::max(max[a], otherMax[a]);
+    }
+}
+
+/**
+ * Internal function to check whether a box is at least partly on the inside of every plane
+ *
+ * @param planes
+ * @param min
+ * @param max
+ * @return
+ */
+static bool ocarn2__instance_box_visible(const float planes[6][4], const float* min, const float* max) {
+    for(int p=0; p < 6; p++) {
+        const float* plane = planes[p];
+
+        // the corner furthest along the plane's normal
+        float x = plane[0] >= 0 ? max[0] : min[0];
+        float y = plane[1] >= 0 ? max[1] : min[1];
+        float z = plane[2] >= 0 ? max[2] : min[2];
+        if(plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Gathers every placed object on the map into instance arrays by model, split into chunks
+ *
+ * @param map
+ * @param rsc
+ * @param options
+ * @return an empty set if the chunk size doesn't cut the map up evenly
+ */
+OCARN2_DEF OCARN2::InstanceSet build_instance_set(const OCARN2::Map& map, const OCARN2::Rsc& rsc, const OCARN2::InstanceOptions& options) {
+    OCARN2::InstanceSet set;
+
+    if(options.chunkSize < 1 || options.chunkSize > 1024 || 1024 % options.chunkSize != 0) {
+        std::cerr << "Chunk size " << options.chunkSize << " doesn't divide the map evenly" << std::endl;
+        return set;
+    }
+
+    set.options = options;
+    set.chunksPerSide = 1024 / options.chunkSize;
+    uint32_t numChunks = set.chunksPerSide * set.chunksPerSide;
+    uint32_t numModels = (uint32_t) rsc.models.size();
+
+    set.chunks.resize(numChunks);
+    for(uint32_t c=0; c < numChunks; c++) {
+        OCARN2::InstanceChunk& chunk = set.chunks[c];
+        chunk.chunkX = c % set.chunksPerSide;
+        chunk.chunkZ = c / set.chunksPerSide;
+        chunk.numInstances = 0;
+        for(int a=0; a < 3; a++) {
+            chunk.min[a] = FLT_MAX;
+            chunk.max[a] = -FLT_MAX;
+        }
+    }
+
+    set.models.resize(numModels);
+    for(uint32_t m=0; m < numModels; m++) {
+        OCARN2::InstanceModel& model = set.models[m];
+        const std::vector<OCARN2::Vertex>& vertices = rsc.models[m].mesh.vertices;
+
+        model = {};
+        for(size_t v=0; v < vertices.size(); v++) {
+            const float p[3] = { vertices[v].x, vertices[v].y, vertices[v].z };
+            if(v == 0) {
+                std::copy(p, p + 3, model.min);
+                std::copy(p, p + 3, model.max);
+            } else {
+                ocarn2__instance_grow(model.min, model.max, p, p);
+            }
+        }
+    }
+
+    // counting sort by model and chunk, so each batch's slot is known before anything is placed
+    std::vector<uint32_t> counts((size_t) numModels * numChunks + 1, 0);
+    for(uint32_t cell=0; cell < 1024 * 1024; cell++) {
+        unsigned char model = map.objectMap[cell];
+        if(model == 255 || model >= numModels) continue;
+
+        uint32_t chunk = (cell / 1024 / options.chunkSize) * set.chunksPerSide + (cell % 1024) / options.chunkSize;
+        counts[(size_t) model * numChunks + chunk + 1]++;
+    }
+
+    for(size_t i=1; i < counts.size(); i++) counts[i] += counts[i - 1];
+    set.instances.resize(counts.back());
+
+    for(uint32_t m=0; m < numModels; m++) {
+        OCARN2::InstanceModel& model = set.models[m];
+        model.firstInstance = counts[(size_t) m * numChunks];
+        model.numInstances = counts[(size_t) (m + 1) * numChunks] - model.firstInstance;
+        model.firstBatch = (uint32_t) set.batches.size();
+
+        for(uint32_t c=0; c < numChunks; c++) {
+            uint32_t first = counts[(size_t) m * numChunks + c], last = counts[(size_t) m * numChunks + c + 1];
+            if(first == last) continue;
+
+            OCARN2::InstanceBatch batch = { m, c, first, last - first, { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+            set.batches.push_back(batch);
+        }
+
+        model.numBatches = (uint32_t) set.batches.size() - model.firstBatch;
+    }
+
+    std::vector<uint32_t> next(counts.begin(), counts.end() - 1);
+
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) {
+            uint32_t cell = z * 1024 + x;
+            unsigned char model = map.objectMap[cell];
+            if(model == 255 || model >= numModels) continue;
+
+            uint32_t chunk = (z / options.chunkSize) * set.chunksPerSide + x / options.chunkSize;
+            OCARN2::Instance& instance = set.instances[next[(size_t) model * numChunks + chunk]++];
+
+            instance.position[0] = (x + 0.5f) * options.cellSize;
+            instance.position[1] = map.objectHeightMap[cell] * options.heightScale;
+            instance.position[2] = (z + 0.5f) * options.cellSize;
+            instance.rotation = (unsigned char) ((map.bitflagMap[cell] >> 2) & 3);
+            instance.cos = ocarn2__quarter_cos[instance.rotation];
+            instance.sin = ocarn2__quarter_sin[instance.rotation];
+            instance.cellX = (uint16_t) x;
+            instance.cellZ = (uint16_t) z;
+            for(int p=0; p < 3; p++) instance.light[p] = map.lightingMap[p][cell];
+        }
+    }
+
+    // boxes, the model's bounds turned (which stays a box for quarter turns) at every instance
+    for(OCARN2::InstanceBatch& batch: set.batches) {
+        const OCARN2::InstanceModel& model = set.models[batch.model];
+
+        for(uint32_t i=batch.first; i < batch.first + batch.count; i++) {
+            const OCARN2::Instance& instance = set.instances[i];
+            float x0 = instance.cos * model.min[0] + instance.sin * model.min[2], x1 = instance.cos * model.max[0] + instance.sin * model.max[2];
+            float z0 = instance.cos * model.min[2] - instance.sin * model.min[0], z1 = instance.cos * model.max[2] - instance.sin * model.max[0];
+
+            const float min[3] = { instance.position[0] + std::min(x0, x1), instance.position[1] + model.min[1], instance.position[2] + std::min(z0, z1) };
+            const float max[3] = { instance.position[0] + std::max(x0, x1), instance.position[1] + model.max[1], instance.position[2] + std::max(z0, z1) };
+            ocarn2__instance_grow(batch.min, batch.max, min, max);
+        }
+
+        OCARN2::InstanceChunk& chunk = set.chunks[batch.chunk];
+        chunk.numInstances += batch.count;
+        ocarn2__instance_grow(chunk.min, chunk.max, batch.min, batch.max);
+    }
+
+    return set;
+}
+
+/**
+ * Finds the batches at least partly inside a frustum. Planes are a, b, c, d with the inside where
+ * a * x + b * y + c * z + d >= 0, and don't need to be normalized
+ *
+ * @param set
+ * @param planes
+ * @param visible batch indices, by model then chunk
+ */
+OCARN2_DEF void cull_instance_batches(const OCARN2::InstanceSet& set, const float planes[6][4], std::vector<uint32_t>& visible) {
+    visible.clear();
+
+    std::vector<bool> chunkVisible(set.chunks.size());
+    for(size_t c=0; c < set.chunks.size(); c++) {
+        const OCARN2::InstanceChunk& chunk = set.chunks[c];
+        chunkVisible[c] = chunk.numInstances > 0 && ocarn2__instance_box_visible(planes, chunk.min, chunk.max);
+    }
+
+    for(uint32_t b=0; b < set.batches.size(); b++) {
+        const OCARN2::InstanceBatch& batch = set.batches[b];
+        if(chunkVisible[batch.chunk] && ocarn2__instance_box_visible(planes, batch.min, batch.max)) visible.push_back(b);
+    }
+}
+
+/**
+ * Writes the model to world transform of a run of instances, 12 floats each: three rows of a 3x4 matrix
+ * taking model space x, y, z, 1 to world space
+ *
+ * @param set
+ * @param first
+ * @param count
+ * @param matrices
+ */
+OCARN2_DEF void instance_matrices(const OCARN2::InstanceSet& set, uint32_t first, uint32_t count, float* matrices) {
+    const OCARN2::Instance* instances = set.instances.data() + first;
+
+    for(uint32_t i=0; i < count; i++) {
+        const OCARN2::Instance& instance = instances[i];
+        float* m = matrices + (size_t) i * 12;
+
+        m[0] = instance.cos;  m[1] = 0; m[2]  = instance.sin; m[3]  = instance.position[0];
+        m[4] = 0;             m[5] = 1; m[6]  = 0;            m[7]  = instance.position[1];
+        m[8] = -instance.sin; m[9] = 0; m[10] = instance.cos; m[11] = instance.position[2];
+    }
+}
+
+/**
+ * Measures an instance set, section by section
+ *
+ * @param set
+ * @return
+ */
+OCARN2_DEF OCARN2::MemoryFootprint instance_set_memory_footprint(const OCARN2::InstanceSet& set) {
+    OCARN2::MemoryFootprint footprint;
+
+    ocarn2__memory_add(footprint, "struct", sizeof(OCARN2::InstanceSet), sizeof(OCARN2::InstanceSet));
+    ocarn2__memory_add(footprint, "chunks", set.chunks);
+    ocarn2__memory_add(footprint, "models", set.models);
+    ocarn2__memory_add(footprint, "batches", set.batches);
+    ocarn2__memory_add(footprint, "instances", set.instances);
+
+    return footprint;
+}
+
+#endif
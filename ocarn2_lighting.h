@@ -0,0 +1,528 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for lighting a Map at any time of day.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * A map has three light planes, dawn, noon and night. A LightingBlender keeps one plane blended between the
+ * two either side of the current hour, and can sample any point straight from the sources. Blending is 8.8
+ * fixed point, 32 cells at a time with AVX2 when the CPU has it.
+ *
+ * The plane is blended in square blocks (32x32 cells by default). When the time moves, a block is only
+ * blended again if its cells could have moved by more than the tolerance, which is worked out from how far
+ * apart the three planes are inside the block. Flat or evenly lit blocks get skipped for a long time, so
+ * moving the clock a minute at a time touches a small part of the map. Blocks whose sources change get
+ * marked dirty and are always blended on the next move.
+ *
+ * bake_lightmap works out a new light plane from heightMap for a sun direction, for edited or generated
+ * terrain. Shadows come from horizon sweeps: lines are walked away from the sun, carrying the height of the
+ * shadow cast so far and dropping it by the sun's slope every step, so each cell is visited a constant number
+ * of times however long the shadows get. Lines are independent, so they're spread over threads, then every
+ * cell reads its shadow height back from the two lines either side of it. Objects can cast shadows too, as
+ * columns as tall as their model's yHi.
+ *
+ * main methods are
+ *
+ * std::vector<unsigned char> bake_lightmap(const Map& map, const LightBakeOptions& options, const Rsc* rsc);
+ * LightingBlender create_lighting_blender(const Map& map, float hour, const LightingOptions& options);
+ * uint32_t set_lighting_time(LightingBlender& blender, float hour);
+ * void mark_lighting_dirty(LightingBlender& blender, uint32_t x, uint32_t z, uint32_t width, uint32_t height);
+ * float sample_lighting(const LightingBlender& blender, float x, float z);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct LightingOptions {
+        // hours of the day each plane is for. the day wraps from night back around to dawn
+        float dawnHour = 6.0f;
+        float noonHour = 12.0f;
+        float nightHour = 20.0f;
+
+        // keep a copy of the three planes side by side, dawn noon night, so sampling a cell is one fetch
+        bool interleaved = true;
+
+        // cells per side of the blocks the plane is blended in. must divide 1024
+        uint32_t blockSize = 32;
+
+        // how far (in light levels) a block may drift from an exact blend before it's blended again
+        float tolerance = 0.5f;
+    };
+
+    struct LightBakeOptions {
+        // points towards the sun, y up. doesn't need to be normalized
+        float sunX = -0.6f, sunY = 0.35f, sunZ = 0.4f;
+
+        // world units per cell, and per step of heightMap, same as the terrain mesh
+        float cellSize = 256.0f;
+        float heightScale = 64.0f;
+
+        // light that reaches everything, from 0 to 1
+        float ambient = 0.3f;
+
+        // shadows fade in over this many world units below the horizon. 0 gives hard edges
+        float penumbra = 128.0f;
+
+        // keeps gentle slopes from shadowing themselves
+        float shadowBias = 32.0f;
+
+        // when there's an Rsc to go with the map, objects cast shadows
+        bool objectShadows = true;
+
+        // threads used to bake. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    // how much of each plane goes into a blend, out of 256
+    struct LightingWeights {
+        uint16_t dawn, noon, night;
+    };
+
+    struct LightingBlender {
+        LightingOptions options;
+        const Map* map = nullptr;
+
+        float hour = 0;
+        LightingWeights weights = {};
+
+        std::vector<unsigned char> blended = std::vector<unsigned char>(1024 * 1024);
+
+        // 3 bytes per cell, empty unless options.interleaved
+        std::vector<unsigned char> interleaved;
+
+        // by block, the weights it was last blended with and the most any cell's three sources differ
+        uint32_t blocksPerSide = 0;
+        std::vector<LightingWeights> blockWeights;
+        std::vector<unsigned char> blockSpread;
+    };
+}
+
+
+OCARN2_DEF std::vector<unsigned char> bake_lightmap(const OCARN2::Map& map, const OCARN2::LightBakeOptions& options = {}, const OCARN2::Rsc* rsc = nullptr);
+OCARN2_DEF OCARN2::LightingWeights lighting_weights(const OCARN2::LightingOptions& options, float hour);
+OCARN2_DEF OCARN2::LightingBlender create_lighting_blender(const OCARN2::Map& map, float hour, const OCARN2::LightingOptions& options = {});
+OCARN2_DEF uint32_t set_lighting_time(OCARN2::LightingBlender& blender, float hour);
+OCARN2_DEF void mark_lighting_dirty(OCARN2::LightingBlender& blender, uint32_t x, uint32_t z, uint32_t width, uint32_t height);
+OCARN2_DEF float sample_lighting(const OCARN2::LightingBlender& blender, float x, float z);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCARN2__LIGHTING_AVX2
+#include <immintrin.h>
+#endif
+
+// weights a block can't have, so it gets blended whatever the time
+static const OCARN2::LightingWeights ocarn2__lighting_dirty = { 0xffff, 0xffff, 0xffff };
+
+static void ocarn2__blend_light_scalar(const unsigned char* dawn, const unsigned char* noon, const unsigned char* night,
+                                       unsigned char* out, size_t count, OCARN2::LightingWeights w) {
+    for(size_t i=0; i < count; i++) {
+        out[i] = (unsigned char) ((dawn[i] * w.dawn + noon[i] * w.noon + night[i] * w.night + 128) >> 8);
+    }
+}
+
+#ifdef OCARN2__LIGHTING_AVX2
+
+/**
+ * Internal blend of 16 cells. Weights add up to 256, so every sum fits in 16 bits
+ */
+__attribute__((target("avx2"))) static inline __m256i ocarn2__blend_light16_avx2(__m128i a, __m128i b, __m128i c, __m256i wDawn, __m256i wNoon, __m256i wNight) {
+    __m256i sum = _mm256_add_epi16(_mm256_set1_epi16(128), _mm256_mullo_epi16(_mm256_cvtepu8_epi16(a), wDawn));
+    sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(b), wNoon));
+    sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(c), wNight));
+
+    return _mm256_srli_epi16(sum, 8);
+}
+
+__attribute__((target("avx2"))) static void ocarn2__blend_light_avx2(const unsigned char* dawn, const unsigned char* noon, const unsigned char* night,
+                                                                    unsigned char* out, size_t count, OCARN2::LightingWeights w) {
+    const __m256i wDawn = _mm256_set1_epi16((short) w.dawn);
+    const __m256i wNoon = _mm256_set1_epi16((short) w.noon);
+    const __m256i wNight = _mm256_set1_epi16((short) w.night);
+
+    size_t i = 0;
+    for(; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (dawn + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (noon + i));
+        __m256i c = _mm256_loadu_si256((const __m256i*) (night + i));
+
+        __m256i low = ocarn2__blend_light16_avx2(_mm256_castsi256_si128(a), _mm256_castsi256_si128(b), _mm256_castsi256_si128(c), wDawn, wNoon, wNight);
+        __m256i high = ocarn2__blend_light16_avx2(_mm256_extracti128_si256(a, 1), _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(c, 1), wDawn, wNoon, wNight);
+
+        // packus works within 128 bit lanes, the permute puts the cells back in order
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xd8));
+    }
+
+    ocarn2__blend_light_scalar(dawn + i, noon + i, night + i, out + i, count - i, w);
+}
+
+#endif
+
+static void ocarn2__blend_light(const unsigned char* dawn, const unsigned char* noon, const unsigned char* night,
+                                unsigned char* out, size_t count, OCARN2::LightingWeights w) {
+#ifdef OCARN2__LIGHTING_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if(avx2) {
+        ocarn2__blend_light_avx2(dawn, noon, night, out, count, w);
+        return;
+    }
+#endif
+    ocarn2__blend_light_scalar(dawn, noon, night, out, count, w);
+}
+
+/**
+ * Internal function to blend one block of the plane with the blender's current weights
+ *
+ * @param blender
+ * @param block
+ */
+static void ocarn2__blend_light_block(OCARN2::LightingBlender& blender, uint32_t block) {
+    const OCARN2::Map& map = *blender.map;
+    uint32_t size = blender.options.blockSize;
+    uint32_t x = block % blender.blocksPerSide * size, z = block / blender.blocksPerSide * size;
+
+    for(uint32_t row = z; row < z + size; row++) {
+        size_t at = row * 1024 + x;
+        ocarn2__blend_light(&map.lightingMap[0][at], &map.lightingMap[1][at], &map.lightingMap[2][at], &blender.blended[at], size, blender.weights);
+    }
+
+    blender.blockWeights[block] = blender.weights;
+}
+
+/**
+ * Internal function to pick up changes to the sources of one block, for the interleaved copy and the spread
+ *
+ * @param blender
+ * @param block
+ */
+static void ocarn2__refresh_light_block(OCARN2::LightingBlender& blender, uint32_t block) {
+    const OCARN2::Map& map = *blender.map;
+    uint32_t size = blender.options.blockSize;
+    uint32_t x = block % blender.blocksPerSide * size, z = block / blender.blocksPerSide * size;
+
+    unsigned char spread = 0;
+    for(uint32_t row = z; row < z + size; row++) {
+        for(size_t at = row * 1024 + x; at < row * 1024 + x + size; at++) {
+            unsigned char a = map.lightingMap[0][at], b = map.lightingMap[1][at], c = map.lightingMap[2][at];
+            spread = std::max(spread, (unsigned char) (std::max(std::max(a, b), c) - std::min(std::min(a, b), c)));
+
+            if(!blender.interleaved.empty()) {
+                blender.interleaved[at * 3 + 0] = a;
+                blender.interleaved[at * 3 + 1] = b;
+                blender.interleaved[at * 3 + 2] = c;
+            }
+        }
+    }
+
+    blender.blockSpread[block] = spread;
+    blender.blockWeights[block] = ocarn2__lighting_dirty;
+}
+
+/**
+ * Internal function to build the heights that block the sun, the ground plus any objects standing on it
+ *
+ * @param map
+ * @param options
+ * @param rsc
+ * @return world units per cell
+ */
+static std::vector<float> ocarn2__light_occluders(const OCARN2::Map& map, const OCARN2::LightBakeOptions& options, const OCARN2::Rsc* rsc) {
+    std::vector<float> heights(1024 * 1024);
+    for(size_t i=0; i < heights.size(); i++) heights[i] = map.heightMap[i] * options.heightScale;
+
+    if(!rsc || !options.objectShadows) return heights;
+
+    for(int32_t z=0; z < 1024; z++) {
+        for(int32_t x=0; x < 1024; x++) {
+            unsigned char object = map.objectMap[z * 1024 + x];
+            if(object == 255 || object >= rsc->models.size()) continue;
+
+            const OCARN2::RscModel& model = rsc->models[object];
+            float top = map.heightMap[z * 1024 + x] * options.heightScale + model.yHi;
+            int32_t reach = (int32_t) (model.radius / options.cellSize);
+
+            // a column over the cells the model covers
+            for(int32_t cz = std::max(z - reach, 0); cz <= std::min(z + reach, 1023); cz++) {
+                for(int32_t cx = std::max(x - reach, 0); cx <= std::min(x + reach, 1023); cx++) {
+                    if((cx - x) * (cx - x) + (cz - z) * (cz - z) > reach * reach) continue;
+                    heights[cz * 1024 + cx] = std::max(heights[cz * 1024 + cx], top);
+                }
+            }
+        }
+    }
+
+    return heights;
+}
+
+/**
+ * Bakes a light plane from heightMap for a sun direction, with diffuse lighting and shadows from the terrain,
+ * and from objects when an Rsc is given. The result can go straight into one of the map's lightingMap planes
+ *
+ * @param map
+ * @param options
+ * @param rsc the map's resources, for object shadows. optional
+ * @return 1024 * 1024 light levels
+ */
+OCARN2_DEF std::vector<unsigned char> bake_lightmap(const OCARN2::Map& map, const OCARN2::LightBakeOptions& options, const OCARN2::Rsc* rsc) {
+    std::vector<unsigned char> light(1024 * 1024);
+
+    float length = std::sqrt(options.sunX * options.sunX + options.sunY * options.sunY + options.sunZ * options.sunZ);
+    if(length == 0) {
+        std::cerr << "Sun direction can't be zero" << std::endl;
+        return light;
+    }
+
+    float sunX = options.sunX / length, sunY = options.sunY / length, sunZ = options.sunZ / length;
+    float across = std::sqrt(sunX * sunX + sunZ * sunZ);
+
+    std::vector<float> occluders = ocarn2__light_occluders(map, options, rsc);
+    auto ground = [&](int32_t x, int32_t z) {
+        return map.heightMap[std::min(std::max(z, 0), 1023) * 1024 + std::min(std::max(x, 0), 1023)] * options.heightScale;
+    };
+
+    // shadows are walked away from the sun along the major axis m, drifting by slope cells along the minor
+    // axis n every step. with xMajor false the axes are swapped, and with flip m counts down
+    bool xMajor = std::fabs(sunX) >= std::fabs(sunZ);
+    float towardsMajor = xMajor ? -sunX : -sunZ, towardsMinor = xMajor ? -sunZ : -sunX;
+    bool flip = towardsMajor < 0;
+    float slope = towardsMajor != 0 ? towardsMinor / std::fabs(towardsMajor) : 0;
+
+    auto cell = [&](int32_t m, int32_t n) {
+        int32_t major = flip ? 1023 - m : m;
+        return xMajor ? n * 1024 + major : major * 1024 + n;
+    };
+
+    // every cell is on the line starting at n - slope * m
+    int32_t firstLine = (int32_t) std::floor(std::min(0.0f, -slope * 1023));
+    int32_t numLines = (int32_t) std::ceil(std::max(1023.0f, 1023 - slope * 1023)) - firstLine + 2;
+
+    // how far the shadow falls per step. with the sun overhead or down, the sweep is left out
+    bool sweep = sunY > 0 && across > 1e-6f;
+    float drop = sweep ? std::sqrt(1 + slope * slope) * options.cellSize * sunY / across : 0;
+
+    // the height of the shadow over each step of each line, not counting the step itself
+    std::vector<float> horizons;
+    if(sweep) {
+        horizons.resize((size_t) numLines * 1024);
+
+        ocarn2__parallel_for((size_t) numLines, options.threads, [&](size_t line) {
+            float* horizon = &horizons[line * 1024];
+            float start = (float) (firstLine + (int32_t) line);
+            float shadow = -1e30f;
+
+            for(int32_t m=0; m < 1024; m++) {
+                shadow -= drop;
+                horizon[m] = shadow;
+
+                float n = start + slope * m;
+                if(n < 0 || n > 1023) continue;
+
+                // between the two cells the line runs past
+                int32_t n0 = (int32_t) n, n1 = std::min(n0 + 1, 1023);
+                float f = n - n0;
+                shadow = std::max(shadow, occluders[cell(m, n0)] * (1 - f) + occluders[cell(m, n1)] * f);
+            }
+        });
+    }
+
+    ocarn2__parallel_for(1024, options.threads, [&](size_t m) {
+        for(int32_t n=0; n < 1024; n++) {
+            int32_t at = cell((int32_t) m, n);
+            int32_t x = at % 1024, z = at / 1024;
+
+            float nx = (ground(x - 1, z) - ground(x + 1, z));
+            float ny = 2 * options.cellSize;
+            float nz = (ground(x, z - 1) - ground(x, z + 1));
+            float diffuse = std::max(0.0f, (nx * sunX + ny * sunY + nz * sunZ) / std::sqrt(nx * nx + ny * ny + nz * nz));
+
+            float lit = sunY > 0 ? 1.0f : 0.0f;
+            if(sweep) {
+                float line = n - slope * m - firstLine;
+                int32_t l0 = (int32_t) line;
+                float f = line - l0;
+
+                float horizon = horizons[l0 * 1024 + m] * (1 - f) + horizons[(l0 + 1) * 1024 + m] * f;
+                float below = horizon - options.shadowBias - ground(x, z);
+
+                if(options.penumbra > 0) lit = std::min(std::max(1 - below / options.penumbra, 0.0f), 1.0f);
+                else lit = below > 0 ? 0.0f : 1.0f;
+            }
+
+            float level = options.ambient + (1 - options.ambient) * diffuse * lit;
+            light[at] = (unsigned char) std::lround(std::min(std::max(level, 0.0f), 1.0f) * 255);
+        }
+    });
+
+    return light;
+}
+
+/**
+ * Works out how much of each plane goes into the light at an hour of the day
+ *
+ * @param options
+ * @param hour wrapped into 0 to 24
+ * @return weights adding up to 256
+ */
+OCARN2_DEF OCARN2::LightingWeights lighting_weights(const OCARN2::LightingOptions& options, float hour) {
+    hour = std::fmod(hour, 24.0f);
+    if(hour < 0) hour += 24.0f;
+
+    // from one plane towards the next
+    float t;
+    uint16_t* from;
+    uint16_t* to;
+    OCARN2::LightingWeights weights = { 0, 0, 0 };
+
+    if(hour >= options.dawnHour && hour < options.noonHour) {
+        t = (hour - options.dawnHour) / (options.noonHour - options.dawnHour);
+        from = &weights.dawn;
+        to = &weights.noon;
+    }
+    else if(hour >= options.noonHour && hour < options.nightHour) {
+        t = (hour - options.noonHour) / (options.nightHour - options.noonHour);
+        from = &weights.noon;
+        to = &weights.night;
+    }
+    else {
+        float since = hour >= options.nightHour ? hour - options.nightHour : hour + 24.0f - options.nightHour;
+        t = since / (options.dawnHour + 24.0f - options.nightHour);
+        from = &weights.night;
+        to = &weights.dawn;
+    }
+
+    *to = (uint16_t) std::lround(std::min(std::max(t, 0.0f), 1.0f) * 256.0f);
+    *from = 256 - *to;
+
+    return weights;
+}
+
+/**
+ * Sets up a blender for a map's light planes and blends the whole plane for the given hour. The blender keeps
+ * a pointer to the map, so the map has to outlive it
+ *
+ * @param map
+ * @param hour
+ * @param options
+ * @return a blender with nothing blended if blockSize doesn't divide the map
+ */
+OCARN2_DEF OCARN2::LightingBlender create_lighting_blender(const OCARN2::Map& map, float hour, const OCARN2::LightingOptions& options) {
+    OCARN2::LightingBlender blender;
+
+    if(options.blockSize < 1 || options.blockSize > 1024 || 1024 % options.blockSize != 0) {
+        std::cerr << "Block size " << options.blockSize << " doesn't divide the map evenly" << std::endl;
+        return blender;
+    }
+
+    blender.options = options;
+    blender.map = &map;
+    blender.blocksPerSide = 1024 / options.blockSize;
+    blender.blockWeights.resize(blender.blocksPerSide * blender.blocksPerSide);
+    blender.blockSpread.resize(blender.blocksPerSide * blender.blocksPerSide);
+    if(options.interleaved) blender.interleaved.resize(1024 * 1024 * 3);
+
+    for(uint32_t block=0; block < blender.blockWeights.size(); block++) ocarn2__refresh_light_block(blender, block);
+
+    set_lighting_time(blender, hour);
+
+    return blender;
+}
+
+/**
+ * Moves the blender to a new hour, blending again only the blocks that could be out by more than the tolerance
+ *
+ * @param blender
+ * @param hour
+ * @return how many blocks were blended
+ */
+OCARN2_DEF uint32_t set_lighting_time(OCARN2::LightingBlender& blender, float hour) {
+    if(!blender.map) return 0;
+
+    blender.hour = hour;
+    blender.weights = lighting_weights(blender.options, hour);
+
+    uint32_t count = 0;
+    for(uint32_t block=0; block < blender.blockWeights.size(); block++) {
+        const OCARN2::LightingWeights& last = blender.blockWeights[block];
+
+        if(last.dawn != ocarn2__lighting_dirty.dawn) {
+            // the weights add up to 256 before and after, so a cell can only move by half their change times the spread
+            int change = std::abs(last.dawn - blender.weights.dawn) + std::abs(last.noon - blender.weights.noon) + std::abs(last.night - blender.weights.night);
+            if(change * blender.blockSpread[block] / 512.0f < blender.options.tolerance) continue;
+        }
+
+        ocarn2__blend_light_block(blender, block);
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Tells the blender a region of the map's light planes has changed. The blocks it covers are blended on the
+ * next call to set_lighting_time
+ *
+ * @param blender
+ * @param x
+ * @param z
+ * @param width
+ * @param height
+ */
+OCARN2_DEF void mark_lighting_dirty(OCARN2::LightingBlender& blender, uint32_t x, uint32_t z, uint32_t width, uint32_t height) {
+    if(!blender.map || x >= 1024 || z >= 1024 || width == 0 || height == 0) return;
+
+    uint32_t size = blender.options.blockSize;
+    uint32_t x1 = std::min(x + width, 1024u) - 1, z1 = std::min(z + height, 1024u) - 1;
+
+    for(uint32_t bz = z / size; bz <= z1 / size; bz++) {
+        for(uint32_t bx = x / size; bx <= x1 / size; bx++) ocarn2__refresh_light_block(blender, bz * blender.blocksPerSide + bx);
+    }
+}
+
+/**
+ * Samples the light at a point for the blender's current hour, filtered between the four nearest cells. This
+ * goes to the sources rather than the blended plane, so it's exact
+ *
+ * @param blender
+ * @param x in cells, clamped to the map
+ * @param z in cells, clamped to the map
+ * @return light level from 0 to 255
+ */
+OCARN2_DEF float sample_lighting(const OCARN2::LightingBlender& blender, float x, float z) {
+    if(!blender.map) return 0;
+
+    x = std::min(std::max(x, 0.0f), 1023.0f);
+    z = std::min(std::max(z, 0.0f), 1023.0f);
+
+    uint32_t x0 = (uint32_t) x, z0 = (uint32_t) z;
+    uint32_t x1 = std::min(x0 + 1, 1023u), z1 = std::min(z0 + 1, 1023u);
+    float fx = x - x0, fz = z - z0;
+
+    const OCARN2::LightingWeights& w = blender.weights;
+    auto cell = [&](uint32_t cx, uint32_t cz) {
+        size_t at = cz * 1024 + cx;
+
+        if(!blender.interleaved.empty()) {
+            const unsigned char* light = &blender.interleaved[at * 3];
+            return (float) (light[0] * w.dawn + light[1] * w.noon + light[2] * w.night);
+        }
+
+        const OCARN2::Map& map = *blender.map;
+        return (float) (map.lightingMap[0][at] * w.dawn + map.lightingMap[1][at] * w.noon + map.lightingMap[2][at] * w.night);
+    };
+
+    float top = cell(x0, z0) + (cell(x1, z0) - cell(x0, z0)) * fx;
+    float bottom = cell(x0, z1) + (cell(x1, z1) - cell(x0, z1)) * fx;
+
+    return (top + (bottom - top) * fz) / 256.0f;
+}
+
+#endif
@@ -0,0 +1,985 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h with a compact layout for a Mesh's geometry, for code that walks triangles a lot.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * Face is 64 bytes on disk and in memory, but collision, skinning and drawing only need the corners, texture
+ * coordinates and flags. A CompactMesh keeps each of those in its own packed array, so a pass over positions
+ * and indices reads 24 bytes a triangle instead of 64 plus three 16 byte vertices. The fields nothing at
+ * runtime reads (distant, next, group, DMask, reserved and the vertices' hidden) are kept aside in the cold
+ * part, so a CompactMesh can be turned back into the exact faces and vertices it came from.
+ *
+ * build_mesh_batches sorts a mesh's faces into one batch per render state (the SF_ flags that change how a
+ * face is drawn), so each batch is one draw call. Opaque batches come first, with their triangles reordered
+ * for the vertex cache (Forsyth's method). Transparent batches (SF_TRANSPARENT) come last, and keep a center
+ * per triangle so sort_mesh_batch can put them back to front for a camera.
+ *
+ * build_quantized_mesh packs a mesh smaller still, for keeping lots of creatures loaded: 16 bit positions in the
+ * mesh's bounds, 16 bit indices and 8 bit texture coordinates, and its animations compressed. Frames that are
+ * close enough to a blend of their neighbours are dropped, and in the rest each coordinate is stored across the
+ * range that vertex moves through over the animation, with as few bits as keep it close enough: none for
+ * vertices that don't move, then 4, 8 or 16. Bits are picked for blocks of 8 vertices, so decoding stays a
+ * straight run. Every frame is checked against the original after, and the worst error is kept with the animation.
+ * evaluate_compressed_pose blends two frames straight out of that form into float positions, using AVX2 where
+ * it's there. Quantized meshes are for drawing and animating only, they can't be written back to a file.
+ *
+ * main methods are
+ *
+ * CompactMesh build_compact_mesh(const Mesh& mesh);
+ * void restore_mesh_geometry(const CompactMesh& compact, Mesh& mesh);
+ * MeshBatches build_mesh_batches(const Mesh& mesh, const MeshBatchOptions& options);
+ * void sort_mesh_batch(MeshBatches& batches, const MeshBatch& batch, float eyeX, float eyeY, float eyeZ);
+ * float vertex_cache_miss_ratio(const uint32_t* indices, size_t count, uint32_t cacheSize);
+ * QuantizedMesh build_quantized_mesh(const Mesh& mesh, const MeshCompressionOptions& options);
+ * void evaluate_pose(const Animation& animation, uint32_t numVertices, float frame, float* x, float* y, float* z);
+ * void evaluate_compressed_pose(const CompressedAnimation& animation, float frame, float* x, float* y, float* z);
+ */
+
+#pragma once
+
+#include <array>
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    // the fields of Face and Vertex that only matter for writing a file back out
+    struct CompactMeshCold {
+        std::vector<uint16_t> hidden; // by vertex
+
+        std::vector<uint16_t> dMask;  // the rest by face
+        std::vector<int32_t> distant, next, group;
+        std::vector<std::array<char, 12>> reserved;
+    };
+
+    struct CompactMesh {
+        uint32_t numVertices = 0;
+        uint32_t numFaces = 0;
+
+        // by vertex
+        std::vector<float> x, y, z;
+        std::vector<int16_t> owners; // the node a vertex moves with
+
+        // by face
+        std::vector<uint32_t> indices; // v1, v2, v3
+        std::vector<uint16_t> uvs;     // tax, tay, tbx, tby, tcx, tcy
+        std::vector<uint16_t> flags;
+
+        CompactMeshCold cold;
+    };
+
+    // the face flags that change how a face is drawn
+    const uint16_t RENDER_STATE_FLAGS = SF_DOUBLE_SIDE | SF_DARK_BACK | SF_OPACITY | SF_TRANSPARENT | SF_PHONG | SF_ENV_MAP;
+
+    struct MeshBatchOptions {
+        // reorder opaque triangles so vertices are reused while they're still in the gpu's cache
+        bool optimizeVertexCache = true;
+
+        // vertices the cache is assumed to hold
+        uint32_t cacheSize = 32;
+    };
+
+    // a run of triangles that share a render state
+    struct MeshBatch {
+        uint16_t state; // face flags masked by RENDER_STATE_FLAGS
+        bool transparent;
+
+        uint32_t firstTriangle, numTriangles;
+    };
+
+    struct MeshBatches {
+        std::vector<MeshBatch> batches; // opaque first, then transparent
+
+        // by triangle, in batch order
+        std::vector<uint32_t> indices; // 3 per triangle, into the mesh's vertices
+        std::vector<uint32_t> faces;   // the face each triangle came from
+        std::vector<float> centers;    // 3 per triangle, for sorting transparent batches
+    };
+
+    struct MeshCompressionOptions {
+        // the furthest any animated vertex may end up from where the original frames put it, in model units
+        float maxError = 0.25f;
+
+        // drop frames that blending their neighbours gets close enough to
+        bool reduceKeyframes = true;
+    };
+
+    /**
+     * an animation's kept frames. a coordinate is low + q * range / (2^bits - 1), in the files' 1/16ths of a
+     * model unit, where low and range cover everywhere that coordinate goes over the animation
+     */
+    struct CompressedAnimation {
+        char name[32];
+        uint32_t kps;
+        uint32_t numFrames; // in the original animation
+        uint32_t numVertices;
+
+        // worst error on any axis over every original frame, in model units
+        float maxError = 0;
+
+        // by coordinate, all the x then y then z
+        std::vector<int16_t> low;
+        std::vector<uint16_t> range;
+
+        // by axis and block of 8 vertices, 0, 4, 8 or 16 bits for q and where the block starts within a frame
+        std::vector<uint8_t> blockBits;
+        std::vector<uint32_t> blockOffsets;
+
+        std::vector<uint16_t> frames; // which of the original frames were kept. the first and last always are
+        uint32_t frameBytes = 0;
+        std::vector<uint8_t> data;    // frameBytes a kept frame
+    };
+
+    struct QuantizedMesh {
+        uint32_t numVertices = 0;
+        uint32_t numFaces = 0;
+
+        // a position is origin + q * scale, per axis
+        float origin[3] = {};
+        float scale[3] = {};
+        float maxError = 0; // worst position error, in model units
+
+        // by vertex
+        std::vector<uint16_t> positions; // x, y, z
+        std::vector<int16_t> owners;
+
+        // by face
+        std::vector<uint16_t> indices; // v1, v2, v3
+        std::vector<uint8_t> uvs;      // tax, tay, tbx, tby, tcx, tcy
+        std::vector<uint16_t> flags;
+
+        std::vector<CompressedAnimation> animations;
+    };
+}
+
+
+OCARN2_DEF OCARN2::CompactMesh build_compact_mesh(const OCARN2::Mesh& mesh);
+OCARN2_DEF void restore_mesh_geometry(const OCARN2::CompactMesh& compact, OCARN2::Mesh& mesh);
+OCARN2_DEF OCARN2::MeshBatches build_mesh_batches(const OCARN2::Mesh& mesh, const OCARN2::MeshBatchOptions& options = {});
+OCARN2_DEF void sort_mesh_batch(OCARN2::MeshBatches& batches, const OCARN2::MeshBatch& batch, float eyeX, float eyeY, float eyeZ);
+OCARN2_DEF float vertex_cache_miss_ratio(const uint32_t* indices, size_t count, uint32_t cacheSize = 32);
+
+OCARN2_DEF OCARN2::QuantizedMesh build_quantized_mesh(const OCARN2::Mesh& mesh, const OCARN2::MeshCompressionOptions& options = {});
+OCARN2_DEF OCARN2::CompressedAnimation compress_animation(const OCARN2::Animation& animation, uint32_t numVertices, const OCARN2::MeshCompressionOptions& options = {});
+OCARN2_DEF void quantized_mesh_positions(const OCARN2::QuantizedMesh& mesh, float* x, float* y, float* z);
+OCARN2_DEF float animation_frame(uint32_t kps, uint32_t numFrames, uint32_t milliseconds);
+OCARN2_DEF void evaluate_pose(const OCARN2::Animation& animation, uint32_t numVertices, float frame, float* x, float* y, float* z);
+OCARN2_DEF void evaluate_compressed_pose(const OCARN2::CompressedAnimation& animation, float frame, float* x, float* y, float* z);
+OCARN2_DEF OCARN2::MemoryFootprint quantized_mesh_memory_footprint(const OCARN2::QuantizedMesh& mesh);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCARN2__MESH_AVX2
+#include <immintrin.h>
+#endif
+
+/**
+ * Splits a mesh's faces and vertices into packed arrays. The mesh is left alone
+ *
+ * @param mesh
+ * @return
+ */
+OCARN2_DEF OCARN2::CompactMesh build_compact_mesh(const OCARN2::Mesh& mesh) {
+    OCARN2::CompactMesh compact;
+    uint32_t numVertices = (uint32_t) mesh.vertices.size(), numFaces = (uint32_t) mesh.faces.size();
+
+    compact.numVertices = numVertices;
+    compact.numFaces = numFaces;
+
+    compact.x.resize(numVertices);
+    compact.y.resize(numVertices);
+    compact.z.resize(numVertices);
+    compact.owners.resize(numVertices);
+    compact.cold.hidden.resize(numVertices);
+
+    for(uint32_t i=0; i < numVertices; i++) {
+        const OCARN2::Vertex& vertex = mesh.vertices[i];
+
+        compact.x[i] = vertex.x;
+        compact.y[i] = vertex.y;
+        compact.z[i] = vertex.z;
+        compact.owners[i] = vertex.owner;
+        compact.cold.hidden[i] = vertex.hidden;
+    }
+
+    compact.indices.resize(numFaces * 3);
+    compact.uvs.resize(numFaces * 6);
+    compact.flags.resize(numFaces);
+    compact.cold.dMask.resize(numFaces);
+    compact.cold.distant.resize(numFaces);
+    compact.cold.next.resize(numFaces);
+    compact.cold.group.resize(numFaces);
+    compact.cold.reserved.resize(numFaces);
+
+    for(uint32_t i=0; i < numFaces; i++) {
+        const OCARN2::Face& face = mesh.faces[i];
+
+        uint32_t* indices = &compact.indices[i * 3];
+        indices[0] = (uint32_t) face.v1;
+        indices[1] = (uint32_t) face.v2;
+        indices[2] = (uint32_t) face.v3;
+
+        // texture coordinates are within a 256 wide texture
+        uint16_t* uvs = &compact.uvs[i * 6];
+        uvs[0] = (uint16_t) face.tax; uvs[1] = (uint16_t) face.tay;
+        uvs[2] = (uint16_t) face.tbx; uvs[3] = (uint16_t) face.tby;
+        uvs[4] = (uint16_t) face.tcx; uvs[5] = (uint16_t) face.tcy;
+
+        compact.flags[i] = face.flags;
+
+        compact.cold.dMask[i] = face.DMask;
+        compact.cold.distant[i] = face.distant;
+        compact.cold.next[i] = face.next;
+        compact.cold.group[i] = face.group;
+        memcpy(compact.cold.reserved[i].data(), face.reserved, sizeof(face.reserved));
+    }
+
+    return compact;
+}
+
+/**
+ * Writes a compact mesh's geometry back into a mesh's faces and vertices, and their counts. Everything else
+ * in the mesh (nodes, animations, sounds and texture) is left as it is
+ *
+ * @param compact
+ * @param mesh
+ */
+OCARN2_DEF void restore_mesh_geometry(const OCARN2::CompactMesh& compact, OCARN2::Mesh& mesh) {
+    mesh.vertices.resize(compact.numVertices);
+    mesh.faces.resize(compact.numFaces);
+    mesh.numVertices = compact.numVertices;
+    mesh.numFaces = compact.numFaces;
+
+    for(uint32_t i=0; i < compact.numVertices; i++) {
+        OCARN2::Vertex& vertex = mesh.vertices[i];
+
+        vertex.x = compact.x[i];
+        vertex.y = compact.y[i];
+        vertex.z = compact.z[i];
+        vertex.owner = compact.owners[i];
+        vertex.hidden = compact.cold.hidden[i];
+    }
+
+    for(uint32_t i=0; i < compact.numFaces; i++) {
+        OCARN2::Face& face = mesh.faces[i];
+
+        const uint32_t* indices = &compact.indices[i * 3];
+        face.v1 = (int32_t) indices[0];
+        face.v2 = (int32_t) indices[1];
+        face.v3 = (int32_t) indices[2];
+
+        const uint16_t* uvs = &compact.uvs[i * 6];
+        face.tax = uvs[0]; face.tay = uvs[1];
+        face.tbx = uvs[2]; face.tby = uvs[3];
+        face.tcx = uvs[4]; face.tcy = uvs[5];
+
+        face.flags = compact.flags[i];
+
+        face.DMask = compact.cold.dMask[i];
+        face.distant = compact.cold.distant[i];
+        face.next = compact.cold.next[i];
+        face.group = compact.cold.group[i];
+        memcpy(face.reserved, compact.cold.reserved[i].data(), sizeof(face.reserved));
+    }
+}
+
+/**
+ * Internal vertex score for Forsyth's method. Vertices used by the last triangle score a flat amount, the rest
+ * of the cache scores less the older it is, and vertices with few triangles left get a boost so they're
+ * finished off rather than left behind
+ *
+ * @param position in the cache, -1 if it's not there
+ * @param remaining triangles still to go that use the vertex
+ * @param cacheSize
+ * @return
+ */
+static float ocarn2__vertex_score(int32_t position, uint32_t remaining, uint32_t cacheSize) {
+    if(remaining == 0) return -1.0f;
+
+    float score = 0;
+    if(position >= 0) {
+        if(position < 3) score = 0.75f;
+        else score = std::pow(1.0f - (float) (position - 3) / (float) (cacheSize - 3), 1.5f);
+    }
+
+    return score + 2.0f / std::sqrt((float) remaining);
+}
+
+/**
+ * Internal function to reorder a run of triangles for the vertex cache, in place
+ *
+ * @param indices 3 per triangle
+ * @param faces the face each triangle came from, moved along with them
+ * @param cacheSize
+ */
+static void ocarn2__optimize_vertex_cache(uint32_t* indices, uint32_t* faces, uint32_t numTriangles, uint32_t cacheSize) {
+    if(numTriangles < 2) return;
+    cacheSize = std::max(cacheSize, 4u);
+
+    // local vertex numbers, so everything below is sized by this run
+    std::vector<uint32_t> vertices(indices, indices + numTriangles * 3);
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+    std::vector<uint32_t> local(numTriangles * 3);
+    for(uint32_t i=0; i < numTriangles * 3; i++) {
+        local[i] = (uint32_t) (std::lower_bound(vertices.begin(), vertices.end(), indices[i]) - vertices.begin());
+    }
+
+    // triangles of each vertex
+    uint32_t numVertices = (uint32_t) vertices.size();
+    std::vector<uint32_t> remaining(numVertices, 0), firstTriangle(numVertices + 1, 0), triangles(numTriangles * 3);
+    for(uint32_t v: local) remaining[v]++;
+    for(uint32_t v=0; v < numVertices; v++) firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+
+    std::vector<uint32_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+    for(uint32_t i=0; i < numTriangles * 3; i++) triangles[filled[local[i]]++] = i / 3;
+
+    std::vector<int32_t> position(numVertices, -1);
+    std::vector<float> vertexScore(numVertices), triangleScore(numTriangles);
+    std::vector<bool> done(numTriangles, false);
+
+    for(uint32_t v=0; v < numVertices; v++) vertexScore[v] = ocarn2__vertex_score(-1, remaining[v], cacheSize);
+    for(uint32_t t=0; t < numTriangles; t++) {
+        triangleScore[t] = vertexScore[local[t * 3]] + vertexScore[local[t * 3 + 1]] + vertexScore[local[t * 3 + 2]];
+    }
+
+    std::vector<uint32_t> cache, touched, order;
+    order.reserve(numTriangles);
+    uint32_t scan = 0;
+
+    while(order.size() < numTriangles) {
+        // the best triangle touching the cache, or failing that the best one left
+        int64_t best = -1;
+        float bestScore = -1.0f;
+
+        for(uint32_t v: cache) {
+            for(uint32_t i = firstTriangle[v]; i < firstTriangle[v + 1]; i++) {
+                uint32_t t = triangles[i];
+                if(!done[t] && triangleScore[t] > bestScore) {
+                    best = t;
+                    bestScore = triangleScore[t];
+                }
+            }
+        }
+
+        if(best < 0) {
+            while(done[scan]) scan++;
+
+            best = scan;
+            for(uint32_t t = scan; t < numTriangles; t++) {
+                if(!done[t] && triangleScore[t] > triangleScore[best]) best = t;
+            }
+        }
+
+        uint32_t t = (uint32_t) best;
+        done[t] = true;
+        order.push_back(t);
+
+        // the triangle's vertices go to the front of the cache
+        for(int32_t c=2; c >= 0; c--) {
+            uint32_t v = local[t * 3 + c];
+            remaining[v]--;
+
+            auto found = std::find(cache.begin(), cache.end(), v);
+            if(found != cache.end()) cache.erase(found);
+            cache.insert(cache.begin(), v);
+        }
+
+        touched.assign(cache.begin(), cache.end());
+        if(cache.size() > cacheSize) cache.resize(cacheSize);
+
+        for(uint32_t v: touched) position[v] = -1;
+        for(uint32_t c=0; c < cache.size(); c++) position[cache[c]] = (int32_t) c;
+
+        // scores only change for vertices that were or are in the cache
+        for(uint32_t v: touched) {
+            float score = ocarn2__vertex_score(position[v], remaining[v], cacheSize);
+            float change = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            for(uint32_t i = firstTriangle[v]; i < firstTriangle[v + 1]; i++) triangleScore[triangles[i]] += change;
+        }
+    }
+
+    std::vector<uint32_t> sortedIndices(numTriangles * 3), sortedFaces(numTriangles);
+    for(uint32_t i=0; i < numTriangles; i++) {
+        memcpy(&sortedIndices[i * 3], &indices[order[i] * 3], 3 * sizeof(uint32_t));
+        sortedFaces[i] = faces[order[i]];
+    }
+
+    memcpy(indices, sortedIndices.data(), sortedIndices.size() * sizeof(uint32_t));
+    memcpy(faces, sortedFaces.data(), sortedFaces.size() * sizeof(uint32_t));
+}
+
+/**
+ * Sorts a mesh's faces into a batch per render state. Faces pointing at vertices the mesh doesn't have are
+ * left out
+ *
+ * @param mesh
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::MeshBatches build_mesh_batches(const OCARN2::Mesh& mesh, const OCARN2::MeshBatchOptions& options) {
+    OCARN2::MeshBatches result;
+
+    auto valid = [&](const OCARN2::Face& face) {
+        return (uint32_t) face.v1 < mesh.vertices.size() && (uint32_t) face.v2 < mesh.vertices.size() && (uint32_t) face.v3 < mesh.vertices.size();
+    };
+
+    // transparent last, then by state. stable so faces keep their file order within a state
+    auto key = [](const OCARN2::Face& face) {
+        uint16_t state = face.flags & OCARN2::RENDER_STATE_FLAGS;
+        return (uint32_t) ((state & OCARN2::SF_TRANSPARENT) ? 0x10000 : 0) | state;
+    };
+
+    std::vector<uint32_t> order;
+    for(uint32_t i=0; i < mesh.faces.size(); i++) {
+        if(valid(mesh.faces[i])) order.push_back(i);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return key(mesh.faces[a]) < key(mesh.faces[b]);
+    });
+
+    result.faces = order;
+    result.indices.resize(order.size() * 3);
+    for(uint32_t i=0; i < order.size(); i++) {
+        const OCARN2::Face& face = mesh.faces[order[i]];
+        result.indices[i * 3] = (uint32_t) face.v1;
+        result.indices[i * 3 + 1] = (uint32_t) face.v2;
+        result.indices[i * 3 + 2] = (uint32_t) face.v3;
+
+        uint16_t state = face.flags & OCARN2::RENDER_STATE_FLAGS;
+        if(result.batches.empty() || result.batches.back().state != state) {
+            result.batches.push_back({ state, (state & OCARN2::SF_TRANSPARENT) != 0, i, 0 });
+        }
+        result.batches.back().numTriangles++;
+    }
+
+    for(const OCARN2::MeshBatch& batch: result.batches) {
+        if(batch.transparent || !options.optimizeVertexCache) continue;
+
+        ocarn2__optimize_vertex_cache(&result.indices[batch.firstTriangle * 3], &result.faces[batch.firstTriangle],
+                                      batch.numTriangles, options.cacheSize);
+    }
+
+    result.centers.resize(order.size() * 3);
+    for(uint32_t i=0; i < order.size(); i++) {
+        const OCARN2::Vertex& a = mesh.vertices[result.indices[i * 3]];
+        const OCARN2::Vertex& b = mesh.vertices[result.indices[i * 3 + 1]];
+        const OCARN2::Vertex& c = mesh.vertices[result.indices[i * 3 + 2]];
+
+        result.centers[i * 3] = (a.x + b.x + c.x) / 3.0f;
+        result.centers[i * 3 + 1] = (a.y + b.y + c.y) / 3.0f;
+        result.centers[i * 3 + 2] = (a.z + b.z + c.z) / 3.0f;
+    }
+
+    return result;
+}
+
+/**
+ * Reorders a batch's triangles from farthest to nearest a point, for drawing transparent faces. The eye has
+ * to be in the mesh's own space
+ *
+ * @param batches
+ * @param batch one of batches.batches
+ * @param eyeX
+ * @param eyeY
+ * @param eyeZ
+ */
+OCARN2_DEF void sort_mesh_batch(OCARN2::MeshBatches& batches, const OCARN2::MeshBatch& batch, float eyeX, float eyeY, float eyeZ) {
+    uint32_t first = batch.firstTriangle, count = batch.numTriangles;
+    if(count < 2) return;
+
+    std::vector<float> distances(count);
+    for(uint32_t i=0; i < count; i++) {
+        const float* center = &batches.centers[(first + i) * 3];
+        float dx = center[0] - eyeX, dy = center[1] - eyeY, dz = center[2] - eyeZ;
+        distances[i] = dx * dx + dy * dy + dz * dz;
+    }
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return distances[a] > distances[b]; });
+
+    std::vector<uint32_t> indices(count * 3), faces(count);
+    std::vector<float> centers(count * 3);
+    for(uint32_t i=0; i < count; i++) {
+        memcpy(&indices[i * 3], &batches.indices[(first + order[i]) * 3], 3 * sizeof(uint32_t));
+        memcpy(&centers[i * 3], &batches.centers[(first + order[i]) * 3], 3 * sizeof(float));
+        faces[i] = batches.faces[first + order[i]];
+    }
+
+    memcpy(&batches.indices[first * 3], indices.data(), indices.size() * sizeof(uint32_t));
+    memcpy(&batches.centers[first * 3], centers.data(), centers.size() * sizeof(float));
+    memcpy(&batches.faces[first], faces.data(), faces.size() * sizeof(uint32_t));
+}
+
+/**
+ * Simulates a first in, first out vertex cache over some triangles, to see how well they're ordered
+ *
+ * @param indices 3 per triangle
+ * @param count number of indices
+ * @param cacheSize
+ * @return vertices fetched per triangle. 3 is no reuse at all, around 0.7 is as good as it gets
+ */
+OCARN2_DEF float vertex_cache_miss_ratio(const uint32_t* indices, size_t count, uint32_t cacheSize) {
+    if(count < 3) return 0;
+
+    std::vector<uint32_t> cache;
+    size_t misses = 0, next = 0;
+
+    for(size_t i=0; i < count; i++) {
+        if(std::find(cache.begin(), cache.end(), indices[i]) != cache.end()) continue;
+
+        misses++;
+        if(cache.size() < cacheSize) cache.push_back(indices[i]);
+        else cache[next++ % cacheSize] = indices[i];
+    }
+
+    return (float) misses / (float) (count / 3);
+}
+
+/**
+ * Packs a mesh's positions, faces and animations into a QuantizedMesh. Positions are kept to 16 bits inside the
+ * mesh's bounds, which for anything the game has is far inside options.maxError
+ *
+ * @param mesh
+ * @param options
+ * @return empty if the mesh has more vertices than 16 bit indices reach, or texture coordinates past 255
+ */
+OCARN2_DEF OCARN2::QuantizedMesh build_quantized_mesh(const OCARN2::Mesh& mesh, const OCARN2::MeshCompressionOptions& options) {
+    OCARN2::QuantizedMesh quantized;
+    uint32_t numVertices = (uint32_t) mesh.vertices.size(), numFaces = (uint32_t) mesh.faces.size();
+
+    if(numVertices > 65536) {
+        std::cerr << "Mesh has " << numVertices << " vertices, too many for 16 bit indices" << std::endl;
+        return {};
+    }
+
+    for(const OCARN2::Face& face: mesh.faces) {
+        for(int32_t uv: { face.tax, face.tay, face.tbx, face.tby, face.tcx, face.tcy }) {
+            if(uv < 0 || uv > 255) {
+                std::cerr << "Mesh has texture coordinate " << uv << ", outside the 256 wide texture" << std::endl;
+                return {};
+            }
+        }
+    }
+
+    quantized.numVertices = numVertices;
+    quantized.numFaces = numFaces;
+
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for(const OCARN2::Vertex& vertex: mesh.vertices) {
+        const float position[3] = { vertex.x, vertex.y, vertex.z };
+        for(int c=0; c < 3; c++) {
+            lo[c] = std::min(lo[c], position[c]);
+            hi[c] = std::max(hi[c], position[c]);
+        }
+    }
+
+    for(int c=0; c < 3 && numVertices; c++) {
+        quantized.origin[c] = lo[c];
+        quantized.scale[c] = (hi[c] - lo[c]) / 65535.0f;
+    }
+
+    quantized.positions.resize(numVertices * 3);
+    quantized.owners.resize(numVertices);
+
+    for(uint32_t i=0; i < numVertices; i++) {
+        const OCARN2::Vertex& vertex = mesh.vertices[i];
+        const float position[3] = { vertex.x, vertex.y, vertex.z };
+
+        for(int c=0; c < 3; c++) {
+            float scale = quantized.scale[c];
+            float q = scale > 0 ? std::round((position[c] - quantized.origin[c]) / scale) : 0.0f;
+            quantized.positions[i * 3 + c] = (uint16_t) std::min(std::max(q, 0.0f), 65535.0f);
+
+            float decoded = quantized.origin[c] + quantized.positions[i * 3 + c] * scale;
+            quantized.maxError = std::max(quantized.maxError, std::fabs(decoded - position[c]));
+        }
+
+        quantized.owners[i] = vertex.owner;
+    }
+
+    quantized.indices.resize(numFaces * 3);
+    quantized.uvs.resize(numFaces * 6);
+    quantized.flags.resize(numFaces);
+
+    for(uint32_t i=0; i < numFaces; i++) {
+        const OCARN2::Face& face = mesh.faces[i];
+
+        quantized.indices[i * 3 + 0] = (uint16_t) face.v1;
+        quantized.indices[i * 3 + 1] = (uint16_t) face.v2;
+        quantized.indices[i * 3 + 2] = (uint16_t) face.v3;
+
+        uint8_t* uvs = &quantized.uvs[i * 6];
+        uvs[0] = (uint8_t) face.tax; uvs[1] = (uint8_t) face.tay;
+        uvs[2] = (uint8_t) face.tbx; uvs[3] = (uint8_t) face.tby;
+        uvs[4] = (uint8_t) face.tcx; uvs[5] = (uint8_t) face.tcy;
+
+        quantized.flags[i] = face.flags;
+    }
+
+    for(const OCARN2::Animation& animation: mesh.animations)
+        quantized.animations.push_back(compress_animation(animation, numVertices, options));
+
+    return quantized;
+}
+
+/**
+ * Compresses one animation. Works for car animations and rsc model animations alike, give it the vertex count
+ * the frames are sized by (the mesh's for cars, animationHeader[1] for rsc models)
+ *
+ * @param animation
+ * @param numVertices
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::CompressedAnimation compress_animation(const OCARN2::Animation& animation, uint32_t numVertices, const OCARN2::MeshCompressionOptions& options) {
+    OCARN2::CompressedAnimation compressed;
+    memcpy(compressed.name, animation.name, sizeof(compressed.name));
+    compressed.kps = animation.kps;
+    compressed.numVertices = numVertices;
+    compressed.numFrames = animation.data && numVertices ? std::min<uint32_t>(animation.numFrames, 65536) : 0;
+
+    const uint32_t n = numVertices, numFrames = compressed.numFrames;
+    if(numFrames == 0) return compressed;
+
+    const int16_t* data = animation.data;
+    auto at = [&](uint32_t frame, size_t coordinate) {
+        return (int32_t) data[((size_t) frame * n + coordinate % n) * 3 + coordinate / n];
+    };
+
+    // half the error allowed goes on dropping frames, half on quantizing the ones kept. in file units
+    float tolerance = std::max(options.maxError, 0.0f) * 16.0f * 0.5f;
+
+    compressed.low.resize((size_t) n * 3);
+    compressed.range.resize((size_t) n * 3);
+    for(size_t i=0; i < (size_t) n * 3; i++) {
+        int32_t lo = INT32_MAX, hi = INT32_MIN;
+        for(uint32_t f=0; f < numFrames; f++) {
+            lo = std::min(lo, at(f, i));
+            hi = std::max(hi, at(f, i));
+        }
+
+        compressed.low[i] = (int16_t) lo;
+        compressed.range[i] = (uint16_t) (hi - lo);
+    }
+
+    // the fewest bits that keep half a step across the widest range in the block within the error allowed
+    const uint32_t blocks = (n + 7) / 8;
+    for(int c=0; c < 3; c++) {
+        for(uint32_t b=0; b < blocks; b++) {
+            uint32_t count = std::min(8u, n - b * 8);
+            float widest = 0;
+            for(uint32_t i = b * 8; i < b * 8 + count; i++) widest = std::max(widest, (float) compressed.range[(size_t) c * n + i]);
+
+            uint8_t bits = 16;
+            if(widest == 0) bits = 0;
+            else if(widest / 15.0f * 0.5f <= tolerance) bits = 4;
+            else if(widest / 255.0f * 0.5f <= tolerance) bits = 8;
+
+            compressed.blockBits.push_back(bits);
+            compressed.blockOffsets.push_back(compressed.frameBytes);
+            compressed.frameBytes += (count * bits + 7) / 8;
+        }
+    }
+
+    // keep a frame only when blending the frames either side of it can't stand in for it
+    std::vector<uint32_t> kept = { 0 };
+    if(options.reduceKeyframes) {
+        uint32_t start = 0;
+        for(uint32_t end = 2; end < numFrames; end++) {
+            bool close = true;
+            for(uint32_t f = start + 1; f < end && close; f++) {
+                float t = (float) (f - start) / (float) (end - start);
+                for(uint32_t i=0; i < n * 3 && close; i++) {
+                    float a = (float) data[(size_t) start * n * 3 + i], b = (float) data[(size_t) end * n * 3 + i];
+                    close = std::fabs(a + (b - a) * t - (float) data[(size_t) f * n * 3 + i]) <= tolerance;
+                }
+            }
+
+            if(!close) {
+                kept.push_back(end - 1);
+                start = end - 1;
+            }
+        }
+    } else {
+        for(uint32_t f=1; f + 1 < numFrames; f++) kept.push_back(f);
+    }
+    if(numFrames > 1) kept.push_back(numFrames - 1);
+
+    compressed.data.resize(kept.size() * compressed.frameBytes);
+    for(size_t k=0; k < kept.size(); k++) {
+        compressed.frames.push_back((uint16_t) kept[k]);
+        uint8_t* frame = &compressed.data[k * compressed.frameBytes];
+
+        for(int c=0; c < 3; c++) {
+            for(uint32_t b=0; b < blocks; b++) {
+                uint8_t bits = compressed.blockBits[c * blocks + b];
+                uint8_t* out = frame + compressed.blockOffsets[c * blocks + b];
+                float levels = (float) ((1u << bits) - 1);
+
+                for(uint32_t j=0, i = b * 8; i < std::min(n, b * 8 + 8); i++, j++) {
+                    size_t coordinate = (size_t) c * n + i;
+                    float range = compressed.range[coordinate];
+                    uint16_t q = (uint16_t) (range > 0 ? std::round((float) (at(kept[k], coordinate) - compressed.low[coordinate]) * levels / range) : 0.0f);
+
+                    // 4 bit pairs go low nibble first
+                    if(bits == 4) out[j / 2] |= (uint8_t) (q << (j & 1) * 4);
+                    else if(bits == 8) out[j] = (uint8_t) q;
+                    else if(bits == 16) memcpy(out + j * 2, &q, 2);
+                }
+            }
+        }
+    }
+
+    // measure what it actually comes out as, against every original frame
+    std::vector<float> pose((size_t) n * 3);
+    for(uint32_t f=0; f < numFrames; f++) {
+        evaluate_compressed_pose(compressed, (float) f, &pose[0], &pose[n], &pose[(size_t) n * 2]);
+        for(size_t i=0; i < (size_t) n * 3; i++)
+            compressed.maxError = std::max(compressed.maxError, std::fabs(pose[i] - (float) at(f, i) / 16.0f));
+    }
+
+    return compressed;
+}
+
+/**
+ * Unpacks a quantized mesh's positions
+ *
+ * @param mesh
+ * @param x numVertices of each
+ * @param y
+ * @param z
+ */
+OCARN2_DEF void quantized_mesh_positions(const OCARN2::QuantizedMesh& mesh, float* x, float* y, float* z) {
+    float* out[3] = { x, y, z };
+
+    for(uint32_t i=0; i < mesh.numVertices; i++) {
+        for(int c=0; c < 3; c++) out[c][i] = mesh.origin[c] + mesh.positions[i * 3 + c] * mesh.scale[c];
+    }
+}
+
+/**
+ * Where an animation is at a time, as a frame to pass to evaluate_pose. The last frame of a looping animation
+ * is the same as the first, so it loops back to the start from there
+ *
+ * @param kps frames a second
+ * @param numFrames
+ * @param milliseconds since it started
+ * @return between 0 and numFrames - 1
+ */
+OCARN2_DEF float animation_frame(uint32_t kps, uint32_t numFrames, uint32_t milliseconds) {
+    if(numFrames < 2 || kps == 0) return 0;
+
+    return (float) std::fmod((double) milliseconds * kps / 1000.0, (double) (numFrames - 1));
+}
+
+/**
+ * Positions of every vertex part way through an animation, blended between the two frames either side
+ *
+ * @param animation
+ * @param numVertices the frames are sized by
+ * @param frame from 0 to numFrames - 1, see animation_frame
+ * @param x numVertices of each, in model units
+ * @param y
+ * @param z
+ */
+OCARN2_DEF void evaluate_pose(const OCARN2::Animation& animation, uint32_t numVertices, float frame, float* x, float* y, float* z) {
+    if(!animation.data || animation.numFrames == 0) return;
+
+    frame = std::min(std::max(frame, 0.0f), (float) (animation.numFrames - 1));
+    uint32_t f0 = (uint32_t) frame, f1 = std::min(f0 + 1, animation.numFrames - 1);
+    float t = frame - (float) f0;
+
+    const int16_t* a = animation.data + (size_t) f0 * numVertices * 3;
+    const int16_t* b = animation.data + (size_t) f1 * numVertices * 3;
+    float wa = (1.0f - t) / 16.0f, wb = t / 16.0f;
+
+    for(uint32_t i=0; i < numVertices; i++) {
+        x[i] = a[i * 3 + 0] * wa + b[i * 3 + 0] * wb;
+        y[i] = a[i * 3 + 1] * wa + b[i * 3 + 1] * wb;
+        z[i] = a[i * 3 + 2] * wa + b[i * 3 + 2] * wb;
+    }
+}
+
+/**
+ * Internal function to blend a block of up to 8 coordinates from two frames. Every step is written out
+ * separately so the AVX2 version can do exactly the same and get the same answer
+ */
+static inline void ocarn2__pose_block(const int16_t* low, const uint16_t* range, const uint8_t* q0, const uint8_t* q1, uint8_t bits,
+                                      float w0, float w1, uint32_t count, float* out) {
+    const float sixteenth = 1.0f / 16.0f, step = (bits ? 1.0f / (float) ((1u << bits) - 1) : 0.0f) * sixteenth;
+
+    for(uint32_t i=0; i < count; i++) {
+        float a = 0, b = 0;
+        if(bits == 4) {
+            a = (q0[i / 2] >> (i & 1) * 4) & 15;
+            b = (q1[i / 2] >> (i & 1) * 4) & 15;
+        } else if(bits == 8) {
+            a = q0[i];
+            b = q1[i];
+        } else if(bits == 16) {
+            uint16_t qa, qb;
+            memcpy(&qa, q0 + i * 2, 2);
+            memcpy(&qb, q1 + i * 2, 2);
+            a = qa;
+            b = qb;
+        }
+
+        float blend = a * w0 + b * w1;
+        float scale = (float) range[i] * step;
+        out[i] = (float) low[i] * sixteenth + scale * blend;
+    }
+}
+
+#ifdef OCARN2__MESH_AVX2
+
+/**
+ * Internal function to widen a block of 8 quantized values, of any of the block bit widths, to floats
+ *
+ * @param q
+ * @param bits
+ * @return
+ */
+__attribute__((target("avx2"))) static inline __m256 ocarn2__pose_q_avx2(const uint8_t* q, uint8_t bits) {
+    switch(bits) {
+        case 4: {
+            // each byte twice, then shifted so every lane has its own nibble at the bottom
+            int32_t packed;
+            memcpy(&packed, q, 4);
+            __m128i pairs = _mm_shuffle_epi8(_mm_cvtsi32_si128(packed), _mm_setr_epi8(0, 0, 1, 1, 2, 2, 3, 3, -1, -1, -1, -1, -1, -1, -1, -1));
+            __m256i nibbles = _mm256_srlv_epi32(_mm256_cvtepu8_epi32(pairs), _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4));
+            return _mm256_cvtepi32_ps(_mm256_and_si256(nibbles, _mm256_set1_epi32(15)));
+        }
+        case 8:  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) q)));
+        case 16: return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) q)));
+        default: return _mm256_setzero_ps();
+    }
+}
+
+/**
+ * Internal function to blend one axis of two frames, a block of 8 coordinates at a time
+ *
+ * @return how many it did, a last block of less than 8 is left for ocarn2__pose_block
+ */
+__attribute__((target("avx2"))) static uint32_t ocarn2__pose_axis_avx2(const int16_t* low, const uint16_t* range, const uint8_t* frame0, const uint8_t* frame1,
+                                                                       const uint8_t* blockBits, const uint32_t* blockOffsets, float w0, float w1, uint32_t n, float* out) {
+    const __m256 sixteenth = _mm256_set1_ps(1.0f / 16.0f);
+    const __m256 weight0 = _mm256_set1_ps(w0), weight1 = _mm256_set1_ps(w1);
+
+    uint32_t b = 0;
+    for(; b * 8 + 8 <= n; b++) {
+        uint8_t bits = blockBits[b];
+        __m256 a = ocarn2__pose_q_avx2(frame0 + blockOffsets[b], bits);
+        __m256 c = ocarn2__pose_q_avx2(frame1 + blockOffsets[b], bits);
+        __m256 step = _mm256_set1_ps((bits ? 1.0f / (float) ((1u << bits) - 1) : 0.0f) * (1.0f / 16.0f));
+
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (low + b * 8))));
+        __m256 scale = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (range + b * 8))));
+
+        __m256 blend = _mm256_add_ps(_mm256_mul_ps(a, weight0), _mm256_mul_ps(c, weight1));
+        scale = _mm256_mul_ps(scale, step);
+        _mm256_storeu_ps(out + b * 8, _mm256_add_ps(_mm256_mul_ps(lo, sixteenth), _mm256_mul_ps(scale, blend)));
+    }
+
+    return b * 8;
+}
+
+#endif
+
+/**
+ * Same as evaluate_pose, straight from a compressed animation. Frames that were dropped are blended from the
+ * kept frames either side, which is what they were checked against
+ *
+ * @param animation
+ * @param frame from 0 to numFrames - 1, see animation_frame
+ * @param x numVertices of each, in model units
+ * @param y
+ * @param z
+ */
+OCARN2_DEF void evaluate_compressed_pose(const OCARN2::CompressedAnimation& animation, float frame, float* x, float* y, float* z) {
+    if(animation.frames.empty()) return;
+
+    const uint32_t n = animation.numVertices, blocks = (n + 7) / 8;
+    frame = std::min(std::max(frame, 0.0f), (float) (animation.numFrames - 1));
+
+    // first kept frame past this one, and the one before it
+    size_t k1 = std::upper_bound(animation.frames.begin(), animation.frames.end(), frame,
+                                 [](float f, uint16_t kept) { return f < (float) kept; }) - animation.frames.begin();
+    k1 = std::min(k1, animation.frames.size() - 1);
+    size_t k0 = k1 > 0 ? k1 - 1 : 0;
+
+    uint16_t f0 = animation.frames[k0], f1 = animation.frames[k1];
+    float t = f1 > f0 ? std::min(std::max((frame - f0) / (float) (f1 - f0), 0.0f), 1.0f) : 0.0f;
+
+    const uint8_t* frame0 = animation.data.data() + k0 * animation.frameBytes;
+    const uint8_t* frame1 = animation.data.data() + k1 * animation.frameBytes;
+
+    float* out[3] = { x, y, z };
+    for(int c=0; c < 3; c++) {
+        const int16_t* low = &animation.low[(size_t) c * n];
+        const uint16_t* range = &animation.range[(size_t) c * n];
+        const uint8_t* blockBits = &animation.blockBits[c * blocks];
+        const uint32_t* blockOffsets = &animation.blockOffsets[c * blocks];
+
+        uint32_t i = 0;
+#ifdef OCARN2__MESH_AVX2
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if(avx2) i = ocarn2__pose_axis_avx2(low, range, frame0, frame1, blockBits, blockOffsets, 1.0f - t, t, n, out[c]);
+#endif
+
+        for(; i < n; i += 8) {
+            uint32_t b = i / 8;
+            ocarn2__pose_block(low + i, range + i, frame0 + blockOffsets[b], frame1 + blockOffsets[b], blockBits[b],
+                               1.0f - t, t, std::min(8u, n - i), out[c] + i);
+        }
+    }
+}
+
+/**
+ * Bytes held by a quantized mesh, in sections struct, positions, owners, indices, uvs, flags and animations.
+ * See mesh_memory_footprint
+ *
+ * @param mesh
+ * @return
+ */
+OCARN2_DEF OCARN2::MemoryFootprint quantized_mesh_memory_footprint(const OCARN2::QuantizedMesh& mesh) {
+    OCARN2::MemoryFootprint footprint;
+
+    ocarn2__memory_add(footprint, "struct", sizeof(OCARN2::QuantizedMesh), sizeof(OCARN2::QuantizedMesh));
+    ocarn2__memory_add(footprint, "positions", mesh.positions);
+    ocarn2__memory_add(footprint, "owners", mesh.owners);
+    ocarn2__memory_add(footprint, "indices", mesh.indices);
+    ocarn2__memory_add(footprint, "uvs", mesh.uvs);
+    ocarn2__memory_add(footprint, "flags", mesh.flags);
+
+    ocarn2__memory_add(footprint, "animations", mesh.animations);
+    for(auto& a: mesh.animations) {
+        ocarn2__memory_add(footprint, "animations", a.low);
+        ocarn2__memory_add(footprint, "animations", a.range);
+        ocarn2__memory_add(footprint, "animations", a.blockBits);
+        ocarn2__memory_add(footprint, "animations", a.blockOffsets);
+        ocarn2__memory_add(footprint, "animations", a.frames);
+        ocarn2__memory_add(footprint, "animations", a.data);
+    }
+
+    return footprint;
+}
+
+#endif
@@ -0,0 +1,655 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for creature pathfinding over a Map.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * build_nav_grid packs walkability into a bitgrid: a cell is walkable if it isn't BF_IMPASSABLE or BF_WATER,
+ * has no object on it, and isn't too steep a climb to any neighbour. It also labels connected regions, so
+ * unreachable goals are turned down without searching.
+ *
+ * Paths are found with HPA*. The map is cut into clusters (32x32 cells by default), and every walkable
+ * opening between neighbouring clusters gets a node on each side. Paths between the nodes of a cluster are
+ * worked out once, up front, so a query only searches the start and goal clusters and the small graph of
+ * nodes, then fills in the cells along the way. Queries don't touch the grid, so any number of threads can
+ * run them at once.
+ *
+ * main methods are
+ *
+ * NavGrid build_nav_grid(const Map& map, const NavOptions& options);
+ * bool nav_walkable(const NavGrid& grid, uint32_t x, uint32_t z);
+ * std::vector<NavPoint> find_nav_path(const NavGrid& grid, NavPoint from, NavPoint to);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct NavOptions {
+        // cells per side of a cluster. must divide 1024
+        uint32_t clusterSize = 32;
+
+        // most heightMap steps a creature can climb between neighbouring cells
+        uint32_t maxClimb = 8;
+
+        // cells with something in objectMap are blocked. 255 is an empty cell
+        bool objectsBlock = true;
+
+        // threads used to build the cluster graph. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    struct NavPoint {
+        uint16_t x, z;
+    };
+
+    // a cell next to an opening into a neighbouring cluster
+    struct NavNode {
+        NavPoint cell;
+        uint32_t cluster;
+
+        uint32_t firstEdge, numEdges;
+    };
+
+    // the cells between the two ends are kept as steps, one byte each, so paths don't need searching again
+    struct NavEdge {
+        uint32_t to;
+        float cost;
+
+        uint32_t firstStep, numSteps;
+    };
+
+    struct NavGrid {
+        NavOptions options;
+
+        // bit x % 64 of word z * 16 + x / 64
+        std::vector<uint64_t> walkable;
+
+        // connected region of each cell, 0 for cells that aren't walkable
+        std::vector<uint32_t> regions;
+
+        uint32_t clustersPerSide = 0;
+
+        // nodes are sorted by cluster, clusterFirstNode[c] to clusterFirstNode[c + 1] are cluster c's
+        std::vector<NavNode> nodes;
+        std::vector<NavEdge> edges;
+        std::vector<uint8_t> steps; // index into the 8 moves, see ocarn2__nav_moves
+        std::vector<uint32_t> clusterFirstNode;
+    };
+}
+
+
+OCARN2_DEF OCARN2::NavGrid build_nav_grid(const OCARN2::Map& map, const OCARN2::NavOptions& options = {});
+OCARN2_DEF bool nav_walkable(const OCARN2::NavGrid& grid, uint32_t x, uint32_t z);
+OCARN2_DEF std::vector<OCARN2::NavPoint> find_nav_path(const OCARN2::NavGrid& grid, OCARN2::NavPoint from, OCARN2::NavPoint to);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cmath>
+#include <algorithm>
+
+/**
+ * Tells if a cell can be walked on. Anything off the map can't
+ *
+ * @param grid
+ * @param x
+ * @param z
+ * @return
+ */
+OCARN2_DEF bool nav_walkable(const OCARN2::NavGrid& grid, uint32_t x, uint32_t z) {
+    if(x >= 1024 || z >= 1024 || grid.walkable.empty()) return false;
+
+    return (grid.walkable[z * 16 + x / 64] >> (x % 64)) & 1;
+}
+
+// orthogonal moves first, then diagonals
+static const int32_t ocarn2__nav_moves[8][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+
+/**
+ * Internal rectangle of cells a local search is kept inside, usually one cluster
+ */
+struct ocarn2__nav_rect {
+    int32_t x, z, size;
+};
+
+/**
+ * Internal search over the cells of a rectangle, from one cell. With a goal it's A* and stops once the goal is
+ * reached, without one it's Dijkstra to every cell. Moves are 8 way, but diagonals can't cut the corner of a
+ * blocked cell. Cells are indexed over the rectangle with a one cell border round it, so moves are offsets and
+ * need no bounds checks
+ */
+struct ocarn2__nav_search {
+    ocarn2__nav_rect rect;
+    int32_t stride = 0;
+    int32_t offsets[8];
+
+    std::vector<float> costs;
+    std::vector<int32_t> parents;
+
+    // scratch kept between runs, so only the first search in a rectangle the size of this one allocates
+    std::vector<unsigned char> blocked;
+    std::vector<std::pair<float, int32_t>> open;
+
+    // which cells can be walked on, once per rectangle however many searches run in it
+    void prepare(const OCARN2::NavGrid& grid, ocarn2__nav_rect r) {
+        rect = r;
+        stride = rect.size + 2;
+        for(int m=0; m < 8; m++) offsets[m] = ocarn2__nav_moves[m][1] * stride + ocarn2__nav_moves[m][0];
+
+        blocked.assign(stride * stride, 1);
+        for(int32_t z=0; z < rect.size; z++) {
+            for(int32_t x=0; x < rect.size; x++) {
+                blocked[(z + 1) * stride + x + 1] = !nav_walkable(grid, rect.x + x, rect.z + z);
+            }
+        }
+    }
+
+    void run(OCARN2::NavPoint start, int32_t goal = -1) {
+        costs.assign(stride * stride, INFINITY);
+        parents.assign(stride * stride, -1);
+
+        int32_t goalX = goal < 0 ? 0 : goal % stride;
+        int32_t goalZ = goal < 0 ? 0 : goal / stride;
+
+        // octile distance, never more than the real cost
+        auto heuristic = [&](int32_t at) {
+            if(goal < 0) return 0.0f;
+
+            float dx = (float) std::abs(at % stride - goalX), dz = (float) std::abs(at / stride - goalZ);
+            return std::max(dx, dz) + 0.41421356f * std::min(dx, dz);
+        };
+
+        std::greater<std::pair<float, int32_t>> later;
+        open.clear();
+
+        int32_t first = index(start);
+        costs[first] = 0;
+        open.push_back({ heuristic(first), first });
+
+        while(!open.empty()) {
+            std::pop_heap(open.begin(), open.end(), later);
+            std::pair<float, int32_t> top = open.back();
+            open.pop_back();
+
+            int32_t at = top.second;
+            if(at == goal) return;
+            if(top.first > costs[at] + heuristic(at) + 1e-3f) continue;
+
+            for(int m=0; m < 8; m++) {
+                int32_t next = at + offsets[m];
+                if(blocked[next]) continue;
+
+                bool diagonal = m >= 4;
+                if(diagonal && (blocked[at + ocarn2__nav_moves[m][0]] || blocked[at + ocarn2__nav_moves[m][1] * stride])) continue;
+
+                float cost = costs[at] + (diagonal ? 1.41421356f : 1.0f);
+
+                if(cost < costs[next]) {
+                    costs[next] = cost;
+                    parents[next] = at;
+
+                    open.push_back({ cost + heuristic(next), next });
+                    std::push_heap(open.begin(), open.end(), later);
+                }
+            }
+        }
+    }
+
+    int32_t index(OCARN2::NavPoint p) const {
+        return (p.z - rect.z + 1) * stride + (p.x - rect.x + 1);
+    }
+
+    float cost(OCARN2::NavPoint p) const {
+        return costs[index(p)];
+    }
+
+    OCARN2::NavPoint point(int32_t at) const {
+        return { (uint16_t) (rect.x + at % stride - 1), (uint16_t) (rect.z + at / stride - 1) };
+    }
+
+    // appends the cells after the start up to p
+    void append_path(OCARN2::NavPoint p, std::vector<OCARN2::NavPoint>& path) const {
+        size_t mark = path.size();
+
+        for(int32_t at = index(p); parents[at] != -1; at = parents[at]) path.push_back(point(at));
+
+        std::reverse(path.begin() + mark, path.end());
+    }
+
+    // appends the cells after p back to the start, for when the search was run from the far end
+    void append_path_back(OCARN2::NavPoint p, std::vector<OCARN2::NavPoint>& path) const {
+        for(int32_t at = parents[index(p)]; at != -1; at = parents[at]) path.push_back(point(at));
+    }
+
+    // appends the moves from the start to p
+    void append_steps(OCARN2::NavPoint p, std::vector<uint8_t>& steps) const {
+        size_t mark = steps.size();
+
+        for(int32_t at = index(p); parents[at] != -1; at = parents[at]) {
+            int32_t offset = at - parents[at];
+
+            uint8_t move = 0;
+            while(offsets[move] != offset) move++;
+            steps.push_back(move);
+        }
+
+        std::reverse(steps.begin() + mark, steps.end());
+    }
+};
+
+/**
+ * Internal functions to get a cluster's rectangle, and the cluster a cell is in
+ */
+static inline ocarn2__nav_rect ocarn2__nav_cluster_rect(const OCARN2::NavGrid& grid, uint32_t cluster) {
+    int32_t size = (int32_t) grid.options.clusterSize;
+    return { (int32_t) (cluster % grid.clustersPerSide) * size, (int32_t) (cluster / grid.clustersPerSide) * size, size };
+}
+
+static inline uint32_t ocarn2__nav_cluster(const OCARN2::NavGrid& grid, OCARN2::NavPoint p) {
+    return (p.z / grid.options.clusterSize) * grid.clustersPerSide + p.x / grid.options.clusterSize;
+}
+
+/**
+ * Internal function to fill in walkable and regions
+ *
+ * @param map
+ * @param grid
+ */
+OCARN2_DEF void ocarn2__build_nav_cells(const OCARN2::Map& map, OCARN2::NavGrid& grid) {
+    const OCARN2::NavOptions& options = grid.options;
+    grid.walkable.assign(1024 * 16, 0);
+
+    ocarn2__parallel_for(1024, options.threads, [&](size_t z) {
+        for(int32_t x=0; x < 1024; x++) {
+            int32_t i = (int32_t) z * 1024 + x;
+
+            if(map.bitflagMap[i] & (OCARN2::BF_IMPASSABLE | OCARN2::BF_WATER)) continue;
+            if(options.objectsBlock && map.objectMap[i] != 255) continue;
+
+            // too steep if any neighbour is more than a climb away
+            int32_t h = map.heightMap[i];
+            bool steep = false;
+            if(x > 0)      steep |= (uint32_t) std::abs(h - map.heightMap[i - 1]) > options.maxClimb;
+            if(x < 1023)   steep |= (uint32_t) std::abs(h - map.heightMap[i + 1]) > options.maxClimb;
+            if(z > 0)      steep |= (uint32_t) std::abs(h - map.heightMap[i - 1024]) > options.maxClimb;
+            if(z < 1023)   steep |= (uint32_t) std::abs(h - map.heightMap[i + 1024]) > options.maxClimb;
+            if(steep) continue;
+
+            grid.walkable[z * 16 + x / 64] |= 1ull << (x % 64);
+        }
+    });
+
+    // 4 way flood fill is enough, since diagonal moves can't cut corners
+    grid.regions.assign(1024 * 1024, 0);
+    std::vector<uint32_t> stack;
+    uint32_t region = 0;
+
+    for(uint32_t start=0; start < 1024 * 1024; start++) {
+        if(grid.regions[start] || !nav_walkable(grid, start % 1024, start / 1024)) continue;
+
+        grid.regions[start] = ++region;
+        stack.push_back(start);
+
+        while(!stack.empty()) {
+            uint32_t at = stack.back();
+            stack.pop_back();
+
+            uint32_t x = at % 1024, z = at / 1024;
+            uint32_t neighbours[4][2] = { {x + 1, z}, {x - 1, z}, {x, z + 1}, {x, z - 1} };
+
+            for(auto& n: neighbours) {
+                if(!nav_walkable(grid, n[0], n[1])) continue;
+
+                uint32_t next = n[1] * 1024 + n[0];
+                if(grid.regions[next]) continue;
+
+                grid.regions[next] = region;
+                stack.push_back(next);
+            }
+        }
+    }
+}
+
+/**
+ * Internal function to find the openings between neighbouring clusters and put a node either side of each.
+ * Short openings get one crossing in the middle, long ones get one at each end
+ *
+ * @param grid
+ * @param crossings filled with the node pairs either side of each crossing
+ */
+OCARN2_DEF void ocarn2__build_nav_nodes(OCARN2::NavGrid& grid, std::vector<std::pair<uint32_t, uint32_t>>& crossings) {
+    uint32_t size = grid.options.clusterSize;
+    std::vector<uint32_t> byCell(1024 * 1024, UINT32_MAX);
+
+    auto node = [&](uint32_t x, uint32_t z) {
+        uint32_t& found = byCell[z * 1024 + x];
+        if(found != UINT32_MAX) return found;
+
+        OCARN2::NavNode n {};
+        n.cell = { (uint16_t) x, (uint16_t) z };
+        n.cluster = ocarn2__nav_cluster(grid, n.cell);
+
+        grid.nodes.push_back(n);
+        found = (uint32_t) grid.nodes.size() - 1;
+        return found;
+    };
+
+    // vertical = the border between a cluster and the one to its right
+    for(int vertical=0; vertical < 2; vertical++) {
+        for(uint32_t border = size; border < 1024; border += size) {
+            for(uint32_t along = 0; along < 1024; along += size) {
+                auto open = [&](uint32_t i) {
+                    return vertical ? nav_walkable(grid, border - 1, i) && nav_walkable(grid, border, i)
+                                    : nav_walkable(grid, i, border - 1) && nav_walkable(grid, i, border);
+                };
+
+                auto cross = [&](uint32_t i) {
+                    uint32_t a = vertical ? node(border - 1, i) : node(i, border - 1);
+                    uint32_t b = vertical ? node(border, i) : node(i, border);
+                    crossings.emplace_back(a, b);
+                };
+
+                for(uint32_t i = along; i < along + size; i++) {
+                    if(!open(i)) continue;
+
+                    uint32_t runStart = i;
+                    while(i + 1 < along + size && open(i + 1)) i++;
+
+                    if(i - runStart + 1 > 6) {
+                        cross(runStart);
+                        cross(i);
+                    }
+                    else {
+                        cross((runStart + i) / 2);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Builds the walkability grid and the cluster graph for pathfinding
+ *
+ * @param map
+ * @param options
+ * @return an empty grid if the cluster size doesn't divide the map evenly
+ */
+OCARN2_DEF OCARN2::NavGrid build_nav_grid(const OCARN2::Map& map, const OCARN2::NavOptions& options) {
+    OCARN2::NavGrid grid;
+
+    if(options.clusterSize < 4 || options.clusterSize > 1024 || 1024 % options.clusterSize != 0) {
+        std::cerr << "Cluster size " << options.clusterSize << " doesn't divide the map evenly" << std::endl;
+        return grid;
+    }
+
+    grid.options = options;
+    grid.clustersPerSide = 1024 / options.clusterSize;
+
+    ocarn2__build_nav_cells(map, grid);
+
+    std::vector<std::pair<uint32_t, uint32_t>> crossings;
+    ocarn2__build_nav_nodes(grid, crossings);
+
+    // sort nodes by cluster, and point the crossings at the new order
+    uint32_t numClusters = grid.clustersPerSide * grid.clustersPerSide;
+    std::vector<uint32_t> order(grid.nodes.size()), moved(grid.nodes.size());
+    for(uint32_t i=0; i < order.size(); i++) order[i] = i;
+
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return grid.nodes[a].cluster < grid.nodes[b].cluster;
+    });
+
+    std::vector<OCARN2::NavNode> sorted(grid.nodes.size());
+    for(uint32_t i=0; i < order.size(); i++) {
+        sorted[i] = grid.nodes[order[i]];
+        moved[order[i]] = i;
+    }
+    grid.nodes.swap(sorted);
+
+    grid.clusterFirstNode.assign(numClusters + 1, 0);
+    for(auto& n: grid.nodes) grid.clusterFirstNode[n.cluster + 1]++;
+    for(uint32_t c=0; c < numClusters; c++) grid.clusterFirstNode[c + 1] += grid.clusterFirstNode[c];
+
+    // paths between the nodes of each cluster, one search per node. rows of clusters go in parallel, each with
+    // one search whose scratch is reused for every cluster in the row, and its own edges and steps. firstStep
+    // is relative to the row's steps until they're gathered
+    uint32_t perSide = grid.clustersPerSide;
+    std::vector<std::vector<std::pair<uint32_t, OCARN2::NavEdge>>> rowEdges(perSide);
+    std::vector<std::vector<uint8_t>> rowSteps(perSide);
+
+    ocarn2__parallel_for(perSide, options.threads, [&](size_t row) {
+        ocarn2__nav_search search;
+
+        for(uint32_t c = (uint32_t) row * perSide; c < (uint32_t) (row + 1) * perSide; c++) {
+            search.prepare(grid, ocarn2__nav_cluster_rect(grid, c));
+
+            for(uint32_t a = grid.clusterFirstNode[c]; a < grid.clusterFirstNode[c + 1]; a++) {
+                search.run(grid.nodes[a].cell);
+
+                for(uint32_t b = grid.clusterFirstNode[c]; b < grid.clusterFirstNode[c + 1]; b++) {
+                    float cost = search.cost(grid.nodes[b].cell);
+                    if(a == b || cost == INFINITY) continue;
+
+                    uint32_t first = (uint32_t) rowSteps[row].size();
+                    search.append_steps(grid.nodes[b].cell, rowSteps[row]);
+
+                    rowEdges[row].push_back({ a, { b, cost, first, (uint32_t) rowSteps[row].size() - first } });
+                }
+            }
+        }
+    });
+
+    // each node's crossings, then its paths inside its cluster. crossings are a single step across the border
+    for(auto& c: crossings) {
+        grid.nodes[moved[c.first]].numEdges++;
+        grid.nodes[moved[c.second]].numEdges++;
+    }
+    for(auto& edges: rowEdges) {
+        for(auto& e: edges) grid.nodes[e.first].numEdges++;
+    }
+
+    uint32_t numEdges = 0;
+    std::vector<uint32_t> filled(grid.nodes.size());
+    for(uint32_t i=0; i < grid.nodes.size(); i++) {
+        grid.nodes[i].firstEdge = numEdges;
+        numEdges += grid.nodes[i].numEdges;
+    }
+    grid.edges.resize(numEdges);
+
+    auto add = [&](uint32_t from, const OCARN2::NavEdge& edge) {
+        grid.edges[grid.nodes[from].firstEdge + filled[from]++] = edge;
+    };
+
+    for(auto& c: crossings) {
+        add(moved[c.first], { moved[c.second], 1.0f, 0, 1 });
+        add(moved[c.second], { moved[c.first], 1.0f, 0, 1 });
+    }
+
+    // the rows' steps first, then the crossings' in the order of the nodes they start from
+    size_t numSteps = 0;
+    for(uint32_t row=0; row < perSide; row++) {
+        uint32_t base = (uint32_t) numSteps;
+        numSteps += rowSteps[row].size();
+
+        for(auto& e: rowEdges[row]) add(e.first, { e.second.to, e.second.cost, e.second.firstStep + base, e.second.numSteps });
+    }
+
+    grid.steps.reserve(numSteps + crossings.size() * 2);
+    for(auto& steps: rowSteps) grid.steps.insert(grid.steps.end(), steps.begin(), steps.end());
+
+    for(uint32_t i=0; i < grid.nodes.size(); i++) {
+        const OCARN2::NavNode& node = grid.nodes[i];
+
+        for(uint32_t e = node.firstEdge; e < node.firstEdge + node.numEdges; e++) {
+            OCARN2::NavEdge& edge = grid.edges[e];
+            const OCARN2::NavNode& to = grid.nodes[edge.to];
+            if(to.cluster == node.cluster) continue;
+
+            int32_t dx = to.cell.x - node.cell.x, dz = to.cell.z - node.cell.z;
+
+            uint8_t move = 0;
+            while(ocarn2__nav_moves[move][0] != dx || ocarn2__nav_moves[move][1] != dz) move++;
+
+            edge.firstStep = (uint32_t) grid.steps.size();
+            grid.steps.push_back(move);
+        }
+    }
+
+    return grid;
+}
+
+/**
+ * Finds a path between two cells. The path includes both ends, and each step is to one of the 8 neighbouring cells
+ *
+ * @param grid
+ * @param from
+ * @param to
+ * @return empty if either end isn't walkable or there's no way between them
+ */
+OCARN2_DEF std::vector<OCARN2::NavPoint> find_nav_path(const OCARN2::NavGrid& grid, OCARN2::NavPoint from, OCARN2::NavPoint to) {
+    typedef std::pair<float, uint32_t> entry;
+
+    // scratch kept between queries on the same thread, so a query only allocates the path it returns
+    struct scratch {
+        ocarn2__nav_search start, goal;
+
+        std::vector<float> costs;
+        std::vector<uint32_t> parents;
+        std::vector<entry> open;
+        std::vector<uint32_t> route;
+    };
+    static thread_local scratch local;
+
+    std::vector<OCARN2::NavPoint> path;
+
+    if(!nav_walkable(grid, from.x, from.z) || !nav_walkable(grid, to.x, to.z)) return path;
+    if(grid.regions[from.z * 1024 + from.x] != grid.regions[to.z * 1024 + to.x]) return path;
+
+    path.push_back(from);
+
+    uint32_t fromCluster = ocarn2__nav_cluster(grid, from);
+    uint32_t toCluster = ocarn2__nav_cluster(grid, to);
+
+    ocarn2__nav_search& start = local.start;
+    ocarn2__nav_search& goal = local.goal;
+    start.prepare(grid, ocarn2__nav_cluster_rect(grid, fromCluster));
+    goal.prepare(grid, ocarn2__nav_cluster_rect(grid, toCluster));
+
+    // both in one cluster, and joined inside it
+    if(fromCluster == toCluster) {
+        start.run(from, start.index(to));
+
+        if(start.cost(to) < INFINITY) {
+            start.append_path(to, path);
+            return path;
+        }
+    }
+    else {
+        start.run(from);
+    }
+
+    // searches from the goal give the cost of getting from each goal cluster node to it, since moves are symmetric
+    goal.run(to);
+
+    // A* over the nodes. the two extra ids are the start and goal
+    uint32_t numNodes = (uint32_t) grid.nodes.size();
+    uint32_t startId = numNodes, goalId = numNodes + 1;
+
+    std::vector<float>& costs = local.costs;
+    std::vector<uint32_t>& parents = local.parents;
+    costs.assign(numNodes + 2, INFINITY);
+    parents.assign(numNodes + 2, UINT32_MAX);
+
+    auto heuristic = [&](OCARN2::NavPoint p) {
+        float dx = std::abs((float) p.x - to.x), dz = std::abs((float) p.z - to.z);
+        return std::max(dx, dz) + 0.41421356f * std::min(dx, dz);
+    };
+
+    auto cell = [&](uint32_t id) {
+        return id == startId ? from : id == goalId ? to : grid.nodes[id].cell;
+    };
+
+    // a heap over the scratch vector, the same order std::priority_queue would give
+    std::vector<entry>& open = local.open;
+    std::greater<entry> later;
+    open.clear();
+
+    costs[startId] = 0;
+    open.push_back({ heuristic(from), startId });
+
+    auto relax = [&](uint32_t at, uint32_t next, float cost) {
+        if(cost >= costs[next]) return;
+
+        costs[next] = cost;
+        parents[next] = at;
+        open.push_back({ cost + heuristic(cell(next)), next });
+        std::push_heap(open.begin(), open.end(), later);
+    };
+
+    while(!open.empty()) {
+        std::pop_heap(open.begin(), open.end(), later);
+        entry top = open.back();
+        open.pop_back();
+
+        uint32_t at = top.second;
+        if(at == goalId) break;
+        if(top.first > costs[at] + heuristic(cell(at)) + 1e-3f) continue;
+
+        if(at == startId) {
+            for(uint32_t n = grid.clusterFirstNode[fromCluster]; n < grid.clusterFirstNode[fromCluster + 1]; n++) {
+                float cost = start.cost(grid.nodes[n].cell);
+                if(cost < INFINITY) relax(at, n, cost);
+            }
+            continue;
+        }
+
+        const OCARN2::NavNode& node = grid.nodes[at];
+        for(uint32_t e = node.firstEdge; e < node.firstEdge + node.numEdges; e++) {
+            relax(at, grid.edges[e].to, costs[at] + grid.edges[e].cost);
+        }
+
+        if(node.cluster == toCluster) {
+            float cost = goal.cost(node.cell);
+            if(cost < INFINITY) relax(at, goalId, costs[at] + cost);
+        }
+    }
+
+    if(parents[goalId] == UINT32_MAX) return {};
+
+    std::vector<uint32_t>& route = local.route;
+    route.clear();
+    for(uint32_t at = goalId; at != UINT32_MAX; at = parents[at]) route.push_back(at);
+    std::reverse(route.begin(), route.end());
+
+    // the first and last legs come from the start and goal searches, the rest are stored on the edges
+    start.append_path(cell(route[1]), path);
+
+    for(size_t i=2; i + 1 < route.size(); i++) {
+        const OCARN2::NavNode& node = grid.nodes[route[i - 1]];
+
+        for(uint32_t e = node.firstEdge; e < node.firstEdge + node.numEdges; e++) {
+            const OCARN2::NavEdge& edge = grid.edges[e];
+            if(edge.to != route[i]) continue;
+
+            OCARN2::NavPoint at = node.cell;
+            for(uint32_t s = edge.firstStep; s < edge.firstStep + edge.numSteps; s++) {
+                at.x += ocarn2__nav_moves[grid.steps[s]][0];
+                at.z += ocarn2__nav_moves[grid.steps[s]][1];
+                path.push_back(at);
+            }
+            break;
+        }
+    }
+
+    goal.append_path_back(cell(route[route.size() - 2]), path);
+
+    return path;
+}
+
+#endif
@@ -0,0 +1,833 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for storing baked MAP and RSC data in a block compressed "pack" file.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * A pack is a list of named sections (one per map plane, or the whole rsc file), and every section is
+ * split into chunks that are compressed on their own. That way a single plane, or a band of rows out of a
+ * plane, can be decompressed without touching the rest of the file, and chunks can be decoded on as many
+ * threads as you like.
+ *
+ * Chunks are compressed with a small built-in LZ4 block codec, so there's nothing extra to link against.
+ * Chunks that don't get smaller are stored raw.
+ *
+ * main methods are
+ *
+ * bool save_map_pack(const Map& map, const std::string& filename, const PackOptions& options);
+ * bool bake_map_pack(const std::string& mapFilename, const std::string& packFilename, const PackOptions& options);
+ * bool bake_rsc_pack(const std::string& rscFilename, const std::string& packFilename, const PackOptions& options);
+ * Map load_map_pack(const std::string& filename, unsigned threads, LoadError* error);
+ * Rsc load_rsc_pack(const std::string& filename, unsigned threads, LoadError* error);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    enum PackCodec {
+        PACK_CODEC_NONE = 0,
+        PACK_CODEC_LZ4 = 1
+    };
+
+    struct PackOptions {
+        uint32_t codec = PACK_CODEC_LZ4;
+
+        // bytes of uncompressed data per chunk. map planes round this down to whole rows
+        uint32_t chunkSize = 64 * 1024;
+
+        // threads used for compressing. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    // these two are stored in the file exactly like this
+    struct PackSection {
+        char name[16];
+        uint64_t rawSize;
+        uint32_t firstChunk;
+        uint32_t numChunks;
+    };
+
+    struct PackChunk {
+        uint64_t offset;
+        uint32_t compressedSize;
+        uint32_t rawSize;
+        uint32_t codec;
+        uint32_t reserved;
+    };
+
+    /**
+     * table of contents of an opened pack file. chunk data is only read when asked for
+     */
+    struct PackFile {
+        std::string filename;
+
+        std::vector<PackSection> sections;
+        std::vector<PackChunk> chunks;
+    };
+}
+
+
+OCARN2_DEF bool save_map_pack(const OCARN2::Map& map, const std::string& filename, const OCARN2::PackOptions& options = {});
+OCARN2_DEF bool bake_map_pack(const std::string& mapFilename, const std::string& packFilename, const OCARN2::PackOptions& options = {});
+OCARN2_DEF bool bake_rsc_pack(const std::string& rscFilename, const std::string& packFilename, const OCARN2::PackOptions& options = {});
+
+OCARN2_DEF OCARN2::Map load_map_pack(const std::string& filename, unsigned threads = 0, OCARN2::LoadError* error = nullptr);
+OCARN2_DEF OCARN2::Rsc load_rsc_pack(const std::string& filename, unsigned threads = 0, OCARN2::LoadError* error = nullptr);
+
+OCARN2_DEF OCARN2::PackFile open_pack_file(const std::string& filename);
+OCARN2_DEF const OCARN2::PackSection* find_pack_section(const OCARN2::PackFile& pack, const std::string& name);
+OCARN2_DEF bool read_pack_range(const OCARN2::PackFile& pack, const std::string& section, uint64_t offset, uint64_t size, void* destination, unsigned threads = 0);
+OCARN2_DEF bool read_map_pack_rows(const OCARN2::PackFile& pack, OCARN2::MapPlane plane, uint32_t firstRow, uint32_t numRows, void* destination, unsigned threads = 0);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cstring>
+#include <memory>
+
+static const char ocarn2__pack_magic[4] = { 'O', 'C', '2', 'P' };
+static const uint32_t ocarn2__pack_version = 1;
+
+// most bytes an lz4 block can decode to per byte of it, a long match is a 255 length byte at a time
+static const uint64_t ocarn2__pack_max_ratio = 255;
+
+
+// lz4 block format. https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+static inline uint32_t ocarn2__lz4_read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t ocarn2__lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - 12);
+}
+
+/**
+ * Worst case size of lz4 compressing size bytes
+ *
+ * @param size
+ * @return
+ */
+static inline size_t ocarn2__lz4_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+static inline unsigned char* ocarn2__lz4_write_length(unsigned char* op, size_t length) {
+    while(length >= 255) { *op++ = 255; length -= 255; }
+    *op++ = (unsigned char) length;
+    return op;
+}
+
+/**
+ * Internal function to compress src into dst using the lz4 block format.
+ * dst must be at least ocarn2__lz4_bound(srcSize) bytes
+ *
+ * @return number of bytes written to dst
+ */
+OCARN2_DEF size_t ocarn2__lz4_compress(const unsigned char* src, size_t srcSize, unsigned char* dst) {
+    const size_t minMatch = 4, lastLiterals = 5, mfLimit = 12;
+
+    uint32_t table[1 << 12] = {};
+
+    unsigned char* op = dst;
+    size_t ip = 0, anchor = 0;
+
+    auto emit = [&](size_t literals, size_t matchLength, size_t offset) {
+        unsigned char* token = op++;
+        *token = (unsigned char) ((literals >= 15 ? 15 : literals) << 4);
+        if(literals >= 15) op = ocarn2__lz4_write_length(op, literals - 15);
+
+        memcpy(op, src + anchor, literals);
+        op += literals;
+
+        if(matchLength == 0) return; // last sequence is literals only
+
+        *op++ = (unsigned char) offset;
+        *op++ = (unsigned char) (offset >> 8);
+
+        matchLength -= minMatch;
+        *token |= (unsigned char) (matchLength >= 15 ? 15 : matchLength);
+        if(matchLength >= 15) op = ocarn2__lz4_write_length(op, matchLength - 15);
+    };
+
+    if(srcSize > mfLimit) {
+        const size_t matchLimit = srcSize - lastLiterals;
+        const size_t inputLimit = srcSize - mfLimit;
+
+        while(ip < inputLimit) {
+            uint32_t sequence = ocarn2__lz4_read32(src + ip);
+            uint32_t& slot = table[ocarn2__lz4_hash(sequence)];
+            size_t ref = slot;
+            slot = (uint32_t) ip;
+
+            if(ref >= ip || ip - ref > 65535 || ocarn2__lz4_read32(src + ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            // grow the match backwards into the pending literals, then forwards
+            while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) { ip--; ref--; }
+
+            size_t length = minMatch;
+            while(ip + length < matchLimit && src[ip + length] == src[ref + length]) length++;
+
+            emit(ip - anchor, length, ip - ref);
+
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    emit(srcSize - anchor, 0, 0);
+
+    return op - dst;
+}
+
+/**
+ * Internal function to decompress an lz4 block. Every length and offset is checked against the buffers,
+ * so a corrupt block fails instead of reading or writing out of bounds
+ *
+ * @return number of bytes written to dst, or -1 if the block is corrupt
+ */
+OCARN2_DEF int64_t ocarn2__lz4_decompress(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize) {
+    const unsigned char* ip = src;
+    const unsigned char* const ipEnd = src + srcSize;
+    unsigned char* op = dst;
+    unsigned char* const opEnd = dst + dstSize;
+
+    auto readLength = [&](size_t& length) -> bool {
+        unsigned char b;
+        do {
+            if(ip >= ipEnd) return false;
+            b = *ip++;
+            length += b;
+        } while(b == 255);
+        return true;
+    };
+
+    while(ip < ipEnd) {
+        unsigned char token = *ip++;
+
+        size_t literals = token >> 4;
+        if(literals == 15 && !readLength(literals)) return -1;
+        if(literals > (size_t) (ipEnd - ip) || literals > (size_t) (opEnd - op)) return -1;
+
+        // short runs are copied 16 bytes at a time when both buffers have room, the extra is overwritten later
+        if(literals <= 16 && ipEnd - ip >= 16 && opEnd - op >= 16) memcpy(op, ip, 16);
+        else memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if(ip == ipEnd) break;
+
+        if(ipEnd - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (size_t) (op - dst)) return -1;
+
+        size_t length = token & 15;
+        if(length == 15 && !readLength(length)) return -1;
+        length += 4;
+        if(length > (size_t) (opEnd - op)) return -1;
+
+        const unsigned char* match = op - offset;
+        if(offset >= 16 && length <= 16 && opEnd - op >= 16) {
+            memcpy(op, match, 16);
+            op += length;
+        }
+        else if(offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        }
+        else if(offset == 1) {
+            memset(op, *match, length);
+            op += length;
+        }
+        else {
+            // overlapping match repeats the last offset bytes. what's been copied repeats too, so every copy
+            // can be twice as long as the one before
+            unsigned char* end = op + length;
+            while(op < end) {
+                size_t n = std::min((size_t) (op - match), (size_t) (end - op));
+                memcpy(op, match, n);
+                op += n;
+            }
+        }
+    }
+
+    return op - dst;
+}
+
+
+/**
+ * Internal struct used while building a pack, before anything is written
+ */
+struct ocarn2__pack_builder {
+    std::vector<OCARN2::PackSection> sections;
+    std::vector<OCARN2::PackChunk> chunks;
+    std::vector<std::vector<unsigned char>> blobs;
+};
+
+/**
+ * Internal function to split data into chunks and compress them into the builder
+ *
+ * @param builder
+ * @param name
+ * @param data
+ * @param size
+ * @param chunkSize
+ * @param options
+ */
+OCARN2_DEF void ocarn2__pack_add_section(ocarn2__pack_builder& builder, const char* name, const unsigned char* data, uint64_t size, uint32_t chunkSize, const OCARN2::PackOptions& options) {
+    OCARN2::PackSection section {};
+    strncpy(section.name, name, sizeof(section.name) - 1);
+    section.rawSize = size;
+    section.firstChunk = (uint32_t) builder.chunks.size();
+    section.numChunks = (uint32_t) ((size + chunkSize - 1) / chunkSize);
+
+    size_t first = builder.chunks.size();
+    builder.chunks.resize(first + section.numChunks);
+    builder.blobs.resize(first + section.numChunks);
+
+    ocarn2__parallel_for(section.numChunks, options.threads, [&](size_t i) {
+        OCARN2::PackChunk& chunk = builder.chunks[first + i];
+        std::vector<unsigned char>& blob = builder.blobs[first + i];
+
+        const unsigned char* raw = data + i * chunkSize;
+        chunk.rawSize = (uint32_t) std::min<uint64_t>(chunkSize, size - i * chunkSize);
+        chunk.codec = OCARN2::PACK_CODEC_NONE;
+
+        if(options.codec == OCARN2::PACK_CODEC_LZ4) {
+            blob.resize(ocarn2__lz4_bound(chunk.rawSize));
+            blob.resize(ocarn2__lz4_compress(raw, chunk.rawSize, blob.data()));
+
+            if(blob.size() < chunk.rawSize) chunk.codec = OCARN2::PACK_CODEC_LZ4;
+        }
+
+        if(chunk.codec == OCARN2::PACK_CODEC_NONE) blob.assign(raw, raw + chunk.rawSize);
+
+        chunk.compressedSize = (uint32_t) blob.size();
+    });
+
+    builder.sections.push_back(section);
+}
+
+/**
+ * Internal function to write out everything added to the builder
+ *
+ * @param builder
+ * @param filename
+ * @return
+ */
+OCARN2_DEF bool ocarn2__pack_write(ocarn2__pack_builder& builder, const std::string& filename) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+
+    uint32_t numSections = (uint32_t) builder.sections.size();
+    uint32_t numChunks = (uint32_t) builder.chunks.size();
+
+    uint64_t offset = 16 + numSections * sizeof(OCARN2::PackSection) + numChunks * sizeof(OCARN2::PackChunk);
+    for(uint32_t i=0; i < numChunks; i++) {
+        builder.chunks[i].offset = offset;
+        offset += builder.chunks[i].compressedSize;
+    }
+
+    file.write(ocarn2__pack_magic, 4);
+    file.write((char*) &ocarn2__pack_version, 4);
+    file.write((char*) &numSections, 4);
+    file.write((char*) &numChunks, 4);
+    file.write((char*) builder.sections.data(), numSections * sizeof(OCARN2::PackSection));
+    file.write((char*) builder.chunks.data(), numChunks * sizeof(OCARN2::PackChunk));
+
+    for(auto& blob: builder.blobs)
+        file.write((char*) blob.data(), blob.size());
+
+    return file.good();
+}
+
+/**
+ * Internal function to decode one chunk into its place in the section's output
+ *
+ * @param chunk
+ * @param compressed
+ * @param destination where the chunk's raw bytes go, must be chunk.rawSize long
+ * @return
+ */
+OCARN2_DEF bool ocarn2__pack_decode_chunk(const OCARN2::PackChunk& chunk, const unsigned char* compressed, unsigned char* destination) {
+    if(chunk.codec == OCARN2::PACK_CODEC_NONE) {
+        if(chunk.compressedSize != chunk.rawSize) return false;
+        memcpy(destination, compressed, chunk.rawSize);
+        return true;
+    }
+
+    if(chunk.codec == OCARN2::PACK_CODEC_LZ4)
+        return ocarn2__lz4_decompress(compressed, chunk.compressedSize, destination, chunk.rawSize) == chunk.rawSize;
+
+    return false;
+}
+
+/**
+ * Compresses every plane of the map into a pack file. Chunks hold whole rows, so read_map_pack_rows
+ * can pull out a band of the map later on
+ *
+ * @param map
+ * @param filename
+ * @param options
+ * @return
+ */
+OCARN2_DEF bool save_map_pack(const OCARN2::Map& map, const std::string& filename, const OCARN2::PackOptions& options) {
+    ocarn2__pack_builder builder;
+
+    for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+        OCARN2::MapPlane plane = (OCARN2::MapPlane) p;
+        OCARN2::MapPlaneInfo info = map_plane_info(plane);
+
+        uint32_t rowSize = info.width * info.cellSize;
+        uint32_t chunkSize = std::max(1u, options.chunkSize / rowSize) * rowSize;
+
+        ocarn2__pack_add_section(builder, info.name, map_plane_data(map, plane), (uint64_t) rowSize * info.width, chunkSize, options);
+    }
+
+    return ocarn2__pack_write(builder, filename);
+}
+
+/**
+ * Reads a .map file and writes it back out as a pack
+ *
+ * @param mapFilename
+ * @param packFilename
+ * @param options
+ * @return false if the map is missing or corrupt, in which case no pack is written
+ */
+OCARN2_DEF bool bake_map_pack(const std::string& mapFilename, const std::string& packFilename, const OCARN2::PackOptions& options) {
+    OCARN2::Map map {};
+    bool loaded = false;
+
+    ocarn2__openFile(mapFilename, [&](std::fstream& file) {
+        OCARN2::LoadError failure;
+        loaded = ocarn2__load_map(file, map, &failure);
+        if(!loaded) ocarn2__report_load_error(mapFilename, failure, nullptr);
+    });
+
+    if(!loaded) return false;
+
+    return save_map_pack(map, packFilename, options);
+}
+
+/**
+ * Compresses an .rsc file into a pack. The rsc file is kept as a single section, since most of it is
+ * textures and sky that get decoded all at once anyway
+ *
+ * @param rscFilename
+ * @param packFilename
+ * @param options
+ * @return
+ */
+OCARN2_DEF bool bake_rsc_pack(const std::string& rscFilename, const std::string& packFilename, const OCARN2::PackOptions& options) {
+    std::vector<unsigned char> raw;
+    bool loaded = false;
+
+    ocarn2__openFile(rscFilename, [&](std::fstream& file) {
+        file.seekg(0, std::ios::end);
+        std::streampos size = file.tellg();
+        if(size == std::streampos(-1)) {
+            std::cerr << "Unable to tell the size of " << rscFilename << std::endl;
+            return;
+        }
+
+        raw.resize((size_t) size);
+        file.seekg(0, std::ios::beg);
+
+        loaded = (bool) file.read((char*) raw.data(), raw.size());
+        if(!loaded) std::cerr << "Unable to read " << rscFilename << std::endl;
+    });
+
+    if(!loaded) return false;
+
+    ocarn2__pack_builder builder;
+    ocarn2__pack_add_section(builder, "rsc", raw.data(), raw.size(), std::max(1u, options.chunkSize), options);
+
+    return ocarn2__pack_write(builder, packFilename);
+}
+
+/**
+ * Internal function to read and check the table of contents of a pack, leaving file just past it.
+ * Every section's chunks have to add up to exactly its size, and every chunk has to be inside the file
+ *
+ * @return false with failure filled in if it isn't a pack or the table doesn't hold together
+ */
+OCARN2_DEF bool ocarn2__pack_read_toc(std::istream& file, OCARN2::PackFile& pack, OCARN2::LoadError& failure) {
+    char magic[4];
+    uint32_t version = 0, numSections = 0, numChunks = 0;
+
+    file.read(magic, 4);
+    file.read((char*) &version, 4);
+    file.read((char*) &numSections, 4);
+    file.read((char*) &numChunks, 4);
+
+    if(!file || memcmp(magic, ocarn2__pack_magic, 4) != 0 || version != ocarn2__pack_version) {
+        failure = { 0, "not a pack file" };
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    std::streampos end = file.tellg();
+    if(end == std::streampos(-1)) {
+        failure = { 16, "can't tell the size of the file" };
+        return false;
+    }
+
+    uint64_t fileSize = (uint64_t) end;
+    file.seekg(16, std::ios::beg);
+
+    uint64_t tableSize = (uint64_t) numSections * sizeof(OCARN2::PackSection) + (uint64_t) numChunks * sizeof(OCARN2::PackChunk);
+    if(tableSize > fileSize - 16) {
+        failure = { 16, "truncated table of contents" };
+        return false;
+    }
+
+    std::vector<OCARN2::PackSection> sections(numSections);
+    std::vector<OCARN2::PackChunk> chunks(numChunks);
+    file.read((char*) sections.data(), numSections * sizeof(OCARN2::PackSection));
+    file.read((char*) chunks.data(), numChunks * sizeof(OCARN2::PackChunk));
+
+    uint64_t chunkTable = 16 + (uint64_t) numSections * sizeof(OCARN2::PackSection);
+    for(uint32_t i=0; i < numChunks; i++) {
+        const OCARN2::PackChunk& chunk = chunks[i];
+        uint64_t at = chunkTable + i * sizeof(OCARN2::PackChunk);
+
+        if(chunk.compressedSize > fileSize || chunk.offset > fileSize - chunk.compressedSize) {
+            failure = { at, "chunk " + std::to_string(i) + " runs past the end of the file" };
+            return false;
+        }
+
+        // nothing decodes to more than lz4's best ratio allows, so a raw size past it would only drive allocations
+        if(chunk.rawSize > (uint64_t) chunk.compressedSize * ocarn2__pack_max_ratio + 16 ||
+           (chunk.codec == OCARN2::PACK_CODEC_NONE && chunk.rawSize != chunk.compressedSize)) {
+            failure = { at, "chunk " + std::to_string(i) + " claims " + std::to_string(chunk.rawSize) + " bytes from " +
+                            std::to_string(chunk.compressedSize) };
+            return false;
+        }
+    }
+
+    for(uint32_t i=0; i < numSections; i++) {
+        OCARN2::PackSection& section = sections[i];
+        section.name[sizeof(section.name) - 1] = '\0';
+        uint64_t at = 16 + i * sizeof(OCARN2::PackSection);
+
+        if((uint64_t) section.firstChunk + section.numChunks > numChunks) {
+            failure = { at, std::string("section ") + section.name + " lists chunks that aren't there" };
+            return false;
+        }
+
+        // chunks can share bytes of the file, so each being in bounds isn't enough to bound the section
+        if(section.rawSize > fileSize * ocarn2__pack_max_ratio + 16 * (uint64_t) numChunks) {
+            failure = { at, std::string("section ") + section.name + " claims " + std::to_string(section.rawSize) +
+                            " bytes from a " + std::to_string(fileSize) + " byte file" };
+            return false;
+        }
+
+        uint64_t covered = 0;
+        for(uint32_t c=0; c < section.numChunks; c++) covered += chunks[section.firstChunk + c].rawSize;
+
+        if(covered != section.rawSize) {
+            failure = { at, std::string("chunks of section ") + section.name + " hold " + std::to_string(covered) +
+                            " bytes, not " + std::to_string(section.rawSize) };
+            return false;
+        }
+    }
+
+    pack.sections = std::move(sections);
+    pack.chunks = std::move(chunks);
+    return true;
+}
+
+/**
+ * Reads the table of contents from a pack file. On failure the returned pack has no sections
+ *
+ * @param filename
+ * @return
+ */
+OCARN2_DEF OCARN2::PackFile open_pack_file(const std::string& filename) {
+    OCARN2::PackFile pack;
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        OCARN2::LoadError failure;
+        if(ocarn2__pack_read_toc(file, pack, failure)) pack.filename = filename;
+        else ocarn2__report_load_error(filename, failure, nullptr);
+    });
+
+    return pack;
+}
+
+/**
+ * Finds a section by name, or nullptr if the pack doesn't have it
+ *
+ * @param pack
+ * @param name
+ * @return
+ */
+OCARN2_DEF const OCARN2::PackSection* find_pack_section(const OCARN2::PackFile& pack, const std::string& name) {
+    for(auto& s: pack.sections) {
+        if(name == s.name) return &s;
+    }
+
+    return nullptr;
+}
+
+/**
+ * Decompresses bytes [offset, offset + size) of a section into destination. Only the chunks overlapping the
+ * range are read from disk, and they are decoded in parallel
+ *
+ * @param pack
+ * @param section
+ * @param offset
+ * @param size
+ * @param destination
+ * @param threads
+ * @return
+ */
+OCARN2_DEF bool read_pack_range(const OCARN2::PackFile& pack, const std::string& section, uint64_t offset, uint64_t size, void* destination, unsigned threads) {
+    const OCARN2::PackSection* s = find_pack_section(pack, section);
+    if(!s || size > s->rawSize || offset > s->rawSize - size) return false;
+    if(size == 0) return true;
+
+    // work out which chunks overlap the range, and where each of them starts in the section
+    std::vector<uint32_t> indices;
+    std::vector<uint64_t> starts;
+
+    uint64_t position = 0;
+    for(uint32_t i=0; i < s->numChunks && position < offset + size; i++) {
+        const OCARN2::PackChunk& chunk = pack.chunks[s->firstChunk + i];
+
+        if(position + chunk.rawSize > offset) {
+            indices.push_back(s->firstChunk + i);
+            starts.push_back(position);
+        }
+
+        position += chunk.rawSize;
+    }
+
+    if(indices.empty()) return false;
+
+    // chunks of a section are stored back to back, so the whole span is one read
+    const OCARN2::PackChunk& first = pack.chunks[indices.front()];
+    const OCARN2::PackChunk& last = pack.chunks[indices.back()];
+    uint64_t spanStart = first.offset;
+    uint64_t spanSize = last.offset + last.compressedSize - spanStart;
+
+    std::unique_ptr<unsigned char[]> compressed(new unsigned char[spanSize]);
+    bool loaded = false;
+
+    ocarn2__openFile(pack.filename, [&](std::fstream& file) {
+        file.seekg((std::streamoff) spanStart, std::ios::beg);
+        loaded = (bool) file.read((char*) compressed.get(), spanSize);
+    });
+
+    if(!loaded) return false;
+
+    // only the first and last chunk can stick out of the range. those two are decoded into scratch and the
+    // part that's wanted is copied out, everything else goes straight into the output
+    auto partial = [&](size_t i) {
+        return starts[i] < offset || starts[i] + pack.chunks[indices[i]].rawSize > offset + size;
+    };
+
+    size_t tail = indices.size() - 1;
+    uint64_t headSize = partial(0) ? pack.chunks[indices[0]].rawSize : 0;
+    uint64_t tailSize = tail > 0 && partial(tail) ? pack.chunks[indices[tail]].rawSize : 0;
+    std::unique_ptr<unsigned char[]> scratch(headSize + tailSize > 0 ? new unsigned char[headSize + tailSize] : nullptr);
+
+    std::atomic<bool> ok {true};
+    unsigned char* out = (unsigned char*) destination;
+
+    ocarn2__parallel_for(indices.size(), threads, [&](size_t i) {
+        const OCARN2::PackChunk& chunk = pack.chunks[indices[i]];
+        const unsigned char* data = compressed.get() + (chunk.offset - spanStart);
+
+        uint64_t chunkStart = starts[i];
+        if(!partial(i)) {
+            if(!ocarn2__pack_decode_chunk(chunk, data, out + (chunkStart - offset))) ok = false;
+            return;
+        }
+
+        unsigned char* decoded = scratch.get() + (i == 0 ? 0 : headSize);
+        if(!ocarn2__pack_decode_chunk(chunk, data, decoded)) {
+            ok = false;
+            return;
+        }
+
+        uint64_t from = std::max(chunkStart, offset);
+        uint64_t to = std::min(chunkStart + chunk.rawSize, offset + size);
+        memcpy(out + (from - offset), decoded + (from - chunkStart), to - from);
+    });
+
+    return ok;
+}
+
+/**
+ * Decompresses numRows rows of a single map plane, so a region of the map can be loaded on demand
+ *
+ * @param pack
+ * @param plane
+ * @param firstRow
+ * @param numRows
+ * @param destination must hold numRows * width * cellSize bytes
+ * @param threads
+ * @return
+ */
+OCARN2_DEF bool read_map_pack_rows(const OCARN2::PackFile& pack, OCARN2::MapPlane plane, uint32_t firstRow, uint32_t numRows, void* destination, unsigned threads) {
+    OCARN2::MapPlaneInfo info = map_plane_info(plane);
+    uint64_t rowSize = (uint64_t) info.width * info.cellSize;
+
+    return read_pack_range(pack, info.name, firstRow * rowSize, numRows * rowSize, destination, threads);
+}
+
+/**
+ * Loads a whole map back out of a pack. The file is read a batch of chunks at a time into one buffer, and
+ * each batch is decoded in parallel straight into the map's planes
+ *
+ * @param filename
+ * @param threads
+ * @param error if given, filled in with the reason and file offset the load failed at
+ * @return a zeroed map if the file is missing, a plane is missing or any chunk is corrupt
+ */
+OCARN2_DEF OCARN2::Map load_map_pack(const std::string& filename, unsigned threads, OCARN2::LoadError* error) {
+    OCARN2::Map map {};
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        OCARN2::PackFile pack;
+        OCARN2::LoadError failure;
+
+        if(!ocarn2__pack_read_toc(file, pack, failure)) {
+            ocarn2__report_load_error(filename, failure, error);
+            return;
+        }
+
+        // flatten every chunk of every plane into one list of jobs, in file order
+        struct Job { const OCARN2::PackChunk* chunk; unsigned char* destination; };
+        std::vector<Job> jobs;
+        jobs.reserve(pack.chunks.size());
+
+        for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+            OCARN2::MapPlane plane = (OCARN2::MapPlane) p;
+            OCARN2::MapPlaneInfo info = map_plane_info(plane);
+
+            const OCARN2::PackSection* s = find_pack_section(pack, info.name);
+            uint64_t planeSize = (uint64_t) info.width * info.width * info.cellSize;
+
+            if(!s || s->rawSize != planeSize) {
+                failure = { 0, std::string(s ? "wrong size for" : "missing") + " map plane " + info.name };
+                ocarn2__report_load_error(filename, failure, error);
+                return;
+            }
+
+            // the table of contents already checked the chunks cover the plane exactly
+            unsigned char* out = map_plane_data(map, plane);
+            for(uint32_t i=0; i < s->numChunks; i++) {
+                const OCARN2::PackChunk& chunk = pack.chunks[s->firstChunk + i];
+                jobs.push_back({ &chunk, out });
+                out += chunk.rawSize;
+            }
+        }
+
+        std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.chunk->offset < b.chunk->offset; });
+
+        // big enough to keep every thread busy, small enough to stay in cache while it's decoded
+        const uint64_t batchSize = 1024 * 1024;
+        std::unique_ptr<unsigned char[]> buffer;
+        uint64_t bufferSize = 0;
+
+        std::atomic<size_t> corrupt { jobs.size() };
+
+        for(size_t first=0; first < jobs.size();) {
+            uint64_t start = jobs[first].chunk->offset;
+            size_t last = first + 1;
+            while(last < jobs.size() && jobs[last].chunk->offset + jobs[last].chunk->compressedSize - start <= batchSize) last++;
+
+            uint64_t span = jobs[last - 1].chunk->offset + jobs[last - 1].chunk->compressedSize - start;
+            if(span > bufferSize) {
+                buffer.reset(new unsigned char[span]);
+                bufferSize = span;
+            }
+
+            file.seekg((std::streamoff) start, std::ios::beg);
+            if(!file.read((char*) buffer.get(), (std::streamsize) span)) {
+                failure = { start, "unable to read chunks" };
+                ocarn2__report_load_error(filename, failure, error);
+                map = {};
+                return;
+            }
+
+            ocarn2__parallel_for(last - first, threads, [&](size_t i) {
+                const Job& job = jobs[first + i];
+                if(!ocarn2__pack_decode_chunk(*job.chunk, buffer.get() + (job.chunk->offset - start), job.destination)) {
+                    size_t seen = corrupt.load();
+                    while(first + i < seen && !corrupt.compare_exchange_weak(seen, first + i)) {}
+                }
+            });
+
+            if(corrupt.load() < jobs.size()) break;
+            first = last;
+        }
+
+        if(corrupt.load() < jobs.size()) {
+            const OCARN2::PackChunk& chunk = *jobs[corrupt.load()].chunk;
+            failure = { chunk.offset, "corrupt chunk " + std::to_string(&chunk - pack.chunks.data()) };
+            ocarn2__report_load_error(filename, failure, error);
+            map = {};
+        }
+    });
+
+    return map;
+}
+
+/**
+ * Loads an rsc out of a pack made with bake_rsc_pack. The chunks are decoded in parallel, then parsed
+ * from memory
+ *
+ * @param filename
+ * @param threads
+ * @param error if given, filled in with the reason and file offset the load failed at. for a corrupt rsc
+ *              inside the pack, the offset is into the rsc rather than the pack
+ * @return an empty rsc if the file is missing or corrupt
+ */
+OCARN2_DEF OCARN2::Rsc load_rsc_pack(const std::string& filename, unsigned threads, OCARN2::LoadError* error) {
+    OCARN2::Rsc rsc {};
+
+    OCARN2::PackFile pack = open_pack_file(filename);
+    if(pack.filename.empty()) return rsc;
+
+    OCARN2::LoadError failure;
+    const OCARN2::PackSection* s = find_pack_section(pack, "rsc");
+    if(!s) {
+        failure = { 0, "missing section rsc" };
+        ocarn2__report_load_error(filename, failure, error);
+        return rsc;
+    }
+
+    std::vector<unsigned char> raw(s->rawSize);
+    if(!read_pack_range(pack, "rsc", 0, s->rawSize, raw.data(), threads)) {
+        failure = { pack.chunks[s->firstChunk].offset, "corrupt chunk in section rsc" };
+        ocarn2__report_load_error(filename, failure, error);
+        return rsc;
+    }
+
+    ocarn2__membuf buffer(raw.data(), raw.size());
+    std::istream in(&buffer);
+
+    if(!ocarn2__load_rsc(in, rsc, &failure)) ocarn2__report_load_error(filename, failure, error);
+
+    return rsc;
+}
+
+#endif
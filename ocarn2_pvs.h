@@ -0,0 +1,888 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for answering "can this cell see that one" over the terrain, eg for creature AI.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * Sight goes from eyeHeight above the ground in the middle of one cell to eyeHeight above the ground in the
+ * middle of the other, and is blocked where heightMap (bilinear between grid points) rises above the line. It
+ * reaches viewDistance, or less in fog: the fog in fogMap at either end limits it to that Fog's fLimit.
+ *
+ * The map is cut into square regions (16x16 cells by default) and every pair of regions is put in one of three
+ * classes, only ever by proof, never by sampling:
+ *
+ * - hidden: no two cells can be in range, going by the furthest fog range in each region, or a ridge runs
+ *   across the corridor between them, along x or z, that's higher than any line can be where it crosses. A
+ *   line's height there is its ends' mixed by how far along it is, so it's bounded by the highest eyes in the
+ *   columns lines through the ridge can come from, and the ridge is wide enough that every traced line checks
+ *   the ground on it at least once
+ * - visible: the ground in the corridor stays under every line between them. Heights are taken over a plane
+ *   fitted to both regions' eyes, so slopes cancel out, and each grid line across the corridor is checked
+ *   against the lowest eyes the lines over it can come from, interpolated the same way. Where that's not
+ *   enough, the grid line is checked a few points at a time. The terrain blocks nothing, so only range is
+ *   left, which is a distance check against the fogMap at both ends
+ * - partly visible: everything else, where the query traces the exact line
+ *
+ * Two bit matrices hold the classes, so apart from partly visible pairs looking one up is a bit test, and
+ * pvs_can_see always gives the same answer as terrain_can_see. How many pairs get proved depends on the
+ * terrain: rolling ground proves most of them, but bumps nearly as tall as eyeHeight between two regions
+ * leave them partly visible.
+ *
+ * Pairs are symmetric, so only one side of the matrix is worked out, spread over threads a row at a time. The
+ * sets are quick enough to build at load, or can be baked once with save_terrain_pvs.
+ *
+ * main methods are
+ *
+ * TerrainPvs build_terrain_pvs(const Map& map, const Rsc* rsc, const PvsOptions& options);
+ * PvsVisibility pvs_cell_visibility(const TerrainPvs& pvs, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+ * bool pvs_can_see(const TerrainPvs& pvs, const Map& map, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+ * SightRanges terrain_sight_ranges(const Rsc* rsc, const PvsOptions& options);
+ * bool terrain_can_see(const Map& map, const SightRanges& ranges, const PvsOptions& options, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+ * bool save_terrain_pvs(const TerrainPvs& pvs, const std::string& filename);
+ * TerrainPvs load_terrain_pvs(const std::string& filename);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct PvsOptions {
+        // cells per side of a region. must divide 1024
+        uint32_t regionSize = 16;
+
+        // world units per cell, and per step of heightMap, same as the terrain mesh
+        float cellSize = 256.0f;
+        float heightScale = 64.0f;
+
+        // world units above the ground at both ends of a sight line
+        float eyeHeight = 256.0f;
+
+        // furthest anything can be seen, in world units, fog or not
+        float viewDistance = 48 * 256.0f;
+
+        // cells between height checks along a sight line
+        float rayStep = 0.5f;
+
+        // threads used to build. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    enum PvsVisibility {
+        PVS_HIDDEN = 0,
+        PVS_PARTIAL,
+        PVS_VISIBLE
+    };
+
+    // how far sight reaches from a cell, by its fogMap value, for tracing without a visibility set
+    struct SightRanges {
+        float byFog[256] = {};
+    };
+
+    struct TerrainPvs {
+        PvsOptions options;
+
+        // how far sight reaches from a cell, by its fogMap value
+        float fogRanges[256] = {};
+
+        uint32_t regionsPerSide = 0;
+        uint32_t numRegions = 0;   // regionsPerSide squared, regionZ * regionsPerSide + regionX
+        uint32_t wordsPerRow = 0;
+
+        // numRegions rows of wordsPerRow words, bit b of row a for the pair a, b
+        std::vector<uint64_t> seen;  // not proved hidden
+        std::vector<uint64_t> clear; // proved the terrain blocks no line between any cell of a and any cell of b
+    };
+}
+
+
+OCARN2_DEF OCARN2::TerrainPvs build_terrain_pvs(const OCARN2::Map& map, const OCARN2::Rsc* rsc = nullptr, const OCARN2::PvsOptions& options = {});
+OCARN2_DEF OCARN2::PvsVisibility pvs_region_visibility(const OCARN2::TerrainPvs& pvs, uint32_t regionA, uint32_t regionB);
+OCARN2_DEF OCARN2::PvsVisibility pvs_cell_visibility(const OCARN2::TerrainPvs& pvs, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+OCARN2_DEF bool pvs_can_see(const OCARN2::TerrainPvs& pvs, const OCARN2::Map& map, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+OCARN2_DEF bool terrain_can_see(const OCARN2::Map& map, const OCARN2::Rsc* rsc, const OCARN2::PvsOptions& options, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+OCARN2_DEF OCARN2::SightRanges terrain_sight_ranges(const OCARN2::Rsc* rsc, const OCARN2::PvsOptions& options = {});
+OCARN2_DEF bool terrain_can_see(const OCARN2::Map& map, const OCARN2::SightRanges& ranges, const OCARN2::PvsOptions& options, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1);
+OCARN2_DEF bool save_terrain_pvs(const OCARN2::TerrainPvs& pvs, const std::string& filename);
+OCARN2_DEF OCARN2::TerrainPvs load_terrain_pvs(const std::string& filename);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cmath>
+
+static const char ocarn2__pvs_magic[4] = { 'O', 'C', '2', 'V' };
+static const uint32_t ocarn2__pvs_version = 2;
+
+// world units of slack on every proof, so float rounding in the traced line can't cross it
+static const float ocarn2__pvs_margin = 1.0f;
+
+/**
+ * Internal function to fill in how far sight reaches for every fogMap value
+ *
+ * @param ranges 256 of them
+ * @param rsc can be nullptr, for no fog
+ * @param options
+ */
+static void ocarn2__pvs_fog_ranges(float* ranges, const OCARN2::Rsc* rsc, const OCARN2::PvsOptions& options) {
+    for(uint32_t v=0; v < 256; v++) {
+        ranges[v] = options.viewDistance;
+
+        // 0 is clear air, the rest index the rsc's fogs from 1
+        if(!rsc || v == 0 || v > rsc->fogs.size()) continue;
+
+        float limit = rsc->fogs[v - 1].fLimit;
+        if(limit > 0) ranges[v] = std::min(ranges[v], limit);
+    }
+}
+
+static inline float ocarn2__pvs_fog_range(const OCARN2::Map& map, const float* ranges, uint32_t x, uint32_t z) {
+    return ranges[map.fogMap[(z / 2) * 512 + x / 2]];
+}
+
+/**
+ * Internal function for the ground height in world units at a point in cells, bilinear between grid points
+ *
+ * @param map
+ * @param x
+ * @param z
+ * @param heightScale
+ * @return
+ */
+static inline float ocarn2__pvs_ground(const OCARN2::Map& map, float x, float z, float heightScale) {
+    int32_t x0 = std::min(std::max((int32_t) x, 0), 1022);
+    int32_t z0 = std::min(std::max((int32_t) z, 0), 1022);
+    float fx = std::min(std::max(x - x0, 0.0f), 1.0f);
+    float fz = std::min(std::max(z - z0, 0.0f), 1.0f);
+
+    const unsigned char* row = &map.heightMap[z0 * 1024 + x0];
+    float top = row[0] + (row[1] - row[0]) * fx;
+    float bottom = row[1024] + (row[1025] - row[1024]) * fx;
+
+    return (top + (bottom - top) * fz) * heightScale;
+}
+
+/**
+ * Internal function to trace a sight line between the middles of two cells, range aside
+ *
+ * @param map
+ * @param options
+ * @return true if the ground never rises above the line
+ */
+static bool ocarn2__pvs_trace(const OCARN2::Map& map, const OCARN2::PvsOptions& options, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    float ax = x0 + 0.5f, az = z0 + 0.5f;
+    float dx = (float) x1 - (float) x0, dz = (float) z1 - (float) z0;
+
+    float ay = ocarn2__pvs_ground(map, ax, az, options.heightScale) + options.eyeHeight;
+    float dy = ocarn2__pvs_ground(map, x1 + 0.5f, z1 + 0.5f, options.heightScale) + options.eyeHeight - ay;
+
+    float length = std::sqrt(dx * dx + dz * dz);
+    uint32_t steps = (uint32_t) std::ceil(length / std::max(options.rayStep, 0.01f));
+
+    for(uint32_t k=1; k < steps; k++) {
+        float t = (float) k / (float) steps;
+        if(ocarn2__pvs_ground(map, ax + dx * t, az + dz * t, options.heightScale) > ay + dy * t) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Internal function to check two cells are close enough to see each other through the fog at both ends
+ *
+ * @param map
+ * @param options
+ * @param ranges already worked out from the fogs
+ * @return
+ */
+static inline bool ocarn2__pvs_in_range(const OCARN2::Map& map, const OCARN2::PvsOptions& options, const float* ranges, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    float dx = ((float) x1 - (float) x0) * options.cellSize, dz = ((float) z1 - (float) z0) * options.cellSize;
+    float range = std::min(ocarn2__pvs_fog_range(map, ranges, x0, z0), ocarn2__pvs_fog_range(map, ranges, x1, z1));
+
+    return dx * dx + dz * dz <= range * range;
+}
+
+/**
+ * Internal function for the closest and furthest two cells of regions a given number of regions apart along
+ * one axis can be, in world units
+ *
+ * @param options
+ * @param apart
+ * @param closest
+ * @param furthest
+ */
+static void ocarn2__pvs_span(const OCARN2::PvsOptions& options, uint32_t apart, float& closest, float& furthest) {
+    float cells = (float) apart * options.regionSize;
+    closest = std::max(cells - (options.regionSize - 1), 0.0f) * options.cellSize;
+    furthest = (cells + (options.regionSize - 1)) * options.cellSize;
+}
+
+/**
+ * Internal function for how far along the sight lines between two regions can be where they reach a grid line
+ * across the axis they're apart on. A grid line is a corner of the cells holding points up to a cell either side
+ * of it, and a point t of the way along a line is (1 - t) * start + t * end
+ *
+ * @param line in cells along the axis from the start of the nearer region
+ * @param du cells between the regions along the axis
+ * @param size region size
+ * @param tLo
+ * @param tHi
+ * @return false if no line gets there
+ */
+static bool ocarn2__pvs_fractions(int32_t line, int32_t du, uint32_t size, float& tLo, float& tHi) {
+    tLo = 0;
+    tHi = 1;
+    if(du == 0) return true;
+
+    tLo = std::max((line - 1 - (size - 0.5f)) / du, 0.0f);
+    tHi = std::min((line + 1 - 0.5f) / du, 1.0f);
+    return tLo <= tHi;
+}
+
+/**
+ * Internal function for which cell middles of each region the lines through some stretch of an axis, between
+ * tLo and tHi of the way along, can start or end at
+ *
+ * @param from the stretch, in cells from the start of the nearer region
+ * @param to
+ * @param tLo
+ * @param tHi
+ * @param d cells from the nearer region's start to the other's
+ * @param size
+ * @param near from and to, from the nearer region's start
+ * @param far and from the other's
+ */
+static void ocarn2__pvs_spans(float from, float to, float tLo, float tHi, int32_t d, uint32_t size, float* near, float* far) {
+    near[0] = far[0] = -1e30f;
+    near[1] = far[1] = 1e30f;
+
+    // each bound only moves one way as t does, so the fractions' limits hold them
+    if(tHi < 1) {
+        near[0] = std::min((from - tLo * (d + size - 0.5f)) / (1 - tLo), (from - tHi * (d + size - 0.5f)) / (1 - tHi));
+        near[1] = std::max((to - tLo * (d + 0.5f)) / (1 - tLo), (to - tHi * (d + 0.5f)) / (1 - tHi));
+    }
+    if(tLo > 0) {
+        far[0] = std::min((from - (1 - tLo) * (size - 0.5f)) / tLo, (from - (1 - tHi) * (size - 0.5f)) / tHi) - d;
+        far[1] = std::max((to - (1 - tLo) * 0.5f) / tLo, (to - (1 - tHi) * 0.5f) / tHi) - d;
+    }
+}
+
+/**
+ * Internal function for the first and last of a region's cells whose middles lie in a span
+ *
+ * @param span from ocarn2__pvs_spans
+ * @param size
+ * @param first
+ * @param last
+ */
+static void ocarn2__pvs_cells(const float* span, uint32_t size, int32_t& first, int32_t& last) {
+    first = std::max((int32_t) std::ceil(std::max(span[0], -1.0f) - 0.5f), 0);
+    last = std::min((int32_t) std::floor(std::min(span[1], size + 1.0f) - 0.5f), (int32_t) size - 1);
+
+    // rounding can lose a cell at the very edge, so fall back to all of them rather than none
+    if(first > last) {
+        first = 0;
+        last = (int32_t) size - 1;
+    }
+}
+
+/**
+ * Internal function for the lowest or highest of a region's columns whose middles lie in a span
+ *
+ * @param columns one value per column along the axis
+ * @param size
+ * @param span from ocarn2__pvs_spans
+ * @param highest
+ * @return
+ */
+static float ocarn2__pvs_extreme(const float* columns, uint32_t size, const float* span, bool highest) {
+    int32_t first, last;
+    ocarn2__pvs_cells(span, size, first, last);
+
+    float value = columns[first];
+    for(int32_t column=first + 1; column <= last; column++) value = highest ? std::max(value, columns[column]) : std::min(value, columns[column]);
+
+    return value;
+}
+
+/**
+ * Internal function for the lowest of a region's cells in each row across the axis, out of the columns whose
+ * middles lie in a span
+ *
+ * @param cells size by size values, along the axis then across it
+ * @param size
+ * @param span
+ * @param rows size lows
+ */
+static void ocarn2__pvs_rows(const float* cells, uint32_t size, const float* span, float* rows) {
+    int32_t first, last;
+    ocarn2__pvs_cells(span, size, first, last);
+
+    std::copy(&cells[first * size], &cells[first * size] + size, rows);
+    for(int32_t u=first + 1; u <= last; u++) {
+        for(uint32_t v=0; v < size; v++) rows[v] = std::min(rows[v], cells[u * size + v]);
+    }
+}
+
+/**
+ * Internal function to check the ground under every sight line between two regions stays below the lines, a
+ * grid line across an axis at a time. u runs along the axis and v across it, and heights are over a plane that's
+ * 0 at u0, v0. A line's height over a plane is its ends' mixed by how far along it is, so it's never below the
+ * lowest eyes over the plane in the columns it can come from, mixed the same way. Where that isn't enough, a
+ * grid line is checked again a few points at a time, against only the eyes lines through those points can
+ * come from both ways
+ *
+ * @param heights heightMap, or heightMap turned on its side to scan along x, so v is always the faster index
+ * @param heightScale
+ * @param size region size
+ * @param u0 first cell of the region nearer the start of the axis, along it
+ * @param v0 and across it
+ * @param du cells along the axis to the other region, 0 or more
+ * @param dv and across it, either way
+ * @param su plane's rise along u, in world units per cell
+ * @param sv and along v
+ * @param near eyes over the plane in the region at u0, along u then across
+ * @param far and in the other
+ * @param nearColumns lowest of near in each column along u
+ * @param farColumns and of far
+ * @param rows scratch for 2 * size
+ * @return
+ */
+static bool ocarn2__pvs_clear(const unsigned char* heights, float heightScale, uint32_t size, int32_t u0, int32_t v0, int32_t du, int32_t dv,
+                              float su, float sv, const float* near, const float* far, const float* nearColumns, const float* farColumns,
+                              float* rows) {
+    const int32_t points = 4;
+    int32_t lines = std::min(u0 + du + (int32_t) size, 1023) - u0 + 1;
+
+    for(int32_t line=0; line < lines; line++) {
+        float tLo, tHi, nearU[2], farU[2];
+        if(!ocarn2__pvs_fractions(line, du, size, tLo, tHi)) continue;
+        ocarn2__pvs_spans(line - 1.0f, line + 1.0f, tLo, tHi, du, size, nearU, farU);
+
+        float nearLow = ocarn2__pvs_extreme(nearColumns, size, nearU, false), farLow = ocarn2__pvs_extreme(farColumns, size, farU, false);
+        float lineLow = std::min(nearLow + (farLow - nearLow) * tLo, nearLow + (farLow - nearLow) * tHi) + su * line;
+
+        float vLo = v0 + 0.5f + std::min(tLo * dv, tHi * dv), vHi = v0 + size - 0.5f + std::max(tLo * dv, tHi * dv);
+        int32_t first = std::max((int32_t) std::floor(vLo), 0), last = std::min((int32_t) std::floor(vHi) + 1, 1023);
+
+        const unsigned char* row = &heights[(u0 + line) * 1024];
+        float high = -1e30f;
+        for(int32_t v=first; v <= last; v++) high = std::max(high, row[v] * heightScale - sv * (float) (v - v0));
+
+        if(high + ocarn2__pvs_margin < lineLow) continue;
+
+        // a few points at a time, out of the rows of the columns the lines can come from
+        ocarn2__pvs_rows(near, size, nearU, rows);
+        ocarn2__pvs_rows(far, size, farU, rows + size);
+
+        for(int32_t from=first; from <= last; from += points) {
+            int32_t to = std::min(from + points - 1, last);
+
+            float pointsHigh = -1e30f;
+            for(int32_t v=from; v <= to; v++) pointsHigh = std::max(pointsHigh, row[v] * heightScale - sv * (float) (v - v0));
+
+            float nearV[2], farV[2];
+            ocarn2__pvs_spans((float) (from - 1 - v0), (float) (to + 1 - v0), tLo, tHi, dv, size, nearV, farV);
+
+            float nearPoints = ocarn2__pvs_extreme(rows, size, nearV, false), farPoints = ocarn2__pvs_extreme(rows + size, size, farV, false);
+            float pointsLow = std::min(nearPoints + (farPoints - nearPoints) * tLo, nearPoints + (farPoints - nearPoints) * tHi) + su * line;
+
+            if(pointsHigh + ocarn2__pvs_margin >= pointsLow) return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Internal function for the lowest ground under a wall width + 1 grid lines wide, starting at every grid line,
+ * within every band of regions. The walls are heightMap rows when across is set, for regions apart in z, and
+ * columns otherwise
+ *
+ * @param map
+ * @param size region size
+ * @param width grid lines past the first
+ * @param across
+ * @return perSide bands of 1024 lows, in heightMap units
+ */
+static std::vector<unsigned char> ocarn2__pvs_walls(const OCARN2::Map& map, uint32_t size, uint32_t width, bool across) {
+    const uint32_t perSide = 1024 / size;
+    std::vector<unsigned char> lines(perSide * 1024, 255), walls(perSide * 1024, 255);
+
+    // lowest point of each grid line within a band. a band takes in the grid line past its last cell, since
+    // the ground between cell middles is interpolated from both sides
+    for(uint32_t band=0; band < perSide; band++) {
+        for(uint32_t along=band * size; along <= std::min(band * size + size, 1023u); along++) {
+            for(uint32_t line=0; line < 1024; line++) {
+                unsigned char h = across ? map.heightMap[line * 1024 + along] : map.heightMap[along * 1024 + line];
+                unsigned char& low = lines[band * 1024 + line];
+                low = std::min(low, h);
+            }
+        }
+    }
+
+    for(uint32_t band=0; band < perSide; band++) {
+        for(uint32_t line=0; line < 1024; line++) {
+            unsigned char low = 255;
+            for(uint32_t w=line; w <= std::min(line + width, 1023u); w++) low = std::min(low, lines[band * 1024 + w]);
+            walls[band * 1024 + line] = low;
+        }
+    }
+
+    return walls;
+}
+
+/**
+ * Internal function to look for a wall between two regions that every line between them has to cross, and that
+ * stands above every one of those lines where it crosses. Heights are in world units from 0, and the highest a
+ * line can be on a grid line is the highest eyes in the columns it can come from, mixed by how far along it is
+ *
+ * @param walls from ocarn2__pvs_walls, for walls crossing this axis
+ * @param heightScale
+ * @param size
+ * @param width
+ * @param u0 first cell of the region nearer the start of the axis, along it
+ * @param du cells along the axis to the other region
+ * @param b0 the regions' places across the axis, which bands the lines pass through
+ * @param b1
+ * @param near highest eye in each column along u of the region at u0
+ * @param far and of the other
+ * @param tops scratch
+ * @return
+ */
+static bool ocarn2__pvs_walled(const std::vector<unsigned char>& walls, float heightScale, uint32_t size, uint32_t width, int32_t u0, int32_t du,
+                               uint32_t b0, uint32_t b1, const float* near, const float* far, std::vector<float>& tops) {
+    // the wall has to sit strictly between the last cell middle of one and the first of the other
+    int32_t from = (int32_t) size, to = du - (int32_t) width;
+    if(to < from) return false;
+
+    tops.resize(du + 1);
+    for(int32_t line=from; line <= du; line++) {
+        float tLo, tHi, nearSpan[2], farSpan[2];
+        ocarn2__pvs_fractions(line, du, size, tLo, tHi);
+        ocarn2__pvs_spans(line - 1.0f, line + 1.0f, tLo, tHi, du, size, nearSpan, farSpan);
+
+        float nearHigh = ocarn2__pvs_extreme(near, size, nearSpan, true), farHigh = ocarn2__pvs_extreme(far, size, farSpan, true);
+        tops[line] = std::max(nearHigh + (farHigh - nearHigh) * tLo, nearHigh + (farHigh - nearHigh) * tHi) + ocarn2__pvs_margin;
+    }
+
+    uint32_t bandLo = std::min(b0, b1), bandHi = std::max(b0, b1);
+    for(int32_t line=from; line <= to; line++) {
+        float top = tops[line];
+        for(uint32_t w=1; w <= width; w++) top = std::max(top, tops[line + w]);
+
+        unsigned char low = 255;
+        for(uint32_t band=bandLo; band <= bandHi && low * heightScale > top; band++) low = std::min(low, walls[band * 1024 + u0 + line]);
+
+        if(low * heightScale > top) return true;
+    }
+
+    return false;
+}
+
+/**
+ * Works out which regions of the map can see each other. With an rsc, fogs cut sight short
+ *
+ * @param map
+ * @param rsc can be nullptr
+ * @param options
+ * @return an empty set if the region size doesn't cut the map up evenly
+ */
+OCARN2_DEF OCARN2::TerrainPvs build_terrain_pvs(const OCARN2::Map& map, const OCARN2::Rsc* rsc, const OCARN2::PvsOptions& options) {
+    OCARN2::TerrainPvs pvs;
+
+    if(options.regionSize < 1 || options.regionSize > 1024 || 1024 % options.regionSize != 0) {
+        std::cerr << "Region size " << options.regionSize << " doesn't divide the map evenly" << std::endl;
+        return pvs;
+    }
+
+    pvs.options = options;
+    ocarn2__pvs_fog_ranges(pvs.fogRanges, rsc, options);
+
+    const uint32_t size = options.regionSize, perSide = 1024 / size;
+    pvs.regionsPerSide = perSide;
+    pvs.numRegions = perSide * perSide;
+    pvs.wordsPerRow = (pvs.numRegions + 63) / 64;
+
+    // longest sight anywhere in each region
+    std::vector<float> farthest(pvs.numRegions, 0);
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) {
+            uint32_t region = (z / size) * perSide + x / size;
+            farthest[region] = std::max(farthest[region], ocarn2__pvs_fog_range(map, pvs.fogRanges, x, z));
+        }
+    }
+
+    // eyes over every cell middle, as the traced lines start and end, and the highest in each column and row of
+    // each region, for walls
+    std::vector<float> eyes(1024 * 1024), highsX(pvs.numRegions * size), highsZ(pvs.numRegions * size);
+    ocarn2__parallel_for(1024, options.threads, [&](size_t z) {
+        for(uint32_t x=0; x < 1024; x++) {
+            eyes[z * 1024 + x] = ocarn2__pvs_ground(map, x + 0.5f, z + 0.5f, options.heightScale) + options.eyeHeight;
+        }
+    });
+
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) {
+            uint32_t region = (z / size) * perSide + x / size;
+            float& highX = highsX[region * size + x % size];
+            float& highZ = highsZ[region * size + z % size];
+            highX = z % size == 0 ? eyes[z * 1024 + x] : std::max(highX, eyes[z * 1024 + x]);
+            highZ = x % size == 0 ? eyes[z * 1024 + x] : std::max(highZ, eyes[z * 1024 + x]);
+        }
+    }
+
+    // the plane through each region's eyes closest to them all, as its middle height and rise per cell
+    std::vector<float> middles(pvs.numRegions), risesX(pvs.numRegions), risesZ(pvs.numRegions);
+    for(uint32_t region=0; region < pvs.numRegions; region++) {
+        uint32_t rx = region % perSide * size, rz = region / perSide * size;
+        float sum = 0, sumX = 0, sumZ = 0, middle = (size - 1) / 2.0f;
+
+        for(uint32_t z=0; z < size; z++) {
+            for(uint32_t x=0; x < size; x++) {
+                float eye = eyes[(rz + z) * 1024 + rx + x];
+                sum += eye;
+                sumX += (x - middle) * eye;
+                sumZ += (z - middle) * eye;
+            }
+        }
+
+        // sum of (x - middle) squared over the region, the same for z
+        float spread = size * size * (size * size - 1.0f) / 12.0f;
+        middles[region] = sum / (size * size);
+        risesX[region] = spread > 0 ? sumX / spread : 0;
+        risesZ[region] = spread > 0 ? sumZ / spread : 0;
+    }
+
+    // heightMap on its side, so scans along x read along rows too
+    std::vector<unsigned char> sideways(1024 * 1024);
+    for(uint32_t z=0; z < 1024; z++) {
+        for(uint32_t x=0; x < 1024; x++) sideways[x * 1024 + z] = map.heightMap[z * 1024 + x];
+    }
+
+    // a traced line checks the ground at least every rayStep cells, so a wall this wide can't be stepped over
+    uint32_t width = (uint32_t) std::ceil(std::max(options.rayStep, 0.01f)) + 1;
+    std::vector<unsigned char> wallsX = ocarn2__pvs_walls(map, size, width, false);
+    std::vector<unsigned char> wallsZ = ocarn2__pvs_walls(map, size, width, true);
+
+    float reachCells = options.viewDistance / options.cellSize + size;
+    int32_t reach = (int32_t) std::ceil(reachCells / size);
+
+    // this side of the diagonal first, then mirrored, so no two threads ever write the same row
+    std::vector<uint64_t> upperSeen((size_t) pvs.numRegions * pvs.wordsPerRow), upperClear(upperSeen.size());
+
+    ocarn2__parallel_for(pvs.numRegions, options.threads, [&](size_t a) {
+        int32_t ax = (int32_t) (a % perSide), az = (int32_t) (a / perSide);
+        uint64_t* seenRow = &upperSeen[a * pvs.wordsPerRow];
+        uint64_t* clearRow = &upperClear[a * pvs.wordsPerRow];
+        std::vector<float> overs(size * size * 2), lows(size * 2), rows(size * 2), tops;
+
+        for(int32_t bz=std::max(az - reach, 0); bz <= std::min(az + reach, (int32_t) perSide - 1); bz++) {
+            for(int32_t bx=std::max(ax - reach, 0); bx <= std::min(ax + reach, (int32_t) perSide - 1); bx++) {
+                uint32_t b = (uint32_t) bz * perSide + (uint32_t) bx;
+                if(b < a) continue;
+
+                // out of range of each other, even from the cells with the longest sight
+                float closeX, farX, closeZ, farZ;
+                ocarn2__pvs_span(pvs.options, (uint32_t) std::abs(bx - ax), closeX, farX);
+                ocarn2__pvs_span(pvs.options, (uint32_t) std::abs(bz - az), closeZ, farZ);
+
+                float closest = std::sqrt(closeX * closeX + closeZ * closeZ);
+                if(closest > std::min(farthest[a], farthest[b]) + ocarn2__pvs_margin) continue;
+
+                // checked across whichever axis they're further apart on, from whichever region comes first on it
+                int32_t dx = (bx - ax) * (int32_t) size, dz = (bz - az) * (int32_t) size;
+                bool across = std::abs(dz) > std::abs(dx);
+                int32_t du = across ? dz : dx, dv = across ? dx : dz;
+                uint32_t near = du < 0 ? b : (uint32_t) a, far = du < 0 ? (uint32_t) a : b;
+                int32_t u0 = (int32_t) (across ? near / perSide : near % perSide) * (int32_t) size;
+                int32_t v0 = (int32_t) (across ? near % perSide : near / perSide) * (int32_t) size;
+                if(du < 0) {
+                    du = -du;
+                    dv = -dv;
+                }
+
+                // the ground under every line measured from one plane, tilted like the ground around both regions
+                // and through both their middle heights, 0 at the corner of the nearer one
+                float riseX = (risesX[a] + risesX[b]) / 2, riseZ = (risesZ[a] + risesZ[b]) / 2;
+                if(dx != 0 || dz != 0) {
+                    float off = (middles[b] - middles[a] - riseX * dx - riseZ * dz) / (float) (dx * dx + dz * dz);
+                    riseX += off * dx;
+                    riseZ += off * dz;
+                }
+                float su = across ? riseZ : riseX, sv = across ? riseX : riseZ;
+
+                // the eyes over it in each region, along the axis then across, and the lowest in each column
+                for(uint32_t end=0; end < 2; end++) {
+                    uint32_t region = end ? far : near;
+                    int32_t ru = (int32_t) (across ? region / perSide : region % perSide) * (int32_t) size - u0;
+                    int32_t rv = (int32_t) (across ? region % perSide : region / perSide) * (int32_t) size - v0;
+                    float* over = &overs[end * size * size];
+
+                    for(int32_t i=0; i < (int32_t) size; i++) {
+                        float low = 1e30f;
+                        for(int32_t j=0; j < (int32_t) size; j++) {
+                            int32_t u = u0 + ru + i, v = v0 + rv + j;
+                            float eye = across ? eyes[u * 1024 + v] : eyes[v * 1024 + u];
+                            over[i * size + j] = eye - su * (ru + i + 0.5f) - sv * (rv + j + 0.5f);
+                            low = std::min(low, over[i * size + j]);
+                        }
+                        lows[end * size + i] = low;
+                    }
+                }
+
+                // ground under every line everywhere between them blocks nothing
+                bool clear = ocarn2__pvs_clear(across ? map.heightMap.data() : sideways.data(), options.heightScale, size, u0, v0, du, dv,
+                                               su, sv, &overs[0], &overs[size * size], &lows[0], &lows[size], &rows[0]);
+
+                // and a wall over every line hides them, across either axis if there's room for one
+                if(!clear) {
+                    const std::vector<float>& highs = across ? highsZ : highsX;
+                    if(ocarn2__pvs_walled(across ? wallsZ : wallsX, options.heightScale, size, width, u0, du, (uint32_t) v0 / size,
+                                          (uint32_t) (v0 + dv) / size, &highs[near * size], &highs[far * size], tops)) continue;
+
+                    // the other way, with the regions' places swapped over
+                    int32_t du2 = across ? dx : dz;
+                    uint32_t near2 = du2 < 0 ? b : (uint32_t) a, far2 = du2 < 0 ? (uint32_t) a : b;
+                    int32_t u2 = (int32_t) (across ? near2 % perSide : near2 / perSide) * (int32_t) size;
+                    int32_t v2 = (int32_t) (across ? near2 / perSide : near2 % perSide) * (int32_t) size;
+                    const std::vector<float>& highs2 = across ? highsX : highsZ;
+                    if(ocarn2__pvs_walled(across ? wallsX : wallsZ, options.heightScale, size, width, u2, std::abs(du2), (uint32_t) v2 / size,
+                                          (uint32_t) (v2 + (across ? dz : dx) * (du2 < 0 ? -1 : 1)) / size, &highs2[near2 * size],
+                                          &highs2[far2 * size], tops)) continue;
+                }
+
+                seenRow[b / 64] |= 1ull << (b % 64);
+                if(clear) clearRow[b / 64] |= 1ull << (b % 64);
+            }
+        }
+    });
+
+    pvs.seen.resize(upperSeen.size());
+    pvs.clear.resize(upperClear.size());
+
+    ocarn2__parallel_for(pvs.numRegions, options.threads, [&](size_t a) {
+        size_t row = a * pvs.wordsPerRow;
+        std::copy(&upperSeen[row], &upperSeen[row] + pvs.wordsPerRow, &pvs.seen[row]);
+        std::copy(&upperClear[row], &upperClear[row] + pvs.wordsPerRow, &pvs.clear[row]);
+
+        // only regions in reach can have a bit set
+        int32_t ax = (int32_t) (a % perSide), az = (int32_t) (a / perSide);
+        for(int32_t bz=std::max(az - reach, 0); bz <= az; bz++) {
+            for(int32_t bx=std::max(ax - reach, 0); bx <= std::min(ax + reach, (int32_t) perSide - 1); bx++) {
+                uint32_t b = (uint32_t) bz * perSide + (uint32_t) bx;
+                if(b >= a) break;
+
+                size_t word = (size_t) b * pvs.wordsPerRow + a / 64;
+                uint64_t bit = 1ull << (a % 64);
+
+                if(upperSeen[word] & bit) pvs.seen[row + b / 64] |= 1ull << (b % 64);
+                if(upperClear[word] & bit) pvs.clear[row + b / 64] |= 1ull << (b % 64);
+            }
+        }
+    });
+
+    return pvs;
+}
+
+/**
+ * Looks up whether two regions can see each other
+ *
+ * @param pvs
+ * @param regionA
+ * @param regionB
+ * @return PVS_HIDDEN for regions off the map
+ */
+OCARN2_DEF OCARN2::PvsVisibility pvs_region_visibility(const OCARN2::TerrainPvs& pvs, uint32_t regionA, uint32_t regionB) {
+    if(regionA >= pvs.numRegions || regionB >= pvs.numRegions) return OCARN2::PVS_HIDDEN;
+
+    size_t word = (size_t) regionA * pvs.wordsPerRow + regionB / 64;
+    uint64_t bit = 1ull << (regionB % 64);
+
+    if(pvs.clear[word] & bit) return OCARN2::PVS_VISIBLE;
+    if(pvs.seen[word] & bit) return OCARN2::PVS_PARTIAL;
+    return OCARN2::PVS_HIDDEN;
+}
+
+/**
+ * Looks up whether the regions two cells are in can see each other
+ *
+ * @param pvs
+ * @param x0
+ * @param z0
+ * @param x1
+ * @param z1
+ * @return PVS_HIDDEN for cells off the map
+ */
+OCARN2_DEF OCARN2::PvsVisibility pvs_cell_visibility(const OCARN2::TerrainPvs& pvs, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    if(x0 >= 1024 || z0 >= 1024 || x1 >= 1024 || z1 >= 1024 || pvs.numRegions == 0) return OCARN2::PVS_HIDDEN;
+
+    uint32_t size = pvs.options.regionSize;
+    return pvs_region_visibility(pvs, (z0 / size) * pvs.regionsPerSide + x0 / size, (z1 / size) * pvs.regionsPerSide + x1 / size);
+}
+
+/**
+ * Checks whether one cell can see another, with a bit test unless their regions are only partly visible to
+ * each other, when the sight line is traced. Always the same answer as terrain_can_see with the map, rsc and
+ * options the set was built from
+ *
+ * @param pvs
+ * @param map the map the set was built from
+ * @param x0
+ * @param z0
+ * @param x1
+ * @param z1
+ * @return
+ */
+OCARN2_DEF bool pvs_can_see(const OCARN2::TerrainPvs& pvs, const OCARN2::Map& map, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    switch(pvs_cell_visibility(pvs, x0, z0, x1, z1)) {
+        case OCARN2::PVS_VISIBLE: return ocarn2__pvs_in_range(map, pvs.options, pvs.fogRanges, x0, z0, x1, z1);
+        case OCARN2::PVS_PARTIAL: return ocarn2__pvs_in_range(map, pvs.options, pvs.fogRanges, x0, z0, x1, z1) &&
+                                         ocarn2__pvs_trace(map, pvs.options, x0, z0, x1, z1);
+        default:                  return false;
+    }
+}
+
+/**
+ * Checks whether one cell can see another by tracing the sight line, without a visibility set. Works out the
+ * fog ranges every call, so for many checks get them once with terrain_sight_ranges instead
+ *
+ * @param map
+ * @param rsc can be nullptr, for no fog
+ * @param options
+ * @param x0
+ * @param z0
+ * @param x1
+ * @param z1
+ * @return false for cells off the map
+ */
+OCARN2_DEF bool terrain_can_see(const OCARN2::Map& map, const OCARN2::Rsc* rsc, const OCARN2::PvsOptions& options, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    return terrain_can_see(map, terrain_sight_ranges(rsc, options), options, x0, z0, x1, z1);
+}
+
+/**
+ * Works out how far sight reaches from a cell for every fogMap value, the same way build_terrain_pvs does
+ *
+ * @param rsc can be nullptr, for no fog
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::SightRanges terrain_sight_ranges(const OCARN2::Rsc* rsc, const OCARN2::PvsOptions& options) {
+    OCARN2::SightRanges ranges;
+    ocarn2__pvs_fog_ranges(ranges.byFog, rsc, options);
+    return ranges;
+}
+
+/**
+ * Checks whether one cell can see another by tracing the sight line, with fog ranges from terrain_sight_ranges
+ *
+ * @param map
+ * @param ranges from terrain_sight_ranges, with the same options
+ * @param options
+ * @param x0
+ * @param z0
+ * @param x1
+ * @param z1
+ * @return false for cells off the map
+ */
+OCARN2_DEF bool terrain_can_see(const OCARN2::Map& map, const OCARN2::SightRanges& ranges, const OCARN2::PvsOptions& options, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    if(x0 >= 1024 || z0 >= 1024 || x1 >= 1024 || z1 >= 1024) return false;
+
+    return ocarn2__pvs_in_range(map, options, ranges.byFog, x0, z0, x1, z1) && ocarn2__pvs_trace(map, options, x0, z0, x1, z1);
+}
+
+/**
+ * Writes a visibility set to a file, to be loaded back instead of built
+ *
+ * @param pvs
+ * @param filename
+ * @return
+ */
+OCARN2_DEF bool save_terrain_pvs(const OCARN2::TerrainPvs& pvs, const std::string& filename) {
+    const OCARN2::PvsOptions& options = pvs.options;
+    ocarn2__writer writer;
+
+    writer.bytes(ocarn2__pvs_magic, 4);
+    writer.value(ocarn2__pvs_version);
+    writer.value(options.regionSize);
+    writer.value(options.cellSize);
+    writer.value(options.heightScale);
+    writer.value(options.eyeHeight);
+    writer.value(options.viewDistance);
+    writer.value(options.rayStep);
+    writer.bytes(pvs.fogRanges, sizeof(pvs.fogRanges));
+    writer.bytes(pvs.seen.data(), pvs.seen.size() * sizeof(uint64_t));
+    writer.bytes(pvs.clear.data(), pvs.clear.size() * sizeof(uint64_t));
+
+    return ocarn2__write_file(filename, writer);
+}
+
+/**
+ * Reads a visibility set written by save_terrain_pvs
+ *
+ * @param filename
+ * @return an empty set if the file can't be read
+ */
+OCARN2_DEF OCARN2::TerrainPvs load_terrain_pvs(const std::string& filename) {
+    OCARN2::TerrainPvs pvs;
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        ocarn2__bounded reader(file, nullptr);
+        OCARN2::PvsOptions options;
+        char magic[4] = {};
+        uint32_t version = 0;
+
+        reader.read(magic, 4, "magic");
+        reader.value(version, "version");
+
+        if(!reader.ok || memcmp(magic, ocarn2__pvs_magic, 4) != 0 || version != ocarn2__pvs_version) {
+            std::cerr << filename << " is not a visibility set" << std::endl;
+            return;
+        }
+
+        reader.value(options.regionSize, "region size");
+        reader.value(options.cellSize, "cell size");
+        reader.value(options.heightScale, "height scale");
+        reader.value(options.eyeHeight, "eye height");
+        reader.value(options.viewDistance, "view distance");
+        reader.value(options.rayStep, "ray step");
+        reader.read(pvs.fogRanges, sizeof(pvs.fogRanges), "fog ranges");
+
+        if(reader.ok && (options.regionSize < 1 || options.regionSize > 1024 || 1024 % options.regionSize != 0)) {
+            reader.fail("region size " + std::to_string(options.regionSize) + " doesn't divide the map evenly");
+        }
+        if(!reader.ok) {
+            std::cerr << filename << " is not a visibility set" << std::endl;
+            return;
+        }
+
+        uint32_t perSide = 1024 / options.regionSize, numRegions = perSide * perSide, wordsPerRow = (numRegions + 63) / 64;
+        size_t words = (size_t) numRegions * wordsPerRow;
+
+        std::vector<uint64_t> seen, clear;
+        if(reader.fits(words * 2, sizeof(uint64_t), "bits")) {
+            seen.resize(words);
+            clear.resize(words);
+            reader.read(seen.data(), words * sizeof(uint64_t), "seen bits");
+            reader.read(clear.data(), words * sizeof(uint64_t), "clear bits");
+        }
+        if(!reader.ok) {
+            std::cerr << filename << " is truncated" << std::endl;
+            return;
+        }
+
+        pvs.options = options;
+        pvs.regionsPerSide = perSide;
+        pvs.numRegions = numRegions;
+        pvs.wordsPerRow = wordsPerRow;
+        pvs.seen = std::move(seen);
+        pvs.clear = std::move(clear);
+    });
+
+    return pvs;
+}
+
+#endif
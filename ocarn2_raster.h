@@ -0,0 +1,646 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h that draws meshes and terrain on the cpu, for previews and visibility checks on
+ * machines without a gpu. Needs ocarn2_image.h next to it.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * Triangles are transformed, clipped against the near plane and set up on the calling thread, then sorted
+ * into square tiles of the target (64x64 pixels by default). Tiles are drawn in parallel, each by one thread,
+ * so nothing is shared while drawing and triangles land in the order they were given.
+ *
+ * Mesh faces are drawn with the mesh's 16 bit texture, and follow its SF_ flags: SF_DOUBLE_SIDE faces aren't
+ * culled, SF_OPACITY faces skip texels that are 0, and SF_TRANSPARENT faces are blended half and half without
+ * writing depth. Faces are front facing when their corners go counter clockwise seen from outside, like the
+ * game's models and the terrain mesh.
+ *
+ * A target made with depthOnly has no colour, and only draws depth from faces that fully block what's behind
+ * them. Made small (256x128 or so), it's a cheap occlusion buffer for raster_box_visible.
+ *
+ * main methods are
+ *
+ * RasterTarget create_raster_target(uint32_t width, uint32_t height, bool depthOnly);
+ * void clear_raster_target(RasterTarget& target, uint32_t rgba);
+ * RasterCamera look_at_camera(float eyeX, float eyeY, float eyeZ, float targetX, float targetY, float targetZ, float fovY, float aspect, float nearZ, float farZ);
+ * RasterCamera frame_mesh_camera(const Mesh& mesh, float aspect);
+ * void draw_mesh(RasterTarget& target, const Mesh& mesh, const RasterCamera& camera, const RasterOptions& options);
+ * void draw_terrain_region(RasterTarget& target, const Map& map, const Rsc* rsc, uint32_t x, uint32_t z, uint32_t width, uint32_t height, const RasterCamera& camera, const RasterOptions& options);
+ * bool raster_box_visible(const RasterTarget& target, const RasterCamera& camera, const float* boxMin, const float* boxMax);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+#include "ocarn2_image.h"
+
+namespace OCARN2 {
+
+    struct RasterOptions {
+        // pixels per side of the tiles triangles are sorted into
+        uint32_t tileSize = 64;
+
+        // threads used to draw tiles. 0 = hardware concurrency
+        unsigned threads = 0;
+
+        // skip faces turned away from the camera, unless they're SF_DOUBLE_SIDE
+        bool cullBackFaces = true;
+
+        // light meshes from above, and terrain with its noon light plane. off draws plain texture colours
+        bool shade = true;
+
+        // world units per cell, and per step of heightMap, same as the terrain mesh
+        float cellSize = 256.0f;
+        float heightScale = 64.0f;
+    };
+
+    struct RasterCamera {
+        // projection * view, column major. depth goes from -1 at the near plane to 1 at the far plane
+        float matrix[16];
+    };
+
+    struct RasterTarget {
+        uint32_t width = 0, height = 0;
+
+        Image color; // rgba, empty for depth only targets
+        std::vector<float> depth; // 0 near to 1 far, top row first
+    };
+}
+
+
+OCARN2_DEF OCARN2::RasterTarget create_raster_target(uint32_t width, uint32_t height, bool depthOnly = false);
+OCARN2_DEF void clear_raster_target(OCARN2::RasterTarget& target, uint32_t rgba = 0x000000ff);
+OCARN2_DEF OCARN2::RasterCamera look_at_camera(float eyeX, float eyeY, float eyeZ, float targetX, float targetY, float targetZ,
+                                               float fovY, float aspect, float nearZ, float farZ);
+OCARN2_DEF OCARN2::RasterCamera frame_mesh_camera(const OCARN2::Mesh& mesh, float aspect);
+OCARN2_DEF void draw_mesh(OCARN2::RasterTarget& target, const OCARN2::Mesh& mesh, const OCARN2::RasterCamera& camera,
+                          const OCARN2::RasterOptions& options = {});
+OCARN2_DEF void draw_terrain_region(OCARN2::RasterTarget& target, const OCARN2::Map& map, const OCARN2::Rsc* rsc,
+                                    uint32_t x, uint32_t z, uint32_t width, uint32_t height,
+                                    const OCARN2::RasterCamera& camera, const OCARN2::RasterOptions& options = {});
+OCARN2_DEF bool raster_box_visible(const OCARN2::RasterTarget& target, const OCARN2::RasterCamera& camera, const float* boxMin, const float* boxMax);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cmath>
+
+/**
+ * Internal vertex on its way to the screen, in clip space with texture coordinates in texels
+ */
+struct ocarn2__raster_vertex {
+    float x, y, z, w;
+    float u, v;
+};
+
+/**
+ * Internal triangle ready to draw. Corners are in pixels, wound so the area is positive, with depth from 0 to 1
+ * and texture coordinates divided by w so they can be interpolated across the screen
+ */
+struct ocarn2__raster_triangle {
+    float x[3], y[3], z[3];
+    float invW[3], u[3], v[3];
+    float area;
+
+    float shade;
+    uint16_t flags;
+
+    const uint16_t* texture;
+    uint32_t textureWidth, textureHeight;
+};
+
+static void ocarn2__raster_transform(const OCARN2::RasterCamera& camera, float x, float y, float z, ocarn2__raster_vertex& out) {
+    const float* m = camera.matrix;
+
+    out.x = m[0] * x + m[4] * y + m[8] * z + m[12];
+    out.y = m[1] * x + m[5] * y + m[9] * z + m[13];
+    out.z = m[2] * x + m[6] * y + m[10] * z + m[14];
+    out.w = m[3] * x + m[7] * y + m[11] * z + m[15];
+}
+
+/**
+ * Internal function to clip a triangle against the near plane, then project and set up what's left. Clipping
+ * against the near plane can leave a quad, which becomes two triangles
+ *
+ * @param target
+ * @param corners
+ * @param triangle flags, shade and texture are filled in already
+ * @param cull skip the triangle if it faces away
+ * @param out
+ */
+static void ocarn2__raster_setup(const OCARN2::RasterTarget& target, const ocarn2__raster_vertex* corners,
+                                 const ocarn2__raster_triangle& triangle, bool cull, std::vector<ocarn2__raster_triangle>& out) {
+    // the near plane is z = -w
+    ocarn2__raster_vertex polygon[4];
+    uint32_t count = 0;
+
+    for(uint32_t i=0; i < 3; i++) {
+        const ocarn2__raster_vertex& a = corners[i];
+        const ocarn2__raster_vertex& b = corners[(i + 1) % 3];
+        float da = a.z + a.w, db = b.z + b.w;
+
+        if(da >= 0) polygon[count++] = a;
+        if((da >= 0) != (db >= 0)) {
+            float t = da / (da - db);
+            ocarn2__raster_vertex& c = polygon[count++];
+
+            c.x = a.x + (b.x - a.x) * t;
+            c.y = a.y + (b.y - a.y) * t;
+            c.z = a.z + (b.z - a.z) * t;
+            c.w = a.w + (b.w - a.w) * t;
+            c.u = a.u + (b.u - a.u) * t;
+            c.v = a.v + (b.v - a.v) * t;
+        }
+    }
+
+    if(count < 3) return;
+
+    // projected corners
+    struct { float x, y, z, invW, u, v; } screen[4];
+    for(uint32_t i=0; i < count; i++) {
+        const ocarn2__raster_vertex& c = polygon[i];
+        float invW = 1.0f / std::max(c.w, 1e-6f);
+
+        // y flips, the top row of the target is first
+        screen[i].x = (c.x * invW * 0.5f + 0.5f) * target.width;
+        screen[i].y = (0.5f - c.y * invW * 0.5f) * target.height;
+        screen[i].z = c.z * invW * 0.5f + 0.5f;
+        screen[i].invW = invW;
+        screen[i].u = c.u * invW;
+        screen[i].v = c.v * invW;
+    }
+
+    for(uint32_t i=1; i + 1 < count; i++) {
+        ocarn2__raster_triangle t = triangle;
+        uint32_t from[3] = { 0, i, i + 1 };
+
+        for(uint32_t c=0; c < 3; c++) {
+            t.x[c] = screen[from[c]].x;
+            t.y[c] = screen[from[c]].y;
+            t.z[c] = screen[from[c]].z;
+            t.invW[c] = screen[from[c]].invW;
+            t.u[c] = screen[from[c]].u;
+            t.v[c] = screen[from[c]].v;
+        }
+
+        // counter clockwise seen from the front is clockwise once y points down, which is a negative area here
+        t.area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+        if(t.area == 0 || std::isnan(t.area)) continue;
+
+        if(t.area > 0) {
+            if(cull) continue;
+        }
+        else {
+            std::swap(t.x[1], t.x[2]);
+            std::swap(t.y[1], t.y[2]);
+            std::swap(t.z[1], t.z[2]);
+            std::swap(t.invW[1], t.invW[2]);
+            std::swap(t.u[1], t.u[2]);
+            std::swap(t.v[1], t.v[2]);
+            t.area = -t.area;
+        }
+
+        float minX = std::min(std::min(t.x[0], t.x[1]), t.x[2]), maxX = std::max(std::max(t.x[0], t.x[1]), t.x[2]);
+        float minY = std::min(std::min(t.y[0], t.y[1]), t.y[2]), maxY = std::max(std::max(t.y[0], t.y[1]), t.y[2]);
+        if(maxX < 0 || maxY < 0 || minX > target.width || minY > target.height) continue;
+
+        out.push_back(t);
+    }
+}
+
+/**
+ * Internal function to draw the triangles that touch one tile
+ */
+static void ocarn2__raster_tile(OCARN2::RasterTarget& target, const std::vector<ocarn2__raster_triangle>& triangles,
+                                const std::vector<uint32_t>& bin, int32_t tileX, int32_t tileY, int32_t tileSize) {
+    bool depthOnly = target.color.pixels.empty();
+
+    int32_t tileRight = std::min(tileX + tileSize, (int32_t) target.width);
+    int32_t tileBottom = std::min(tileY + tileSize, (int32_t) target.height);
+
+    for(uint32_t index: bin) {
+        const ocarn2__raster_triangle& t = triangles[index];
+
+        int32_t x0 = std::max(tileX, (int32_t) std::floor(std::min(std::min(t.x[0], t.x[1]), t.x[2])));
+        int32_t y0 = std::max(tileY, (int32_t) std::floor(std::min(std::min(t.y[0], t.y[1]), t.y[2])));
+        int32_t x1 = std::min(tileRight, (int32_t) std::ceil(std::max(std::max(t.x[0], t.x[1]), t.x[2])));
+        int32_t y1 = std::min(tileBottom, (int32_t) std::ceil(std::max(std::max(t.y[0], t.y[1]), t.y[2])));
+
+        // edge e is opposite corner e. pixels exactly on an edge belong to the triangle on its top or left side
+        float stepX[3], stepY[3], start[3];
+        bool topLeft[3];
+        for(uint32_t e=0; e < 3; e++) {
+            uint32_t a = (e + 1) % 3, b = (e + 2) % 3;
+            float dx = t.x[b] - t.x[a], dy = t.y[b] - t.y[a];
+
+            stepX[e] = -dy;
+            stepY[e] = dx;
+            start[e] = dx * (y0 + 0.5f - t.y[a]) - dy * (x0 + 0.5f - t.x[a]);
+            topLeft[e] = dy > 0 || (dy == 0 && dx < 0);
+        }
+
+        bool alphaTest = (t.flags & OCARN2::SF_OPACITY) != 0;
+        bool blend = (t.flags & OCARN2::SF_TRANSPARENT) != 0;
+        float invArea = 1.0f / t.area;
+
+        for(int32_t y = y0; y < y1; y++) {
+            float w[3] = { start[0], start[1], start[2] };
+
+            for(int32_t x = x0; x < x1; x++, w[0] += stepX[0], w[1] += stepX[1], w[2] += stepX[2]) {
+                bool inside = true;
+                for(uint32_t e=0; e < 3; e++) {
+                    if(w[e] < 0 || (w[e] == 0 && !topLeft[e])) inside = false;
+                }
+                if(!inside) continue;
+
+                float l0 = w[0] * invArea, l1 = w[1] * invArea, l2 = 1.0f - l0 - l1;
+                float z = t.z[0] * l0 + t.z[1] * l1 + t.z[2] * l2;
+
+                size_t at = (size_t) y * target.width + x;
+                if(z < 0 || z > 1 || z >= target.depth[at]) continue;
+
+                if(depthOnly) {
+                    target.depth[at] = z;
+                    continue;
+                }
+
+                unsigned char rgb[3] = { 255, 255, 255 };
+                if(t.texture) {
+                    float invW = t.invW[0] * l0 + t.invW[1] * l1 + t.invW[2] * l2;
+                    float u = (t.u[0] * l0 + t.u[1] * l1 + t.u[2] * l2) / invW;
+                    float v = (t.v[0] * l0 + t.v[1] * l1 + t.v[2] * l2) / invW;
+
+                    uint32_t tu = (uint32_t) std::min(std::max((int32_t) u, 0), (int32_t) t.textureWidth - 1);
+                    uint32_t tv = (uint32_t) std::min(std::max((int32_t) v, 0), (int32_t) t.textureHeight - 1);
+                    uint16_t texel = t.texture[tv * t.textureWidth + tu];
+
+                    if(alphaTest && texel == 0) continue;
+                    texel_to_rgb(texel, rgb);
+                }
+
+                unsigned char* pixel = &target.color.pixels[at * 4];
+                for(uint32_t c=0; c < 3; c++) {
+                    unsigned char shaded = (unsigned char) std::min(rgb[c] * t.shade, 255.0f);
+                    pixel[c] = blend ? (unsigned char) ((pixel[c] + shaded + 1) / 2) : shaded;
+                }
+                pixel[3] = 255;
+
+                if(!blend) target.depth[at] = z;
+            }
+
+            for(uint32_t e=0; e < 3; e++) start[e] += stepY[e];
+        }
+    }
+}
+
+/**
+ * Internal function to sort triangles into tiles and draw the tiles in parallel
+ */
+static void ocarn2__raster_draw(OCARN2::RasterTarget& target, const std::vector<ocarn2__raster_triangle>& triangles, const OCARN2::RasterOptions& options) {
+    int32_t tileSize = (int32_t) std::max(options.tileSize, 8u);
+    int32_t tilesX = ((int32_t) target.width + tileSize - 1) / tileSize;
+    int32_t tilesY = ((int32_t) target.height + tileSize - 1) / tileSize;
+    if(tilesX == 0 || tilesY == 0) return;
+
+    std::vector<std::vector<uint32_t>> bins(tilesX * tilesY);
+    for(uint32_t i=0; i < triangles.size(); i++) {
+        const ocarn2__raster_triangle& t = triangles[i];
+
+        int32_t x0 = std::max(0, (int32_t) std::floor(std::min(std::min(t.x[0], t.x[1]), t.x[2])) / tileSize);
+        int32_t y0 = std::max(0, (int32_t) std::floor(std::min(std::min(t.y[0], t.y[1]), t.y[2])) / tileSize);
+        int32_t x1 = std::min(tilesX - 1, (int32_t) std::ceil(std::max(std::max(t.x[0], t.x[1]), t.x[2])) / tileSize);
+        int32_t y1 = std::min(tilesY - 1, (int32_t) std::ceil(std::max(std::max(t.y[0], t.y[1]), t.y[2])) / tileSize);
+
+        for(int32_t ty = y0; ty <= y1; ty++) {
+            for(int32_t tx = x0; tx <= x1; tx++) bins[ty * tilesX + tx].push_back(i);
+        }
+    }
+
+    ocarn2__parallel_for(bins.size(), options.threads, [&](size_t tile) {
+        if(bins[tile].empty()) return;
+        ocarn2__raster_tile(target, triangles, bins[tile], (int32_t) (tile % tilesX) * tileSize, (int32_t) (tile / tilesX) * tileSize, tileSize);
+    });
+}
+
+/**
+ * Makes a target to draw into, cleared to black and the far plane
+ *
+ * @param width
+ * @param height
+ * @param depthOnly leave out colour, for occlusion checks
+ * @return
+ */
+OCARN2_DEF OCARN2::RasterTarget create_raster_target(uint32_t width, uint32_t height, bool depthOnly) {
+    OCARN2::RasterTarget target;
+    target.width = width;
+    target.height = height;
+    target.depth.resize((size_t) width * height);
+    if(!depthOnly) target.color = create_image(width, height, 4);
+
+    clear_raster_target(target);
+
+    return target;
+}
+
+/**
+ * Clears a target's colour and depth
+ *
+ * @param target
+ * @param rgba colour as 0xRRGGBBAA
+ */
+OCARN2_DEF void clear_raster_target(OCARN2::RasterTarget& target, uint32_t rgba) {
+    std::fill(target.depth.begin(), target.depth.end(), 1.0f);
+
+    for(size_t i=0; i < target.color.pixels.size(); i += 4) {
+        target.color.pixels[i] = (unsigned char) (rgba >> 24);
+        target.color.pixels[i + 1] = (unsigned char) (rgba >> 16);
+        target.color.pixels[i + 2] = (unsigned char) (rgba >> 8);
+        target.color.pixels[i + 3] = (unsigned char) rgba;
+    }
+}
+
+/**
+ * Makes a perspective camera at eye, looking at target with y up
+ *
+ * @param eyeX
+ * @param eyeY
+ * @param eyeZ
+ * @param targetX
+ * @param targetY
+ * @param targetZ
+ * @param fovY vertical field of view in degrees
+ * @param aspect width over height
+ * @param nearZ
+ * @param farZ
+ * @return
+ */
+OCARN2_DEF OCARN2::RasterCamera look_at_camera(float eyeX, float eyeY, float eyeZ, float targetX, float targetY, float targetZ,
+                                               float fovY, float aspect, float nearZ, float farZ) {
+    float fx = targetX - eyeX, fy = targetY - eyeY, fz = targetZ - eyeZ;
+    float length = std::sqrt(fx * fx + fy * fy + fz * fz);
+    fx /= length; fy /= length; fz /= length;
+
+    // side = forward x up, using z as up when looking straight up or down
+    float upX = 0, upY = 1, upZ = 0;
+    if(std::fabs(fy) > 0.999f) { upY = 0; upZ = 1; }
+
+    float sx = fy * upZ - fz * upY, sy = fz * upX - fx * upZ, sz = fx * upY - fy * upX;
+    length = std::sqrt(sx * sx + sy * sy + sz * sz);
+    sx /= length; sy /= length; sz /= length;
+
+    float ux = sy * fz - sz * fy, uy = sz * fx - sx * fz, uz = sx * fy - sy * fx;
+
+    float view[16] = {
+        sx, ux, -fx, 0,
+        sy, uy, -fy, 0,
+        sz, uz, -fz, 0,
+        -(sx * eyeX + sy * eyeY + sz * eyeZ), -(ux * eyeX + uy * eyeY + uz * eyeZ), fx * eyeX + fy * eyeY + fz * eyeZ, 1
+    };
+
+    float f = 1.0f / std::tan(fovY * 3.14159265f / 360.0f);
+    float projection[16] = {
+        f / aspect, 0, 0, 0,
+        0, f, 0, 0,
+        0, 0, (farZ + nearZ) / (nearZ - farZ), -1,
+        0, 0, 2 * farZ * nearZ / (nearZ - farZ), 0
+    };
+
+    OCARN2::RasterCamera camera;
+    for(uint32_t c=0; c < 4; c++) {
+        for(uint32_t r=0; r < 4; r++) {
+            float sum = 0;
+            for(uint32_t k=0; k < 4; k++) sum += projection[k * 4 + r] * view[c * 4 + k];
+            camera.matrix[c * 4 + r] = sum;
+        }
+    }
+
+    return camera;
+}
+
+/**
+ * Makes a camera that looks at a mesh from the front, a little above and to the side, with all of it in view.
+ * Handy for thumbnails
+ *
+ * @param mesh
+ * @param aspect width over height of the target
+ * @return
+ */
+OCARN2_DEF OCARN2::RasterCamera frame_mesh_camera(const OCARN2::Mesh& mesh, float aspect) {
+    float low[3] = { INFINITY, INFINITY, INFINITY }, high[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for(const OCARN2::Vertex& v: mesh.vertices) {
+        low[0] = std::min(low[0], v.x); high[0] = std::max(high[0], v.x);
+        low[1] = std::min(low[1], v.y); high[1] = std::max(high[1], v.y);
+        low[2] = std::min(low[2], v.z); high[2] = std::max(high[2], v.z);
+    }
+    if(mesh.vertices.empty()) {
+        for(uint32_t i=0; i < 3; i++) low[i] = high[i] = 0;
+    }
+
+    float center[3] = { (low[0] + high[0]) / 2, (low[1] + high[1]) / 2, (low[2] + high[2]) / 2 };
+    float dx = high[0] - low[0], dy = high[1] - low[1], dz = high[2] - low[2];
+    float radius = std::max(std::sqrt(dx * dx + dy * dy + dz * dz) / 2, 1e-3f);
+
+    // far enough back for a 40 degree view to fit the bounding sphere either way
+    float fovY = 40.0f;
+    float fit = std::tan(fovY * 3.14159265f / 360.0f) * std::min(aspect, 1.0f);
+    float distance = radius / fit * 1.05f;
+
+    float direction[3] = { 0.55f, 0.45f, -0.7f };
+    float length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+
+    return look_at_camera(center[0] + direction[0] / length * distance, center[1] + direction[1] / length * distance, center[2] + direction[2] / length * distance,
+                          center[0], center[1], center[2], fovY, aspect, distance * 0.05f, distance + radius * 2);
+}
+
+/**
+ * Draws a mesh, textured with its own texture (256 texels wide)
+ *
+ * @param target
+ * @param mesh
+ * @param camera
+ * @param options
+ */
+OCARN2_DEF void draw_mesh(OCARN2::RasterTarget& target, const OCARN2::Mesh& mesh, const OCARN2::RasterCamera& camera, const OCARN2::RasterOptions& options) {
+    bool depthOnly = target.color.pixels.empty();
+
+    std::vector<ocarn2__raster_vertex> vertices(mesh.vertices.size());
+    for(size_t i=0; i < vertices.size(); i++) {
+        ocarn2__raster_transform(camera, mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z, vertices[i]);
+    }
+
+    uint32_t textureHeight = mesh.textureData ? mesh.textureSize / 512 : 0;
+
+    // light from above and in front
+    const float light[3] = { 0.37f, 0.80f, -0.47f };
+
+    std::vector<ocarn2__raster_triangle> triangles;
+    triangles.reserve(mesh.faces.size());
+
+    for(const OCARN2::Face& face: mesh.faces) {
+        if((uint32_t) face.v1 >= vertices.size() || (uint32_t) face.v2 >= vertices.size() || (uint32_t) face.v3 >= vertices.size()) continue;
+
+        // faces that don't fully block the view behind them don't go in depth only targets
+        if(depthOnly && (face.flags & (OCARN2::SF_OPACITY | OCARN2::SF_TRANSPARENT))) continue;
+
+        ocarn2__raster_triangle triangle {};
+        triangle.flags = face.flags;
+        triangle.shade = 1.0f;
+
+        if(textureHeight > 0) {
+            triangle.texture = mesh.textureData;
+            triangle.textureWidth = 256;
+            triangle.textureHeight = textureHeight;
+        }
+
+        const OCARN2::Vertex& a = mesh.vertices[face.v1];
+        const OCARN2::Vertex& b = mesh.vertices[face.v2];
+        const OCARN2::Vertex& c = mesh.vertices[face.v3];
+
+        if(options.shade) {
+            float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+            float vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+            float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+            float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+
+            float facing = length > 0 ? (nx * light[0] + ny * light[1] + nz * light[2]) / length : 0;
+            if(face.flags & OCARN2::SF_DOUBLE_SIDE) facing = std::fabs(facing);
+
+            triangle.shade = 0.45f + 0.55f * std::max(facing, 0.0f);
+        }
+
+        ocarn2__raster_vertex corners[3] = { vertices[face.v1], vertices[face.v2], vertices[face.v3] };
+        corners[0].u = (float) face.tax; corners[0].v = (float) face.tay;
+        corners[1].u = (float) face.tbx; corners[1].v = (float) face.tby;
+        corners[2].u = (float) face.tcx; corners[2].v = (float) face.tcy;
+
+        bool cull = options.cullBackFaces && !(face.flags & OCARN2::SF_DOUBLE_SIDE);
+        ocarn2__raster_setup(target, corners, triangle, cull, triangles);
+    }
+
+    ocarn2__raster_draw(target, triangles, options);
+}
+
+/**
+ * Draws part of a map's terrain, two triangles a cell, textured from the Rsc's terrain textures when there is
+ * one. Regions are drawn in one go, so keep them to what's in view (a few hundred cells on a side)
+ *
+ * @param target
+ * @param map
+ * @param rsc the map's resources, for textures. optional
+ * @param x first cell of the region
+ * @param z
+ * @param width cells across, clipped to the map
+ * @param height
+ * @param camera in world units, see RasterOptions::cellSize
+ * @param options
+ */
+OCARN2_DEF void draw_terrain_region(OCARN2::RasterTarget& target, const OCARN2::Map& map, const OCARN2::Rsc* rsc,
+                                    uint32_t x, uint32_t z, uint32_t width, uint32_t height,
+                                    const OCARN2::RasterCamera& camera, const OCARN2::RasterOptions& options) {
+    if(x >= 1024 || z >= 1024) return;
+    width = std::min(width, 1024 - x);
+    height = std::min(height, 1024 - z);
+
+    // corners of the cells, the last row and column repeat the edge of the map
+    uint32_t points = width + 1;
+    std::vector<ocarn2__raster_vertex> grid((size_t) points * (height + 1));
+    for(uint32_t gz=0; gz <= height; gz++) {
+        for(uint32_t gx=0; gx <= width; gx++) {
+            uint32_t cx = std::min(x + gx, 1023u), cz = std::min(z + gz, 1023u);
+            float worldY = map.heightMap[cz * 1024 + cx] * options.heightScale;
+
+            ocarn2__raster_transform(camera, (x + gx) * options.cellSize, worldY, (z + gz) * options.cellSize, grid[gz * points + gx]);
+        }
+    }
+
+    std::vector<ocarn2__raster_triangle> triangles;
+    triangles.reserve((size_t) width * height * 2);
+
+    for(uint32_t qz=0; qz < height; qz++) {
+        for(uint32_t qx=0; qx < width; qx++) {
+            uint32_t cell = (z + qz) * 1024 + x + qx;
+            uint16_t flags = map.bitflagMap[cell];
+
+            ocarn2__raster_triangle triangle {};
+            triangle.shade = options.shade ? map.lightingMap[1][cell] / 255.0f : 1.0f;
+
+            uint32_t textureSize = 0;
+            if(rsc && map.textureMap[cell] < rsc->textures.size()) {
+                const OCARN2::Texture& texture = rsc->textures[map.textureMap[cell]];
+                textureSize = (uint32_t) std::sqrt((float) (texture.size / 2));
+
+                if(texture.data && textureSize > 0) {
+                    triangle.texture = texture.data;
+                    triangle.textureWidth = triangle.textureHeight = textureSize;
+                }
+            }
+
+            // corners go around the cell like the terrain mesh, with the texture turned by BF_TEXTURE_DIRECTION
+            static const float cornerUvs[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+            static const uint32_t cornerOffsets[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+            uint32_t rotation = flags & 3;
+
+            ocarn2__raster_vertex corners[4];
+            for(uint32_t c=0; c < 4; c++) {
+                corners[c] = grid[(qz + cornerOffsets[c][1]) * points + qx + cornerOffsets[c][0]];
+                corners[c].u = cornerUvs[(c + rotation) & 3][0] * textureSize;
+                corners[c].v = cornerUvs[(c + rotation) & 3][1] * textureSize;
+            }
+
+            static const uint32_t split[2][6] = { { 0, 2, 1, 0, 3, 2 }, { 0, 3, 1, 1, 3, 2 } };
+            const uint32_t* order = split[(flags & OCARN2::BF_REVERSE) ? 1 : 0];
+
+            for(uint32_t t=0; t < 2; t++) {
+                ocarn2__raster_vertex three[3] = { corners[order[t * 3]], corners[order[t * 3 + 1]], corners[order[t * 3 + 2]] };
+                ocarn2__raster_setup(target, three, triangle, options.cullBackFaces, triangles);
+            }
+        }
+    }
+
+    ocarn2__raster_draw(target, triangles, options);
+}
+
+/**
+ * Checks a box against what's been drawn into a target, usually a small depth only one. It's conservative:
+ * a box is only hidden if every pixel it could cover already has something nearer than its nearest corner
+ *
+ * @param target
+ * @param camera
+ * @param boxMin 3 floats
+ * @param boxMax 3 floats
+ * @return false if the box is out of view or hidden
+ */
+OCARN2_DEF bool raster_box_visible(const OCARN2::RasterTarget& target, const OCARN2::RasterCamera& camera, const float* boxMin, const float* boxMax) {
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY, nearest = INFINITY;
+
+    for(uint32_t corner=0; corner < 8; corner++) {
+        ocarn2__raster_vertex v;
+        ocarn2__raster_transform(camera, corner & 1 ? boxMax[0] : boxMin[0], corner & 2 ? boxMax[1] : boxMin[1], corner & 4 ? boxMax[2] : boxMin[2], v);
+
+        // a corner behind the near plane, so the box could be right up against the camera
+        if(v.z < -v.w || v.w <= 0) return true;
+
+        float sx = (v.x / v.w * 0.5f + 0.5f) * target.width;
+        float sy = (0.5f - v.y / v.w * 0.5f) * target.height;
+
+        minX = std::min(minX, sx); maxX = std::max(maxX, sx);
+        minY = std::min(minY, sy); maxY = std::max(maxY, sy);
+        nearest = std::min(nearest, v.z / v.w * 0.5f + 0.5f);
+    }
+
+    if(maxX < 0 || maxY < 0 || minX > target.width || minY > target.height || nearest > 1) return false;
+
+    int32_t x0 = std::max(0, (int32_t) std::floor(minX)), x1 = std::min((int32_t) target.width, (int32_t) std::ceil(maxX));
+    int32_t y0 = std::max(0, (int32_t) std::floor(minY)), y1 = std::min((int32_t) target.height, (int32_t) std::ceil(maxY));
+
+    for(int32_t y = y0; y < y1; y++) {
+        for(int32_t x = x0; x < x1; x++) {
+            if(nearest <= target.depth[(size_t) y * target.width + x]) return true;
+        }
+    }
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,900 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for sharing loaded assets between processes through POSIX shared memory, so a host
+ * running many servers holds one copy of each area rather than one per process.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * One process copies maps, rscs and meshes into a named segment, laid out flat with every reference stored as
+ * an offset from the start of the segment, so it means the same thing wherever a process maps it. Everyone else
+ * maps it read only and gets views, the same arrays the loaders fill in but pointing straight into the segment,
+ * nothing is parsed or copied. Views are good until the segment is closed.
+ *
+ * load_shared_segment does both: the first process to ask creates the segment and loads the files into it,
+ * the rest wait for it to be ready and map it. A segment whose creator died before finishing is made again, and
+ * nothing is created when a file fails to load. The segment stays around after everyone closes it until
+ * remove_shared_segment is called (or the machine restarts). glibc before 2.34 needs -lrt for shm_open.
+ *
+ * main methods are
+ *
+ * SharedSegment load_shared_segment(const std::string& name, const std::vector<SharedAssetFile>& files, uint32_t timeoutMs);
+ * SharedSegment create_shared_segment(const std::string& name, const SharedAssets& assets);
+ * SharedSegment open_shared_segment(const std::string& name, uint32_t timeoutMs);
+ * SharedMap find_shared_map(const SharedSegment& segment, const std::string& name);
+ * SharedRsc find_shared_rsc(const SharedSegment& segment, const std::string& name);
+ * SharedMesh find_shared_mesh(const SharedSegment& segment, const std::string& name);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    enum SharedAssetKind {
+        SHARED_MAP = 1,
+        SHARED_RSC,
+        SHARED_MESH // .car or .3df
+    };
+
+    // what to put in a segment. the assets are only read, and have to stay alive until it's created
+    struct SharedAssets {
+        struct Entry {
+            std::string name;
+            SharedAssetKind kind;
+            const void* asset;
+        };
+
+        std::vector<Entry> entries;
+    };
+
+    // a file for load_shared_segment to load into the segment
+    struct SharedAssetFile {
+        std::string name;
+        std::string filename;
+        SharedAssetKind kind;
+    };
+
+    struct SharedSegment {
+        std::string name;
+        const unsigned char* base = nullptr;
+        size_t size = 0;
+    };
+
+    // each frame is numVertices x, y, z
+    struct SharedAnimation {
+        const char* name;
+        uint32_t kps;
+        uint32_t numFrames;
+        uint32_t numVertices;
+        const int16_t* data;
+    };
+
+    struct SharedMesh {
+        const char* name = nullptr;
+        uint32_t numVertices = 0, numFaces = 0, numNodes = 0;
+        uint32_t textureSize = 0;
+
+        const Face* faces = nullptr;
+        const Vertex* vertices = nullptr;
+        const Node* nodes = nullptr;
+        const uint16_t* textureData = nullptr;
+
+        std::vector<SharedAnimation> animations;
+    };
+
+    // indexed by MapPlane, like map_plane_data. all nullptr if the map wasn't found
+    struct SharedMap {
+        const unsigned char* planes[MAP_NUM_PLANES] = {};
+    };
+
+    struct SharedRscModel {
+        int32_t radius;
+        int32_t yLo, yHi;
+        int32_t lineLength;
+        int32_t lightIntensity;
+        int32_t circleRadius;
+        int32_t circleIntensity;
+        int32_t flags;
+        int32_t grRadius;
+        int32_t defLight;
+        int32_t lastAnimationTime;
+        float boundingRadius;
+
+        SharedMesh mesh;
+
+        int32_t textureSize;
+        const uint16_t* textureData;
+
+        // numFrames is 0 unless flags has OF_ANIMATED set
+        SharedAnimation animation;
+    };
+
+    struct SharedRsc {
+        // 128 * 128 texels each
+        std::vector<const uint16_t*> textures;
+        std::vector<SharedRscModel> models;
+
+        const uint16_t* sky[3] = {};
+        const unsigned char* skyMap = nullptr;
+    };
+}
+
+
+OCARN2_DEF void add_shared_map(OCARN2::SharedAssets& assets, const std::string& name, const OCARN2::Map& map);
+OCARN2_DEF void add_shared_rsc(OCARN2::SharedAssets& assets, const std::string& name, const OCARN2::Rsc& rsc);
+OCARN2_DEF void add_shared_mesh(OCARN2::SharedAssets& assets, const std::string& name, const OCARN2::Mesh& mesh);
+
+OCARN2_DEF OCARN2::SharedSegment create_shared_segment(const std::string& name, const OCARN2::SharedAssets& assets);
+OCARN2_DEF OCARN2::SharedSegment open_shared_segment(const std::string& name, uint32_t timeoutMs = 10000);
+OCARN2_DEF OCARN2::SharedSegment load_shared_segment(const std::string& name, const std::vector<OCARN2::SharedAssetFile>& files, uint32_t timeoutMs = 10000);
+OCARN2_DEF void close_shared_segment(OCARN2::SharedSegment& segment);
+OCARN2_DEF bool remove_shared_segment(const std::string& name);
+
+OCARN2_DEF OCARN2::SharedMap find_shared_map(const OCARN2::SharedSegment& segment, const std::string& name);
+OCARN2_DEF OCARN2::SharedRsc find_shared_rsc(const OCARN2::SharedSegment& segment, const std::string& name);
+OCARN2_DEF OCARN2::SharedMesh find_shared_mesh(const OCARN2::SharedSegment& segment, const std::string& name);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#if defined(__unix__) || defined(__APPLE__)
+#define OCARN2__SHM 1
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char ocarn2__shm_magic[8] = { 'O', 'C', 'A', 'R', 'N', '2', 'S', 'M' };
+static const uint32_t ocarn2__shm_version = 2;
+
+// everything below is stored in the segment exactly like this. offsets are from the start of the segment
+
+struct ocarn2__shm_header {
+    char magic[8];
+    uint32_t version;
+    std::atomic<uint32_t> ready; // set last, once everything else is written
+    uint64_t size;
+    uint32_t numEntries;
+    uint32_t creator; // pid of the process writing it, so a reader can tell when it died before ready was set
+};
+
+struct ocarn2__shm_entry {
+    char name[48];
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;
+};
+
+struct ocarn2__shm_animation {
+    char name[32];
+    uint32_t kps, numFrames;
+    uint32_t numVertices, reserved;
+    uint64_t data;
+};
+
+struct ocarn2__shm_mesh {
+    char name[24];
+    uint32_t numVertices, numFaces, numNodes;
+    uint32_t textureSize, numAnimations;
+    uint64_t faces, vertices, nodes, texture, animations;
+};
+
+struct ocarn2__shm_model {
+    int32_t header[11]; // radius to lastAnimationTime, in RscModel order
+    float boundingRadius;
+    int32_t textureSize;
+    uint32_t reserved;
+    uint64_t mesh, texture;
+    ocarn2__shm_animation animation;
+};
+
+struct ocarn2__shm_rsc {
+    uint32_t numTextures, numModels;
+    uint64_t textures; // numTextures offsets
+    uint64_t models;   // numModels ocarn2__shm_model
+    uint64_t sky[3];
+    uint64_t skyMap;
+};
+
+struct ocarn2__shm_map {
+    uint64_t planes[OCARN2::MAP_NUM_PLANES];
+};
+
+/**
+ * Internal writer that lays things out in the segment. With no base it only adds up the size, so the same code
+ * measures the segment and then fills it
+ */
+struct ocarn2__shm_writer {
+    unsigned char* base = nullptr;
+    uint64_t size = 0;
+
+    uint64_t alloc(uint64_t bytes, uint64_t align = 64) {
+        size = (size + align - 1) / align * align;
+        uint64_t offset = size;
+        size += bytes;
+        return offset;
+    }
+
+    uint64_t copy(const void* data, uint64_t bytes) {
+        uint64_t offset = alloc(bytes);
+        if(base && bytes) memcpy(base + offset, data, bytes);
+        return offset;
+    }
+
+    template<typename T>
+    T* at(uint64_t offset) {
+        return base ? (T*) (base + offset) : nullptr;
+    }
+};
+
+/**
+ * Internal function to write an animation's header, and its frames
+ */
+static void ocarn2__shm_write_animation(ocarn2__shm_writer& writer, ocarn2__shm_animation& out, const OCARN2::Animation& animation, uint64_t numVertices) {
+    memcpy(out.name, animation.name, sizeof(out.name));
+    out.kps = animation.kps;
+    out.numFrames = animation.data ? animation.numFrames : 0;
+    out.numVertices = (uint32_t) numVertices;
+    out.data = writer.copy(animation.data, numVertices * out.numFrames * 6);
+}
+
+/**
+ * Internal function to write a mesh
+ *
+ * @return offset of its ocarn2__shm_mesh
+ */
+static uint64_t ocarn2__shm_write_mesh(ocarn2__shm_writer& writer, const OCARN2::Mesh& mesh) {
+    uint64_t offset = writer.alloc(sizeof(ocarn2__shm_mesh));
+    ocarn2__shm_mesh record {};
+
+    memcpy(record.name, mesh.name, sizeof(record.name));
+    record.numVertices = (uint32_t) mesh.vertices.size();
+    record.numFaces = (uint32_t) mesh.faces.size();
+    record.numNodes = (uint32_t) mesh.nodes.size();
+    record.textureSize = mesh.textureData ? mesh.textureSize : 0;
+    record.numAnimations = (uint32_t) mesh.animations.size();
+
+    record.faces = writer.copy(mesh.faces.data(), mesh.faces.size() * sizeof(OCARN2::Face));
+    record.vertices = writer.copy(mesh.vertices.data(), mesh.vertices.size() * sizeof(OCARN2::Vertex));
+    record.nodes = writer.copy(mesh.nodes.data(), mesh.nodes.size() * sizeof(OCARN2::Node));
+    record.texture = writer.copy(mesh.textureData, record.textureSize);
+    record.animations = writer.alloc(mesh.animations.size() * sizeof(ocarn2__shm_animation));
+
+    for(size_t a=0; a < mesh.animations.size(); a++) {
+        ocarn2__shm_animation animation {};
+        ocarn2__shm_write_animation(writer, animation, mesh.animations[a], mesh.vertices.size());
+        if(writer.base) writer.at<ocarn2__shm_animation>(record.animations)[a] = animation;
+    }
+
+    if(writer.base) *writer.at<ocarn2__shm_mesh>(offset) = record;
+    return offset;
+}
+
+/**
+ * Internal function to write an rsc's textures, models and sky
+ *
+ * @return offset of its ocarn2__shm_rsc
+ */
+static uint64_t ocarn2__shm_write_rsc(ocarn2__shm_writer& writer, const OCARN2::Rsc& rsc) {
+    uint64_t offset = writer.alloc(sizeof(ocarn2__shm_rsc));
+    ocarn2__shm_rsc record {};
+
+    record.numTextures = (uint32_t) rsc.textures.size();
+    record.numModels = (uint32_t) rsc.models.size();
+
+    record.textures = writer.alloc(rsc.textures.size() * 8, 8);
+    for(size_t t=0; t < rsc.textures.size(); t++) {
+        // anything that isn't a whole 128 * 128 texture is left out rather than read past
+        const OCARN2::Texture& texture = rsc.textures[t];
+        bool whole = texture.data && texture.size >= 128 * 128 * 2;
+        uint64_t at = whole ? writer.copy(texture.data, 128 * 128 * 2) : 0;
+        if(writer.base) writer.at<uint64_t>(record.textures)[t] = at;
+    }
+
+    record.models = writer.alloc(rsc.models.size() * sizeof(ocarn2__shm_model));
+    for(size_t m=0; m < rsc.models.size(); m++) {
+        const OCARN2::RscModel& model = rsc.models[m];
+        ocarn2__shm_model out {};
+
+        int32_t header[11] = { model.radius, model.yLo, model.yHi, model.lineLength, model.lightIntensity, model.circleRadius,
+                               model.circleIntensity, model.flags, model.grRadius, model.defLight, model.lastAnimationTime };
+        memcpy(out.header, header, sizeof(header));
+        out.boundingRadius = model.boundingRadius;
+        out.textureSize = model.textureData ? model.textureSize : 0;
+
+        out.mesh = ocarn2__shm_write_mesh(writer, model.mesh);
+        out.texture = writer.copy(model.textureData, (uint64_t) std::max(out.textureSize, 0));
+
+        if(model.flags & OCARN2::OF_ANIMATED) {
+            ocarn2__shm_write_animation(writer, out.animation, model.animation, (uint64_t) std::max(model.animationHeader[1], 0));
+        }
+
+        if(writer.base) writer.at<ocarn2__shm_model>(record.models)[m] = out;
+    }
+
+    for(int s=0; s < 3; s++) record.sky[s] = writer.copy(rsc.sky[s], sizeof(rsc.sky[s]));
+    record.skyMap = writer.copy(rsc.skyMap, sizeof(rsc.skyMap));
+
+    if(writer.base) *writer.at<ocarn2__shm_rsc>(offset) = record;
+    return offset;
+}
+
+/**
+ * Internal function to write every plane of a map
+ *
+ * @return offset of its ocarn2__shm_map
+ */
+static uint64_t ocarn2__shm_write_map(ocarn2__shm_writer& writer, const OCARN2::Map& map) {
+    uint64_t offset = writer.alloc(sizeof(ocarn2__shm_map));
+    ocarn2__shm_map record {};
+
+    for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+        OCARN2::MapPlaneInfo info = map_plane_info((OCARN2::MapPlane) p);
+        record.planes[p] = writer.copy(map_plane_data(map, (OCARN2::MapPlane) p), (uint64_t) info.width * info.width * info.cellSize);
+    }
+
+    if(writer.base) *writer.at<ocarn2__shm_map>(offset) = record;
+    return offset;
+}
+
+/**
+ * Internal function to lay out a whole segment. Everything but the ready flag
+ */
+static void ocarn2__shm_write(ocarn2__shm_writer& writer, const OCARN2::SharedAssets& assets) {
+    uint64_t headerOffset = writer.alloc(sizeof(ocarn2__shm_header));
+    uint64_t entries = writer.alloc(assets.entries.size() * sizeof(ocarn2__shm_entry));
+
+    for(size_t i=0; i < assets.entries.size(); i++) {
+        const OCARN2::SharedAssets::Entry& entry = assets.entries[i];
+        ocarn2__shm_entry out {};
+
+        strncpy(out.name, entry.name.c_str(), sizeof(out.name) - 1);
+        out.kind = entry.kind;
+
+        switch(entry.kind) {
+            case OCARN2::SHARED_MAP:  out.offset = ocarn2__shm_write_map(writer, *(const OCARN2::Map*) entry.asset); break;
+            case OCARN2::SHARED_RSC:  out.offset = ocarn2__shm_write_rsc(writer, *(const OCARN2::Rsc*) entry.asset); break;
+            case OCARN2::SHARED_MESH: out.offset = ocarn2__shm_write_mesh(writer, *(const OCARN2::Mesh*) entry.asset); break;
+        }
+
+        if(writer.base) writer.at<ocarn2__shm_entry>(entries)[i] = out;
+    }
+
+    if(writer.base) {
+        ocarn2__shm_header* header = writer.at<ocarn2__shm_header>(headerOffset);
+        memcpy(header->magic, ocarn2__shm_magic, 8);
+        header->version = ocarn2__shm_version;
+        header->size = writer.size;
+        header->numEntries = (uint32_t) assets.entries.size();
+    }
+}
+
+/**
+ * Internal function to get at something in a segment, or nullptr if it isn't all inside it
+ */
+template<typename T>
+static const T* ocarn2__shm_at(const OCARN2::SharedSegment& segment, uint64_t offset, uint64_t count = 1) {
+    if(offset > segment.size || count > (segment.size - offset) / sizeof(T)) return nullptr;
+    return (const T*) (segment.base + offset);
+}
+
+/**
+ * Internal function to find an entry by name and kind
+ */
+static const ocarn2__shm_entry* ocarn2__shm_find(const OCARN2::SharedSegment& segment, const std::string& name, OCARN2::SharedAssetKind kind) {
+    if(!segment.base) return nullptr;
+
+    const ocarn2__shm_header* header = (const ocarn2__shm_header*) segment.base;
+    // the table is the first thing after the header
+    uint64_t table = (sizeof(ocarn2__shm_header) + 63) / 64 * 64;
+    const ocarn2__shm_entry* entries = ocarn2__shm_at<ocarn2__shm_entry>(segment, table, header->numEntries);
+    if(!entries) return nullptr;
+
+    for(uint32_t i=0; i < header->numEntries; i++) {
+        if(entries[i].kind == (uint32_t) kind && strncmp(entries[i].name, name.c_str(), sizeof(entries[i].name)) == 0) return &entries[i];
+    }
+
+    std::cerr << "Shared segment " << segment.name << " has nothing called " << name << std::endl;
+    return nullptr;
+}
+
+/**
+ * Internal function to turn an animation record into a view
+ */
+static OCARN2::SharedAnimation ocarn2__shm_animation_view(const OCARN2::SharedSegment& segment, const ocarn2__shm_animation& animation) {
+    OCARN2::SharedAnimation view { animation.name, animation.kps, animation.numFrames, animation.numVertices, nullptr };
+    view.data = ocarn2__shm_at<int16_t>(segment, animation.data, (uint64_t) animation.numVertices * animation.numFrames * 3);
+    if(!view.data) view.numFrames = 0;
+    return view;
+}
+
+/**
+ * Internal function to turn a mesh record into a view. Arrays that don't fit in the segment come back empty
+ */
+static OCARN2::SharedMesh ocarn2__shm_mesh_view(const OCARN2::SharedSegment& segment, uint64_t offset) {
+    OCARN2::SharedMesh view;
+    const ocarn2__shm_mesh* record = ocarn2__shm_at<ocarn2__shm_mesh>(segment, offset);
+    if(!record) return view;
+
+    view.name = record->name;
+    view.faces = ocarn2__shm_at<OCARN2::Face>(segment, record->faces, record->numFaces);
+    view.vertices = ocarn2__shm_at<OCARN2::Vertex>(segment, record->vertices, record->numVertices);
+    view.nodes = ocarn2__shm_at<OCARN2::Node>(segment, record->nodes, record->numNodes);
+    view.textureData = ocarn2__shm_at<uint16_t>(segment, record->texture, record->textureSize / 2);
+
+    view.numFaces = view.faces ? record->numFaces : 0;
+    view.numVertices = view.vertices ? record->numVertices : 0;
+    view.numNodes = view.nodes ? record->numNodes : 0;
+    view.textureSize = view.textureData ? record->textureSize : 0;
+
+    const ocarn2__shm_animation* animations = ocarn2__shm_at<ocarn2__shm_animation>(segment, record->animations, record->numAnimations);
+    if(animations) {
+        for(uint32_t a=0; a < record->numAnimations; a++)
+            view.animations.push_back(ocarn2__shm_animation_view(segment, animations[a]));
+    }
+
+    return view;
+}
+
+/**
+ * Adds a map to go in a segment. It has to stay alive until create_shared_segment is done
+ *
+ * @param assets
+ * @param name up to 47 characters
+ * @param map
+ */
+OCARN2_DEF void add_shared_map(OCARN2::SharedAssets& assets, const std::string& name, const OCARN2::Map& map) {
+    assets.entries.push_back({ name, OCARN2::SHARED_MAP, &map });
+}
+
+/**
+ * Adds an rsc's textures, models and sky to go in a segment. It has to stay alive until create_shared_segment is done
+ *
+ * @param assets
+ * @param name up to 47 characters
+ * @param rsc
+ */
+OCARN2_DEF void add_shared_rsc(OCARN2::SharedAssets& assets, const std::string& name, const OCARN2::Rsc& rsc) {
+    assets.entries.push_back({ name, OCARN2::SHARED_RSC, &rsc });
+}
+
+/**
+ * Adds a .car or .3df mesh to go in a segment. It has to stay alive until create_shared_segment is done
+ *
+ * @param assets
+ * @param name up to 47 characters
+ * @param mesh
+ */
+OCARN2_DEF void add_shared_mesh(OCARN2::SharedAssets& assets, const std::string& name, const OCARN2::Mesh& mesh) {
+    assets.entries.push_back({ name, OCARN2::SHARED_MESH, &mesh });
+}
+
+/**
+ * Internal function to create and fill a segment. If exclusive, fails without a message when it already exists
+ */
+static OCARN2::SharedSegment ocarn2__shm_create(const std::string& name, const OCARN2::SharedAssets& assets, bool exclusive, bool* exists) {
+    OCARN2::SharedSegment segment;
+#ifdef OCARN2__SHM
+    ocarn2__shm_writer measure;
+    ocarn2__shm_write(measure, assets);
+    size_t size = (size_t) measure.size;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        if(errno == EEXIST && exclusive) {
+            if(exists) *exists = true;
+            return segment;
+        }
+        std::cerr << "Unable to create shared segment " << name << ": " << strerror(errno) << std::endl;
+        return segment;
+    }
+
+    // the header goes in before the segment is sized, so a reader that can see a header always sees who's
+    // writing it. ready stays 0 until the end
+    ocarn2__shm_header start {};
+    memcpy(start.magic, ocarn2__shm_magic, 8);
+    start.version = ocarn2__shm_version;
+    start.size = size;
+    start.creator = (uint32_t) getpid();
+    bool started = pwrite(fd, &start, sizeof(start), 0) == (ssize_t) sizeof(start);
+
+    void* memory = MAP_FAILED;
+    if(ftruncate(fd, (off_t) size) == 0) memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(memory == MAP_FAILED) {
+        std::cerr << "Unable to map shared segment " << name << ": " << strerror(errno) << std::endl;
+        shm_unlink(name.c_str());
+        return segment;
+    }
+
+    // where shared memory can't be written to, straight after sizing it instead
+    if(!started) ((ocarn2__shm_header*) memory)->creator = (uint32_t) getpid();
+
+    ocarn2__shm_writer writer;
+    writer.base = (unsigned char*) memory;
+    ocarn2__shm_write(writer, assets);
+
+    // readers wait on this, so it goes last
+    ((ocarn2__shm_header*) memory)->ready.store(1, std::memory_order_release);
+
+    // from here on it's read only for this process too
+    mprotect(memory, size, PROT_READ);
+
+    segment.name = name;
+    segment.base = (const unsigned char*) memory;
+    segment.size = size;
+#else
+    std::cerr << "Shared segments need POSIX shared memory" << std::endl;
+#endif
+    return segment;
+}
+
+/**
+ * Copies assets into a new shared memory segment. Fails if a segment with that name already exists
+ *
+ * @param name POSIX shared memory name, eg "/ocarn2-area1"
+ * @param assets
+ * @return the segment, mapped read only. empty on failure
+ */
+OCARN2_DEF OCARN2::SharedSegment create_shared_segment(const std::string& name, const OCARN2::SharedAssets& assets) {
+    return ocarn2__shm_create(name, assets, false, nullptr);
+}
+
+#ifdef OCARN2__SHM
+/**
+ * Internal function to check whether the process that was writing a segment is gone. 0 means it hasn't said
+ * who it is yet, so it's still starting. Only works when everyone shares a pid namespace
+ */
+static bool ocarn2__shm_creator_gone(uint32_t creator) {
+    return creator != 0 && kill((pid_t) creator, 0) != 0 && errno == ESRCH;
+}
+#endif
+
+// which segment a name led to, since the name can be removed and made again while it's being looked at
+struct ocarn2__shm_id {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+};
+
+/**
+ * Internal function to map an existing segment. Sets stale when it was never finished and never will be,
+ * because whoever was writing it died first, and id to the segment that was looked at
+ */
+static OCARN2::SharedSegment ocarn2__shm_open(const std::string& name, uint32_t timeoutMs, bool* stale, ocarn2__shm_id* id) {
+    OCARN2::SharedSegment segment;
+#ifdef OCARN2__SHM
+    auto start = std::chrono::steady_clock::now();
+    auto waited = [&]() {
+        return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) {
+        std::cerr << "Unable to open shared segment " << name << ": " << strerror(errno) << std::endl;
+        return segment;
+    }
+
+    // the creator writes the header, pid and all, before anything else
+    struct stat info {};
+    while(fstat(fd, &info) == 0 && (size_t) info.st_size < sizeof(ocarn2__shm_header) && waited() < timeoutMs) usleep(1000);
+    if(id) *id = { (uint64_t) info.st_dev, (uint64_t) info.st_ino };
+
+    void* first = (size_t) info.st_size >= sizeof(ocarn2__shm_header) ? mmap(nullptr, sizeof(ocarn2__shm_header), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if(first == MAP_FAILED) {
+        // never got a header, so the creator didn't get past shm_open
+        if(stale && (size_t) info.st_size < sizeof(ocarn2__shm_header)) *stale = true;
+        std::cerr << "Unable to map shared segment " << name << std::endl;
+        close(fd);
+        return segment;
+    }
+
+    const ocarn2__shm_header* header = (const ocarn2__shm_header*) first;
+    while(header->ready.load(std::memory_order_acquire) == 0 && waited() < timeoutMs) {
+        // no point waiting out the timeout for a creator that isn't there
+        if(ocarn2__shm_creator_gone(header->creator)) break;
+        usleep(1000);
+    }
+
+    bool ready = header->ready.load(std::memory_order_acquire) != 0;
+    bool valid = ready && memcmp(header->magic, ocarn2__shm_magic, 8) == 0 && header->version == ocarn2__shm_version;
+    bool gone = !ready && ocarn2__shm_creator_gone(header->creator);
+    uint32_t creator = header->creator;
+    size_t size = (size_t) header->size;
+    munmap(first, sizeof(ocarn2__shm_header));
+
+    // the whole of it, now the header says how big that is
+    void* memory = MAP_FAILED;
+    if(valid && fstat(fd, &info) == 0 && (size_t) info.st_size == size) memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(memory == MAP_FAILED) {
+        if(gone) std::cerr << "Shared segment " << name << " was left unfinished by process " << creator << std::endl;
+        else std::cerr << "Shared segment " << name << " isn't ready or isn't an ocarn2 segment" << std::endl;
+
+        if(stale) *stale = gone;
+        return segment;
+    }
+
+    segment.name = name;
+    segment.base = (const unsigned char*) memory;
+    segment.size = size;
+#else
+    (void) timeoutMs;
+    (void) stale;
+    (void) id;
+    std::cerr << "Shared segments need POSIX shared memory" << std::endl;
+#endif
+    return segment;
+}
+
+/**
+ * Maps an existing segment read only, waiting up to timeoutMs for whoever is creating it to finish.
+ * Gives up early if they died before finishing
+ *
+ * @param name
+ * @param timeoutMs
+ * @return empty on failure
+ */
+OCARN2_DEF OCARN2::SharedSegment open_shared_segment(const std::string& name, uint32_t timeoutMs) {
+    return ocarn2__shm_open(name, timeoutMs, nullptr, nullptr);
+}
+
+#ifdef OCARN2__SHM
+/**
+ * Internal function to remove a segment found stale, unless the name has moved on to another one since. Two
+ * processes can find the same stale segment, and the second mustn't remove the one the first made in its place,
+ * so the check and the removal happen under a lock on the stale segment
+ *
+ * @return true if this call removed it
+ */
+static bool ocarn2__shm_remove_stale(const std::string& name, const ocarn2__shm_id& staleId) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) return false;
+
+    auto same = [&](int other) {
+        struct stat info {};
+        return fstat(other, &info) == 0 && (uint64_t) info.st_dev == staleId.device && (uint64_t) info.st_ino == staleId.inode;
+    };
+
+    bool removed = false;
+    if(same(fd) && flock(fd, LOCK_EX) == 0) {
+        // whoever had the lock before may have removed it and made a new one
+        int current = shm_open(name.c_str(), O_RDONLY, 0);
+        if(current >= 0 && same(current)) removed = shm_unlink(name.c_str()) == 0;
+        if(current >= 0) close(current);
+    }
+
+    close(fd); // and the lock with it
+    return removed;
+}
+#endif
+
+/**
+ * Internal function to load one file for load_shared_segment, logging why when it can't
+ *
+ * @return false if the file is missing or didn't load
+ */
+static bool ocarn2__shm_load_file(const OCARN2::SharedAssetFile& file, std::vector<OCARN2::Map>& maps,
+                                  std::vector<OCARN2::Rsc*>& rscs, std::vector<OCARN2::Mesh>& meshes, OCARN2::SharedAssets& assets) {
+    bool loaded = false;
+
+    switch(file.kind) {
+        case OCARN2::SHARED_MAP:
+            maps.emplace_back();
+            ocarn2__openFile(file.filename, [&](std::fstream& in) {
+                OCARN2::LoadError failure;
+                loaded = ocarn2__load_map(in, maps.back(), &failure);
+                if(!loaded) ocarn2__report_load_error(file.filename, failure, nullptr);
+            });
+            if(loaded) add_shared_map(assets, file.name, maps.back());
+            break;
+        case OCARN2::SHARED_RSC:
+            // Rsc holds the sky inline, too big for the stack
+            rscs.push_back(new OCARN2::Rsc {});
+            ocarn2__openFile(file.filename, [&](std::fstream& in) {
+                OCARN2::LoadError failure;
+                loaded = ocarn2__load_rsc(in, *rscs.back(), &failure);
+                if(!loaded) ocarn2__report_load_error(file.filename, failure, nullptr);
+            });
+            if(loaded) add_shared_rsc(assets, file.name, *rscs.back());
+            break;
+        case OCARN2::SHARED_MESH: {
+            bool car = file.filename.size() > 4 &&
+                       ocarn2__equals_ignore_case(std::string_view(file.filename).substr(file.filename.size() - 4), ".car");
+            meshes.emplace_back();
+            ocarn2__openFile(file.filename, [&](std::fstream& in) {
+                OCARN2::LoadError failure;
+                loaded = car ? ocarn2__load_car(in, meshes.back(), &failure) : ocarn2__load_3df(in, meshes.back(), &failure);
+                if(!loaded) ocarn2__report_load_error(file.filename, failure, nullptr);
+            });
+            if(loaded) add_shared_mesh(assets, file.name, meshes.back());
+            break;
+        }
+        default:
+            std::cerr << "Unknown shared asset kind for " << file.filename << std::endl;
+            break;
+    }
+
+    return loaded;
+}
+
+/**
+ * Maps a segment if another process has made it, or makes it by loading the files if not. Only one process
+ * ever loads the files, the rest wait up to timeoutMs for it. A segment left unfinished by a creator that died
+ * is removed and made again. If any file fails to load nothing is created, so the next call tries again
+ *
+ * @param name POSIX shared memory name, eg "/ocarn2-area1"
+ * @param files
+ * @param timeoutMs
+ * @return empty on failure
+ */
+OCARN2_DEF OCARN2::SharedSegment load_shared_segment(const std::string& name, const std::vector<OCARN2::SharedAssetFile>& files, uint32_t timeoutMs) {
+    // the second time round is after removing a stale segment, or losing the race to create it
+    for(int attempt=0; attempt < 2; attempt++) {
+#ifdef OCARN2__SHM
+        // check first, so nobody loads files just to find the segment is already there
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd >= 0) {
+            close(fd);
+
+            bool stale = false;
+            ocarn2__shm_id staleId;
+            OCARN2::SharedSegment segment = ocarn2__shm_open(name, timeoutMs, &stale, &staleId);
+            if(!stale || attempt > 0) return segment;
+
+            if(ocarn2__shm_remove_stale(name, staleId)) std::cerr << "Removed stale shared segment " << name << " to make it again" << std::endl;
+        }
+#endif
+
+        std::vector<OCARN2::Map> maps;
+        std::vector<OCARN2::Rsc*> rscs;
+        std::vector<OCARN2::Mesh> meshes;
+        maps.reserve(files.size());
+        meshes.reserve(files.size());
+
+        OCARN2::SharedAssets assets;
+        bool loaded = true;
+        for(const OCARN2::SharedAssetFile& file: files) {
+            if(!ocarn2__shm_load_file(file, maps, rscs, meshes, assets)) {
+                loaded = false;
+                break;
+            }
+        }
+
+        bool exists = false;
+        OCARN2::SharedSegment segment;
+        if(loaded) segment = ocarn2__shm_create(name, assets, true, &exists);
+        else std::cerr << "Not creating shared segment " << name << ", its files didn't all load" << std::endl;
+
+        for(OCARN2::Rsc* rsc: rscs) {
+            free_rsc(*rsc);
+            delete rsc;
+        }
+        for(OCARN2::Mesh& mesh: meshes) free_mesh(mesh);
+
+        // someone else got there between the check and the create
+        if(!exists) return segment;
+    }
+
+    return open_shared_segment(name, timeoutMs);
+}
+
+/**
+ * Unmaps a segment. Views into it can't be used after this. The segment itself stays until it's removed
+ *
+ * @param segment
+ */
+OCARN2_DEF void close_shared_segment(OCARN2::SharedSegment& segment) {
+#ifdef OCARN2__SHM
+    if(segment.base) munmap((void*) segment.base, segment.size);
+#endif
+    segment.base = nullptr;
+    segment.size = 0;
+}
+
+/**
+ * Removes a segment's name, so the next load_shared_segment makes a new one. Processes that have it mapped
+ * keep it until they close it
+ *
+ * @param name
+ * @return
+ */
+OCARN2_DEF bool remove_shared_segment(const std::string& name) {
+#ifdef OCARN2__SHM
+    return shm_unlink(name.c_str()) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Finds a map in a segment
+ *
+ * @param segment
+ * @param name
+ * @return every plane nullptr if it isn't there
+ */
+OCARN2_DEF OCARN2::SharedMap find_shared_map(const OCARN2::SharedSegment& segment, const std::string& name) {
+    OCARN2::SharedMap view;
+
+    const ocarn2__shm_entry* entry = ocarn2__shm_find(segment, name, OCARN2::SHARED_MAP);
+    const ocarn2__shm_map* record = entry ? ocarn2__shm_at<ocarn2__shm_map>(segment, entry->offset) : nullptr;
+    if(!record) return view;
+
+    for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+        OCARN2::MapPlaneInfo info = map_plane_info((OCARN2::MapPlane) p);
+        view.planes[p] = ocarn2__shm_at<unsigned char>(segment, record->planes[p], (uint64_t) info.width * info.width * info.cellSize);
+    }
+
+    return view;
+}
+
+/**
+ * Finds an rsc in a segment
+ *
+ * @param segment
+ * @param name
+ * @return no textures or models if it isn't there
+ */
+OCARN2_DEF OCARN2::SharedRsc find_shared_rsc(const OCARN2::SharedSegment& segment, const std::string& name) {
+    OCARN2::SharedRsc view;
+
+    const ocarn2__shm_entry* entry = ocarn2__shm_find(segment, name, OCARN2::SHARED_RSC);
+    const ocarn2__shm_rsc* record = entry ? ocarn2__shm_at<ocarn2__shm_rsc>(segment, entry->offset) : nullptr;
+    if(!record) return view;
+
+    const uint64_t* textures = ocarn2__shm_at<uint64_t>(segment, record->textures, record->numTextures);
+    if(textures) {
+        for(uint32_t t=0; t < record->numTextures; t++)
+            view.textures.push_back(textures[t] ? ocarn2__shm_at<uint16_t>(segment, textures[t], 128 * 128) : nullptr);
+    }
+
+    const ocarn2__shm_model* models = ocarn2__shm_at<ocarn2__shm_model>(segment, record->models, record->numModels);
+    if(models) {
+        for(uint32_t m=0; m < record->numModels; m++) {
+            const ocarn2__shm_model& model = models[m];
+            OCARN2::SharedRscModel out {};
+
+            int32_t* header[11] = { &out.radius, &out.yLo, &out.yHi, &out.lineLength, &out.lightIntensity, &out.circleRadius,
+                                    &out.circleIntensity, &out.flags, &out.grRadius, &out.defLight, &out.lastAnimationTime };
+            for(int h=0; h < 11; h++) *header[h] = model.header[h];
+            out.boundingRadius = model.boundingRadius;
+
+            out.mesh = ocarn2__shm_mesh_view(segment, model.mesh);
+            out.textureData = ocarn2__shm_at<uint16_t>(segment, model.texture, (uint64_t) std::max(model.textureSize, 0) / 2);
+            out.textureSize = out.textureData ? model.textureSize : 0;
+
+            out.animation = ocarn2__shm_animation_view(segment, model.animation);
+
+            view.models.push_back(out);
+        }
+    }
+
+    for(int s=0; s < 3; s++) view.sky[s] = ocarn2__shm_at<uint16_t>(segment, record->sky[s], 256 * 256);
+    view.skyMap = ocarn2__shm_at<unsigned char>(segment, record->skyMap, 128 * 128);
+
+    return view;
+}
+
+/**
+ * Finds a .car or .3df mesh in a segment
+ *
+ * @param segment
+ * @param name
+ * @return faces nullptr if it isn't there
+ */
+OCARN2_DEF OCARN2::SharedMesh find_shared_mesh(const OCARN2::SharedSegment& segment, const std::string& name) {
+    const ocarn2__shm_entry* entry = ocarn2__shm_find(segment, name, OCARN2::SHARED_MESH);
+    if(!entry) return {};
+
+    return ocarn2__shm_mesh_view(segment, entry->offset);
+}
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h that turns a Map's height and texture planes into ready to draw terrain.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * The map is cut into square chunks (64x64 cells by default) and every chunk is meshed at a few levels of
+ * detail, geomipmapping style. Level 0 is a quad per cell using textureMap, level n is a quad per 2^n x 2^n
+ * cells using textureMapFar, so each level has a quarter of the triangles of the one before. Chunk edges get
+ * skirts hanging down to hide the cracks where neighbouring chunks are drawn at different levels.
+ *
+ * Texture rotation comes from BF_TEXTURE_DIRECTION (textureMap) and BF_TEXTURE2_DIRECTION (textureMapFar),
+ * and BF_REVERSE flips which diagonal a quad is split along. Each level's indices are grouped into one batch
+ * per texture, so a chunk is one draw call per texture it uses.
+ *
+ * main methods are
+ *
+ * TerrainMesh build_terrain_mesh(const Map& map, const TerrainOptions& options);
+ * const TerrainChunk* get_terrain_chunk(const TerrainMesh& terrain, uint32_t chunkX, uint32_t chunkZ);
+ * uint32_t select_terrain_lod(const TerrainMesh& terrain, const TerrainChunk& chunk, float x, float z);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+namespace OCARN2 {
+
+    struct TerrainOptions {
+        // cells per side of a chunk. must divide 1024, and be a multiple of 2^(numLods - 1)
+        uint32_t chunkSize = 64;
+
+        // levels of detail built per chunk
+        uint32_t numLods = 4;
+
+        // world units per cell, and per step of heightMap
+        float cellSize = 256.0f;
+        float heightScale = 64.0f;
+
+        // how far skirts hang below chunk edges. 0 leaves them out
+        float skirtDepth = 512.0f;
+
+        // select_terrain_lod moves to the next level every lodDistance world units away from a chunk
+        float lodDistance = 8192.0f;
+
+        // threads used to build chunks. 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    struct TerrainVertex {
+        float x, y, z;
+        float nx, ny, nz;
+        float u, v;
+    };
+
+    // a run of a level's indices that all use the same texture
+    struct TerrainBatch {
+        uint16_t texture;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    // triangles are wound so their front faces point up, or out of the chunk for skirts
+    struct TerrainLod {
+        std::vector<TerrainVertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<TerrainBatch> batches;
+    };
+
+    struct TerrainChunk {
+        uint32_t chunkX, chunkZ;
+
+        // world space bounds, not counting skirts
+        float minX, minY, minZ;
+        float maxX, maxY, maxZ;
+
+        std::vector<TerrainLod> lods;
+    };
+
+    struct TerrainMesh {
+        TerrainOptions options;
+
+        uint32_t chunksPerSide = 0;
+        std::vector<TerrainChunk> chunks; // chunkZ * chunksPerSide + chunkX
+    };
+}
+
+
+OCARN2_DEF OCARN2::TerrainMesh build_terrain_mesh(const OCARN2::Map& map, const OCARN2::TerrainOptions& options = {});
+OCARN2_DEF const OCARN2::TerrainChunk* get_terrain_chunk(const OCARN2::TerrainMesh& terrain, uint32_t chunkX, uint32_t chunkZ);
+OCARN2_DEF uint32_t select_terrain_lod(const OCARN2::TerrainMesh& terrain, const OCARN2::TerrainChunk& chunk, float x, float z);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#include <cmath>
+
+/**
+ * Internal function to get the height of a grid point. The grid has one more point per side than the map has
+ * cells, the last row and column repeat the edge
+ *
+ * @param map
+ * @param x
+ * @param z
+ * @return
+ */
+static inline float ocarn2__terrain_height(const OCARN2::Map& map, int32_t x, int32_t z) {
+    x = std::min(std::max(x, 0), 1023);
+    z = std::min(std::max(z, 0), 1023);
+
+    return map.heightMap[z * 1024 + x];
+}
+
+/**
+ * Internal function to make the vertex at a grid point, with a normal from the full resolution heights around it
+ *
+ * @param map
+ * @param options
+ * @param x
+ * @param z
+ * @return
+ */
+static OCARN2::TerrainVertex ocarn2__terrain_vertex(const OCARN2::Map& map, const OCARN2::TerrainOptions& options, int32_t x, int32_t z) {
+    OCARN2::TerrainVertex vertex {};
+
+    vertex.x = x * options.cellSize;
+    vertex.y = ocarn2__terrain_height(map, x, z) * options.heightScale;
+    vertex.z = z * options.cellSize;
+
+    float dx = (ocarn2__terrain_height(map, x + 1, z) - ocarn2__terrain_height(map, x - 1, z)) * options.heightScale;
+    float dz = (ocarn2__terrain_height(map, x, z + 1) - ocarn2__terrain_height(map, x, z - 1)) * options.heightScale;
+
+    float nx = -dx, ny = 2.0f * options.cellSize, nz = -dz;
+    float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+
+    vertex.nx = nx / length;
+    vertex.ny = ny / length;
+    vertex.nz = nz / length;
+
+    return vertex;
+}
+
+/**
+ * Internal function to mesh one level of one chunk
+ *
+ * @param map
+ * @param options
+ * @param chunk
+ * @param level
+ * @return
+ */
+OCARN2_DEF OCARN2::TerrainLod ocarn2__build_terrain_lod(const OCARN2::Map& map, const OCARN2::TerrainOptions& options, const OCARN2::TerrainChunk& chunk, uint32_t level) {
+    OCARN2::TerrainLod lod;
+
+    int32_t step = 1 << level;
+    int32_t quads = (int32_t) options.chunkSize / step;
+    int32_t originX = (int32_t) (chunk.chunkX * options.chunkSize);
+    int32_t originZ = (int32_t) (chunk.chunkZ * options.chunkSize);
+
+    // level 0 draws textureMap, the rest draw the far textures like the game does in the distance
+    const std::vector<uint16_t>& textures = level == 0 ? map.textureMap : map.textureMapFar;
+    int directionShift = level == 0 ? 0 : 8;
+
+    // sort the quads by texture, so each texture's indices end up in one run
+    std::vector<std::pair<uint16_t, int32_t>> order(quads * quads);
+    for(int32_t i=0; i < quads * quads; i++) {
+        int32_t cell = (originZ + (i / quads) * step) * 1024 + originX + (i % quads) * step;
+        order[i] = { textures[cell], i };
+    }
+    std::sort(order.begin(), order.end());
+
+    // quads don't share vertices since their uvs differ, but they do share positions and normals
+    int32_t points = quads + 1;
+    std::vector<OCARN2::TerrainVertex> grid(points * points);
+    for(int32_t gz=0; gz < points; gz++) {
+        for(int32_t gx=0; gx < points; gx++) {
+            grid[gz * points + gx] = ocarn2__terrain_vertex(map, options, originX + gx * step, originZ + gz * step);
+        }
+    }
+
+    bool skirts = options.skirtDepth > 0;
+    size_t edgeQuads = skirts ? 4 * quads : 0;
+    lod.vertices.reserve(order.size() * 4 + edgeQuads * 2);
+    lod.indices.reserve(order.size() * 6 + edgeQuads * 6);
+
+    for(auto& entry: order) {
+        int32_t qx = entry.second % quads;
+        int32_t qz = entry.second / quads;
+        int32_t x = originX + qx * step;
+        int32_t z = originZ + qz * step;
+
+        if(lod.batches.empty() || lod.batches.back().texture != entry.first) {
+            lod.batches.push_back({ entry.first, (uint32_t) lod.indices.size(), 0 });
+        }
+
+        uint16_t flags = map.bitflagMap[z * 1024 + x];
+        uint32_t rotation = (flags >> directionShift) & 3;
+
+        // corners go around the quad: (x, z), (x+1, z), (x+1, z+1), (x, z+1)
+        static const float cornerUvs[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+        static const int32_t cornerOffsets[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+
+        uint32_t base = (uint32_t) lod.vertices.size();
+        for(uint32_t c=0; c < 4; c++) {
+            OCARN2::TerrainVertex vertex = grid[(qz + cornerOffsets[c][1]) * points + qx + cornerOffsets[c][0]];
+            vertex.u = cornerUvs[(c + rotation) & 3][0];
+            vertex.v = cornerUvs[(c + rotation) & 3][1];
+
+            lod.vertices.push_back(vertex);
+        }
+
+        if(flags & OCARN2::BF_REVERSE) {
+            uint32_t triangles[6] = { base, base + 3, base + 1, base + 1, base + 3, base + 2 };
+            lod.indices.insert(lod.indices.end(), triangles, triangles + 6);
+        }
+        else {
+            uint32_t triangles[6] = { base, base + 2, base + 1, base, base + 3, base + 2 };
+            lod.indices.insert(lod.indices.end(), triangles, triangles + 6);
+        }
+
+        if(skirts) {
+            // edges in the order the up facing triangles go round, so the skirt faces out of the chunk
+            uint32_t edges[4][2] = { {1, 0}, {2, 1}, {3, 2}, {0, 3} };
+            bool onEdge[4] = { qz == 0, qx == quads - 1, qz == quads - 1, qx == 0 };
+
+            for(uint32_t e=0; e < 4; e++) {
+                if(!onEdge[e]) continue;
+
+                uint32_t a = base + edges[e][0], b = base + edges[e][1];
+                uint32_t lowered = (uint32_t) lod.vertices.size();
+
+                OCARN2::TerrainVertex lowA = lod.vertices[a], lowB = lod.vertices[b];
+                lowA.y -= options.skirtDepth;
+                lowB.y -= options.skirtDepth;
+                lod.vertices.push_back(lowA);
+                lod.vertices.push_back(lowB);
+
+                uint32_t triangles[6] = { a, lowered, b, b, lowered, lowered + 1 };
+                lod.indices.insert(lod.indices.end(), triangles, triangles + 6);
+            }
+        }
+
+        lod.batches.back().indexCount = (uint32_t) lod.indices.size() - lod.batches.back().firstIndex;
+    }
+
+    return lod;
+}
+
+/**
+ * Meshes the whole map, every chunk at every level of detail. Chunks are built in parallel
+ *
+ * @param map
+ * @param options
+ * @return an empty mesh if the options don't cut the map up evenly
+ */
+OCARN2_DEF OCARN2::TerrainMesh build_terrain_mesh(const OCARN2::Map& map, const OCARN2::TerrainOptions& options) {
+    OCARN2::TerrainMesh terrain;
+
+    if(options.chunkSize < 1 || options.chunkSize > 1024 || 1024 % options.chunkSize != 0) {
+        std::cerr << "Chunk size " << options.chunkSize << " doesn't divide the map evenly" << std::endl;
+        return terrain;
+    }
+    if(options.numLods < 1 || options.numLods > 11 || options.chunkSize % (1u << (options.numLods - 1)) != 0) {
+        std::cerr << "Chunk size " << options.chunkSize << " can't be split into " << options.numLods << " levels" << std::endl;
+        return terrain;
+    }
+
+    terrain.options = options;
+    terrain.chunksPerSide = 1024 / options.chunkSize;
+    terrain.chunks.resize(terrain.chunksPerSide * terrain.chunksPerSide);
+
+    ocarn2__parallel_for(terrain.chunks.size(), options.threads, [&](size_t i) {
+        OCARN2::TerrainChunk& chunk = terrain.chunks[i];
+        chunk.chunkX = (uint32_t) (i % terrain.chunksPerSide);
+        chunk.chunkZ = (uint32_t) (i / terrain.chunksPerSide);
+
+        // bounds take in the shared last row and column too
+        unsigned char lowest = 255, highest = 0;
+        for(uint32_t z=0; z <= options.chunkSize; z++) {
+            for(uint32_t x=0; x <= options.chunkSize; x++) {
+                unsigned char h = (unsigned char) ocarn2__terrain_height(map, chunk.chunkX * options.chunkSize + x, chunk.chunkZ * options.chunkSize + z);
+                lowest = std::min(lowest, h);
+                highest = std::max(highest, h);
+            }
+        }
+
+        chunk.minX = chunk.chunkX * options.chunkSize * options.cellSize;
+        chunk.minZ = chunk.chunkZ * options.chunkSize * options.cellSize;
+        chunk.maxX = chunk.minX + options.chunkSize * options.cellSize;
+        chunk.maxZ = chunk.minZ + options.chunkSize * options.cellSize;
+        chunk.minY = lowest * options.heightScale;
+        chunk.maxY = highest * options.heightScale;
+
+        for(uint32_t level=0; level < options.numLods; level++) {
+            chunk.lods.push_back(ocarn2__build_terrain_lod(map, options, chunk, level));
+        }
+    });
+
+    return terrain;
+}
+
+/**
+ * Returns the chunk at the given chunk coordinates
+ *
+ * @param terrain
+ * @param chunkX
+ * @param chunkZ
+ * @return nullptr if it's off the map
+ */
+OCARN2_DEF const OCARN2::TerrainChunk* get_terrain_chunk(const OCARN2::TerrainMesh& terrain, uint32_t chunkX, uint32_t chunkZ) {
+    if(chunkX >= terrain.chunksPerSide || chunkZ >= terrain.chunksPerSide) return nullptr;
+
+    return &terrain.chunks[chunkZ * terrain.chunksPerSide + chunkX];
+}
+
+/**
+ * Picks the level to draw a chunk at, from how far the given point (in world units) is from it
+ *
+ * @param terrain
+ * @param chunk
+ * @param x
+ * @param z
+ * @return
+ */
+OCARN2_DEF uint32_t select_terrain_lod(const OCARN2::TerrainMesh& terrain, const OCARN2::TerrainChunk& chunk, float x, float z) {
+    float dx = std::max(std::max(chunk.minX - x, x - chunk.maxX), 0.0f);
+    float dz = std::max(std::max(chunk.minZ - z, z - chunk.maxZ), 0.0f);
+    float distance = std::sqrt(dx * dx + dz * dz);
+
+    if(terrain.options.lodDistance <= 0) return 0;
+
+    uint32_t level = (uint32_t) (distance / terrain.options.lodDistance);
+    return std::min(level, (uint32_t) chunk.lods.size() - 1);
+}
+
+#endif
@@ -0,0 +1,559 @@
+/**
+ * Author: Kyle Keiper
+ * Copyright: 2022
+ * License: MIT
+ *
+ * Companion to ocarn2.h for loading a .map file a region at a time, instead of all 13.5MB at once.
+ * Same rules as ocarn2.h: define OCARN2_IMPLEMENTATION in **1** source file before including it
+ *
+ * The map is cut up into square tiles (64x64 cells by default). A tile holds every plane for its
+ * region, and is read straight out of the .map file using the plane offsets from map_plane_info.
+ * The file is opened once and every tile is read from that descriptor with pread (reopened per tile where
+ * there's no pread). Loaded tiles are kept in an LRU cache, and prefetch_map_tiles queues the tiles around a
+ * moving point on the map's worker threads and returns straight away, so they're ready before they're asked
+ * for. get_map_tile never reads a tile twice: if a worker is already reading it, it waits for that read.
+ *
+ * main methods are
+ *
+ * TiledMap open_tiled_map(const std::string& filename, const TiledMapOptions& options);
+ * std::shared_ptr<const MapTile> get_map_tile(TiledMap& map, uint32_t tileX, uint32_t tileZ);
+ * void prefetch_map_tiles(TiledMap& map, float x, float z);
+ * void wait_map_tiles(TiledMap& map);
+ */
+
+#pragma once
+
+#include "ocarn2.h"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace OCARN2 {
+
+    struct TiledMapOptions {
+        // cells per side of a tile. must divide 1024 and be even, since fog and ambient are half resolution
+        uint32_t tileSize = 64;
+
+        // most tiles kept in the cache. should be at least (2 * prefetchRadius + 1)^2
+        size_t maxTiles = 64;
+
+        // tiles on each side of the current one that prefetch_map_tiles loads
+        uint32_t prefetchRadius = 1;
+
+        // worker threads that prefetch_map_tiles queues loads on, started the first time it's called.
+        // 0 = hardware concurrency
+        unsigned threads = 0;
+    };
+
+    /**
+     * one region of the map. fields mirror OCARN2::Map, but are size * size (fog and ambient are size/2 * size/2)
+     * and indexed relative to the tile's corner
+     */
+    struct MapTile {
+        uint32_t tileX, tileZ;
+        uint32_t size;
+
+        std::vector<unsigned char> heightMap;
+        std::vector<uint16_t> textureMap;
+        std::vector<uint16_t> textureMapFar;
+        std::vector<unsigned char> objectMap;
+        std::vector<uint16_t> bitflagMap;
+        std::vector<std::vector<unsigned char>> lightingMap;
+        std::vector<unsigned char> waterMap;
+        std::vector<unsigned char> objectHeightMap;
+        std::vector<unsigned char> fogMap;
+        std::vector<unsigned char> ambientMap;
+    };
+
+    // least recently used tiles are at the back of the list. everything here is guarded by mutex
+    struct MapTileCache {
+        std::mutex mutex;
+        std::list<std::shared_ptr<const MapTile>> tiles;
+        std::unordered_map<uint32_t, std::list<std::shared_ptr<const MapTile>>::iterator> lookup;
+
+        // tiles prefetch_map_tiles asked for that no one has started on, and tiles being read right now
+        std::deque<uint32_t> queued;
+        std::unordered_set<uint32_t> loading;
+
+        std::condition_variable wake;   // workers, when something is queued
+        std::condition_variable loaded; // anyone waiting on a tile in loading, or on wait_map_tiles
+        std::vector<std::thread> workers;
+        bool stopping = false;
+
+        // the .map file, open for as long as the cache is. -1 where there's no pread
+        int fd = -1;
+    };
+
+    struct TiledMap {
+        std::string filename;
+        TiledMapOptions options;
+
+        uint32_t tilesPerSide = 0;
+
+        std::shared_ptr<MapTileCache> cache;
+    };
+}
+
+
+OCARN2_DEF OCARN2::TiledMap open_tiled_map(const std::string& filename, const OCARN2::TiledMapOptions& options = {});
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> get_map_tile(OCARN2::TiledMap& map, uint32_t tileX, uint32_t tileZ);
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> get_map_tile_at(OCARN2::TiledMap& map, uint32_t x, uint32_t z);
+OCARN2_DEF void prefetch_map_tiles(OCARN2::TiledMap& map, float x, float z);
+OCARN2_DEF void wait_map_tiles(OCARN2::TiledMap& map);
+OCARN2_DEF size_t tiled_map_cached_tiles(OCARN2::TiledMap& map);
+
+
+#ifdef OCARN2_IMPLEMENTATION
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+/**
+ * Internal function to get at a tile's plane as raw bytes, same as map_plane_data does for Map
+ *
+ * @param tile
+ * @param plane
+ * @return
+ */
+OCARN2_DEF unsigned char* ocarn2__map_tile_plane(OCARN2::MapTile& tile, OCARN2::MapPlane plane) {
+    switch(plane) {
+        case OCARN2::MAP_HEIGHT:        return tile.heightMap.data();
+        case OCARN2::MAP_TEXTURE:       return (unsigned char*) tile.textureMap.data();
+        case OCARN2::MAP_TEXTURE_FAR:   return (unsigned char*) tile.textureMapFar.data();
+        case OCARN2::MAP_OBJECT:        return tile.objectMap.data();
+        case OCARN2::MAP_BITFLAG:       return (unsigned char*) tile.bitflagMap.data();
+        case OCARN2::MAP_LIGHT_DAWN:    return tile.lightingMap[0].data();
+        case OCARN2::MAP_LIGHT_NOON:    return tile.lightingMap[1].data();
+        case OCARN2::MAP_LIGHT_NIGHT:   return tile.lightingMap[2].data();
+        case OCARN2::MAP_WATER:         return tile.waterMap.data();
+        case OCARN2::MAP_OBJECT_HEIGHT: return tile.objectHeightMap.data();
+        case OCARN2::MAP_FOG:           return tile.fogMap.data();
+        case OCARN2::MAP_AMBIENT:       return tile.ambientMap.data();
+        default:                        return nullptr;
+    }
+}
+
+/**
+ * Internal function to read size bytes at offset from the map's descriptor, carrying on after short reads
+ *
+ * @return false on an error or end of file
+ */
+OCARN2_DEF bool ocarn2__map_tile_pread(int fd, unsigned char* destination, size_t size, uint64_t offset) {
+#if defined(__unix__) || defined(__APPLE__)
+    size_t done = 0;
+
+    while(done < size) {
+        ssize_t got = ::pread(fd, destination + done, size - done, (off_t) (offset + done));
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) return false;
+        done += got;
+    }
+
+    return true;
+#else
+    (void) fd; (void) destination; (void) size; (void) offset;
+    return false;
+#endif
+}
+
+/**
+ * Internal function to read one tile out of the .map file. Rows of a plane are contiguous on disk,
+ * so it's one read per row per plane, all from the descriptor the map keeps open
+ *
+ * @param map
+ * @param tileX
+ * @param tileZ
+ * @return nullptr if the file couldn't be read
+ */
+OCARN2_DEF std::shared_ptr<OCARN2::MapTile> ocarn2__load_map_tile(const OCARN2::TiledMap& map, uint32_t tileX, uint32_t tileZ) {
+    uint32_t size = map.options.tileSize;
+    uint32_t half = size / 2;
+
+    auto tile = std::make_shared<OCARN2::MapTile>();
+    tile->tileX = tileX;
+    tile->tileZ = tileZ;
+    tile->size = size;
+
+    tile->heightMap.resize(size * size);
+    tile->textureMap.resize(size * size);
+    tile->textureMapFar.resize(size * size);
+    tile->objectMap.resize(size * size);
+    tile->bitflagMap.resize(size * size);
+    tile->lightingMap.assign(3, std::vector<unsigned char>(size * size));
+    tile->waterMap.resize(size * size);
+    tile->objectHeightMap.resize(size * size);
+    tile->fogMap.resize(half * half);
+    tile->ambientMap.resize(half * half);
+
+    auto readPlanes = [&](const std::function<bool(unsigned char*, size_t, uint64_t)>& read) {
+        for(int p=0; p < OCARN2::MAP_NUM_PLANES; p++) {
+            OCARN2::MapPlane plane = (OCARN2::MapPlane) p;
+            OCARN2::MapPlaneInfo info = map_plane_info(plane);
+
+            // fog and ambient planes are half resolution, so the tile covers half as many of their cells
+            uint32_t cells = info.width == 1024 ? size : half;
+            uint32_t column = tileX * cells;
+            uint32_t row = tileZ * cells;
+
+            unsigned char* out = ocarn2__map_tile_plane(*tile, plane);
+            uint32_t rowBytes = cells * info.cellSize;
+
+            for(uint32_t r=0; r < cells; r++) {
+                uint64_t offset = info.fileOffset + ((uint64_t) (row + r) * info.width + column) * info.cellSize;
+                if(!read(out + r * rowBytes, rowBytes, offset)) return false;
+            }
+        }
+
+        return true;
+    };
+
+    bool loaded = false;
+
+    if(map.cache->fd >= 0) {
+        int fd = map.cache->fd;
+        loaded = readPlanes([fd](unsigned char* destination, size_t bytes, uint64_t offset) {
+            return ocarn2__map_tile_pread(fd, destination, bytes, offset);
+        });
+    }
+    else {
+        ocarn2__openFile(map.filename, [&](std::fstream& file) {
+            loaded = readPlanes([&](unsigned char* destination, size_t bytes, uint64_t offset) {
+                file.seekg((std::streamoff) offset, std::ios::beg);
+                return (bool) file.read((char*) destination, bytes);
+            });
+        });
+    }
+
+    if(!loaded) {
+        std::cerr << "Unable to read tile " << tileX << ", " << tileZ << " from " << map.filename << std::endl;
+        return nullptr;
+    }
+
+    return tile;
+}
+
+/**
+ * Internal function to look up a tile in the cache, marking it most recently used
+ *
+ * @param cache
+ * @param key
+ * @return
+ */
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> ocarn2__map_tile_lookup(OCARN2::MapTileCache& cache, uint32_t key) {
+    auto found = cache.lookup.find(key);
+    if(found == cache.lookup.end()) return nullptr;
+
+    cache.tiles.splice(cache.tiles.begin(), cache.tiles, found->second);
+    return *found->second;
+}
+
+/**
+ * Internal function to put a freshly loaded tile in the cache, evicting the least recently used tiles.
+ * If another thread got there first, its tile wins
+ *
+ * @param map
+ * @param key
+ * @param tile
+ * @return the cached tile
+ */
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> ocarn2__map_tile_insert(OCARN2::TiledMap& map, uint32_t key, std::shared_ptr<const OCARN2::MapTile> tile) {
+    OCARN2::MapTileCache& cache = *map.cache;
+
+    auto existing = ocarn2__map_tile_lookup(cache, key);
+    if(existing) return existing;
+
+    cache.tiles.push_front(tile);
+    cache.lookup[key] = cache.tiles.begin();
+
+    // anyone still holding an evicted tile keeps it alive through the shared_ptr
+    while(cache.tiles.size() > std::max<size_t>(1, map.options.maxTiles)) {
+        auto& last = cache.tiles.back();
+        cache.lookup.erase(last->tileZ * map.tilesPerSide + last->tileX);
+        cache.tiles.pop_back();
+    }
+
+    return tile;
+}
+
+/**
+ * Internal function to read a tile someone has already put in loading, then cache it and let anyone
+ * waiting on it know. Called without the lock held
+ *
+ * @param map
+ * @param key
+ * @return the cached tile, nullptr if it couldn't be read
+ */
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> ocarn2__map_tile_finish(OCARN2::TiledMap& map, uint32_t key) {
+    std::shared_ptr<const OCARN2::MapTile> tile = ocarn2__load_map_tile(map, key % map.tilesPerSide, key / map.tilesPerSide);
+
+    {
+        std::lock_guard<std::mutex> lock(map.cache->mutex);
+        if(tile) tile = ocarn2__map_tile_insert(map, key, tile);
+        map.cache->loading.erase(key);
+    }
+
+    map.cache->loaded.notify_all();
+    return tile;
+}
+
+/**
+ * Internal function to stop the workers and close the file once the last TiledMap sharing the cache is gone.
+ * Tiles still queued are dropped
+ *
+ * @param cache
+ */
+OCARN2_DEF void ocarn2__free_map_tile_cache(OCARN2::MapTileCache* cache) {
+    {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        cache->stopping = true;
+    }
+
+    cache->wake.notify_all();
+    for(auto& w: cache->workers) w.join();
+
+#if defined(__unix__) || defined(__APPLE__)
+    if(cache->fd >= 0) ::close(cache->fd);
+#endif
+
+    delete cache;
+}
+
+/**
+ * Internal function to start the map's workers. Called with the lock held
+ *
+ * @param map
+ */
+OCARN2_DEF void ocarn2__start_map_tile_workers(OCARN2::TiledMap& map) {
+    unsigned threads = map.options.threads;
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the workers get a copy of the map that doesn't own the cache, or the cache could never be freed
+    OCARN2::TiledMap view = map;
+    view.cache = std::shared_ptr<OCARN2::MapTileCache>(std::shared_ptr<OCARN2::MapTileCache>(), map.cache.get());
+
+    for(unsigned t=0; t < threads; t++) {
+        map.cache->workers.emplace_back([view]() mutable {
+            OCARN2::MapTileCache& cache = *view.cache;
+
+            while(true) {
+                uint32_t key;
+
+                {
+                    std::unique_lock<std::mutex> lock(cache.mutex);
+                    cache.wake.wait(lock, [&]() { return cache.stopping || !cache.queued.empty(); });
+
+                    if(cache.stopping) break;
+
+                    key = cache.queued.front();
+                    cache.queued.pop_front();
+                    cache.loading.insert(key);
+                }
+
+                ocarn2__map_tile_finish(view, key);
+            }
+        });
+    }
+}
+
+/**
+ * Prepares a .map file for tiled access. Nothing but the file size is read up front, and the file stays
+ * open until the last copy of the TiledMap is gone
+ *
+ * @param filename
+ * @param options
+ * @return
+ */
+OCARN2_DEF OCARN2::TiledMap open_tiled_map(const std::string& filename, const OCARN2::TiledMapOptions& options) {
+    OCARN2::TiledMap map;
+
+    if(options.tileSize < 2 || options.tileSize > 1024 || 1024 % options.tileSize != 0) {
+        std::cerr << "Tile size " << options.tileSize << " doesn't divide the map evenly" << std::endl;
+        return map;
+    }
+
+    OCARN2::MapPlaneInfo last = map_plane_info(OCARN2::MAP_AMBIENT);
+    uint64_t expected = last.fileOffset + last.width * last.width * last.cellSize;
+    uint64_t fileSize = 0;
+    int fd = -1;
+
+#if defined(__unix__) || defined(__APPLE__)
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return map;
+    }
+
+    struct stat info {};
+    if(fstat(fd, &info) == 0) fileSize = (uint64_t) info.st_size;
+#else
+    bool opened = false;
+
+    ocarn2__openFile(filename, [&](std::fstream& file) {
+        file.seekg(0, std::ios::end);
+        fileSize = (uint64_t) file.tellg();
+        opened = true;
+    });
+
+    if(!opened) return map;
+#endif
+
+    if(fileSize < expected) {
+        std::cerr << filename << " is too small to be a map file" << std::endl;
+#if defined(__unix__) || defined(__APPLE__)
+        ::close(fd);
+#endif
+        return map;
+    }
+
+    map.filename = filename;
+    map.options = options;
+    map.tilesPerSide = 1024 / options.tileSize;
+    map.cache = std::shared_ptr<OCARN2::MapTileCache>(new OCARN2::MapTileCache(), ocarn2__free_map_tile_cache);
+    map.cache->fd = fd;
+
+    return map;
+}
+
+/**
+ * Returns the tile at the given tile coordinates, loading it if it isn't cached. If a worker is already
+ * reading it, waits for that instead of reading it again, and if it's only queued, takes it off the queue
+ *
+ * @param map
+ * @param tileX
+ * @param tileZ
+ * @return nullptr if the coordinates are off the map or the file couldn't be read
+ */
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> get_map_tile(OCARN2::TiledMap& map, uint32_t tileX, uint32_t tileZ) {
+    if(!map.cache || tileX >= map.tilesPerSide || tileZ >= map.tilesPerSide) return nullptr;
+
+    OCARN2::MapTileCache& cache = *map.cache;
+    uint32_t key = tileZ * map.tilesPerSide + tileX;
+
+    {
+        std::unique_lock<std::mutex> lock(cache.mutex);
+
+        while(true) {
+            auto cached = ocarn2__map_tile_lookup(cache, key);
+            if(cached) return cached;
+
+            if(cache.loading.count(key) == 0) break;
+            cache.loaded.wait(lock);
+        }
+
+        auto queued = std::find(cache.queued.begin(), cache.queued.end(), key);
+        if(queued != cache.queued.end()) cache.queued.erase(queued);
+
+        cache.loading.insert(key);
+    }
+
+    // load outside the lock so other tiles can be served meanwhile
+    return ocarn2__map_tile_finish(map, key);
+}
+
+/**
+ * Returns the tile containing the given map cell
+ *
+ * @param map
+ * @param x
+ * @param z
+ * @return
+ */
+OCARN2_DEF std::shared_ptr<const OCARN2::MapTile> get_map_tile_at(OCARN2::TiledMap& map, uint32_t x, uint32_t z) {
+    if(!map.cache) return nullptr;
+
+    return get_map_tile(map, x / map.options.tileSize, z / map.options.tileSize);
+}
+
+/**
+ * Queues the tiles around a point on the map's workers, so they're cached before they're needed, and
+ * returns without waiting for them. Call it whenever the point of interest moves. x and z are in map cells.
+ * Tiles queued by an earlier call that no one has started on yet are dropped
+ *
+ * @param map
+ * @param x
+ * @param z
+ */
+OCARN2_DEF void prefetch_map_tiles(OCARN2::TiledMap& map, float x, float z) {
+    if(!map.cache) return;
+
+    int32_t radius = (int32_t) map.options.prefetchRadius;
+    int32_t centerX = (int32_t) (x / map.options.tileSize);
+    int32_t centerZ = (int32_t) (z / map.options.tileSize);
+
+    std::vector<std::pair<uint32_t, uint32_t>> wanted;
+
+    for(int32_t tz = centerZ - radius; tz <= centerZ + radius; tz++) {
+        for(int32_t tx = centerX - radius; tx <= centerX + radius; tx++) {
+            if(tx < 0 || tz < 0 || tx >= (int32_t) map.tilesPerSide || tz >= (int32_t) map.tilesPerSide) continue;
+
+            wanted.emplace_back(tx, tz);
+        }
+    }
+
+    // nearest tiles are queued first, since they're the ones about to be asked for
+    std::sort(wanted.begin(), wanted.end(), [&](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+        int32_t da = std::max(std::abs((int32_t) a.first - centerX), std::abs((int32_t) a.second - centerZ));
+        int32_t db = std::max(std::abs((int32_t) b.first - centerX), std::abs((int32_t) b.second - centerZ));
+        return da < db;
+    });
+
+    OCARN2::MapTileCache& cache = *map.cache;
+
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+
+        if(cache.workers.empty()) ocarn2__start_map_tile_workers(map);
+
+        // whatever's still waiting was for where the point used to be
+        cache.queued.clear();
+
+        // cached tiles are touched farthest first, so the nearest end up most recently used
+        for(size_t i = wanted.size(); i-- > 0;) {
+            ocarn2__map_tile_lookup(cache, wanted[i].second * map.tilesPerSide + wanted[i].first);
+        }
+
+        for(auto& tile: wanted) {
+            uint32_t key = tile.second * map.tilesPerSide + tile.first;
+            if(cache.lookup.count(key) || cache.loading.count(key)) continue;
+
+            cache.queued.push_back(key);
+        }
+    }
+
+    cache.wake.notify_all();
+}
+
+/**
+ * Blocks until every tile queued by prefetch_map_tiles, and every tile being read, is in the cache
+ *
+ * @param map
+ */
+OCARN2_DEF void wait_map_tiles(OCARN2::TiledMap& map) {
+    if(!map.cache) return;
+
+    std::unique_lock<std::mutex> lock(map.cache->mutex);
+    map.cache->loaded.wait(lock, [&]() { return map.cache->queued.empty() && map.cache->loading.empty(); });
+}
+
+/**
+ * Number of tiles currently held in the cache
+ *
+ * @param map
+ * @return
+ */
+OCARN2_DEF size_t tiled_map_cached_tiles(OCARN2::TiledMap& map) {
+    if(!map.cache) return 0;
+
+    std::lock_guard<std::mutex> lock(map.cache->mutex);
+    return map.cache->tiles.size();
+}
+
+#endif